@@ -0,0 +1,71 @@
+// Compare the unfused BertSelfAttention forward with the fused QKV +
+// attention kernel path on the CPU.
+// Usage: bench/bin/bench_attention [SEQUENCE_LENGTH] [ITERATIONS]
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <torch/autograd.h>
+#include <torch/types.h>
+
+#include "config.h"
+#include "model/bert_self_attention.h"
+
+double timeForward(BertSelfAttention& attention, const torch::Tensor& hiddenStates,
+                   const torch::Tensor& attentionMask, int iterations) {
+  // Warm-up
+  attention->forward(hiddenStates, attentionMask);
+  auto startTime = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    attention->forward(hiddenStates, attentionMask);
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - startTime;
+  return elapsed.count() / iterations;
+}
+
+int main(int argc, char *argv[]) {
+  long sequenceLength = argc > 1 ? std::stol(argv[1]) : DEFAULT_MAX_SEQUENCE_LENGTH;
+  int iterations = argc > 2 ? std::stoi(argv[2]) : 20;
+
+  // bert-base dimensions
+  Config config;
+  config.hiddenSize = 768;
+  config.attentionDropoutProb = 0.1;
+  config.hiddenDropoutProb = 0.1;
+  config.intermediateSize = 3072;
+  config.maxPositionEmbeddings = 512;
+  config.numAttentionHeads = 12;
+  config.numHiddenLayers = 12;
+  config.typeVocabSize = 2;
+  config.vocabSize = 30522;
+
+  torch::manual_seed(0);
+  BertSelfAttention attention(config);
+  attention->eval();
+  torch::NoGradGuard noGrad;
+
+  std::cout << "batch_size,sequence_length,unfused_ms,fused_ms,speedup,max_abs_diff" << std::endl;
+  for (long batchSize : {1, 32}) {
+    torch::Tensor hiddenStates = torch::randn({batchSize, sequenceLength, config.hiddenSize});
+    // Pad the second half of every other sequence
+    torch::Tensor attentionMask = torch::zeros({batchSize, 1, 1, sequenceLength});
+    attentionMask.slice(0, 1, batchSize, 2).slice(3, sequenceLength / 2).fill_(-10000.0f);
+
+    attention->fused = false;
+    torch::Tensor expected = attention->forward(hiddenStates, attentionMask);
+    double unfusedMs = timeForward(attention, hiddenStates, attentionMask, iterations);
+
+    attention->fused = true;
+    torch::Tensor actual = attention->forward(hiddenStates, attentionMask);
+    double fusedMs = timeForward(attention, hiddenStates, attentionMask, iterations);
+
+    std::cout << batchSize << DELIMITER
+              << sequenceLength << DELIMITER
+              << unfusedMs << DELIMITER
+              << fusedMs << DELIMITER
+              << unfusedMs / fusedMs << DELIMITER
+              << (expected - actual).abs().max().item<float>() << std::endl;
+  }
+  return 0;
+}
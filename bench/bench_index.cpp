@@ -0,0 +1,117 @@
+// Recall and latency of IVF index queries against an exact search, for
+// float32 and int8 vectors and a range of nprobe values. Vectors are
+// synthetic (clustered random vectors) or the rows of a `bert embed` file,
+// whose last NUM_QUERIES rows are then the queries.
+// Usage: bench/bin/bench_index [NUM_VECTORS] [NUM_LISTS] [EMBEDDINGS]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <torch/autograd.h>
+#include <torch/types.h>
+
+#include "ann/ivf_index.h"
+#include "config.h"
+#include "embed/embedding_file.h"
+#include "predict.h"
+
+const long NUM_QUERIES = 1000;
+const long DIM = 768;
+const long K = 10;
+
+int main(int argc, char *argv[]) {
+  long numVectors = argc > 1 ? std::stol(argv[1]) : 100000;
+  long numLists = argc > 2 ? std::stol(argv[2]) : 1024;
+  std::string embeddingsFname = argc > 3 ? argv[3] : "";
+
+  torch::manual_seed(0);
+  torch::NoGradGuard noGrad;
+  std::string vectorsFname = "/tmp/bench_index.emb";
+  torch::Tensor queries;
+  if (embeddingsFname.empty()) {
+    // Clustered, so that the lists mean something: a few points around each
+    // of numVectors / 100 random centers
+    torch::Tensor centers = torch::randn({numVectors / 100 + 1, DIM});
+    auto sample = [&centers](long n) {
+      torch::Tensor which = torch::randint(centers.size(0), {n}, torch::kLong);
+      return centers.index_select(0, which) + 0.5 * torch::randn({n, DIM});
+    };
+    embed::EmbeddingFile output(vectorsFname, numVectors, DIM, embed::Float32);
+    for (long row = 0; row < numVectors; row += IVF_BUILD_BLOCK_ROWS) {
+      output.writeRows(row, sample(std::min<long>(IVF_BUILD_BLOCK_ROWS, numVectors - row)));
+    }
+    output.sync();
+    queries = sample(NUM_QUERIES);
+  } else {
+    embed::EmbeddingFile input(embeddingsFname);
+    numVectors = std::min<long>(numVectors, input.getNumRows() - NUM_QUERIES);
+    embed::EmbeddingFile output(vectorsFname, numVectors, input.getDim(), embed::Float32);
+    output.writeRows(0, input.getRows(0, numVectors));
+    output.sync();
+    queries = input.getRows(input.getNumRows() - NUM_QUERIES, NUM_QUERIES).clone();
+  }
+  queries = queries / queries.norm(2, -1, true).clamp_min(1e-12);
+  embed::EmbeddingFile vectors(vectorsFname);
+
+  // Exact neighbours, by block
+  torch::Tensor bestScores = torch::full({NUM_QUERIES, K}, -2.0f);
+  torch::Tensor bestRows = torch::zeros({NUM_QUERIES, K}, torch::kLong);
+  for (long row = 0; row < numVectors; row += IVF_BUILD_BLOCK_ROWS) {
+    long count = std::min<long>(IVF_BUILD_BLOCK_ROWS, numVectors - row);
+    torch::Tensor block = vectors.getRows(row, count);
+    block = block / block.norm(2, -1, true).clamp_min(1e-12);
+    auto top = queries.matmul(block.t()).topk(std::min(K, count), 1);
+    torch::Tensor scores = torch::cat({bestScores, std::get<0>(top)}, 1);
+    torch::Tensor rows = torch::cat({bestRows, std::get<1>(top) + row}, 1);
+    torch::Tensor keep = std::get<1>(scores.topk(K, 1));
+    bestScores = scores.gather(1, keep);
+    bestRows = rows.gather(1, keep);
+  }
+  const long* bestRowsData = bestRows.data_ptr<long>();
+
+  std::cout << "compression,num_lists,nprobe,recall_at_" << K
+            << ",latency_p50_ms,latency_p99_ms,queries_per_sec,build_sec" << std::endl;
+  for (ann::Compression compression : {ann::NoCompression, ann::Int8}) {
+    std::string indexFname = "/tmp/bench_index.ivf";
+    auto startTime = std::chrono::steady_clock::now();
+    ann::buildIndex(vectors, indexFname, numLists, compression, 0, 10, 0);
+    std::chrono::duration<double> buildTime = std::chrono::steady_clock::now() - startTime;
+    ann::IvfIndex index(indexFname);
+
+    for (long nprobe : {1, 2, 4, 8, 16, 32, 64, 128}) {
+      if (nprobe > static_cast<long>(index.getNumLists())) break;
+      // One query at a time for the latency, ...
+      std::vector<double> latencies;
+      long numFound = 0;
+      for (long q = 0; q < NUM_QUERIES; q++) {
+        auto queryStart = std::chrono::steady_clock::now();
+        auto neighbours = index.search(queries[q].data_ptr<float>(), K, nprobe);
+        std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - queryStart;
+        latencies.push_back(elapsed.count());
+        std::unordered_set<long> expected(bestRowsData + q * K, bestRowsData + (q + 1) * K);
+        for (const auto& neighbour : neighbours) numFound += expected.count(neighbour.second);
+      }
+      // ... all of them in parallel for the throughput
+      auto batchStart = std::chrono::steady_clock::now();
+      index.search(queries, K, nprobe);
+      std::chrono::duration<double> batchTime = std::chrono::steady_clock::now() - batchStart;
+
+      std::cout << (compression == ann::Int8 ? "int8" : "none") << DELIMITER
+                << index.getNumLists() << DELIMITER
+                << nprobe << DELIMITER
+                << static_cast<double>(numFound) / (NUM_QUERIES * K) << DELIMITER
+                << predict::percentile(latencies, 0.5) << DELIMITER
+                << predict::percentile(latencies, 0.99) << DELIMITER
+                << NUM_QUERIES / batchTime.count() << DELIMITER
+                << buildTime.count() << std::endl;
+    }
+    std::remove(indexFname.c_str());
+  }
+  std::remove(vectorsFname.c_str());
+  return 0;
+}
@@ -0,0 +1,74 @@
+// Two runs over the same inputs with a prediction cache, as `predict
+// --cache` makes them: the first misses every input, inserts and flushes
+// the outputs, the second reopens the file and must hit every input with
+// the same outputs. Fails (exit code 1) if it does not, else prints the
+// lookup and flush times.
+// Usage: bench/bin/bench_prediction_cache [NUM_INPUTS] [NUM_LABELS]
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <torch/types.h>
+
+#include "config.h"
+#include "predict/prediction_cache.h"
+
+using predict::PredictionCache;
+
+static int fail(const std::string& message) {
+  std::cerr << "FAILED: " << message << std::endl;
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  long numInputs = argc > 1 ? std::stol(argv[1]) : 10000;
+  long numLabels = argc > 2 ? std::stol(argv[2]) : 2;
+
+  torch::manual_seed(0);
+  std::string fname = "/tmp/bench_prediction_cache.bin";
+  std::remove(fname.c_str());
+  torch::Tensor ids = torch::randint(1, 30000, {numInputs, DEFAULT_MAX_SEQUENCE_LENGTH},
+                                     torch::kLong);
+  torch::Tensor outputs = torch::randn({numInputs, numLabels});
+  std::vector<uint64_t> keys(numInputs);
+  for (long i = 0; i < numInputs; i++) {
+    keys[i] = PredictionCache::getKey(0, ids[i].data_ptr<long>(), ids.size(1));
+  }
+
+  std::cout << "run,hits,lookup_ms,flush_ms" << std::endl;
+  for (int run = 1; run <= 2; run++) {
+    PredictionCache cache(fname);
+    long numHits = 0;
+    float computeMs;
+    auto startTime = std::chrono::steady_clock::now();
+    for (long i = 0; i < numInputs; i++) {
+      torch::Tensor output = cache.lookup(keys[i], computeMs);
+      if (output.defined()) {
+        if (!output.equal(outputs[i])) return fail("wrong output for input " + std::to_string(i));
+        numHits++;
+      } else {
+        cache.insert(keys[i], outputs[i], 1.0f);
+        // Found again before the flush, as a repeated input would be
+        if (!cache.lookup(keys[i], computeMs).defined()) return fail("pending record not found");
+      }
+    }
+    std::chrono::duration<double, std::milli> lookupTime =
+      std::chrono::steady_clock::now() - startTime;
+    startTime = std::chrono::steady_clock::now();
+    cache.flush();
+    std::chrono::duration<double, std::milli> flushTime =
+      std::chrono::steady_clock::now() - startTime;
+
+    // Still found once flushed, as the next streaming batch would look them up
+    if (!cache.lookup(keys[0], computeMs).defined()) return fail("flushed record not found");
+    if (numHits != (run == 1 ? 0 : numInputs)) {
+      return fail("run " + std::to_string(run) + " had " + std::to_string(numHits) + " hits");
+    }
+    std::cout << run << DELIMITER << numHits << DELIMITER << lookupTime.count()
+              << DELIMITER << flushTime.count() << std::endl;
+  }
+  std::remove(fname.c_str());
+  return 0;
+}
@@ -0,0 +1,4 @@
+#ifndef ANN_H
+#define ANN_H
+#include "ann/ann.h"
+#endif
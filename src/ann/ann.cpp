@@ -0,0 +1,523 @@
+#include "ann.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <torch/autograd.h>
+#include <torch/types.h>
+
+#include "config.h"
+#include "data.h"
+#include "embed.h"
+#include "embed/embedding_file.h"
+#include "embed/sentence_encoder.h"
+#include "ivf_index.h"
+#include "predict.h"
+#include "runtime.h"
+
+namespace ann {
+
+// The index header stores the pooling by its position here
+static const std::vector<std::string> POOLINGS = {"cls", "mean", "pooled"};
+
+static const char* ENCODER_OPTIONS_HELP = "\
+  -b, --batch-size          Number of sentences per forward pass\n\
+                              Default: 32\n\
+  -L, --max-sequence-length Pad/truncate input sequences to that many tokens\n\
+                              Default: 100\n\
+  -d, --device              Device to run on, e.g. `cpu`, `cuda`, `cuda:1`\n\
+                              Default: `cuda` if available, else `cpu`\n\
+  -j, --num-threads         Number of intra-op threads for tensor operations\n\
+                              and the search\n\
+                              Default: 0 (libtorch default)\n\
+  -J, --num-interop-threads Number of inter-op threads\n\
+                              Default: 0 (libtorch default)\n\
+  -k, --tokenizer-threads   Number of threads that tokenize FILE\n\
+                              Default: 0 (single-threaded)\n\
+  -A, --cpu-affinity        `none`, `cores` or `numa:N`, see `predict --help`\n\
+                              Default: none\n\
+  -P, --packed              Run the position-wise encoder layers on the\n\
+                              non-padding tokens only\n\
+  -Q, --quantize            Run the Linear layers with int8 weights: `int8`.\n\
+                              CPU only\n\
+                              Default: none (float32)\n\
+";
+
+static void printBuildHelp() {
+  std::cout << "Usage: index build [OPTIONS] MODEL FILE INDEX [TASK]" << std::endl;
+  std::cout << "       index build [OPTIONS] --embeddings EMBEDDINGS INDEX" << std::endl;
+  std::cout << "\
+Encode each line of FILE as `bert embed` does, into INDEX.emb, and write an\n\
+inverted-file (IVF) index over the vectors to INDEX: the vectors are split\n\
+in lists by their most similar k-means centroid, and a query only scans the\n\
+lists of its most similar centroids. Vectors are L2-normalized, so\n\
+similarities are cosine similarities. See `src/ann/ivf_index.h` for the\n\
+file format.\n\n\
+Options:\n\
+  -e, --embeddings          Index the vectors of EMBEDDINGS, written by\n\
+                              `bert embed`, instead of encoding a FILE\n\
+  -p, --pooling             `cls`, `mean` or `pooled`, see `embed --help`.\n\
+                              Stored in INDEX for the queries. With\n\
+                              --embeddings, the pooling EMBEDDINGS records,\n\
+                              and required if it records none\n\
+                              Default: cls\n\
+  -l, --num-lists           Number of lists (k-means centroids)\n\
+                              Default: 0 (4 * sqrt(NUM_VECTORS))\n\
+  -c, --compression         `none` (float32) or `int8` vectors, with one\n\
+                              scale each\n\
+                              Default: none\n\
+  -i, --iterations          Number of k-means iterations\n\
+                              Default: 10\n\
+  -s, --seed                Seed for the k-means sample and initialization\n\
+                              Default: 0\n\
+" << ENCODER_OPTIONS_HELP;
+}
+
+static void printQueryHelp() {
+  std::cout << "Usage: index query [OPTIONS] MODEL INDEX FILE [TASK]" << std::endl;
+  std::cout << "\
+Encode each line of FILE with the pooling INDEX was built with, and print its\n\
+nearest neighbours in INDEX, most similar first, as DELIMITER-separated\n\
+ROW:SIMILARITY items, one line per line of FILE. ROW is the 0-based line of\n\
+the indexed FILE.\n\n\
+Options:\n\
+  -N, --num-neighbours      Number of neighbours per query\n\
+                              Default: 10\n\
+  -n, --nprobe              Number of lists to scan per query. More lists give\n\
+                              better recall for slower queries\n\
+                              Default: 8\n\
+" << ENCODER_OPTIONS_HELP;
+}
+
+void printHelp(const std::string &programName) {
+  std::cout << "Usage: " << programName << " {build,query} [OPTIONS...]" << std::endl;
+  std::cout << "\
+Approximate nearest-neighbour search over sentence vectors, see\n\
+`" << programName << " build --help` and `" << programName << " query --help`\n";
+}
+
+// Options of the sentence encoder, shared by build and query
+struct EncoderOptions {
+  int batchSize = DEFAULT_BATCH_SIZE,
+      maxSequenceLength = DEFAULT_MAX_SEQUENCE_LENGTH,
+      numThreads = DEFAULT_NUM_THREADS,
+      numInteropThreads = DEFAULT_NUM_INTEROP_THREADS,
+      tokenizerThreads = 0;
+  std::string cpuAffinity = "none";
+  std::string deviceName = "";
+  bool packed = false;
+  std::string quantize = "";
+};
+
+// Parse an option of EncoderOptions. Returns 0 if c is one, 1 if it is
+// invalid and -1 if it is not an encoder option
+static int parseEncoderOption(int c, EncoderOptions& options) {
+  switch (c) {
+    case 'b':
+      options.batchSize = std::stoi(optarg);
+      if (options.batchSize <= 0) {
+        printf("Invalid batch size `%s`\n", optarg);
+        return 1;
+      }
+      return 0;
+    case 'L':
+      options.maxSequenceLength = std::stoi(optarg);
+      if (options.maxSequenceLength < 2) {
+        printf("Invalid maximum sequence length `%s`, [CLS] and [SEP] need 2\n", optarg);
+        return 1;
+      }
+      return 0;
+    case 'd':
+      options.deviceName = optarg;
+      return 0;
+    case 'j':
+      options.numThreads = std::stoi(optarg);
+      return 0;
+    case 'J':
+      options.numInteropThreads = std::stoi(optarg);
+      return 0;
+    case 'k':
+      options.tokenizerThreads = std::stoi(optarg);
+      return 0;
+    case 'A':
+      options.cpuAffinity = optarg;
+      if (!isValidAffinity(options.cpuAffinity)) {
+        printf("Invalid CPU affinity `%s`\n", optarg);
+        return 1;
+      }
+      return 0;
+    case 'P':
+      options.packed = true;
+      return 0;
+    case 'Q':
+      options.quantize = optarg;
+      if (options.quantize != "int8") {
+        printf("Invalid quantization `%s`\n", optarg);
+        return 1;
+      }
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+// Configure the runtime and load the encoder, or print an error and return
+// nullptr
+static std::unique_ptr<embed::SentenceEncoder> loadEncoder(
+    const EncoderOptions& options, const std::string& baseFname,
+    const std::string& taskName, const std::string& pooling) {
+  try {
+    configureScheduler(options.numThreads, options.numInteropThreads,
+                       options.tokenizerThreads, 0, options.cpuAffinity);
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return nullptr;
+  }
+  torch::Device device = getDevice(options.deviceName);
+  printRuntimeInfo(device);
+
+  bool quantized = predict::isQuantizedModel(baseFname) || !options.quantize.empty();
+  if (quantized && !device.is_cpu()) {
+    std::cerr << "Error: quantized inference runs on the CPU only" << std::endl;
+    return nullptr;
+  }
+  std::unique_ptr<embed::SentenceEncoder> encoder(new embed::SentenceEncoder(
+    baseFname, taskName, pooling, /*normalize=*/true, device,
+    !options.quantize.empty(), options.packed));
+  if (options.maxSequenceLength > encoder->getMaxPositionEmbeddings()) {
+    std::cerr << "Error: maximum sequence length exceeds the model's "
+              << encoder->getMaxPositionEmbeddings() << " position embeddings"
+              << std::endl;
+    return nullptr;
+  }
+  return encoder;
+}
+
+static int build(int argc, char *argv[]) {
+  int c, opt = 0;
+  EncoderOptions encoderOptions;
+  std::string embeddingsFname = "";
+  std::string pooling = "cls";
+  bool poolingGiven = false;
+  std::string compression = "none";
+  long numLists = 0, numIterations = 10, seed = 0;
+
+	static struct option options[] = {
+			{"embeddings",            required_argument, NULL,  'e' },
+			{"pooling",               required_argument, NULL,  'p' },
+			{"num-lists",             required_argument, NULL,  'l' },
+			{"compression",           required_argument, NULL,  'c' },
+			{"iterations",            required_argument, NULL,  'i' },
+			{"seed",                  required_argument, NULL,  's' },
+			{"batch-size",            required_argument, NULL,  'b' },
+			{"max-sequence-length",   required_argument, NULL,  'L' },
+			{"device",                required_argument, NULL,  'd' },
+			{"num-threads",           required_argument, NULL,  'j' },
+			{"num-interop-threads",   required_argument, NULL,  'J' },
+			{"tokenizer-threads",     required_argument, NULL,  'k' },
+			{"cpu-affinity",          required_argument, NULL,  'A' },
+			{"packed",                no_argument,       NULL,  'P' },
+			{"quantize",              required_argument, NULL,  'Q' },
+			{"help",                  no_argument,       NULL,  'h' },
+			{NULL,                    0,                 NULL,   0  }
+	};
+
+	while ((c = getopt_long(argc, argv, ":e:p:l:c:i:s:b:L:d:j:J:k:A:PQ:h", options, &opt)) != -1) {
+    int parsed = parseEncoderOption(c, encoderOptions);
+    if (parsed == 1) {
+      printBuildHelp();
+      return 1;
+    } else if (parsed == 0) {
+      continue;
+    }
+    switch (c) {
+      case 'e':
+        embeddingsFname = optarg;
+        break;
+      case 'p':
+        pooling = optarg;
+        poolingGiven = true;
+        if (std::find(POOLINGS.begin(), POOLINGS.end(), pooling) == POOLINGS.end()) {
+          printBuildHelp();
+          printf("Invalid pooling `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'l':
+        numLists = std::stol(optarg);
+        break;
+      case 'c':
+        compression = optarg;
+        if ((compression != "none") && (compression != "int8")) {
+          printBuildHelp();
+          printf("Invalid compression `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'i':
+        numIterations = std::stol(optarg);
+        break;
+      case 's':
+        seed = std::stol(optarg);
+        break;
+      case 'h':
+        printBuildHelp();
+        return 1;
+      case '?':
+        printBuildHelp();
+        printf("Invalid argument -%c\n", optopt);
+        return 1;
+      case ':':
+        printBuildHelp();
+        printf("Missing option for %c\n", optopt);
+        return 1;
+      default:
+        printf("?? getopt returned character code 0%o ??\n", c);
+        return 1;
+    }
+  }
+
+  // Positional arguments: MODEL FILE INDEX [TASK], or INDEX with --embeddings
+  int numPositional = argc - optind;
+  bool fromEmbeddings = !embeddingsFname.empty();
+  if (fromEmbeddings ? (numPositional != 1)
+                     : ((numPositional != 3) && (numPositional != 4))) {
+    printBuildHelp();
+    return 1;
+  }
+  std::string indexFname = argv[optind + (fromEmbeddings ? 0 : 2)];
+  if (!fromEmbeddings) {
+    std::string baseFname = argv[optind];
+    std::string textsFname = argv[optind+1];
+    std::string taskName = (numPositional == 4) ? argv[optind+3] : "";
+    if ((pooling == "pooled") && taskName.empty()) {
+      printBuildHelp();
+      std::cout << "Error: `--pooling pooled` needs a TASK" << std::endl;
+      return 1;
+    }
+    auto encoder = loadEncoder(encoderOptions, baseFname, taskName, pooling);
+    if (!encoder) return 1;
+
+    embeddingsFname = indexFname + ".emb";
+    auto startTime = std::chrono::steady_clock::now();
+    embed::EmbeddingFile output(embeddingsFname, embed::countLines(textsFname),
+                                encoder->getDim(), embed::Float32, pooling);
+    long numRows = embed::encodeFile(*encoder, textsFname, output,
+                                     encoderOptions.batchSize,
+                                     encoderOptions.maxSequenceLength);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    std::cerr << "# "
+              << "embeddings=" << embeddingsFname
+              << " rows=" << numRows
+              << " sentences_per_sec=" << numRows / elapsed.count()
+              << std::endl;
+  } else {
+    try {
+      configureScheduler(encoderOptions.numThreads, encoderOptions.numInteropThreads,
+                         0, 0, encoderOptions.cpuAffinity);
+    } catch (const std::exception& e) {
+      std::cerr << "Error: " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  embed::EmbeddingFile vectors(embeddingsFname);
+  // Queries must be encoded as the indexed vectors were
+  std::string recordedPooling = vectors.getPooling();
+  if (!recordedPooling.empty() && poolingGiven && (recordedPooling != pooling)) {
+    std::cerr << "Error: " << embeddingsFname << " was written with `--pooling "
+              << recordedPooling << "`, not `" << pooling << "`" << std::endl;
+    return 1;
+  } else if (recordedPooling.empty() && !poolingGiven) {
+    std::cerr << "Error: " << embeddingsFname << " does not record its pooling, "
+              << "give `--pooling`" << std::endl;
+    return 1;
+  }
+  if (!recordedPooling.empty()) pooling = recordedPooling;
+  if (numLists <= 0) {
+    numLists = std::max(1L, std::lround(4 * std::sqrt(vectors.getNumRows())));
+  }
+  auto startTime = std::chrono::steady_clock::now();
+  buildIndex(vectors, indexFname, numLists,
+             compression == "int8" ? Int8 : NoCompression,
+             std::find(POOLINGS.begin(), POOLINGS.end(), pooling) - POOLINGS.begin(),
+             numIterations, seed);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+  IvfIndex index(indexFname);
+  std::ifstream indexFile(indexFname, std::ios::binary | std::ios::ate);
+  std::cerr << "# "
+            << "vectors=" << index.getNumVectors()
+            << " dim=" << index.getDim()
+            << " lists=" << index.getNumLists()
+            << " compression=" << compression
+            << " pooling=" << pooling
+            << " build_sec=" << elapsed.count()
+            << " index_mb=" << indexFile.tellg() / (1024.0 * 1024.0)
+            << std::endl;
+  printSchedulerStats();
+  return 0;
+}
+
+static int query(int argc, char *argv[]) {
+  int c, opt = 0;
+  EncoderOptions encoderOptions;
+  long numNeighbours = 10, nprobe = 8;
+
+	static struct option options[] = {
+			{"num-neighbours",        required_argument, NULL,  'N' },
+			{"nprobe",                required_argument, NULL,  'n' },
+			{"batch-size",            required_argument, NULL,  'b' },
+			{"max-sequence-length",   required_argument, NULL,  'L' },
+			{"device",                required_argument, NULL,  'd' },
+			{"num-threads",           required_argument, NULL,  'j' },
+			{"num-interop-threads",   required_argument, NULL,  'J' },
+			{"tokenizer-threads",     required_argument, NULL,  'k' },
+			{"cpu-affinity",          required_argument, NULL,  'A' },
+			{"packed",                no_argument,       NULL,  'P' },
+			{"quantize",              required_argument, NULL,  'Q' },
+			{"help",                  no_argument,       NULL,  'h' },
+			{NULL,                    0,                 NULL,   0  }
+	};
+
+	while ((c = getopt_long(argc, argv, ":N:n:b:L:d:j:J:k:A:PQ:h", options, &opt)) != -1) {
+    int parsed = parseEncoderOption(c, encoderOptions);
+    if (parsed == 1) {
+      printQueryHelp();
+      return 1;
+    } else if (parsed == 0) {
+      continue;
+    }
+    switch (c) {
+      case 'N':
+        numNeighbours = std::stol(optarg);
+        break;
+      case 'n':
+        nprobe = std::stol(optarg);
+        break;
+      case 'h':
+        printQueryHelp();
+        return 1;
+      case '?':
+        printQueryHelp();
+        printf("Invalid argument -%c\n", optopt);
+        return 1;
+      case ':':
+        printQueryHelp();
+        printf("Missing option for %c\n", optopt);
+        return 1;
+      default:
+        printf("?? getopt returned character code 0%o ??\n", c);
+        return 1;
+    }
+  }
+
+  // Positional arguments: MODEL INDEX FILE [TASK]
+  int numPositional = argc - optind;
+  if ((numPositional != 3) && (numPositional != 4)) {
+    printQueryHelp();
+    return 1;
+  }
+  if ((numNeighbours < 1) || (nprobe < 1)) {
+    printQueryHelp();
+    std::cout << "Error: --num-neighbours and --nprobe must be positive" << std::endl;
+    return 1;
+  }
+  std::string baseFname = argv[optind];
+  std::string indexFname = argv[optind+1];
+  std::string textsFname = argv[optind+2];
+  std::string taskName = (numPositional == 4) ? argv[optind+3] : "";
+
+  IvfIndex index(indexFname);
+  if (index.getPooling() >= POOLINGS.size()) {
+    std::cerr << "Error: unknown pooling in " << indexFname << std::endl;
+    return 1;
+  }
+  std::string pooling = POOLINGS[index.getPooling()];
+  if ((pooling == "pooled") && taskName.empty()) {
+    printQueryHelp();
+    std::cout << "Error: " << indexFname << " was built with `--pooling pooled`, "
+              << "which needs a TASK" << std::endl;
+    return 1;
+  }
+  auto encoder = loadEncoder(encoderOptions, baseFname, taskName, pooling);
+  if (!encoder) return 1;
+  if (encoder->getDim() != static_cast<long>(index.getDim())) {
+    std::cerr << "Error: the model's vectors have " << encoder->getDim()
+              << " values, the index's " << index.getDim() << std::endl;
+    return 1;
+  }
+
+  std::ifstream file(textsFname);
+  if (!file.is_open()) throw std::runtime_error(textsFname + " not found!");
+  LineEncoder lineEncoder(encoder->getVocabFname(), encoder->getLowercaseFname(),
+                          encoderOptions.maxSequenceLength);
+  torch::NoGradGuard noGrad;
+  long numQueries = 0;
+  double encodeSeconds = 0.0, searchSeconds = 0.0;
+  std::vector<torch::Tensor> ids;
+  std::string line;
+  while (true) {
+    ids.clear();
+    while ((static_cast<long>(ids.size()) < encoderOptions.batchSize)
+           && std::getline(file, line)) {
+      ids.push_back(lineEncoder.encode(line));
+    }
+    if (ids.empty()) break;
+    auto startTime = std::chrono::steady_clock::now();
+    torch::Tensor batch = torch::stack(ids);
+    batch = batch.slice(1, 0, std::max(1L, (batch != PADDING_IDX).sum(1).max().item<long>()));
+    torch::Tensor vectors = encoder->encode(batch);
+    auto encodedTime = std::chrono::steady_clock::now();
+    auto neighbours = index.search(vectors, numNeighbours, nprobe);
+    auto searchedTime = std::chrono::steady_clock::now();
+    encodeSeconds += std::chrono::duration<double>(encodedTime - startTime).count();
+    searchSeconds += std::chrono::duration<double>(searchedTime - encodedTime).count();
+
+    for (const auto& row : neighbours) {
+      for (size_t i = 0; i < row.size(); i++) {
+        if (i > 0) std::cout << DELIMITER;
+        std::cout << row[i].second << ':' << row[i].first;
+      }
+      std::cout << std::endl;
+    }
+    numQueries += ids.size();
+  }
+
+  std::cerr << "# "
+            << "queries=" << numQueries
+            << " nprobe=" << nprobe
+            << " encode_ms_per_query=" << 1000.0 * encodeSeconds / std::max(1L, numQueries)
+            << " search_ms_per_query=" << 1000.0 * searchSeconds / std::max(1L, numQueries)
+            << std::endl;
+  printSchedulerStats();
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printHelp(argv[0]);
+    return 1;
+  }
+  std::string command = argv[1];
+  if (command == "build") {
+    return build(argc-1, ++argv);
+  } else if (command == "query") {
+    return query(argc-1, ++argv);
+  }
+  printHelp(argv[0]);
+  if ((command != "-h") && (command != "--help")) {
+    std::cout << "Invalid command `" << command << "`" << std::endl;
+  }
+  return 1;
+}
+}
@@ -0,0 +1,10 @@
+#ifndef ANN_ANN_H
+#define ANN_ANN_H
+#include <string>
+
+namespace ann {
+void printHelp(const std::string &programName);
+// `bert index {build,query}`
+int main(int argc, char *argv[]);
+}
+#endif
@@ -0,0 +1,299 @@
+#include "ivf_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+#include <ATen/Parallel.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <torch/autograd.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "kernels.h"
+
+namespace ann {
+
+static const char IVF_MAGIC[8] = {'B', 'E', 'R', 'T', 'I', 'V', 'F', '1'};
+
+// Byte offsets of the sections of an index file
+struct Layout {
+  size_t centroids, offsets, ids, scales, vectors, size;
+};
+
+static size_t alignUp(size_t offset) {
+  return (offset + 63) / 64 * 64;
+}
+
+static Layout getLayout(const IvfHeader& header) {
+  Layout layout;
+  layout.centroids = alignUp(header.headerSize);
+  layout.offsets = alignUp(layout.centroids
+                           + header.numLists * header.dim * sizeof(float));
+  layout.ids = alignUp(layout.offsets + (header.numLists + 1) * sizeof(uint64_t));
+  layout.scales = alignUp(layout.ids + header.numVectors * sizeof(uint64_t));
+  bool int8 = header.compression == Int8;
+  layout.vectors = alignUp(layout.scales + (int8 ? header.numVectors * sizeof(float) : 0));
+  layout.size = layout.vectors
+    + header.numVectors * header.dim * (int8 ? sizeof(int8_t) : sizeof(float));
+  return layout;
+}
+
+static torch::Tensor normalizeRows(const torch::Tensor& x) {
+  return x / x.norm(2, -1, true).clamp_min(1e-12);
+}
+
+// The centroid with the largest inner product for each row, with at most
+// IVF_SCORE_BLOCK_SIZE scores at a time
+static torch::Tensor assignLists(const torch::Tensor& rows, const torch::Tensor& centroids) {
+  long step = std::max(1L, static_cast<long>(IVF_SCORE_BLOCK_SIZE / centroids.size(0)));
+  std::vector<torch::Tensor> assignments;
+  for (long begin = 0; begin < rows.size(0); begin += step) {
+    assignments.push_back(rows.slice(0, begin, begin + step).matmul(centroids.t()).argmax(1));
+  }
+  return torch::cat(assignments);
+}
+
+// Spherical k-means: centroids of unit norm, vectors go to the centroid with
+// the largest inner product
+static torch::Tensor trainCentroids(const torch::Tensor& sample, long numLists,
+                                    long numIterations) {
+  long numSamples = sample.size(0);
+  torch::Tensor centroids = sample.index_select(
+    0, torch::randperm(numSamples, torch::kLong).slice(0, 0, numLists)).clone();
+  for (long i = 0; i < numIterations; i++) {
+    torch::Tensor sums = torch::zeros_like(centroids);
+    torch::Tensor counts = torch::zeros({numLists}, torch::kLong);
+    for (long row = 0; row < numSamples; row += IVF_BUILD_BLOCK_ROWS) {
+      torch::Tensor block = sample.slice(0, row, row + IVF_BUILD_BLOCK_ROWS);
+      torch::Tensor assignment = assignLists(block, centroids);
+      sums.index_add_(0, assignment, block);
+      counts += torch::bincount(assignment, {}, numLists);
+    }
+    // Empty lists start over from a random sample
+    torch::Tensor empty = (counts == 0).nonzero().view(-1);
+    if (empty.numel() > 0) {
+      sums.index_copy_(0, empty, sample.index_select(
+        0, torch::randint(numSamples, {empty.numel()}, torch::kLong)));
+    }
+    centroids = normalizeRows(sums);
+  }
+  return centroids.contiguous();
+}
+
+void buildIndex(const embed::EmbeddingFile& vectors, const std::string& fname,
+                long numLists, Compression compression, uint32_t pooling,
+                long numIterations, long seed) {
+  long numVectors = vectors.getNumRows();
+  long dim = vectors.getDim();
+  if (numVectors == 0) throw std::runtime_error("No vectors to index");
+  numLists = std::min(numLists, numVectors);
+  torch::NoGradGuard noGrad;
+  torch::manual_seed(seed);
+
+  // Train on a sample, copied in row order by block, with at least one
+  // vector per list (numLists is at most numVectors)
+  long numSamples = std::max(numLists, std::min<long>(numLists * IVF_TRAIN_SAMPLES_PER_LIST,
+                                                      IVF_TRAIN_MAX_SAMPLES));
+  numSamples = std::min(numVectors, numSamples);
+  torch::Tensor sampleRows = numSamples == numVectors
+    ? torch::arange(numVectors, torch::kLong)
+    : std::get<0>(torch::randint(numVectors, {numSamples}, torch::kLong).sort());
+  torch::Tensor sample = torch::empty({numSamples, dim});
+  const long* sampleRowsData = sampleRows.data_ptr<long>();
+  for (long i = 0; i < numSamples;) {
+    long row = sampleRowsData[i];
+    long count = std::min<long>(IVF_BUILD_BLOCK_ROWS, numVectors - row);
+    long end = i;
+    while ((end < numSamples) && (sampleRowsData[end] < row + count)) end++;
+    sample.slice(0, i, end).copy_(vectors.getRows(row, count).index_select(
+      0, sampleRows.slice(0, i, end) - row));
+    i = end;
+  }
+  sample.div_(sample.norm(2, -1, true).clamp_min(1e-12));
+  torch::Tensor centroids = trainCentroids(sample, numLists, numIterations);
+  sample = torch::Tensor();
+
+  // The list of every vector, by block
+  std::vector<uint32_t> lists(numVectors);
+  std::vector<uint64_t> offsets(numLists + 1, 0);
+  for (long row = 0; row < numVectors; row += IVF_BUILD_BLOCK_ROWS) {
+    long count = std::min<long>(IVF_BUILD_BLOCK_ROWS, numVectors - row);
+    torch::Tensor block = normalizeRows(vectors.getRows(row, count));
+    torch::Tensor assignment = assignLists(block, centroids);
+    const long* assignmentData = assignment.data_ptr<long>();
+    for (long i = 0; i < count; i++) {
+      lists[row + i] = assignmentData[i];
+      offsets[assignmentData[i] + 1]++;
+    }
+  }
+  for (long l = 0; l < numLists; l++) offsets[l + 1] += offsets[l];
+
+  IvfHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, IVF_MAGIC, sizeof(IVF_MAGIC));
+  header.numVectors = numVectors;
+  header.dim = dim;
+  header.numLists = numLists;
+  header.compression = compression;
+  header.pooling = pooling;
+  header.headerSize = sizeof(IvfHeader);
+  Layout layout = getLayout(header);
+
+  int fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("Cannot create " + fname);
+  if (posix_fallocate(fd, 0, layout.size) != 0) {
+    close(fd);
+    throw std::runtime_error("Cannot allocate " + std::to_string(layout.size)
+                             + " bytes for " + fname);
+  }
+  void* address = mmap(nullptr, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (address == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("Cannot map " + fname);
+  }
+  char* mapped = static_cast<char*>(address);
+  std::memcpy(mapped, &header, sizeof(header));
+  std::memcpy(mapped + layout.centroids, centroids.data_ptr<float>(), centroids.nbytes());
+  std::memcpy(mapped + layout.offsets, offsets.data(), offsets.size() * sizeof(uint64_t));
+  uint64_t* ids = reinterpret_cast<uint64_t*>(mapped + layout.ids);
+  float* scales = reinterpret_cast<float*>(mapped + layout.scales);
+
+  // Second pass: each vector to the next free position of its list, so that
+  // lists hold their rows in ascending order
+  std::vector<uint64_t> positions(offsets.begin(), offsets.end() - 1);
+  std::vector<int8_t> codes;
+  std::vector<float> codeScales;
+  for (long row = 0; row < numVectors; row += IVF_BUILD_BLOCK_ROWS) {
+    long count = std::min<long>(IVF_BUILD_BLOCK_ROWS, numVectors - row);
+    torch::Tensor block = normalizeRows(vectors.getRows(row, count)).contiguous();
+    const float* blockData = block.data_ptr<float>();
+    if (compression == Int8) {
+      codes.resize(count * dim);
+      codeScales.resize(count);
+      kernels::quantizeRows(blockData, codes.data(), codeScales.data(), dim, 0, count);
+    }
+    for (long i = 0; i < count; i++) {
+      uint64_t position = positions[lists[row + i]]++;
+      ids[position] = row + i;
+      if (compression == Int8) {
+        scales[position] = codeScales[i];
+        std::memcpy(mapped + layout.vectors + position * dim, codes.data() + i * dim, dim);
+      } else {
+        std::memcpy(mapped + layout.vectors + position * dim * sizeof(float),
+                    blockData + i * dim, dim * sizeof(float));
+      }
+    }
+  }
+  msync(mapped, layout.size, MS_SYNC);
+  munmap(mapped, layout.size);
+  close(fd);
+}
+
+IvfIndex::IvfIndex(const std::string& fname) : fname (fname) {
+  fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Cannot open " + fname);
+  struct stat st;
+  fstat(fd, &st);
+  if ((static_cast<size_t>(st.st_size) < sizeof(header))
+      || (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+      || (std::memcmp(header.magic, IVF_MAGIC, sizeof(IVF_MAGIC)) != 0)) {
+    close(fd);
+    throw std::runtime_error(fname + " is not an index file");
+  }
+  Layout layout = getLayout(header);
+  if (static_cast<size_t>(st.st_size) < layout.size) {
+    close(fd);
+    throw std::runtime_error(fname + " is truncated");
+  }
+  mappedSize = layout.size;
+  void* address = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (address == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("Cannot map " + fname);
+  }
+  mapped = static_cast<char*>(address);
+  centroids = reinterpret_cast<const float*>(mapped + layout.centroids);
+  offsets = reinterpret_cast<const uint64_t*>(mapped + layout.offsets);
+  ids = reinterpret_cast<const uint64_t*>(mapped + layout.ids);
+  scales = reinterpret_cast<const float*>(mapped + layout.scales);
+  vectors = mapped + layout.vectors;
+}
+
+IvfIndex::~IvfIndex() {
+  if (mapped != nullptr) munmap(mapped, mappedSize);
+  if (fd >= 0) close(fd);
+}
+
+std::vector<Neighbour> IvfIndex::search(const float* query, long k, long nprobe) const {
+  long dim = header.dim;
+  long numLists = header.numLists;
+  nprobe = std::max(1L, std::min(nprobe, numLists));
+
+  // The nprobe lists with the most similar centroids
+  std::vector<float> scores(numLists);
+  kernels::vectorScores(query, centroids, numLists, dim, scores.data());
+  std::vector<long> probed(numLists);
+  for (long l = 0; l < numLists; l++) probed[l] = l;
+  std::partial_sort(probed.begin(), probed.begin() + nprobe, probed.end(),
+                    [&scores](long a, long b) { return scores[a] > scores[b]; });
+
+  std::vector<int8_t> queryCodes;
+  float queryScale = 1.0f;
+  if (header.compression == Int8) {
+    queryCodes.resize(dim);
+    kernels::quantizeRows(query, queryCodes.data(), &queryScale, dim, 0, 1);
+  }
+
+  // A min-heap of the best k so far
+  std::greater<Neighbour> worse;
+  std::vector<Neighbour> best;
+  best.reserve(k + 1);
+  for (long p = 0; p < nprobe; p++) {
+    uint64_t begin = offsets[probed[p]], end = offsets[probed[p] + 1];
+    long count = end - begin;
+    if (static_cast<long>(scores.size()) < count) scores.resize(count);
+    if (header.compression == Int8) {
+      kernels::vectorScoresInt8(queryCodes.data(), queryScale,
+                                reinterpret_cast<const int8_t*>(vectors) + begin * dim,
+                                scales + begin, count, dim, scores.data());
+    } else {
+      kernels::vectorScores(query, reinterpret_cast<const float*>(vectors) + begin * dim,
+                            count, dim, scores.data());
+    }
+    for (long i = 0; i < count; i++) {
+      if (static_cast<long>(best.size()) < k) {
+        best.emplace_back(scores[i], ids[begin + i]);
+        std::push_heap(best.begin(), best.end(), worse);
+      } else if (scores[i] > best.front().first) {
+        std::pop_heap(best.begin(), best.end(), worse);
+        best.back() = Neighbour(scores[i], ids[begin + i]);
+        std::push_heap(best.begin(), best.end(), worse);
+      }
+    }
+  }
+  // Most similar first
+  std::sort_heap(best.begin(), best.end(), worse);
+  return best;
+}
+
+std::vector<std::vector<Neighbour>> IvfIndex::search(const torch::Tensor& queries,
+                                                     long k, long nprobe) const {
+  if (queries.size(1) != static_cast<long>(header.dim)) {
+    throw std::runtime_error("Queries of " + std::to_string(queries.size(1))
+                             + " values for an index of " + std::to_string(header.dim));
+  }
+  torch::Tensor x = queries.to(torch::kFloat).contiguous();
+  const float* data = x.data_ptr<float>();
+  std::vector<std::vector<Neighbour>> neighbours(x.size(0));
+  at::parallel_for(0, x.size(0), 1, [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++) {
+      neighbours[i] = search(data + i * header.dim, k, nprobe);
+    }
+  });
+  return neighbours;
+}
+}
@@ -0,0 +1,87 @@
+#ifndef ANN_IVF_INDEX_H
+#define ANN_IVF_INDEX_H
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <torch/types.h>
+
+#include "embed/embedding_file.h"
+
+namespace ann {
+// An inverted-file (IVF) index written by `bert index build`: this header,
+// then 64-byte aligned sections of
+//   centroids  NUM_LISTS x DIM float32
+//   offsets    NUM_LISTS + 1 uint64, the first position of each list
+//   ids        NUM_VECTORS uint64, the row of each position
+//   scales     NUM_VECTORS float32 (int8 only)
+//   vectors    NUM_VECTORS x DIM float32 or int8, grouped by list
+// Vectors are L2-normalized, so inner products are cosine similarities
+struct IvfHeader {
+  char magic[8];  // "BERTIVF1"
+  uint64_t numVectors;
+  uint64_t dim;
+  uint64_t numLists;
+  uint32_t compression;  // 0: none (float32), 1: int8
+  uint32_t pooling;  // 0: cls, 1: mean, 2: pooled, as `bert embed --pooling`
+  uint32_t headerSize;  // 64
+  char reserved[20];
+};
+static_assert(sizeof(IvfHeader) == 64, "The header is 64 bytes");
+
+enum Compression : uint32_t {
+  NoCompression = 0,
+  Int8 = 1,
+};
+
+// A neighbour: similarity and row of the indexed vectors
+typedef std::pair<float, uint64_t> Neighbour;
+
+// Write an index over the rows of vectors to fname. The centroids are
+// trained with spherical k-means on a sample of IVF_TRAIN_SAMPLES_PER_LIST
+// vectors per list (at most IVF_TRAIN_MAX_SAMPLES), then every vector goes
+// to the list of its nearest centroid. Rows are normalized on the way, read
+// in blocks and scored against the centroids a bounded block at a time, so
+// vectors need not fit in memory
+void buildIndex(const embed::EmbeddingFile& vectors, const std::string& fname,
+                long numLists, Compression compression, uint32_t pooling,
+                long numIterations, long seed);
+
+// A memory-mapped, read-only index
+class IvfIndex {
+  public:
+    explicit IvfIndex(const std::string& fname);
+    ~IvfIndex();
+    IvfIndex(const IvfIndex&) = delete;
+    IvfIndex& operator=(const IvfIndex&) = delete;
+
+    // The k most similar vectors to a query of DIM values (L2-normalized),
+    // best first, from the nprobe lists with the most similar centroids
+    std::vector<Neighbour> search(const float* query, long k, long nprobe) const;
+    // search() for each row of queries, shape: (NUM_QUERIES, DIM), in
+    // parallel on the intra-op threads
+    std::vector<std::vector<Neighbour>> search(const torch::Tensor& queries,
+                                               long k, long nprobe) const;
+
+    uint64_t getNumVectors() const { return header.numVectors; }
+    uint64_t getDim() const { return header.dim; }
+    uint64_t getNumLists() const { return header.numLists; }
+    Compression getCompression() const { return static_cast<Compression>(header.compression); }
+    uint32_t getPooling() const { return header.pooling; }
+
+  private:
+    std::string fname;
+    IvfHeader header;
+    int fd = -1;
+    char* mapped = nullptr;
+    size_t mappedSize = 0;
+    // Sections of the mapped file
+    const float* centroids;
+    const uint64_t* offsets;
+    const uint64_t* ids;
+    const float* scales;
+    const char* vectors;
+};
+}
+#endif
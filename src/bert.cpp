@@ -1,14 +1,20 @@
 #include <iostream>
 #include <string>
 
+#include "ann.h"
+#include "distill.h"
+#include "embed.h"
 #include "predict.h"
+#include "prune.h"
+#include "quantize.h"
+#include "serve.h"
 #include "train.h"
 #include "tokenize.h"
 
 void printHelp(const std::string& programName) {
     std::cout << "Usage: "
               << programName
-              << " {train,tokenize} [OPTIONS...]"
+              << " {train,distill,predict,embed,index,prune,quantize,serve,tokenize} [OPTIONS...]"
               << std::endl;
 }
 
@@ -31,6 +37,18 @@ int main(int argc, char* argv[]) {
     return tokenize::main(argc-1,  ++argv);
   } else if (std::string(argv[1]) == "predict") {
     return predict::main(argc-1,  ++argv);
+  } else if (std::string(argv[1]) == "embed") {
+    return embed::main(argc-1,  ++argv);
+  } else if (std::string(argv[1]) == "index") {
+    return ann::main(argc-1,  ++argv);
+  } else if (std::string(argv[1]) == "distill") {
+    return distill::main(argc-1,  ++argv);
+  } else if (std::string(argv[1]) == "prune") {
+    return prune::main(argc-1,  ++argv);
+  } else if (std::string(argv[1]) == "quantize") {
+    return quantize::main(argc-1,  ++argv);
+  } else if (std::string(argv[1]) == "serve") {
+    return serve::main(argc-1,  ++argv);
   } else {
     std::cout << "Invalid command `" << argv[1] << "`" << std::endl;
     return 1;
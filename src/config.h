@@ -3,17 +3,39 @@
 
 #define PADDING_IDX 0  // Padding value for token ids
 #define LAYER_NORM_EPS 1e-12 
-#define MAX_SEQUENCE_LENGTH 100  // Pad/truncate input sequences to that
 #define DELIMITER ','  // Delimiter for label files
 #define SNIFF_LINES 100  // Lines to consider when detecting task type
 #define CLASSIFICATION_IGNORE_INDEX -1  // Value to ignore when computing classification loss
 #define MAX_GRADIENT_NORM 1.0f  // Gradient clipping value
 #define WEIGHT_DECAY 1e-2f  // Adam weight decay value
+#define BUCKET_SIZE 100  // Batches per length-sorted bucket when sampling training batches
+#define FUSED_ATTENTION true  // Fused QKV + attention kernel for CPU inference
+#define FUSED_EMBEDDINGS true  // Fused embedding gather + sum + LayerNorm kernel for CPU inference
+#define FUSED_HEADS true  // Run the sentence-level task heads as one GEMM per stage when training
+#define FUSED_EPILOGUE true  // Fused bias+GELU and bias+dropout+residual+LayerNorm CPU kernels
+#define LAYER_NORM_GRAD_CHUNKS 64  // Fused LayerNorm backward, row chunks summed for the gamma/beta gradients
+#define INITIAL_LOSS_SCALE 65536.0f  // Float16 training, see MixedPrecision
+#define LOSS_SCALE_GROWTH_INTERVAL 2000  // Steps without overflow before doubling the loss scale
+#define STREAM_QUEUE_BATCHES 4  // Streaming predict, tokenized lines buffered ahead of the model, in batches
+#define SERVE_STATS_INTERVAL_SEC 10  // `bert serve`, seconds between statistics lines
+#define EMBED_CHUNK_BATCHES 64  // `bert embed`, batches of lines read and tokenized at a time
+#define EMBED_RELEASE_MB 64  // `bert embed`, written megabytes between flushing and releasing mapped pages
+#define IVF_TRAIN_SAMPLES_PER_LIST 256  // `bert index build`, k-means training vectors per list
+#define IVF_TRAIN_MAX_SAMPLES 131072  // `bert index build`, at most this many k-means training vectors
+#define IVF_SCORE_BLOCK_SIZE 16777216  // `bert index build`, vector-centroid scores (rows x lists) computed at a time
+#define IVF_BUILD_BLOCK_ROWS 65536  // `bert index build`, vectors normalized and assigned to lists at a time
+#define STREAM_CHUNK_LINES 8192  // `train --streaming`, lines read, tokenized and shuffled as one chunk
+#define STREAM_SHUFFLE_CHUNKS 4  // `train --streaming`, chunks whose examples are shuffled together
+#define STREAM_BUFFER_EXAMPLES 32768  // `train --streaming`, examples buffered ahead of the model
+#define STREAM_PRELOADERS 2  // `train --streaming`, threads reading chunks ahead of the model
 
 // Default arguments for train
 #define DEFAULT_BATCH_SIZE 32
 #define DEFAULT_NUM_EPOCHS 4
 #define DEFAULT_LR 1e-5f
+#define DEFAULT_MAX_SEQUENCE_LENGTH 100  // Pad/truncate input sequences to that
+#define DEFAULT_NUM_THREADS 0  // libtorch intra-op threads, 0 for the libtorch default
+#define DEFAULT_NUM_INTEROP_THREADS 0  // libtorch inter-op threads, 0 for the libtorch default
 
 struct Config {
     int hiddenSize;;
@@ -1,5 +1,8 @@
 #ifndef DATA_H
 #define DATA_H
+#include "data/length_bucket_sampler.h"
 #include "data/text_dataset.h"
 #include "data/data_utils.h"
+#include "data/streaming_dataset.h"
+#include "data/text_windows.h"
 #endif
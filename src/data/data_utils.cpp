@@ -8,12 +8,19 @@
 #include <torch/types.h>
 
 #include "config.h"
+#include "runtime.h"
 #include "tokenize.h"
 
 
 template <typename T>
 torch::Tensor idsToTensor(const std::vector<std::vector<T>>& ids,
-                          T& sosId, T& eosId, T& paddingIdx) {
+                          T& sosId, T& eosId, T& paddingIdx,
+                          long maxLength) {
+  // Every row holds at least [CLS] and [SEP]
+  if (maxLength < 2) {
+    throw std::runtime_error("Maximum sequence length " + std::to_string(maxLength)
+                             + " is shorter than [CLS] and [SEP]");
+  }
   torch::ScalarType dtype;
   if (std::is_same<T, long>::value) {
     dtype = torch::kInt64;
@@ -23,18 +30,19 @@ torch::Tensor idsToTensor(const std::vector<std::vector<T>>& ids,
 
   long numRows = ids.size();
 
-  torch::Tensor idsTensor = torch::full({numRows * MAX_SEQUENCE_LENGTH},
+  torch::Tensor idsTensor = torch::full({numRows * maxLength},
                                          paddingIdx,
                                          torch::TensorOptions().dtype(dtype));
 
   // Get a pointer to tensor and copy values sequentially
   T* data = idsTensor.data_ptr<T>();
+  long numTruncated = 0;
   for (int i = 0; i < ids.size(); i++) {
       *data++ = sosId;
       int elementsInserted = 1;
     for (int j = 0; j < ids[i].size(); j++) {
-      if (j >= MAX_SEQUENCE_LENGTH - 2) {
-        std::cerr << "WARNING: truncating sequence to " << MAX_SEQUENCE_LENGTH << std::endl;
+      if (j >= maxLength - 2) {
+        numTruncated++;
         break;
       }
       *data++ = ids[i][j];
@@ -44,9 +52,14 @@ torch::Tensor idsToTensor(const std::vector<std::vector<T>>& ids,
       elementsInserted++;
 
     // Forward pointer to next row
-    for (int k = elementsInserted; k < MAX_SEQUENCE_LENGTH; k++) data++;
+    for (int k = elementsInserted; k < maxLength; k++) data++;
+  }
+  if (numTruncated > 0) {
+    std::cerr << "WARNING: truncated " << numTruncated << " of " << numRows
+              << " sequences to " << maxLength << " tokens, see `--window-stride`"
+              << std::endl;
   }
-  return idsTensor.view({numRows, MAX_SEQUENCE_LENGTH});
+  return idsTensor.view({numRows, maxLength});
 }
 
 template <typename T>
@@ -96,17 +109,35 @@ torch::Tensor idsToTensor(const std::vector<std::vector<T>>& ids) {
 }
 
 
-torch::Tensor readTextsToTensor(const std::string& textsFname,
-                                const std::string& vocabFname,
-                                const std::string& lowercaseFname) {
-  // Initialize tokenizer
+static Tokenizer* getTokenizer(const std::string& vocabFname,
+                               const std::string& lowercaseFname) {
   std::string suffix = ".sp";
-  Tokenizer *tokenizer;
   if (vocabFname.compare(vocabFname.size() - suffix.size(), suffix.size(), suffix) == 0) {
-    tokenizer = new SentencepieceTokenizer(vocabFname, lowercaseFname);
-  } else {
-    tokenizer = new FullTokenizer(vocabFname, lowercaseFname);
+    return new SentencepieceTokenizer(vocabFname, lowercaseFname);
+  }
+  return new FullTokenizer(vocabFname, lowercaseFname);
+}
+
+std::string getVocabFname(const std::string& modelDir) {
+  std::string vocabFname = modelDir + "/vocab.txt";
+  std::ifstream file(vocabFname);
+  if (!file.is_open()) {
+    // Sentencepiece
+    vocabFname = modelDir + "/model.sp";
   }
+  return vocabFname;
+}
+
+// Tokenize the lines of a text file to ids, without special tokens. Also
+// gives the ids of [CLS] and [SEP]
+static std::vector<std::vector<long>> readTextsToIds(const std::string& textsFname,
+                                                     const std::string& vocabFname,
+                                                     const std::string& lowercaseFname,
+                                                     long& sosId, long& eosId) {
+  // Initialize tokenizer
+  std::unique_ptr<Tokenizer> tokenizer(getTokenizer(vocabFname, lowercaseFname));
+  sosId = tokenizer->tokenToId("[CLS]");
+  eosId = tokenizer->tokenToId("[SEP]");
 
   // Prepare file stream
   std::ifstream file(textsFname);
@@ -117,125 +148,225 @@ torch::Tensor readTextsToTensor(const std::string& textsFname,
   // Read file line-by-line and tokenize to ids
   std::string line;
   std::vector<std::vector<long>> textsIds;
-  while (std::getline(file, line)) {
-    textsIds.push_back(tokenizer->tokenizeToIds(line));
+  ThreadPool* pool = getTokenizerPool();
+  if (pool == nullptr) {
+    while (std::getline(file, line)) {
+      textsIds.push_back(tokenizer->tokenizeToIds(line));
+    }
+  } else {
+    // Each worker tokenizes a contiguous range of lines with its own tokenizer
+    std::vector<std::string> lines;
+    while (std::getline(file, line)) lines.push_back(line);
+    textsIds.resize(lines.size());
+    pool->parallelFor(lines.size(), [&](int worker, long begin, long end) {
+      std::unique_ptr<Tokenizer> workerTokenizer(getTokenizer(vocabFname, lowercaseFname));
+      for (long i = begin; i < end; i++) {
+        textsIds[i] = workerTokenizer->tokenizeToIds(lines[i]);
+      }
+    });
   }
+  return textsIds;
+}
 
+torch::Tensor readTextsToTensor(const std::string& textsFname,
+                                const std::string& vocabFname,
+                                const std::string& lowercaseFname,
+                                long maxLength) {
+  long sosId, eosId, paddingIdx = PADDING_IDX;
+  std::vector<std::vector<long>> textsIds = readTextsToIds(textsFname, vocabFname,
+                                                           lowercaseFname, sosId, eosId);
   // Convert std::vector ids to torch::Tensor
-  long sosId = tokenizer->tokenToId("[CLS]"),
-       eosId = tokenizer->tokenToId("[SEP]"),
-       paddingIdx = PADDING_IDX;
-  return idsToTensor(textsIds, sosId, eosId, paddingIdx);
+  return idsToTensor(textsIds, sosId, eosId, paddingIdx, maxLength);
 }
 
 torch::Tensor readTextsToTensor(const std::string& modelDir,
                                 const std::vector<Task>& tasks,
-                                const std::string& subset) {
+                                const std::string& subset,
+                                long maxLength) {
   std::string textsFname = tasks[0].baseDir + "/" + subset + "-texts";
-  std::string vocabFname = modelDir + "/vocab.txt";
-  std::ifstream file(vocabFname);
+  std::string lowercaseFname = modelDir + "/lowercase";
+  return readTextsToTensor(textsFname, getVocabFname(modelDir), lowercaseFname,
+                           maxLength);
+}
+
+TextWindows readTextsToWindows(const std::string& textsFname,
+                               const std::string& vocabFname,
+                               const std::string& lowercaseFname,
+                               long maxLength, long stride) {
+  long sosId, eosId;
+  std::vector<std::vector<long>> textsIds = readTextsToIds(textsFname, vocabFname,
+                                                           lowercaseFname, sosId, eosId);
+  return splitIntoWindows(textsIds, sosId, eosId, maxLength, stride);
+}
+
+TextWindows readTextsToWindows(const std::string& modelDir,
+                               const std::vector<Task>& tasks,
+                               const std::string& subset,
+                               long maxLength, long stride) {
+  std::string textsFname = tasks[0].baseDir + "/" + subset + "-texts";
+  return readTextsToWindows(textsFname, getVocabFname(modelDir), modelDir + "/lowercase",
+                            maxLength, stride);
+}
+
+LineEncoder::LineEncoder(const std::string& vocabFname,
+                         const std::string& lowercaseFname,
+                         long maxLength)
+  : tokenizer (getTokenizer(vocabFname, lowercaseFname)),
+    maxLength (maxLength) {
+  sosId = tokenizer->tokenToId("[CLS]");
+  eosId = tokenizer->tokenToId("[SEP]");
+}
+
+LineEncoder::~LineEncoder() {}
+
+torch::Tensor LineEncoder::encode(const std::string& line) {
+  std::vector<std::vector<long>> ids = {tokenizer->tokenizeToIds(line)};
+  long paddingIdx = PADDING_IDX;
+  return idsToTensor(ids, sosId, eosId, paddingIdx, maxLength)[0];
+}
+
+torch::Tensor LineEncoder::encode(const std::vector<std::string>& lines) {
+  std::vector<std::vector<long>> ids;
+  ids.reserve(lines.size());
+  for (const auto& line : lines) ids.push_back(tokenizer->tokenizeToIds(line));
+  long paddingIdx = PADDING_IDX;
+  return idsToTensor(ids, sosId, eosId, paddingIdx, maxLength);
+}
+
+long getSeparatorId(const std::string& vocabFname,
+                    const std::string& lowercaseFname) {
+  // A WordPiece id is the line of the token in the vocabulary, no need to
+  // load all of it
+  std::string suffix = ".sp";
+  if (vocabFname.compare(vocabFname.size() - suffix.size(), suffix.size(), suffix) != 0) {
+    std::ifstream file(vocabFname);
+    std::string line;
+    for (long i = 0; std::getline(file, line); i++) {
+      if (line == "[SEP]") return i;
+    }
+  }
+  std::unique_ptr<Tokenizer> tokenizer(getTokenizer(vocabFname, lowercaseFname));
+  return tokenizer->tokenToId("[SEP]");
+}
+
+long getSeparatorId(const std::string& modelDir) {
+  return getSeparatorId(getVocabFname(modelDir), modelDir + "/lowercase");
+}
+
+template <typename T> T stringToNumber(const std::string& s) {}
+template<> long stringToNumber(const std::string& s) { return std::stol(s); }
+template<> float stringToNumber(const std::string& s) { return std::stol(s); }
+
+static std::vector<std::string> readLines(const std::string& fname) {
+  std::ifstream file(fname);
   if (!file.is_open()) {
-    // Sentencepiece
-    vocabFname = modelDir + "/model.sp";
+    throw std::runtime_error(fname + " not found!");
   }
-  std::string lowercaseFname = modelDir + "/lowercase";
-  return readTextsToTensor(textsFname, vocabFname, lowercaseFname);
+  std::string line;
+  std::vector<std::string> lines;
+  while (std::getline(file, line)) lines.push_back(line);
+  return lines;
+}
+
+// Sentence-level: one label per line
+template <typename T>
+static std::vector<T> parseLabels(const std::vector<std::string>& lines) {
+  std::vector<T> out;
+  out.reserve(lines.size());
+  for (const auto& line : lines) out.push_back(stringToNumber<T>(line));
+  return out;
+}
+
+// 2D: DELIMITER-separated labels per line
+template <typename T>
+static std::vector<std::vector<T>> parseLabels2D(const std::vector<std::string>& lines) {
+	std::vector<std::vector<T>> data;
+  data.reserve(lines.size());
+  for (const auto& line : lines) {
+		std::string value;
+		std::vector<T> lineData;
+		std::istringstream iss(line);
+		while(std::getline(iss, value, DELIMITER)) {
+			lineData.push_back(stringToNumber<T>(value));
+		}
+		data.push_back(lineData);
+  }
+  return data;
 }
 
-torch::Tensor readLabelsToTensor(const std::string& labelsFname, int taskType) {
+torch::Tensor labelLinesToTensor(const std::vector<std::string>& lines, int taskType,
+                                 long maxLength) {
   if (((Binary & taskType) == Binary)
       || (Regression & taskType) == Regression) {
     if ((TokenLevel & taskType) == TokenLevel) {
-      // Token-level, use readLabels2D and overloaded idsToTensor with
+      // Token-level, use parseLabels2D and overloaded idsToTensor with
       // sepcial token ids
       float sosId = CLASSIFICATION_IGNORE_INDEX,
             eosId = CLASSIFICATION_IGNORE_INDEX,
             paddingIdx = CLASSIFICATION_IGNORE_INDEX;
       std::vector<std::vector<float>> labels =
-          readLabels2D<float>(labelsFname);
-      return idsToTensor(labels, sosId, eosId, paddingIdx);
+          parseLabels2D<float>(lines);
+      return idsToTensor(labels, sosId, eosId, paddingIdx, maxLength);
     } else if ((MultiLabel & taskType) == MultiLabel) {
-      // Multi-label use readLabels2D and plain idsToTensor
+      // Multi-label use parseLabels2D and plain idsToTensor
       std::vector<std::vector<float>> labels =
-          readLabels2D<float>(labelsFname);
+          parseLabels2D<float>(lines);
       return idsToTensor(labels);
     } else {
-      // Sentence-level, use readLabels and plain idsToTensor
-      std::vector<float> labels = readLabels<float>(labelsFname);
+      // Sentence-level, use parseLabels and plain idsToTensor
+      std::vector<float> labels = parseLabels<float>(lines);
       return idsToTensor(labels);
     }
   } else {
     // Multiclass
     if ((TokenLevel & taskType) == TokenLevel) {
-      // Token-level, use readLabels2D and overloaded idsToTensor with
+      // Token-level, use parseLabels2D and overloaded idsToTensor with
       // sepcial token ids
       long sosId = CLASSIFICATION_IGNORE_INDEX,
            eosId = CLASSIFICATION_IGNORE_INDEX,
            paddingIdx = CLASSIFICATION_IGNORE_INDEX;
       std::vector<std::vector<long>> labels =
-          readLabels2D<long>(labelsFname);
-      return idsToTensor(labels, sosId, eosId, paddingIdx);
+          parseLabels2D<long>(lines);
+      return idsToTensor(labels, sosId, eosId, paddingIdx, maxLength);
     } else if ((MultiLabel & taskType) == MultiLabel) {
-      // Multi-label use readLabels2D and plain idsToTensor
+      // Multi-label use parseLabels2D and plain idsToTensor
       std::vector<std::vector<long>> labels =
-          readLabels2D<long>(labelsFname);
+          parseLabels2D<long>(lines);
       return idsToTensor(labels);
     } else {
-      // Sentence-level, use readLabels and plain idsToTensor
-      std::vector<long> labels = readLabels<long>(labelsFname);
+      // Sentence-level, use parseLabels and plain idsToTensor
+      std::vector<long> labels = parseLabels<long>(lines);
       return idsToTensor(labels);
     }
   }
 }
 
+torch::Tensor readLabelsToTensor(const std::string& labelsFname, int taskType,
+                                 long maxLength) {
+  return labelLinesToTensor(readLines(labelsFname), taskType, maxLength);
+}
+
 std::vector<torch::Tensor> readLabelsToTensor(const std::vector<Task>& tasks,
-                                              const std::string& subset) {
+                                              const std::string& subset,
+                                              long maxLength) {
   std::string baseFname = tasks[0].baseDir + "/" + subset + "-";
   std::vector<torch::Tensor> labelsVector;
 
   for (const auto& task : tasks) {
     std::string labelsFname = baseFname + task.name;
-    labelsVector.push_back(readLabelsToTensor(labelsFname, task.taskType));
+    labelsVector.push_back(readLabelsToTensor(labelsFname, task.taskType, maxLength));
   }
   return labelsVector;
 }
 
-template <typename T> T stringToNumber(const std::string& s) {}
-template<> long stringToNumber(const std::string& s) { return std::stol(s); }
-template<> float stringToNumber(const std::string& s) { return std::stol(s); }
-
 template <typename T>
 std::vector<T> readLabels(std::string fname) {
-  std::ifstream file(fname);
-  if (!file.is_open()) {
-    throw std::runtime_error(fname + " not found!");
-  }
-  std::string line;
-  std::vector<T> out;
-  while (std::getline(file, line)) {
-    out.push_back(stringToNumber<T>(line));
-  }
-  return out;
+  return parseLabels<T>(readLines(fname));
 }
 
 template <typename T>
 std::vector<std::vector<T>> readLabels2D(std::string fname) {
-  std::ifstream file(fname);
-  if (!file.is_open()) {
-    throw std::runtime_error(fname + " not found!");
-  }
-  std::string line;
-	std::vector<std::vector<T>> data;
-  while (std::getline(file, line)) {
-		std::string value;
-		std::vector<T> lineData;
-		std::istringstream iss(line);
-		while(std::getline(iss, value, DELIMITER)) {
-			lineData.push_back(stringToNumber<T>(value));
-		}
-		data.push_back(lineData);
-  }
-  return data;
+  return parseLabels2D<T>(readLines(fname));
 }
 
 int detectTaskType(std::string labelsFname) {
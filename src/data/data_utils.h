@@ -1,24 +1,77 @@
 #ifndef DATA_UTILS_H
 #define DATA_UTILS_H
+#include <memory>
 #include <vector>
 
 #include <torch/types.h>
 
+#include "text_windows.h"
 #include "train/task.h"
 
-// Read a text file and return a padded tensor of embedding indices
+class Tokenizer;
+
+// Read a text file and return a tensor of embedding indices, padded or
+// truncated to maxLength
 torch::Tensor readTextsToTensor(const std::string& textsFname,
                                 const std::string& vocabFname,
-                                const std::string& lowercaseFname);
+                                const std::string& lowercaseFname,
+                                long maxLength);
 
 torch::Tensor readTextsToTensor(const std::string& modelDir,
                                 const std::vector<Task>& tasks,
-                                const std::string& subset);
+                                const std::string& subset,
+                                long maxLength);
+
+// Read a text file split into windows of maxLength tokens that start
+// `stride` tokens apart, instead of truncating long lines
+TextWindows readTextsToWindows(const std::string& textsFname,
+                               const std::string& vocabFname,
+                               const std::string& lowercaseFname,
+                               long maxLength, long stride);
+
+TextWindows readTextsToWindows(const std::string& modelDir,
+                               const std::vector<Task>& tasks,
+                               const std::string& subset,
+                               long maxLength, long stride);
+
+// Converts single lines to embedding indices as readTextsToTensor does for
+// a whole file, e.g. for streaming inputs
+class LineEncoder {
+  public:
+    LineEncoder(const std::string& vocabFname,
+                const std::string& lowercaseFname,
+                long maxLength);
+    ~LineEncoder();
+    // shape: (maxLength), padded or truncated
+    torch::Tensor encode(const std::string& line);
+    // shape: (NUM_LINES, maxLength), with one truncation warning for all
+    torch::Tensor encode(const std::vector<std::string>& lines);
+  private:
+    std::unique_ptr<Tokenizer> tokenizer;
+    long sosId, eosId, maxLength;
+};
 
-// Read labels for the given task into a vector of tensors of indices
-torch::Tensor readLabelsToTensor(const std::string& labelsFname, int taskType);
+// The tokenizer vocabulary of an extracted model directory, `vocab.txt` or
+// `model.sp` for sentencepiece
+std::string getVocabFname(const std::string& modelDir);
+
+// Get the id of the [SEP] token, which separates the segments of an input
+long getSeparatorId(const std::string& vocabFname,
+                    const std::string& lowercaseFname);
+long getSeparatorId(const std::string& modelDir);
+
+// Read labels for the given task into a vector of tensors of indices.
+// Token-level labels are padded or truncated to maxLength
+torch::Tensor readLabelsToTensor(const std::string& labelsFname, int taskType,
+                                 long maxLength);
 std::vector<torch::Tensor> readLabelsToTensor(const std::vector<Task>& tasks,
-                                              const std::string& subset);
+                                              const std::string& subset,
+                                              long maxLength);
+
+// Labels of some lines of a labels file, as readLabelsToTensor gives them
+// for a whole file
+torch::Tensor labelLinesToTensor(const std::vector<std::string>& lines, int taskType,
+                                 long maxLength);
 
 // Read labels from a filename to a vector of C++ types
 // Sentence-level: one label per line
@@ -41,7 +94,8 @@ torch::Tensor idsToTensor(const std::vector<T>& ids);
 // For sentence-level labels
 template <typename T>
 torch::Tensor idsToTensor(const std::vector<std::vector<T>>& ids,
-                          T& sosId, T& eosId, T& paddingIdx);
+                          T& sosId, T& eosId, T& paddingIdx,
+                          long maxLength);
 
 // Convert a vector of C++ types to a torch tensor
 // For multi-label tasks
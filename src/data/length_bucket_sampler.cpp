@@ -0,0 +1,97 @@
+#include "length_bucket_sampler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+LengthBucketSampler::LengthBucketSampler(std::vector<long> lengths,
+                                         size_t batchSize,
+                                         size_t bucketSize,
+                                         bool shuffle)
+  : lengths (std::move(lengths)), batchSize (batchSize),
+    bucketSize (bucketSize), shuffle (shuffle) {
+  if (batchSize == 0) {
+    throw std::runtime_error("LengthBucketSampler needs a positive batch size");
+  }
+  reset();
+}
+
+void LengthBucketSampler::reset(torch::optional<size_t> newSize) {
+  if (newSize.has_value() && *newSize != lengths.size()) {
+    throw std::runtime_error("LengthBucketSampler cannot be resized");
+  }
+  size_t numExamples = lengths.size();
+  std::vector<size_t> indices(numExamples);
+  if (shuffle) {
+    // Use the torch generator so that `--seed` controls the order
+    torch::Tensor permutation = torch::randperm(
+      numExamples, torch::TensorOptions().dtype(torch::kInt64));
+    const long* data = permutation.data_ptr<long>();
+    for (size_t i = 0; i < numExamples; i++) indices[i] = data[i];
+  } else {
+    for (size_t i = 0; i < numExamples; i++) indices[i] = i;
+  }
+
+  size_t bucketExamples = shuffle ? batchSize * bucketSize : numExamples;
+  auto byLength = [this] (size_t a, size_t b) {
+    return lengths[a] > lengths[b];
+  };
+
+  batches.clear();
+  batchIndex = 0;
+  for (size_t bucketStart = 0; bucketStart < numExamples; bucketStart += bucketExamples) {
+    size_t bucketEnd = std::min(bucketStart + bucketExamples, numExamples);
+    std::stable_sort(indices.begin() + bucketStart, indices.begin() + bucketEnd, byLength);
+    for (size_t batchStart = bucketStart; batchStart < bucketEnd; batchStart += batchSize) {
+      size_t batchEnd = std::min(batchStart + batchSize, bucketEnd);
+      batches.emplace_back(indices.begin() + batchStart, indices.begin() + batchEnd);
+    }
+  }
+
+  if (shuffle) {
+    torch::Tensor permutation = torch::randperm(
+      batches.size(), torch::TensorOptions().dtype(torch::kInt64));
+    const long* data = permutation.data_ptr<long>();
+    std::vector<std::vector<size_t>> shuffled(batches.size());
+    for (size_t i = 0; i < batches.size(); i++) {
+      shuffled[i] = std::move(batches[data[i]]);
+    }
+    batches = std::move(shuffled);
+  }
+}
+
+torch::optional<std::vector<size_t>> LengthBucketSampler::next(size_t /*batchSize*/) {
+  if (batchIndex >= batches.size()) return torch::nullopt;
+  return batches[batchIndex++];
+}
+
+void LengthBucketSampler::save(torch::serialize::OutputArchive& archive) const {
+  // Store the batches flattened, along with their sizes
+  std::vector<int64_t> flatIndices, batchSizes;
+  for (const auto& batch : batches) {
+    flatIndices.insert(flatIndices.end(), batch.begin(), batch.end());
+    batchSizes.push_back(batch.size());
+  }
+  archive.write("indices", torch::tensor(flatIndices), /*is_buffer=*/true);
+  archive.write("batch_sizes", torch::tensor(batchSizes), /*is_buffer=*/true);
+  archive.write("batch_index",
+                torch::tensor(static_cast<int64_t>(batchIndex)),
+                /*is_buffer=*/true);
+}
+
+void LengthBucketSampler::load(torch::serialize::InputArchive& archive) {
+  torch::Tensor flatIndices = torch::empty(1, torch::kInt64);
+  torch::Tensor batchSizes = torch::empty(1, torch::kInt64);
+  torch::Tensor index = torch::empty(1, torch::kInt64);
+  archive.read("indices", flatIndices, /*is_buffer=*/true);
+  archive.read("batch_sizes", batchSizes, /*is_buffer=*/true);
+  archive.read("batch_index", index, /*is_buffer=*/true);
+
+  const long* indicesData = flatIndices.data_ptr<long>();
+  batches.clear();
+  for (long i = 0, offset = 0; i < batchSizes.size(0); i++) {
+    long size = batchSizes[i].item<long>();
+    batches.emplace_back(indicesData + offset, indicesData + offset + size);
+    offset += size;
+  }
+  batchIndex = index.item<long>();
+}
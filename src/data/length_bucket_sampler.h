@@ -0,0 +1,35 @@
+#ifndef LENGTH_BUCKET_SAMPLER_H
+#define LENGTH_BUCKET_SAMPLER_H
+#include <vector>
+
+#include <torch/data/samplers/base.h>
+#include <torch/serialize/archive.h>
+#include <torch/types.h>
+
+// Batch sampler that groups examples of similar token length, so that
+// collated (and trimmed) batches carry little padding.
+// With shuffling, on every reset the indices are shuffled and split into
+// buckets of `batchSize * bucketSize` examples, each bucket is sorted by
+// length and cut into batches, and the order of all batches is shuffled.
+// Without shuffling, the whole dataset is sorted by length.
+// The batch size given to `next` is ignored, batches are formed on reset
+class LengthBucketSampler : public torch::data::samplers::Sampler<> {
+  public:
+    LengthBucketSampler(std::vector<long> lengths,
+                        size_t batchSize,
+                        size_t bucketSize,
+                        bool shuffle);
+
+    void reset(torch::optional<size_t> newSize = torch::nullopt) override;
+    torch::optional<std::vector<size_t>> next(size_t batchSize) override;
+    void save(torch::serialize::OutputArchive& archive) const override;
+    void load(torch::serialize::InputArchive& archive) override;
+  private:
+    std::vector<long> lengths;  // Number of non-padding tokens per example
+    size_t batchSize;
+    size_t bucketSize;  // Number of batches per bucket
+    bool shuffle;
+    std::vector<std::vector<size_t>> batches;
+    size_t batchIndex = 0;
+};
+#endif
@@ -0,0 +1,196 @@
+#include "streaming_dataset.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "config.h"
+#include "runtime/scheduler.h"
+
+TextChunkReader::TextChunkReader(const std::string& modelDir,
+                                 const std::vector<Task>& tasks,
+                                 const std::string& subset,
+                                 long maxLength)
+  : state (std::make_shared<State>()) {
+  state->vocabFname = getVocabFname(modelDir);
+  state->lowercaseFname = modelDir + "/lowercase";
+  state->maxLength = maxLength;
+  std::string baseFname = tasks[0].baseDir + "/" + subset + "-";
+  state->fnames.push_back(baseFname + "texts");
+  for (const auto& task : tasks) {
+    state->fnames.push_back(baseFname + task.name);
+    state->taskTypes.push_back(task.taskType);
+  }
+  state->labelCounts.resize(tasks.size());
+  state->numLabels.assign(tasks.size(), 0);
+
+  std::vector<std::ifstream> files;
+  for (const auto& fname : state->fnames) {
+    files.emplace_back(fname);
+    if (!files.back().is_open()) throw std::runtime_error(fname + " not found!");
+  }
+
+  // Record where each chunk starts and count its labels
+  std::vector<std::string> lines;
+  std::string line;
+  while (true) {
+    std::vector<long> chunkOffsets;
+    for (auto& file : files) chunkOffsets.push_back(file.tellg());
+    long numLines = 0;
+    while ((numLines < STREAM_CHUNK_LINES) && std::getline(files[0], line)) numLines++;
+    if (numLines == 0) break;
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+      lines.clear();
+      while ((static_cast<long>(lines.size()) < numLines) && std::getline(files[i + 1], line)) {
+        lines.push_back(line);
+      }
+      if (static_cast<long>(lines.size()) != numLines) {
+        throw std::runtime_error(state->fnames[i + 1] + " has fewer lines than "
+                                 + state->fnames[0]);
+      }
+      torch::Tensor labels = labelLinesToTensor(lines, state->taskTypes[i], maxLength);
+      state->numLabels[i] += (labels != CLASSIFICATION_IGNORE_INDEX).sum().item<long>();
+
+      torch::Tensor& counts = state->labelCounts[i];
+      torch::Tensor chunkCounts;
+      if ((Binary & state->taskTypes[i]) == Binary) {
+        // One column per label of multi-label tasks, else all labels together
+        bool columns = ((MultiLabel & state->taskTypes[i]) == MultiLabel)
+                       && ((TokenLevel & state->taskTypes[i]) != TokenLevel);
+        torch::Tensor values = columns ? labels : labels.reshape({-1, 1});
+        chunkCounts = torch::stack({(values == 0).sum(0), (values == 1).sum(0)})
+          .to(torch::kFloat);
+      } else {
+        torch::Tensor classes = labels.masked_select(labels >= 0).to(torch::kLong);
+        chunkCounts = torch::bincount(classes, {}, counts.defined() ? counts.size(0) : 0)
+          .to(torch::kFloat);
+        if (counts.defined() && (counts.size(0) < chunkCounts.size(0))) {
+          counts = torch::constant_pad_nd(counts, {0, chunkCounts.size(0) - counts.size(0)});
+        }
+      }
+      counts = counts.defined() ? counts + chunkCounts : chunkCounts;
+    }
+    state->offsets.push_back(chunkOffsets);
+    state->numExamples += numLines;
+  }
+}
+
+std::unique_ptr<LineEncoder> TextChunkReader::takeEncoder() const {
+  {
+    std::lock_guard<std::mutex> lock(state->encodersMutex);
+    if (!state->encoders.empty()) {
+      std::unique_ptr<LineEncoder> encoder = std::move(state->encoders.back());
+      state->encoders.pop_back();
+      return encoder;
+    }
+  }
+  return std::unique_ptr<LineEncoder>(
+    new LineEncoder(state->vocabFname, state->lowercaseFname, state->maxLength));
+}
+
+void TextChunkReader::returnEncoder(std::unique_ptr<LineEncoder> encoder) const {
+  std::lock_guard<std::mutex> lock(state->encodersMutex);
+  state->encoders.push_back(std::move(encoder));
+}
+
+TextChunkReader::ChunkType TextChunkReader::read_chunk(size_t chunkIndex) {
+  // Every chunk but the last is full
+  long firstLine = static_cast<long>(chunkIndex) * STREAM_CHUNK_LINES;
+  long numLines = std::min<long>(STREAM_CHUNK_LINES, state->numExamples - firstLine);
+  std::vector<std::vector<std::string>> fileLines(state->fnames.size());
+  {
+    LoaderScope loaderScope;
+    for (size_t f = 0; f < state->fnames.size(); f++) {
+      std::ifstream file(state->fnames[f]);
+      if (!file.is_open()) throw std::runtime_error(state->fnames[f] + " not found!");
+      file.seekg(state->offsets[chunkIndex][f]);
+      std::string line;
+      while ((static_cast<long>(fileLines[f].size()) < numLines) && std::getline(file, line)) {
+        fileLines[f].push_back(line);
+      }
+      if (static_cast<long>(fileLines[f].size()) != numLines) {
+        throw std::runtime_error(state->fnames[f] + " changed while reading it");
+      }
+    }
+  }
+
+  // Texts, in one contiguous range of lines per tokenizer worker
+  const std::vector<std::string>& lines = fileLines[0];
+  torch::Tensor texts = torch::empty({numLines, state->maxLength}, torch::kInt64);
+  auto encode = [&](int worker, long begin, long end) {
+    if (begin == end) return;
+    std::unique_ptr<LineEncoder> encoder = takeEncoder();
+    texts.slice(0, begin, end).copy_(encoder->encode(
+      std::vector<std::string>(lines.begin() + begin, lines.begin() + end)));
+    returnEncoder(std::move(encoder));
+  };
+  // Time on the tokenizer pool is counted as its busy time, not the loader's
+  ThreadPool* pool = getTokenizerPool();
+  if (pool != nullptr) {
+    pool->parallelFor(numLines, encode);
+  } else {
+    LoaderScope loaderScope;
+    encode(0, 0, numLines);
+  }
+
+  LoaderScope loaderScope;
+  std::vector<torch::Tensor> labels;
+  for (size_t i = 0; i < state->taskTypes.size(); i++) {
+    labels.push_back(labelLinesToTensor(fileLines[i + 1], state->taskTypes[i],
+                                        state->maxLength));
+  }
+
+  ChunkType examples;
+  examples.reserve(numLines);
+  for (long i = 0; i < numLines; i++) {
+    std::vector<torch::Tensor> target;
+    for (const auto& taskLabels : labels) target.push_back(taskLabels[i]);
+    examples.push_back({texts[i], target});
+  }
+  return examples;
+}
+
+size_t TextChunkReader::chunk_count() {
+  return state->offsets.size();
+}
+
+void TextChunkReader::reset() {}
+
+long TextChunkReader::getNumExamples() const {
+  return state->numExamples;
+}
+
+std::vector<torch::Tensor> TextChunkReader::getClassWeights(const std::vector<Task>& tasks,
+                                                            const torch::Device& device) const {
+  std::vector<torch::Tensor> out;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    const torch::Tensor& counts = state->labelCounts[i];
+    if ((Binary & tasks[i].taskType) == Binary) {
+      // Binary task - weight is given by num_negative/num_positive
+      out.push_back((counts[0] / counts[1]).to(device));
+    } else {
+      if ((MultiLabel & tasks[i].taskType) == MultiLabel) {
+        throw std::runtime_error("Multi-label multi-class tasks not supported");
+      }
+      // Weight is given by num_samples / (num_classes * num_classX)
+      float numSamples = state->numLabels[i];
+      out.push_back((numSamples / (counts.size(0) * counts)).to(device));
+    }
+  }
+  return out;
+}
+
+StreamingDatasetType getStreamingDataset(const TextChunkReader& reader,
+                                         const std::vector<Task>& tasks,
+                                         long batchSize) {
+  torch::data::datasets::ChunkDatasetOptions options(
+    STREAM_PRELOADERS, batchSize, std::max<long>(STREAM_BUFFER_EXAMPLES, batchSize),
+    STREAM_SHUFFLE_CHUNKS);
+  return torch::data::datasets::make_shared_dataset<StreamingDataset>(
+      reader,
+      torch::data::samplers::RandomSampler(0),
+      torch::data::samplers::RandomSampler(0),
+      options)
+    .map(MultiTaskStack(tasks));
+}
@@ -0,0 +1,88 @@
+#ifndef STREAMING_DATASET_H
+#define STREAMING_DATASET_H
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <torch/data.h>
+#include <torch/types.h>
+
+#include "data_utils.h"
+#include "text_dataset.h"
+#include "train/task.h"
+
+// Reads a split in chunks of STREAM_CHUNK_LINES lines for a ChunkDataset:
+// the texts, tokenized on the tokenizer pool (if any), and the labels of
+// each task. Only the byte offsets of the chunks are kept in memory, found
+// with one pass over the files that also counts the labels for the class
+// weights. Copies share their state, so a copy can be handed to the dataset
+class TextChunkReader
+  : public torch::data::datasets::ChunkDataReader<MultiTaskExample> {
+    public:
+        using BatchType = ChunkType;
+
+        // The files are read from [tasks.baseDir]/{texts,[task.name]}-[subset]
+        // and padded or truncated to maxLength, as for TextDataset
+        TextChunkReader(const std::string& modelDir,
+                        const std::vector<Task>& tasks,
+                        const std::string& subset,
+                        long maxLength);
+
+        ChunkType read_chunk(size_t chunkIndex) override;
+        size_t chunk_count() override;
+        void reset() override;
+
+        long getNumExamples() const;
+
+        // As TextDataset::getClassWeights, from the counted labels
+        std::vector<torch::Tensor> getClassWeights(const std::vector<Task>& tasks,
+                                                   const torch::Device& device) const;
+    private:
+        struct State {
+            std::string vocabFname, lowercaseFname;
+            long maxLength;
+            // The texts, then the labels of each task
+            std::vector<std::string> fnames;
+            std::vector<int> taskTypes;
+            // Byte offset of each chunk in each file
+            std::vector<std::vector<long>> offsets;
+            long numExamples = 0;
+            // Binary tasks: the number of 0 and 1 labels of each column,
+            // shape: (2, NUM_COLUMNS). Multiclass tasks: the number of
+            // labels of each class, shape: (NUM_CLASSES)
+            std::vector<torch::Tensor> labelCounts;
+            // Non-ignored labels of each task
+            std::vector<long> numLabels;
+            // Idle line encoders, one is taken for each tokenized range
+            std::mutex encodersMutex;
+            std::vector<std::unique_ptr<LineEncoder>> encoders;
+        };
+        std::shared_ptr<State> state;
+
+        std::unique_ptr<LineEncoder> takeEncoder() const;
+        void returnEncoder(std::unique_ptr<LineEncoder> encoder) const;
+};
+
+// Chunks are read in a random order by STREAM_PRELOADERS threads, the
+// examples of STREAM_SHUFFLE_CHUNKS chunks at a time are shuffled together,
+// and at most STREAM_BUFFER_EXAMPLES examples wait for the model
+using StreamingDataset = torch::data::datasets::ChunkDataset<
+  TextChunkReader,
+  torch::data::samplers::RandomSampler,
+  torch::data::samplers::RandomSampler>;
+
+using StreamingDatasetType = torch::data::datasets::MapDataset<
+  torch::data::datasets::SharedBatchDataset<StreamingDataset>, MultiTaskStack>;
+
+using StreamingDataLoaderType = std::unique_ptr<
+  torch::data::StatefulDataLoader<StreamingDatasetType>>;
+
+// Initialize a streaming dataset over the split of a reader, giving
+// batches of batchSize examples mapped in a MultiTaskStack. The data loader
+// must ask for the same batch size
+StreamingDatasetType getStreamingDataset(const TextChunkReader& reader,
+                                         const std::vector<Task>& tasks,
+                                         long batchSize);
+
+#endif
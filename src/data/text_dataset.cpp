@@ -1,14 +1,33 @@
 #include "text_dataset.h"
 
+#include <algorithm>
+
 #include "config.h"
 #include "data_utils.h"
 
 
 TextDataset::TextDataset(const std::string& modelDir,
                          const std::vector<Task>& tasks,
-                         const std::string& subset)
-  : texts (readTextsToTensor(modelDir, tasks, subset)),
-    labels (readLabelsToTensor(tasks, subset)) {}
+                         const std::string& subset,
+                         long maxLength,
+                         long windowStride) {
+  if (windowStride <= 0) {
+    texts = readTextsToTensor(modelDir, tasks, subset, maxLength);
+    labels = readLabelsToTensor(tasks, subset, maxLength);
+    return;
+  }
+  windows = readTextsToWindows(modelDir, tasks, subset, maxLength, windowStride);
+  texts = windows.ids;
+  // Token-level labels of the whole texts, with [CLS] and [SEP]
+  long longest = 0;
+  for (long length : windows.documentLengths) longest = std::max(longest, length);
+  documentLabels = readLabelsToTensor(tasks, subset, std::max(longest + 2, maxLength));
+  for (size_t i = 0; i < tasks.size(); i++) {
+    labels.push_back(getWindowLabels(documentLabels[i], windows,
+                                     (TokenLevel & tasks[i].taskType) == TokenLevel,
+                                     maxLength));
+  }
+}
 
 MultiTaskExample TextDataset::get(size_t index) {
   // Since we have multiple labels, they are collected in a vector
@@ -19,6 +38,11 @@ MultiTaskExample TextDataset::get(size_t index) {
 	return {texts[index], labelsOut};
 }
 
+std::vector<MultiTaskExample> TextDataset::get_batch(torch::ArrayRef<size_t> indices) {
+  LoaderScope loaderScope;
+  return torch::data::Dataset<TextDataset, MultiTaskExample>::get_batch(indices);
+}
+
 torch::optional<size_t> TextDataset::size() const {
 	return texts.size(0);
 }
@@ -31,7 +55,14 @@ std::vector<torch::IntArrayRef> TextDataset::getLabelSizes() const {
   return labelSizes;
 }
 
-std::vector<torch::Tensor> TextDataset::getClassWeights(const std::vector<Task>& tasks) const {
+std::vector<long> TextDataset::getLengths() const {
+  torch::Tensor lengths = (texts != PADDING_IDX).sum(1).contiguous();
+  const long* data = lengths.data_ptr<long>();
+  return std::vector<long>(data, data + lengths.size(0));
+}
+
+std::vector<torch::Tensor> TextDataset::getClassWeights(const std::vector<Task>& tasks,
+                                                        const torch::Device& device) const {
   std::vector<torch::Tensor> out;
   using namespace torch::indexing;
   for (size_t i = 0; i < tasks.size(); i++) {
@@ -47,11 +78,11 @@ std::vector<torch::Tensor> TextDataset::getClassWeights(const std::vector<Task>&
               (labels[i].index({Ellipsis, j}) == 0).sum().to(torch::kFloat);
           weights[j] = neg/pos;
         }
-        out.push_back(weights.cuda());
+        out.push_back(weights.to(device));
       } else {
         torch::Tensor pos = (labels[i] == 1).sum().to(torch::kFloat);
         torch::Tensor neg = (labels[i] == 0).sum().to(torch::kFloat);
-        out.push_back((neg/pos).cuda().unsqueeze(0));
+        out.push_back((neg/pos).to(device).unsqueeze(0));
       }
     } else {
       // Multiclass task.
@@ -73,14 +104,29 @@ std::vector<torch::Tensor> TextDataset::getClassWeights(const std::vector<Task>&
       for (long j = 0; j < numClasses.item<long>(); j++) {
         weights[j] = numSamples / (numClasses * (labels[i] == j).sum());
       }
-      out.push_back(weights.cuda());
+      out.push_back(weights.to(device));
     }
   }
   return out;
 }
 
+const TextWindows& TextDataset::getWindows() const {
+  return windows;
+}
+
+const std::vector<torch::Tensor>& TextDataset::getLabels() const {
+  return labels;
+}
+
+const std::vector<torch::Tensor>& TextDataset::getDocumentLabels() const {
+  return documentLabels;
+}
+
 TextDatasetType getDataset(const std::string& modelDir,
                            const std::vector<Task>& tasks,
-                           const std::string& subset) {
-  return TextDataset(modelDir, tasks, subset).map(MultiTaskStack());
+                           const std::string& subset,
+                           long maxLength,
+                           long windowStride) {
+  return TextDataset(modelDir, tasks, subset, maxLength, windowStride)
+    .map(MultiTaskStack(tasks));
 }
@@ -5,14 +5,28 @@
 #include <torch/types.h>
 #include <torch/data.h>
 
+#include "config.h"
+#include "length_bucket_sampler.h"
+#include "runtime/scheduler.h"
+#include "text_windows.h"
 #include "train/task.h"
 
 // torch::data::Example for multiple targets
 using MultiTaskExample = torch::data::Example<torch::Tensor, std::vector<torch::Tensor>>;
 
-// Collate a vector of MultiTaskExample(s) to tensors
+// Collate a vector of MultiTaskExample(s) to tensors.
+// The batch is trimmed to its longest non-padding row, along with the
+// targets of token-level tasks
 struct MultiTaskStack : public torch::data::transforms::Collation<MultiTaskExample> {
+  MultiTaskStack() {}
+  explicit MultiTaskStack(const std::vector<Task>& tasks) {
+    for (const auto& task : tasks) {
+      tokenLevel.push_back((TokenLevel & task.taskType) == TokenLevel);
+    }
+  }
+
   MultiTaskExample apply_batch(std::vector<MultiTaskExample> examples) override {
+    LoaderScope loaderScope;
     std::vector<torch::Tensor> data;
     std::vector<std::vector<torch::Tensor>> targets;
     std::vector<torch::Tensor> targetsStacked;
@@ -28,11 +42,22 @@ struct MultiTaskStack : public torch::data::transforms::Collation<MultiTaskExamp
       }
     }
 
-    for (auto it = targets.begin(); it != targets.end(); it++) {
-      targetsStacked.push_back(torch::stack(*it));
+    torch::Tensor dataStacked = torch::stack(data);
+    // Sequences are padded at the end, so the longest row gives the number
+    // of columns that hold any non-padding token
+    long length = (dataStacked != PADDING_IDX).sum(1).max().item<long>();
+    dataStacked = dataStacked.slice(1, 0, length);
+
+    for (size_t i = 0; i < targets.size(); i++) {
+      targetsStacked.push_back(torch::stack(targets[i]));
+      if (i < tokenLevel.size() && tokenLevel[i]) {
+        targetsStacked.back() = targetsStacked.back().slice(1, 0, length);
+      }
     }
-    return {torch::stack(data), targetsStacked};
+    return {dataStacked, targetsStacked};
   }
+
+  std::vector<bool> tokenLevel;  // Whether each target is token-level
 };
 
 // torch::data::Dataset implementation for text inputs and multiple targets
@@ -40,29 +65,50 @@ class TextDataset : public torch::data::Dataset<TextDataset, MultiTaskExample> {
     public:
         // Initialize dataset.
         // The files are read from [tasks.baseDir]/{texts,[task.name]}-[subset]
+        // and padded or truncated to maxLength. With a windowStride, each
+        // example is a window of a text instead, see TextWindows
         explicit TextDataset(const std::string& modelDir,
                              const std::vector<Task>& tasks,
-                             const std::string& subset);
+                             const std::string& subset,
+                             long maxLength,
+                             long windowStride = 0);
 			  MultiTaskExample get(size_t index) override;
+        // As the default, but accounted to the data loader pool, see LoaderScope
+        std::vector<MultiTaskExample> get_batch(torch::ArrayRef<size_t> indices) override;
 			  torch::optional<size_t> size() const override;
 
         // Get the tensor.sizes() of all labels
         std::vector<torch::IntArrayRef> getLabelSizes() const;
 
-        // Get the class weights for imbalanced classes loss weighting
-        std::vector<torch::Tensor> getClassWeights(const std::vector<Task>& tasks) const;
+        // Get the number of non-padding tokens of each text
+        std::vector<long> getLengths() const;
+
+        // Get the class weights for imbalanced classes loss weighting,
+        // placed on `device`
+        std::vector<torch::Tensor> getClassWeights(const std::vector<Task>& tasks,
+                                                   const torch::Device& device) const;
+
+        // The windows of the texts and the labels of each window, and the
+        // labels of the whole texts. Only with a windowStride
+        const TextWindows& getWindows() const;
+        const std::vector<torch::Tensor>& getLabels() const;
+        const std::vector<torch::Tensor>& getDocumentLabels() const;
     private:
         torch::Tensor texts;
         std::vector<torch::Tensor> labels;
+        TextWindows windows;
+        std::vector<torch::Tensor> documentLabels;
 };
 
 using TextDatasetType = torch::data::datasets::MapDataset<TextDataset,MultiTaskStack>;
 
-using TextDataLoaderType = torch::disable_if_t<false,std::unique_ptr<torch::data::StatelessDataLoader<torch::data::datasets::MapDataset<TextDataset,MultiTaskStack>,torch::data::samplers::RandomSampler>,std::default_delete<torch::data::StatelessDataLoader<torch::data::datasets::MapDataset<TextDataset,MultiTaskStack>,torch::data::samplers::RandomSampler>>>>;
+using TextDataLoaderType = std::unique_ptr<torch::data::StatelessDataLoader<TextDatasetType,LengthBucketSampler>>;
 
 // Initialize a text dataset and maps it in a MultiTaskTask
 TextDatasetType getDataset(const std::string& modelDir,
                            const std::vector<Task>& tasks,
-                           const std::string& subset);
+                           const std::string& subset,
+                           long maxLength,
+                           long windowStride = 0);
 
 #endif
@@ -0,0 +1,109 @@
+#include "text_windows.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "config.h"
+
+TextWindows splitIntoWindows(const std::vector<std::vector<long>>& ids,
+                             long sosId, long eosId, long maxLength, long stride) {
+  long windowLength = maxLength - 2;
+  if ((stride <= 0) || (stride > windowLength)) {
+    throw std::runtime_error("Window stride should be between 1 and "
+                             + std::to_string(windowLength));
+  }
+  TextWindows windows;
+  for (size_t i = 0; i < ids.size(); i++) {
+    long length = ids[i].size();
+    windows.documentLengths.push_back(length);
+    for (long start = 0; ; start += stride) {
+      windows.documents.push_back(i);
+      windows.offsets.push_back(start);
+      if (start + windowLength >= length) break;
+    }
+  }
+
+  long numWindows = windows.documents.size();
+  windows.ids = torch::full({numWindows, maxLength}, PADDING_IDX, torch::kInt64);
+  long* data = windows.ids.data_ptr<long>();
+  for (long w = 0; w < numWindows; w++) {
+    const std::vector<long>& document = ids[windows.documents[w]];
+    long start = windows.offsets[w];
+    long end = std::min(static_cast<long>(document.size()), start + windowLength);
+    long* row = data + w * maxLength;
+    *row++ = sosId;
+    row = std::copy(document.begin() + start, document.begin() + end, row);
+    *row = eosId;
+  }
+  return windows;
+}
+
+torch::Tensor getWindowLabels(const torch::Tensor& labels, const TextWindows& windows,
+                              bool tokenLevel, long maxLength) {
+  torch::Tensor documents = torch::tensor(windows.documents, torch::kInt64);
+  if (!tokenLevel) return labels.index_select(0, documents);
+
+  using torch::indexing::Slice;
+  long numWindows = windows.documents.size();
+  torch::Tensor windowLabels = torch::full({numWindows, maxLength},
+                                           CLASSIFICATION_IGNORE_INDEX, labels.options());
+  for (long w = 0; w < numWindows; w++) {
+    long document = windows.documents[w], start = windows.offsets[w];
+    long length = std::min(windows.documentLengths[document] - start, maxLength - 2);
+    // Column 0 is [CLS] in both
+    windowLabels.index_put_({w, Slice(1, 1 + length)},
+                            labels.index({document, Slice(1 + start, 1 + start + length)}));
+  }
+  return windowLabels;
+}
+
+std::vector<torch::Tensor> mergeWindows(const std::vector<torch::Tensor>& outputs,
+                                        const TextWindows& windows,
+                                        bool tokenLevel,
+                                        const std::string& aggregation) {
+  using torch::indexing::Slice;
+  long numDocuments = windows.documentLengths.size();
+  std::vector<std::vector<long>> documentWindows(numDocuments);
+  for (size_t w = 0; w < windows.documents.size(); w++) {
+    documentWindows[windows.documents[w]].push_back(w);
+  }
+
+  std::vector<torch::Tensor> merged(numDocuments);
+  for (long i = 0; i < numDocuments; i++) {
+    const std::vector<long>& ws = documentWindows[i];
+    if (!tokenLevel) {
+      std::vector<torch::Tensor> documentOutputs;
+      for (long w : ws) documentOutputs.push_back(outputs[w]);
+      torch::Tensor stacked = torch::stack(documentOutputs);
+      merged[i] = (aggregation == "max") ? std::get<0>(stacked.max(0)) : stacked.mean(0);
+      continue;
+    }
+
+    // [CLS] from the first window, [SEP] from the last
+    long length = windows.documentLengths[i];
+    torch::Tensor first = outputs[ws.front()], last = outputs[ws.back()];
+    std::vector<long> shape = first.sizes().vec();
+    shape[0] = length + 2;
+    merged[i] = torch::empty(shape, first.options());
+    merged[i][0] = first[0];
+    merged[i][length + 1] = last[last.size(0) - 1];
+
+    // Token range [starts[k], ends[k]) of each window of the document
+    std::vector<long> starts, ends;
+    for (long w : ws) {
+      starts.push_back(windows.offsets[w]);
+      ends.push_back(windows.offsets[w] + outputs[w].size(0) - 2);
+    }
+    // A token in two windows goes to the one where it is farther from an
+    // edge. Windows start in order, so each overlap is split at its middle
+    for (size_t k = 0; k < ws.size(); k++) {
+      long from = (k == 0) ? starts[k] : (starts[k] + ends[k - 1] + 1) / 2;
+      long to = (k + 1 == ws.size()) ? ends[k] : (starts[k + 1] + ends[k] + 1) / 2;
+      if (from >= to) continue;
+      merged[i].index_put_({Slice(1 + from, 1 + to)},
+                           outputs[ws[k]].index({Slice(1 + from - starts[k],
+                                                       1 + to - starts[k])}));
+    }
+  }
+  return merged;
+}
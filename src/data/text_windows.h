@@ -0,0 +1,38 @@
+#ifndef TEXT_WINDOWS_H
+#define TEXT_WINDOWS_H
+#include <string>
+#include <vector>
+
+#include <torch/types.h>
+
+// Documents longer than the sequence limit, split into overlapping windows
+// of at most maxLength tokens ([CLS] and [SEP] included) that start
+// `stride` tokens apart. Each token is in at most ceil(maxLength / stride)
+// windows, so the cost per document grows linearly with its length
+struct TextWindows {
+  torch::Tensor ids;  // shape: (NUM_WINDOWS, maxLength)
+  std::vector<long> documents;  // Document of each window
+  std::vector<long> offsets;  // Position of the first token of each window in its document
+  std::vector<long> documentLengths;  // Tokens of each document, without [CLS] and [SEP]
+};
+
+// Split tokenized documents (without special tokens) into windows
+TextWindows splitIntoWindows(const std::vector<std::vector<long>>& ids,
+                             long sosId, long eosId, long maxLength, long stride);
+
+// Labels of each window from those of the documents. Token-level labels
+// should have a column for every token of the longest document, plus
+// [CLS] and [SEP] (see readLabelsToTensor)
+torch::Tensor getWindowLabels(const torch::Tensor& labels, const TextWindows& windows,
+                              bool tokenLevel, long maxLength);
+
+// Merge the outputs of the windows of each document.
+// Sentence-level outputs are averaged (`mean`) or take their maximum
+// (`max`) over the windows. Token-level outputs, with a row for [CLS], the
+// tokens of the window and [SEP], are stitched: each token takes the outputs
+// of the window where it has the most context on both sides
+std::vector<torch::Tensor> mergeWindows(const std::vector<torch::Tensor>& outputs,
+                                        const TextWindows& windows,
+                                        bool tokenLevel,
+                                        const std::string& aggregation);
+#endif
@@ -0,0 +1,4 @@
+#ifndef DISTILL_H
+#define DISTILL_H
+#include "distill/distill.h"
+#endif
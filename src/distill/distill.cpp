@@ -0,0 +1,243 @@
+#include "distill.h"
+
+#include <algorithm>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "data.h"
+#include "distill_utils.h"
+#include "predict.h"
+#include "runtime.h"
+#include "state.h"
+#include "train/task.h"
+
+namespace distill {
+
+void printHelp(const std::string &programName) {
+  std::cout << "Usage: " << programName << " [OPTIONS] TEACHER" << std::endl;
+  std::cout << "\
+Distill a fine-tuned BERT model (TEACHER, as saved by `train --save-model`)\n\
+into a smaller student on the same tasks and data. The student learns the\n\
+teacher's soft logits, and optionally its hidden states, and is saved in the\n\
+format of `train`, so `predict` runs it directly.\n\n\
+Model and data selection:\n\
+  -M, --model-dir           Extracted model directory the teacher was\n\
+                              fine-tuned from, for its vocabulary\n\
+  -D, --data-dir            Base data directory, as used by `train`\n\
+  -S, --save-model          Base filename for the student\n\n\
+Task selection:\n\
+  -t  --task                Task name, as used by `train`\n\
+  -m  --metric              Add a metric for the specified task.\n\
+                              Choose from: {accuracy,f1,matthewscc}\n\
+                              Default: accuracy\n\
+  -l  --loss-multiplier     Multiplier for task loss\n\
+                              Default: 0.1\n\n\
+Student (sizes default to the teacher's):\n\
+  -N, --num-layers          Number of encoder layers\n\
+                              Default: half of the teacher's\n\
+  -H, --hidden-size         Hidden size. Also scales the number of heads and\n\
+                              the intermediate size, unless given\n\
+  -A, --num-heads           Number of attention heads\n\
+  -I, --intermediate-size   Intermediate (feed-forward) size\n\n\
+Distillation:\n\
+  -T, --temperature         Softmax temperature of the soft logits\n\
+                              Default: 2\n\
+  -K, --soft-weight         Weight of the soft-logit loss; the loss on the\n\
+                              labels gets one minus it\n\
+                              Default: 0.5\n\
+  -W, --hidden-weight       Weight of the mean squared error between the\n\
+                              hidden states of every student layer and of the\n\
+                              matching teacher layer\n\
+                              Default: 0 (disabled)\n\n\
+Training parameters:\n\
+  -b, --batch-size\n\
+  -e, --num-epochs\n\
+  -a, --lr\n\
+  -s, --seed\n\
+  -L, --max-sequence-length Pad/truncate input sequences to that many tokens\n\
+                              Default: 100\n\
+  -d, --device              Device to train on, e.g. `cpu`, `cuda`, `cuda:1`\n\
+                              Default: `cuda` if available, else `cpu`\n\
+  -j, --num-threads         Number of intra-op threads for tensor operations\n\
+                              Default: 0 (libtorch default)\n\
+";
+}
+
+int main(int argc, char *argv[]) {
+  int c, opt = 0;
+  int batchSize = DEFAULT_BATCH_SIZE,
+      numEpochs = DEFAULT_NUM_EPOCHS,
+      seed = 42,
+      maxSequenceLength = DEFAULT_MAX_SEQUENCE_LENGTH,
+      numThreads = DEFAULT_NUM_THREADS;
+  float lr = DEFAULT_LR;
+  int numLayers = 0, hiddenSize = 0, numHeads = 0, intermediateSize = 0;
+  float temperature = 2.0f, softWeight = 0.5f, hiddenWeight = 0.0f;
+  std::string modelDir = "", dataDir = "", saveModel = "", deviceName = "";
+  std::vector<Task> tasks;
+
+	static struct option options[] = {
+			{"model-dir",             required_argument, NULL,  'M' },
+			{"data-dir",              required_argument, NULL,  'D' },
+			{"save-model",            required_argument, NULL,  'S' },
+			{"task",                  required_argument, NULL,  't' },
+			{"metric",                required_argument, NULL,  'm' },
+			{"loss-multiplier",       required_argument, NULL,  'l' },
+			{"num-layers",            required_argument, NULL,  'N' },
+			{"hidden-size",           required_argument, NULL,  'H' },
+			{"num-heads",             required_argument, NULL,  'A' },
+			{"intermediate-size",     required_argument, NULL,  'I' },
+			{"temperature",           required_argument, NULL,  'T' },
+			{"soft-weight",           required_argument, NULL,  'K' },
+			{"hidden-weight",         required_argument, NULL,  'W' },
+			{"batch-size",            required_argument, NULL,  'b' },
+			{"num-epochs",            required_argument, NULL,  'e' },
+			{"lr",                    required_argument, NULL,  'a' },
+			{"seed",                  required_argument, NULL,  's' },
+			{"max-sequence-length",   required_argument, NULL,  'L' },
+			{"device",                required_argument, NULL,  'd' },
+			{"num-threads",           required_argument, NULL,  'j' },
+			{"help",                  no_argument,       NULL,  'h' },
+			{NULL,                    0,                 NULL,   0  }
+	};
+
+	while ((c = getopt_long(argc, argv, ":M:D:S:t:m:l:N:H:A:I:T:K:W:b:e:a:s:L:d:j:h",
+                          options, &opt)) != -1) {
+    switch (c) {
+      case 'M':
+        modelDir = optarg;
+        break;
+      case 'D':
+        dataDir = optarg;
+        break;
+      case 'S':
+        saveModel = optarg;
+        break;
+      case 't':
+        tasks.push_back(Task());
+        tasks.back().name = optarg;
+        break;
+      case 'm':
+        if (tasks.empty()) {
+          printf("Task not specified, cannot add metric `%s`\n", optarg);
+          return 1;
+        }
+        tasks.back().addMetric(optarg);
+        break;
+      case 'l':
+        if (tasks.empty()) {
+          printf("Task not specified, cannot set loss multiplier `%s`", optarg);
+          return 1;
+        }
+        tasks.back().lossMultiplier = std::stof(optarg);
+        break;
+      case 'N':
+        numLayers = std::stoi(optarg);
+        break;
+      case 'H':
+        hiddenSize = std::stoi(optarg);
+        break;
+      case 'A':
+        numHeads = std::stoi(optarg);
+        break;
+      case 'I':
+        intermediateSize = std::stoi(optarg);
+        break;
+      case 'T':
+        temperature = std::stof(optarg);
+        break;
+      case 'K':
+        softWeight = std::stof(optarg);
+        break;
+      case 'W':
+        hiddenWeight = std::stof(optarg);
+        break;
+      case 'b':
+        batchSize = std::stoi(optarg);
+        if (batchSize <= 0) {
+          printHelp(argv[0]);
+          printf("Invalid batch size `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'e':
+        numEpochs = std::stoi(optarg);
+        break;
+      case 'a':
+        lr = std::stof(optarg);
+        break;
+      case 's':
+        seed = std::stoi(optarg);
+        break;
+      case 'L':
+        maxSequenceLength = std::stoi(optarg);
+        if (maxSequenceLength < 2) {
+          printHelp(argv[0]);
+          printf("Invalid maximum sequence length `%s`, [CLS] and [SEP] need 2\n", optarg);
+          return 1;
+        }
+        break;
+      case 'd':
+        deviceName = optarg;
+        break;
+      case 'j':
+        numThreads = std::stoi(optarg);
+        break;
+      case 'h':
+        printHelp(argv[0]);
+        return 1;
+      case '?':
+        printHelp(argv[0]);
+        printf("Invalid argument -%c\n", optopt);
+        return 1;
+      case ':':
+        printHelp(argv[0]);
+        printf("Missing option for %c\n", optopt);
+        return 1;
+      default:
+        printf("?? getopt returned character code 0%o ??\n", c);
+        return 1;
+    }
+  }
+
+  if ((argc - optind != 1) || modelDir.empty() || dataDir.empty() || tasks.empty()) {
+    printHelp(argv[0]);
+    return 1;
+  }
+  if ((softWeight < 0.0f) || (softWeight > 1.0f) || (temperature <= 0.0f)) {
+    std::cout << "Error: the soft weight should be in [0, 1] and the temperature positive"
+              << std::endl;
+    return 1;
+  }
+  std::string teacherFname = argv[optind];
+  if (predict::isQuantizedModel(teacherFname)) {
+    std::cerr << "Error: distill from the float model, then quantize the student" << std::endl;
+    return 1;
+  }
+
+  if (tasks.size() == 1) tasks[0].lossMultiplier = 1.0f;
+  for (auto& task : tasks) {
+    task.baseDir = dataDir;
+    if (task.metrics.empty()) task.addMetric("accuracy");
+    detectTaskType(task);
+  }
+
+  Config teacherConfig;
+  readStruct(teacherConfig, teacherFname + "-bert.config");
+  if (numLayers <= 0) numLayers = std::max(1, teacherConfig.numHiddenLayers / 2);
+  Config studentConfig = getStudentConfig(teacherConfig, numLayers, hiddenSize,
+                                          numHeads, intermediateSize);
+
+  setNumThreads(numThreads, DEFAULT_NUM_INTEROP_THREADS);
+  torch::Device device = getDevice(deviceName);
+  printRuntimeInfo(device);
+
+  runDistillation(teacherFname, modelDir, tasks, studentConfig, batchSize, numEpochs,
+                  lr, saveModel, seed, maxSequenceLength, temperature, softWeight,
+                  hiddenWeight, device);
+  return 0;
+}
+}
@@ -0,0 +1,9 @@
+#ifndef DISTILL_DISTILL_H
+#define DISTILL_DISTILL_H
+#include <string>
+
+namespace distill {
+void printHelp(const std::string &programName);
+int main(int argc, char *argv[]);
+}
+#endif
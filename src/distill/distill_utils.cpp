@@ -0,0 +1,373 @@
+#include "distill_utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <torch/nn/modules/container/modulelist.h>
+#include <torch/nn/modules/linear.h>
+#include <torch/nn/utils.h>
+#include <torch/optim.h>
+#include <torch/serialize.h>
+
+#include "data.h"
+#include "model.h"
+#include "predict.h"
+#include "state.h"
+#include "train/train_loop.h"
+#include "train/train_utils.h"
+
+Config getStudentConfig(const Config& teacher,
+                        int numLayers, int hiddenSize,
+                        int numAttentionHeads, int intermediateSize) {
+  Config student = teacher;
+  if (numLayers > 0) student.numHiddenLayers = numLayers;
+  if (hiddenSize > 0) {
+    student.hiddenSize = hiddenSize;
+    int headSize = teacher.hiddenSize / teacher.numAttentionHeads;
+    student.numAttentionHeads = std::max(1, hiddenSize / headSize);
+    student.intermediateSize = hiddenSize * teacher.intermediateSize / teacher.hiddenSize;
+  }
+  if (numAttentionHeads > 0) student.numAttentionHeads = numAttentionHeads;
+  if (intermediateSize > 0) student.intermediateSize = intermediateSize;
+  if (student.hiddenSize % student.numAttentionHeads != 0) {
+    throw std::runtime_error(
+      "Hidden size " + std::to_string(student.hiddenSize)
+      + " is not a multiple of the number of attention heads "
+      + std::to_string(student.numAttentionHeads));
+  }
+  return student;
+}
+
+long copyMatchingParameters(torch::nn::Module& student,
+                            const torch::nn::Module& teacher,
+                            long studentLayers, long teacherLayers) {
+  const std::string layerPrefix = "encoder.layer.";
+  torch::NoGradGuard noGrad;
+  auto teacherParams = teacher.named_parameters();
+  long numCopied = 0;
+  for (auto& param : student.named_parameters()) {
+    std::string name = param.key();
+    if (name.compare(0, layerPrefix.size(), layerPrefix) == 0) {
+      // encoder.layer.<i>.rest -> encoder.layer.<i * T / S>.rest
+      std::string::size_type end = name.find('.', layerPrefix.size());
+      long layer = std::stol(name.substr(layerPrefix.size(), end - layerPrefix.size()));
+      name = layerPrefix + std::to_string(layer * teacherLayers / studentLayers)
+             + name.substr(end);
+    }
+    const torch::Tensor* teacherParam = teacherParams.find(name);
+    if (teacherParam == nullptr || !teacherParam->sizes().equals(param.value().sizes())) {
+      continue;
+    }
+    param.value().copy_(*teacherParam);
+    numCopied++;
+  }
+  return numCopied;
+}
+
+// Outputs of every encoder layer, shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+static std::vector<torch::Tensor> getLayerOutputs(BertModel& model,
+                                                  const torch::Tensor& inputIds) {
+  std::vector<torch::Tensor> outputs;
+  torch::Tensor hidden = model->embed(inputIds);
+  for (long i = 0; i < model->getNumLayers(); i++) {
+    hidden = model->forwardLayers(hidden, inputIds, i, i + 1);
+    outputs.push_back(hidden);
+  }
+  return outputs;
+}
+
+void runDistillation(const std::string& teacherFname,
+                     const std::string& modelDir,
+                     std::vector<Task>& tasks,
+                     const Config& studentConfig,
+                     int batchSize,
+                     int numEpochs,
+                     float lr,
+                     const std::string& saveFname,
+                     int randomSeed,
+                     long maxSequenceLength,
+                     float temperature,
+                     float softWeight,
+                     float hiddenWeight,
+                     const torch::Device& device) {
+  if (predict::isQuantizedModel(teacherFname)) {
+    throw std::runtime_error("Cannot distill from the quantized model " + teacherFname);
+  }
+  torch::manual_seed(randomSeed);
+
+  // Teacher, as saved by `train` (and possibly `prune`)
+  Config teacherConfig;
+  readStruct(teacherConfig, teacherFname + "-bert.config");
+  BertModel teacher(teacherConfig);
+  loadPrunedShapes(teacher, teacherFname + "-bert.pruned");
+  torch::load(teacher, teacherFname + "-bert.pt", device);
+  teacher->eval();
+  if (maxSequenceLength > studentConfig.maxPositionEmbeddings) {
+    throw std::runtime_error(
+      "Maximum sequence length " + std::to_string(maxSequenceLength)
+      + " exceeds the model's " + std::to_string(studentConfig.maxPositionEmbeddings)
+      + " position embeddings");
+  }
+
+  if (!saveFname.empty()) {
+    saveStruct(studentConfig, saveFname + "-bert.config");
+  }
+
+  // Student, starting from the teacher's embeddings and every
+  // TEACHER_LAYERS / STUDENT_LAYERS-th layer where the sizes allow
+  BertModel student(studentConfig);
+  long numCopied = copyMatchingParameters(*student, *teacher,
+                                          studentConfig.numHiddenLayers,
+                                          teacherConfig.numHiddenLayers);
+  student->to(device);
+  long separatorId = getSeparatorId(modelDir);
+  teacher->setSeparatorId(separatorId);
+  student->setSeparatorId(separatorId);
+
+  TextDatasetType trainDataset = getDataset(modelDir, tasks, "train", maxSequenceLength);
+  TextDatasetType valDataset = getDataset(modelDir, tasks, "val", maxSequenceLength);
+  std::vector<torch::IntArrayRef> valLabelSizes = valDataset.dataset().getLabelSizes();
+  TextDataLoaderType trainLoader = torch::data::make_data_loader(
+    trainDataset,
+    LengthBucketSampler(trainDataset.dataset().getLengths(), batchSize, BUCKET_SIZE, true),
+    torch::data::DataLoaderOptions().batch_size(batchSize));
+  TextDataLoaderType valLoader = torch::data::make_data_loader(
+    valDataset,
+    LengthBucketSampler(valDataset.dataset().getLengths(), batchSize, BUCKET_SIZE, false),
+    torch::data::DataLoaderOptions().batch_size(batchSize));
+
+  // Student heads, and the same tasks with the teacher's heads
+  tasks = initTasks(tasks, trainDataset, studentConfig, saveFname, device);
+  std::vector<Task> teacherTasks = tasks;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    bool binary = (Binary & tasks[i].taskType) == Binary, tokenLevel;
+    teacherTasks[i].classifier = predict::loadClassifier(
+      teacherFname + "-" + tasks[i].name + (binary ? "-binary.pt" : "-multiclass.pt"),
+      device, binary, tokenLevel);
+    teacherTasks[i].classifier.ptr()->eval();
+    numCopied += copyMatchingParameters(*tasks[i].classifier.ptr(),
+                                        *teacherTasks[i].classifier.ptr(), 1, 1);
+  }
+
+  bool anyTokenLevel = std::any_of(tasks.begin(), tasks.end(), [](const Task& task) {
+    return (TokenLevel & task.taskType) == TokenLevel;
+  });
+  if (!anyTokenLevel && hiddenWeight == 0.0f) {
+    teacher->setClsOnlyLayers(1);
+    student->setClsOnlyLayers(1);
+  }
+
+  // Hidden states of student layer i are matched to those of teacher layer
+  // (i + 1) * TEACHER_LAYERS / STUDENT_LAYERS - 1, through a learned
+  // projection if the hidden sizes differ. The projections are not saved
+  torch::nn::ModuleList projections;
+  if (hiddenWeight > 0.0f && studentConfig.hiddenSize != teacherConfig.hiddenSize) {
+    for (long i = 0; i < studentConfig.numHiddenLayers; i++) {
+      projections->push_back(torch::nn::Linear(studentConfig.hiddenSize,
+                                               teacherConfig.hiddenSize));
+    }
+    projections->to(device);
+  }
+
+  std::vector<torch::Tensor> dParams, ndParams;
+  splitWeightDecayParams(*student, dParams, ndParams);
+  splitWeightDecayParams(*projections, dParams, ndParams);
+  for (auto& task : tasks) splitWeightDecayParams(*task.classifier.ptr(), dParams, ndParams);
+  std::vector<torch::optim::OptimizerParamGroup> param_groups {
+    torch::optim::OptimizerParamGroup(
+      ndParams,
+      std::make_unique<torch::optim::AdamWOptions>(torch::optim::AdamWOptions(lr))
+    ),
+    torch::optim::OptimizerParamGroup(
+      dParams,
+      std::make_unique<torch::optim::AdamWOptions>(
+        torch::optim::AdamWOptions(lr).weight_decay(WEIGHT_DECAY)
+      )
+    )
+  };
+  torch::optim::AdamW optimizer(param_groups);
+
+  auto newLabels = [&valLabelSizes](std::vector<torch::Tensor>& labels,
+                                    std::vector<torch::Tensor>& predictions) {
+    for (const auto& size : valLabelSizes) {
+      labels.push_back(torch::full(size, CLASSIFICATION_IGNORE_INDEX, torch::kFloat));
+      predictions.push_back(torch::zeros(size));
+    }
+  };
+
+  // Validation scores of the teacher, for reference
+  {
+    std::vector<std::vector<float>> valLosses(tasks.size());
+    std::vector<torch::Tensor> valLabels, valPredictions;
+    float valPaddingRatio;
+    newLabels(valLabels, valPredictions);
+    trainLoop(teacher, teacherTasks, valLoader, valLosses, valLabels, valPredictions,
+              valPaddingRatio, device);
+    for (size_t i = 0; i < tasks.size(); i++) {
+      std::cerr << "# "
+                << "task=" << tasks[i].name
+                << " teacher_layers=" << teacherConfig.numHiddenLayers
+                << " student_layers=" << studentConfig.numHiddenLayers
+                << " teacher_hidden_size=" << teacherConfig.hiddenSize
+                << " student_hidden_size=" << studentConfig.hiddenSize
+                << " initialized_tensors=" << numCopied;
+      for (const auto& metric : tasks[i].metrics) {
+        std::cerr << " teacher_val_" << metric.first << "="
+                  << metric.second(valLabels[i], valPredictions[i]);
+      }
+      std::cerr << std::endl;
+    }
+  }
+
+  float bestMetric = -std::numeric_limits<float>::infinity();
+  float currentMetric;
+
+  // Print headers
+  std::cout << "epoch";
+  for (auto const& task : tasks) std::cout << "," << task.name << "_train_loss";
+  if (hiddenWeight > 0.0f) std::cout << ",hidden_train_loss";
+  for (auto const& task : tasks) {
+    std::cout << "," << task.name << "_val_loss";
+    for (const auto& metric : task.metrics) {
+      std::cout << "," << task.name << "_val_" << metric.first;
+    }
+  }
+  std::cout << std::endl;
+
+  for (int epoch = 1; epoch <= numEpochs; epoch++) {
+    std::vector<std::vector<float>> trainLosses(tasks.size()), valLosses(tasks.size());
+    std::vector<float> hiddenLosses;
+    student->train();
+    projections->train();
+    for (auto& task : tasks) task.classifier.ptr()->train();
+
+    auto trainStartTime = std::chrono::steady_clock::now();
+    for (auto& batch : *trainLoader) {
+      torch::Tensor data = batch.data.to(device);
+      std::vector<torch::Tensor> batchLabels;
+      for (auto& labels : batch.target) batchLabels.push_back(labels.to(device));
+
+      // The teacher runs in the same loop, without gradients
+      std::vector<torch::Tensor> teacherHidden, studentHidden;
+      torch::Tensor teacherOutput, studentOutput;
+      {
+        torch::NoGradGuard noGrad;
+        if (hiddenWeight > 0.0f) {
+          teacherHidden = getLayerOutputs(teacher, data);
+          teacherOutput = teacherHidden.back();
+        } else {
+          teacherOutput = teacher->forward(data);
+        }
+      }
+      if (hiddenWeight > 0.0f) {
+        studentHidden = getLayerOutputs(student, data);
+        studentOutput = studentHidden.back();
+      } else {
+        studentOutput = student->forward(data);
+      }
+
+      torch::Tensor loss = torch::zeros(1, torch::TensorOptions().device(device));
+      for (size_t i = 0; i < tasks.size(); i++) {
+        torch::Tensor studentInput = studentOutput, teacherInput = teacherOutput;
+        torch::Tensor labels = batchLabels[i];
+        if ((TokenLevel & tasks[i].taskType) == TokenLevel) {
+          // Token-level, the positions with a label only, as in innerLoop
+          PackingInfo validTokens = maskToPackingInfo(
+            (data != PADDING_IDX) & (labels != CLASSIFICATION_IGNORE_INDEX));
+          studentInput = pack(studentInput, validTokens);
+          teacherInput = pack(teacherInput, validTokens);
+          labels = pack(labels, validTokens);
+        }
+        torch::Tensor teacherLogits;
+        {
+          torch::NoGradGuard noGrad;
+          teacherLogits = teacherTasks[i].classifier.forward(teacherInput);
+        }
+        torch::Tensor studentLogits = tasks[i].classifier.forward(studentInput);
+        torch::Tensor softLoss = distillationLoss(studentLogits / temperature,
+                                                  teacherLogits / temperature,
+                                                  (Binary & tasks[i].taskType) == Binary);
+        torch::Tensor taskLoss = softWeight * temperature * temperature * softLoss;
+        if (softWeight < 1.0f) {
+          taskLoss += (1.0f - softWeight) * tasks[i].criterion.forward(studentLogits, labels);
+        }
+        loss += taskLoss * tasks[i].lossMultiplier;
+        trainLosses[i].push_back(taskLoss.item<float>());
+      }
+
+      if (hiddenWeight > 0.0f) {
+        PackingInfo tokens = getPackingInfo(data);
+        long numStudentLayers = studentHidden.size(), numTeacherLayers = teacherHidden.size();
+        torch::Tensor hiddenLoss = torch::zeros(1, torch::TensorOptions().device(device));
+        for (long j = 0; j < numStudentLayers; j++) {
+          torch::Tensor studentStates = pack(studentHidden[j], tokens);
+          if (!projections->is_empty()) {
+            studentStates = projections->ptr<torch::nn::LinearImpl>(j)->forward(studentStates);
+          }
+          torch::Tensor teacherStates = pack(
+            teacherHidden[(j + 1) * numTeacherLayers / numStudentLayers - 1], tokens);
+          hiddenLoss += torch::mse_loss(studentStates, teacherStates);
+        }
+        hiddenLoss /= numStudentLayers;
+        loss += hiddenWeight * hiddenLoss;
+        hiddenLosses.push_back(hiddenLoss.item<float>());
+      }
+
+      optimizer.zero_grad();
+      loss.backward();
+      for (auto& param_group : optimizer.param_groups()) {
+        for (auto& param : param_group.params()) {
+          torch::nn::utils::clip_grad_norm_(param, MAX_GRADIENT_NORM);
+        }
+      }
+      optimizer.step();
+    }
+    std::chrono::duration<double> trainElapsed =
+      std::chrono::steady_clock::now() - trainStartTime;
+
+    std::cout << epoch;
+    for (size_t i = 0; i < tasks.size(); i++) {
+      float sum = 0.0f;
+      for (float x : trainLosses[i]) sum += x;
+      std::cout << "," << sum / trainLosses[i].size();
+    }
+    if (hiddenWeight > 0.0f) {
+      float sum = 0.0f;
+      for (float x : hiddenLosses) sum += x;
+      std::cout << "," << sum / hiddenLosses.size();
+    }
+
+    // Val epoch, on the labels
+    std::vector<torch::Tensor> valLabels, valPredictions;
+    float valPaddingRatio;
+    newLabels(valLabels, valPredictions);
+    trainLoop(student, tasks, valLoader, valLosses, valLabels, valPredictions,
+              valPaddingRatio, device);
+    for (size_t i = 0; i < tasks.size(); i++) {
+      float sum = 0.0f;
+      for (float x : valLosses[i]) sum += x;
+      std::cout << "," << sum / valLosses[i].size();
+      for (const auto& metric : tasks[i].metrics) {
+        std::cout << "," << metric.second(valLabels[i], valPredictions[i]);
+      }
+    }
+    std::cout << std::endl;
+    std::cerr << "# "
+              << "epoch=" << epoch
+              << " train_examples_per_sec="
+              << trainDataset.dataset().size().value() / trainElapsed.count()
+              << std::endl;
+
+    if (!saveFname.empty()) {
+      currentMetric = tasks[0].metrics[0].second(valLabels[0], valPredictions[0]);
+      saveModel(student, tasks, saveFname, currentMetric, bestMetric);
+    }
+  }
+}
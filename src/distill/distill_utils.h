@@ -0,0 +1,46 @@
+#ifndef DISTILL_UTILS_H
+#define DISTILL_UTILS_H
+#include <string>
+#include <vector>
+
+#include <torch/nn/module.h>
+#include <torch/types.h>
+
+#include "config.h"
+#include "train/task.h"
+
+// A student Config from its teacher's. Sizes that are not positive are
+// taken from the teacher, except that numAttentionHeads keeps the teacher's
+// head size and intermediateSize its ratio when only hiddenSize changes
+Config getStudentConfig(const Config& teacher,
+                        int numLayers, int hiddenSize,
+                        int numAttentionHeads, int intermediateSize);
+
+// Copy the parameters of a teacher BertModel (or head) to a student where
+// the shapes match. Student layer i starts from teacher layer
+// i * TEACHER_LAYERS / STUDENT_LAYERS. Returns the number of copied tensors
+long copyMatchingParameters(torch::nn::Module& student,
+                            const torch::nn::Module& teacher,
+                            long studentLayers, long teacherLayers);
+
+// Train a student BERT and its heads on the soft logits (and, if
+// hiddenWeight > 0, the hidden states) of a fine-tuned teacher, written to
+// teacherFname by `train`. The loss of each task is
+//   softWeight * T^2 * distillationLoss(student / T, teacher / T)
+//   + (1 - softWeight) * (loss on the labels)
+// The student is saved to saveFname as by `train`
+void runDistillation(const std::string& teacherFname,
+                     const std::string& modelDir,
+                     std::vector<Task>& tasks,
+                     const Config& studentConfig,
+                     int batchSize,
+                     int numEpochs,
+                     float lr,
+                     const std::string& saveFname,
+                     int randomSeed,
+                     long maxSequenceLength,
+                     float temperature,
+                     float softWeight,
+                     float hiddenWeight,
+                     const torch::Device& device);
+#endif
@@ -0,0 +1,4 @@
+#ifndef EMBED_H
+#define EMBED_H
+#include "embed/embed.h"
+#endif
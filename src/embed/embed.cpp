@@ -0,0 +1,256 @@
+#include "embed.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <torch/types.h>
+
+#include "config.h"
+#include "embedding_file.h"
+#include "predict.h"
+#include "runtime.h"
+#include "sentence_encoder.h"
+
+namespace embed {
+
+long countLines(const std::string& fname) {
+  std::ifstream file(fname, std::ios::binary);
+  if (!file.is_open()) throw std::runtime_error(fname + " not found!");
+  std::vector<char> buffer(1 << 20);
+  long numLines = 0;
+  char last = '\n';
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    std::streamsize size = file.gcount();
+    if (size == 0) break;
+    numLines += std::count(buffer.data(), buffer.data() + size, '\n');
+    last = buffer[size - 1];
+  }
+  // A last line without a newline
+  if (last != '\n') numLines++;
+  return numLines;
+}
+
+void printHelp(const std::string &programName) {
+  std::cout << "Usage: " << programName << " [OPTIONS] MODEL FILE OUTPUT [TASK]" << std::endl;
+  std::cout << "\
+Write a sentence vector for each line of FILE to OUTPUT, a memory-mapped\n\
+matrix: a 64-byte header (see `src/embed/embedding_file.h`), then one\n\
+row-major row per line. FILE is read and written in chunks, so it does not\n\
+need to fit in memory.\n\n\
+Options:\n\
+  -p, --pooling             `cls` (the final hidden state of [CLS]), `mean`\n\
+                              (the mean of the final hidden states) or `pooled`\n\
+                              (the BertPooler output of the TASK head)\n\
+                              Default: cls\n\
+  -f, --dtype               `float32` or `float16` values\n\
+                              Default: float32\n\
+  -n, --normalize           Scale each vector to unit L2 norm\n\
+  -b, --batch-size          Number of sentences per forward pass\n\
+                              Default: 32\n\
+  -L, --max-sequence-length Pad/truncate input sequences to that many tokens\n\
+                              Default: 100\n\
+  -d, --device              Device to run on, e.g. `cpu`, `cuda`, `cuda:1`\n\
+                              Default: `cuda` if available, else `cpu`\n\
+  -j, --num-threads         Number of intra-op threads for tensor operations\n\
+                              Default: 0 (libtorch default)\n\
+  -J, --num-interop-threads Number of inter-op threads\n\
+                              Default: 0 (libtorch default)\n\
+  -k, --tokenizer-threads   Number of threads that tokenize FILE\n\
+                              Default: 0 (single-threaded)\n\
+  -A, --cpu-affinity        `none`, `cores` or `numa:N`, see `predict --help`\n\
+                              Default: none\n\
+  -P, --packed              Run the position-wise encoder layers on the\n\
+                              non-padding tokens only\n\
+  -Q, --quantize            Run the Linear layers with int8 weights: `int8`.\n\
+                              CPU only\n\
+                              Default: none (float32)\n\
+";
+}
+
+int main(int argc, char *argv[]) {
+  int c, opt = 0;
+  int batchSize = DEFAULT_BATCH_SIZE,
+      maxSequenceLength = DEFAULT_MAX_SEQUENCE_LENGTH,
+      numThreads = DEFAULT_NUM_THREADS,
+      numInteropThreads = DEFAULT_NUM_INTEROP_THREADS,
+      tokenizerThreads = 0;
+  std::string cpuAffinity = "none";
+  std::string deviceName = "";
+  std::string pooling = "cls";
+  std::string dtype = "float32";
+  bool normalize = false;
+  bool packed = false;
+  std::string quantize = "";
+
+	static struct option options[] = {
+			{"pooling",               required_argument, NULL,  'p' },
+			{"dtype",                 required_argument, NULL,  'f' },
+			{"normalize",             no_argument,       NULL,  'n' },
+			{"batch-size",            required_argument, NULL,  'b' },
+			{"max-sequence-length",   required_argument, NULL,  'L' },
+			{"device",                required_argument, NULL,  'd' },
+			{"num-threads",           required_argument, NULL,  'j' },
+			{"num-interop-threads",   required_argument, NULL,  'J' },
+			{"tokenizer-threads",     required_argument, NULL,  'k' },
+			{"cpu-affinity",          required_argument, NULL,  'A' },
+			{"packed",                no_argument,       NULL,  'P' },
+			{"quantize",              required_argument, NULL,  'Q' },
+			{"help",                  no_argument,       NULL,  'h' },
+			{NULL,                    0,                 NULL,   0  }
+	};
+
+	while ((c = getopt_long(argc, argv, ":p:f:nb:L:d:j:J:k:A:PQ:h", options, &opt)) != -1) {
+    switch (c) {
+      case 'p':
+        pooling = optarg;
+        if ((pooling != "cls") && (pooling != "mean") && (pooling != "pooled")) {
+          printHelp(argv[0]);
+          printf("Invalid pooling `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'f':
+        dtype = optarg;
+        if ((dtype != "float32") && (dtype != "float16")) {
+          printHelp(argv[0]);
+          printf("Invalid dtype `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'n':
+        normalize = true;
+        break;
+      case 'b':
+        batchSize = std::stoi(optarg);
+        if (batchSize <= 0) {
+          printHelp(argv[0]);
+          printf("Invalid batch size `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'L':
+        maxSequenceLength = std::stoi(optarg);
+        if (maxSequenceLength < 2) {
+          printHelp(argv[0]);
+          printf("Invalid maximum sequence length `%s`, [CLS] and [SEP] need 2\n", optarg);
+          return 1;
+        }
+        break;
+      case 'd':
+        deviceName = optarg;
+        break;
+      case 'j':
+        numThreads = std::stoi(optarg);
+        break;
+      case 'J':
+        numInteropThreads = std::stoi(optarg);
+        break;
+      case 'k':
+        tokenizerThreads = std::stoi(optarg);
+        break;
+      case 'A':
+        cpuAffinity = optarg;
+        if (!isValidAffinity(cpuAffinity)) {
+          printHelp(argv[0]);
+          printf("Invalid CPU affinity `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'P':
+        packed = true;
+        break;
+      case 'Q':
+        quantize = optarg;
+        if (quantize != "int8") {
+          printHelp(argv[0]);
+          printf("Invalid quantization `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'h':
+        printHelp(argv[0]);
+        return 1;
+      case '?':
+        printHelp(argv[0]);
+        printf("Invalid argument -%c\n", optopt);
+        return 1;
+      case ':':
+        printHelp(argv[0]);
+        printf("Missing option for %c\n", optopt);
+        return 1;
+      default:
+        printf("?? getopt returned character code 0%o ??\n", c);
+        return 1;
+    }
+  }
+
+  // Positional arguments: MODEL FILE OUTPUT [TASK]
+  int numPositional = argc - optind;
+  if ((numPositional != 3) && (numPositional != 4)) {
+    printHelp(argv[0]);
+    return 1;
+  }
+  std::string baseFname = argv[optind];
+  std::string textsFname = argv[optind+1];
+  std::string outputFname = argv[optind+2];
+  std::string taskName = (numPositional == 4) ? argv[optind+3] : "";
+  if ((pooling == "pooled") && taskName.empty()) {
+    printHelp(argv[0]);
+    std::cout << "Error: `--pooling pooled` needs a TASK" << std::endl;
+    return 1;
+  }
+
+  try {
+    configureScheduler(numThreads, numInteropThreads, tokenizerThreads, 0, cpuAffinity);
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  torch::Device device = getDevice(deviceName);
+  printRuntimeInfo(device);
+
+  bool quantized = predict::isQuantizedModel(baseFname) || !quantize.empty();
+  if (quantized && !device.is_cpu()) {
+    std::cerr << "Error: quantized inference runs on the CPU only" << std::endl;
+    return 1;
+  }
+  SentenceEncoder encoder(baseFname, taskName, pooling, normalize, device,
+                          !quantize.empty(), packed);
+  if (maxSequenceLength > encoder.getMaxPositionEmbeddings()) {
+    std::cerr << "Error: maximum sequence length exceeds the model's "
+              << encoder.getMaxPositionEmbeddings() << " position embeddings"
+              << std::endl;
+    return 1;
+  }
+
+  long numRows = countLines(textsFname);
+  long dim = encoder.getDim();
+  EmbeddingFile output(outputFname, numRows, dim, dtype == "float16" ? Float16 : Float32,
+                       pooling);
+
+  auto startTime = std::chrono::steady_clock::now();
+  long numWritten = encodeFile(encoder, textsFname, output, batchSize, maxSequenceLength);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+  std::cerr << "# "
+            << "rows=" << numWritten
+            << " dim=" << dim
+            << " dtype=" << dtype
+            << " pooling=" << pooling
+            << " normalize=" << normalize
+            << " sentences_per_sec=" << numWritten / elapsed.count()
+            << " output_mb="
+            << (sizeof(EmbeddingHeader) + numRows * dim * (dtype == "float16" ? 2 : 4))
+               / (1024.0 * 1024.0)
+            << std::endl;
+  printSchedulerStats();
+  return 0;
+}
+}
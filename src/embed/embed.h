@@ -0,0 +1,12 @@
+#ifndef EMBED_EMBED_H
+#define EMBED_EMBED_H
+#include <string>
+
+namespace embed {
+// Number of lines of a file, as read by std::getline
+long countLines(const std::string& fname);
+
+void printHelp(const std::string &programName);
+int main(int argc, char *argv[]);
+}
+#endif
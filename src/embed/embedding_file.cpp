@@ -0,0 +1,140 @@
+#include "embedding_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+
+namespace embed {
+
+static const char EMBEDDING_MAGIC[8] = {'B', 'E', 'R', 'T', 'E', 'M', 'B', '1'};
+
+// The header stores the pooling by its position here, 0 if not recorded
+static const std::vector<std::string> POOLINGS = {"", "cls", "mean", "pooled"};
+
+static size_t getTypeSize(EmbeddingType dtype) {
+  return dtype == Float16 ? 2 : 4;
+}
+
+EmbeddingFile::EmbeddingFile(const std::string& fname, uint64_t numRows, uint64_t dim,
+                             EmbeddingType dtype, const std::string& pooling)
+  : fname (fname) {
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, EMBEDDING_MAGIC, sizeof(EMBEDDING_MAGIC));
+  header.numRows = numRows;
+  header.dim = dim;
+  header.dtype = dtype;
+  header.headerSize = sizeof(EmbeddingHeader);
+  auto poolingIt = std::find(POOLINGS.begin(), POOLINGS.end(), pooling);
+  if (poolingIt == POOLINGS.end()) throw std::runtime_error("Invalid pooling `" + pooling + "`");
+  header.pooling = poolingIt - POOLINGS.begin();
+
+  fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("Cannot create " + fname);
+  mappedSize = header.headerSize + numRows * dim * getTypeSize(dtype);
+  // Reserve the blocks up front, so that a full disk fails here rather than
+  // with a SIGBUS on a mapped page
+  if (posix_fallocate(fd, 0, mappedSize) != 0) {
+    close(fd);
+    throw std::runtime_error("Cannot allocate " + std::to_string(mappedSize)
+                             + " bytes for " + fname);
+  }
+  map(true);
+  std::memcpy(mapped, &header, sizeof(header));
+}
+
+EmbeddingFile::EmbeddingFile(const std::string& fname) : fname (fname) {
+  fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Cannot open " + fname);
+  struct stat st;
+  fstat(fd, &st);
+  if ((static_cast<size_t>(st.st_size) < sizeof(header))
+      || (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+      || (std::memcmp(header.magic, EMBEDDING_MAGIC, sizeof(EMBEDDING_MAGIC)) != 0)) {
+    close(fd);
+    throw std::runtime_error(fname + " is not an embedding file");
+  }
+  mappedSize = header.headerSize
+    + header.numRows * header.dim * getTypeSize(getType());
+  if (static_cast<size_t>(st.st_size) < mappedSize) {
+    close(fd);
+    throw std::runtime_error(fname + " is truncated");
+  }
+  map(false);
+}
+
+std::string EmbeddingFile::getPooling() const {
+  return header.pooling < POOLINGS.size() ? POOLINGS[header.pooling] : "";
+}
+
+void EmbeddingFile::map(bool writable) {
+  void* address = mmap(nullptr, mappedSize, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                       MAP_SHARED, fd, 0);
+  if (address == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("Cannot map " + fname);
+  }
+  mapped = static_cast<char*>(address);
+  dirtyStart = dirtyEnd = 0;
+}
+
+EmbeddingFile::~EmbeddingFile() {
+  if (mapped != nullptr) munmap(mapped, mappedSize);
+  if (fd >= 0) close(fd);
+}
+
+const char* EmbeddingFile::data(uint64_t row) const {
+  return mapped + header.headerSize + row * header.dim * getTypeSize(getType());
+}
+
+void EmbeddingFile::writeRows(uint64_t row, const torch::Tensor& rows) {
+  if (row + rows.size(0) > header.numRows) {
+    throw std::runtime_error("Rows past the end of " + fname);
+  }
+  torch::Tensor values = rows.to(torch::kCPU)
+    .to(getType() == Float16 ? torch::kHalf : torch::kFloat).contiguous();
+  size_t start = data(row) - mapped;
+  std::memcpy(mapped + start, values.data_ptr(), values.nbytes());
+
+  // Rows of a chunk may come in any order, track the range written since
+  // the last release
+  size_t end = start + values.nbytes();
+  if (dirtyStart == dirtyEnd) {
+    dirtyStart = start;
+    dirtyEnd = end;
+  } else {
+    dirtyStart = std::min(dirtyStart, start);
+    dirtyEnd = std::max(dirtyEnd, end);
+  }
+  if (dirtyEnd - dirtyStart >= EMBED_RELEASE_MB * (1UL << 20)) sync();
+}
+
+void EmbeddingFile::sync() {
+  if (dirtyStart == dirtyEnd) return;
+  // Whole pages only
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t begin = dirtyStart / pageSize * pageSize;
+  msync(mapped + begin, dirtyEnd - begin, MS_SYNC);
+  // The pages are in the file now, drop them from the process
+  madvise(mapped + begin, dirtyEnd - begin, MADV_DONTNEED);
+  dirtyStart = dirtyEnd = 0;
+}
+
+torch::Tensor EmbeddingFile::getRows(uint64_t row, uint64_t count) const {
+  if (row + count > header.numRows) {
+    throw std::runtime_error("Rows past the end of " + fname);
+  }
+  auto dtype = getType() == Float16 ? torch::kHalf : torch::kFloat;
+  torch::Tensor rows = torch::from_blob(const_cast<char*>(data(row)),
+                                        {static_cast<long>(count), static_cast<long>(header.dim)},
+                                        torch::TensorOptions().dtype(dtype));
+  return getType() == Float16 ? rows.to(torch::kFloat) : rows;
+}
+}
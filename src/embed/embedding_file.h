@@ -0,0 +1,75 @@
+#ifndef EMBED_EMBEDDING_FILE_H
+#define EMBED_EMBEDDING_FILE_H
+#include <cstdint>
+#include <string>
+
+#include <torch/types.h>
+
+namespace embed {
+// A matrix of sentence vectors written by `bert embed`: this header, then
+// NUM_ROWS rows of DIM float32 or float16 values, row-major, starting at
+// headerSize bytes. Rows are 64-byte aligned if DIM is a multiple of 16
+// (float32) or 32 (float16), e.g. for numpy:
+//   np.memmap(fname, dtype=np.float32, mode="r", offset=64, shape=(numRows, dim))
+struct EmbeddingHeader {
+  char magic[8];  // "BERTEMB1"
+  uint64_t numRows;
+  uint64_t dim;
+  uint32_t dtype;  // 0: float32, 1: float16
+  uint32_t headerSize;  // 64
+  uint32_t pooling;  // 0: not recorded, 1: cls, 2: mean, 3: pooled
+  char reserved[28];
+};
+static_assert(sizeof(EmbeddingHeader) == 64, "The header is 64 bytes");
+
+enum EmbeddingType : uint32_t {
+  Float32 = 0,
+  Float16 = 1,
+};
+
+// A memory-mapped embedding file, either created with a fixed size for
+// writing rows in any order, or opened read-only
+class EmbeddingFile {
+  public:
+    // Create (or overwrite) a file for numRows rows of dim values, recording
+    // the `bert embed --pooling` they come from, if any
+    EmbeddingFile(const std::string& fname, uint64_t numRows, uint64_t dim,
+                  EmbeddingType dtype, const std::string& pooling = "");
+    // Open an existing file read-only
+    explicit EmbeddingFile(const std::string& fname);
+    ~EmbeddingFile();
+    EmbeddingFile(const EmbeddingFile&) = delete;
+    EmbeddingFile& operator=(const EmbeddingFile&) = delete;
+
+    // Write consecutive rows from `row` on, shape: (NUM_ROWS, DIM). Rows are
+    // converted to the file's type. Written pages are flushed and released
+    // from time to time, so the resident memory stays bounded
+    void writeRows(uint64_t row, const torch::Tensor& rows);
+    // Flush all written rows to disk
+    void sync();
+
+    // A read-only view of some rows as a float32 tensor, shape:
+    // (count, DIM). Zero-copy for float32 files
+    torch::Tensor getRows(uint64_t row, uint64_t count) const;
+
+    uint64_t getNumRows() const { return header.numRows; }
+    uint64_t getDim() const { return header.dim; }
+    EmbeddingType getType() const { return static_cast<EmbeddingType>(header.dtype); }
+    // `cls`, `mean` or `pooled`, or empty if not recorded
+    std::string getPooling() const;
+    // The first value of a row
+    const char* data(uint64_t row) const;
+
+  private:
+    void map(bool writable);
+
+    std::string fname;
+    EmbeddingHeader header;
+    int fd = -1;
+    char* mapped = nullptr;
+    size_t mappedSize = 0;
+    // Byte range written since the last sync()
+    size_t dirtyStart = 0, dirtyEnd = 0;
+};
+}
+#endif
@@ -0,0 +1,166 @@
+#include "sentence_encoder.h"
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "data.h"
+#include "model/classifier.h"
+#include "runtime.h"
+#include "state.h"
+
+namespace embed {
+
+// Consecutive lines of the input file, tokenized
+struct Chunk {
+  long firstRow;
+  torch::Tensor ids;  // shape: (NUM_LINES, MAX_SEQUENCE_LENGTH)
+};
+
+SentenceEncoder::SentenceEncoder(const std::string& baseFname, const std::string& taskName,
+                                 const std::string& pooling, bool normalize,
+                                 const torch::Device& device, bool quantize, bool packed)
+  : pooling (pooling), normalize (normalize) {
+  Config config;
+  readStruct(config, baseFname + "-bert.config");
+  dim = config.hiddenSize;
+  maxPositionEmbeddings = config.maxPositionEmbeddings;
+
+  // The encoder, and the head whose pooler is used if `pooled`
+  if (pooling == "pooled") {
+    model = predict::loadPredictor(baseFname, taskName, device, quantize,
+                                   0.0f, "max-prob");
+    if (model.tokenLevel) {
+      throw std::runtime_error("The head of a token-level task has no sentence pooler");
+    }
+    auto binary = std::dynamic_pointer_cast<BinaryClassifierImpl>(model.classifier.ptr());
+    auto multiclass = std::dynamic_pointer_cast<MulticlassClassifierImpl>(model.classifier.ptr());
+    pooler = [binary, multiclass](torch::Tensor hidden) {
+      return binary ? binary->pool(hidden) : multiclass->pool(hidden);
+    };
+  } else {
+    model.bertModel = predict::loadBertModel(baseFname, device, quantize);
+    model.vocabFname = predict::getModelVocabFname(baseFname);
+    model.lowercaseFname = baseFname + ".lowercase";
+    model.device = device;
+  }
+  model.bertModel->packed = packed;
+  // Only [CLS] is needed from the last layer, unless averaging
+  if (pooling != "mean") model.bertModel->setClsOnlyLayers(1);
+}
+
+torch::Tensor SentenceEncoder::encode(torch::Tensor batch) {
+  batch = batch.to(model.device);
+  // shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  torch::Tensor hidden = model.bertModel->forward(batch).to(torch::kFloat);
+  torch::Tensor pooled;
+  if (pooling == "mean") {
+    torch::Tensor mask = (batch != PADDING_IDX).unsqueeze(-1).to(torch::kFloat);
+    pooled = (hidden * mask).sum(1) / mask.sum(1);
+  } else if (pooling == "pooled") {
+    pooled = pooler(hidden);
+  } else {
+    pooled = hidden.select(1, 0);
+  }
+  if (normalize) pooled = pooled / pooled.norm(2, -1, true).clamp_min(1e-12);
+  return pooled.to(torch::kCPU);
+}
+
+// Read and tokenize chunks of the input file into a queue. Lines of a chunk
+// are tokenized on the tokenizer pool, if any
+static void readChunks(const std::string& textsFname, const SentenceEncoder& encoder,
+                       long maxSequenceLength, long chunkSize, BoundedQueue<Chunk>& queue) {
+  std::ifstream file(textsFname);
+  if (!file.is_open()) throw std::runtime_error(textsFname + " not found!");
+  ThreadPool* pool = getTokenizerPool();
+  // One line encoder per worker, or for this thread
+  std::vector<std::unique_ptr<LineEncoder>> lineEncoders(pool != nullptr ? pool->size() : 1);
+  auto getLineEncoder = [&](int worker) -> LineEncoder& {
+    if (!lineEncoders[worker]) {
+      lineEncoders[worker].reset(new LineEncoder(encoder.getVocabFname(),
+                                                 encoder.getLowercaseFname(),
+                                                 maxSequenceLength));
+    }
+    return *lineEncoders[worker];
+  };
+
+  long firstRow = 0;
+  std::vector<std::string> lines;
+  std::string line;
+  while (true) {
+    lines.clear();
+    while ((static_cast<long>(lines.size()) < chunkSize) && std::getline(file, line)) {
+      lines.push_back(line);
+    }
+    if (lines.empty()) break;
+    std::vector<torch::Tensor> ids(lines.size());
+    auto encode = [&](int worker, long begin, long end) {
+      LineEncoder& lineEncoder = getLineEncoder(worker);
+      for (long i = begin; i < end; i++) ids[i] = lineEncoder.encode(lines[i]);
+    };
+    if (pool != nullptr) {
+      pool->parallelFor(lines.size(), encode);
+    } else {
+      encode(0, 0, lines.size());
+    }
+    if (!queue.push({firstRow, torch::stack(ids)})) break;
+    firstRow += lines.size();
+  }
+}
+
+long encodeFile(SentenceEncoder& encoder, const std::string& textsFname,
+                EmbeddingFile& output, long batchSize, long maxSequenceLength) {
+  if (batchSize <= 0) throw std::runtime_error("The batch size must be positive");
+  // Reader stage, a chunk ahead of the model
+  long chunkSize = batchSize * EMBED_CHUNK_BATCHES;
+  BoundedQueue<Chunk> queue(2);
+  std::exception_ptr readerError;
+  std::thread reader([&] {
+    try {
+      readChunks(textsFname, encoder, maxSequenceLength, chunkSize, queue);
+    } catch (...) {
+      readerError = std::current_exception();
+    }
+    queue.close();
+  });
+
+  // Model stage. On an error, stop the reader before leaving
+  torch::NoGradGuard noGrad;
+  long numWritten = 0;
+  try {
+    Chunk chunk;
+    while (queue.pop(chunk)) {
+      // Sort the lines of the chunk by length (longest first), so that each
+      // batch can be trimmed to its longest row
+      torch::Tensor lengths = (chunk.ids != PADDING_IDX).sum(1);
+      torch::Tensor order = lengths.argsort(0, /*descending=*/true);
+      const long* orderData = order.data_ptr<long>();
+      const long* lengthsData = lengths.data_ptr<long>();
+      long numLines = chunk.ids.size(0);
+      torch::Tensor vectors = torch::empty({numLines, encoder.getDim()});
+
+      for (long i = 0; i < numLines; i += batchSize) {
+        torch::Tensor indices = order.slice(0, i, std::min(i + batchSize, numLines));
+        torch::Tensor batch = chunk.ids.index_select(0, indices)
+          .slice(1, 0, lengthsData[orderData[i]]);
+        vectors.index_copy_(0, indices, encoder.encode(batch));
+      }
+      output.writeRows(chunk.firstRow, vectors);
+      numWritten += numLines;
+    }
+  } catch (...) {
+    queue.close();
+    reader.join();
+    throw;
+  }
+  reader.join();
+  if (readerError) std::rethrow_exception(readerError);
+  output.sync();
+  return numWritten;
+}
+}
@@ -0,0 +1,46 @@
+#ifndef EMBED_SENTENCE_ENCODER_H
+#define EMBED_SENTENCE_ENCODER_H
+#include <functional>
+#include <string>
+
+#include <torch/types.h>
+
+#include "embedding_file.h"
+#include "predict.h"
+
+namespace embed {
+// A model loaded for sentence vectors, see `bert embed --pooling`
+class SentenceEncoder {
+  public:
+    // pooling is `cls`, `mean` or `pooled` (the BertPooler of the taskName
+    // head, which must be sentence-level)
+    SentenceEncoder(const std::string& baseFname, const std::string& taskName,
+                    const std::string& pooling, bool normalize,
+                    const torch::Device& device, bool quantize, bool packed);
+
+    // The vectors of a batch of input ids, (BATCH_SIZE, SEQUENCE_LENGTH)
+    // trimmed to its longest row. Returns float32 on the CPU, shape:
+    // (BATCH_SIZE, DIM)
+    torch::Tensor encode(torch::Tensor batch);
+
+    long getDim() const { return dim; }
+    long getMaxPositionEmbeddings() const { return maxPositionEmbeddings; }
+    const std::string& getVocabFname() const { return model.vocabFname; }
+    const std::string& getLowercaseFname() const { return model.lowercaseFname; }
+
+  private:
+    predict::Predictor model;
+    std::function<torch::Tensor (torch::Tensor)> pooler;
+    std::string pooling;
+    bool normalize;
+    long dim, maxPositionEmbeddings;
+};
+
+// Encode every line of a file into output, one row per line, batchSize
+// lines per forward pass. Lines are read and tokenized in chunks (see
+// EMBED_CHUNK_BATCHES) on a reader thread, a chunk ahead of the model.
+// Returns the number of rows written
+long encodeFile(SentenceEncoder& encoder, const std::string& textsFname,
+                EmbeddingFile& output, long batchSize, long maxSequenceLength);
+}
+#endif
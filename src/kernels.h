@@ -0,0 +1,8 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+#include "kernels/attention_kernel.h"
+#include "kernels/embedding_kernel.h"
+#include "kernels/fused_epilogue.h"
+#include "kernels/int8_linear.h"
+#include "kernels/vector_scores.h"
+#endif
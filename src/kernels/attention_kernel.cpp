@@ -0,0 +1,105 @@
+#include "attention_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <ATen/Parallel.h>
+
+#include "vec.h"
+
+namespace kernels {
+
+void attentionBlock(const float* qkv, const float* mask, float* output,
+                    long sequenceLength, long numHeads, long headSize,
+                    float scale, long b, long h,
+                    long queryStart, long queryEnd) {
+  const long hiddenSize = numHeads * headSize;
+  const long rowStride = 3 * hiddenSize;
+  const float* sequence = qkv + b * sequenceLength * rowStride;
+  const float* sequenceMask = mask + b * sequenceLength;
+  const long numQueries = queryEnd - queryStart;
+
+  // Running softmax statistics and unnormalized outputs per query
+  std::vector<float> maxScore(numQueries, -std::numeric_limits<float>::infinity());
+  std::vector<float> sumExp(numQueries, 0.0f);
+  std::vector<float> accumulator(numQueries * headSize, 0.0f);
+  float scores[ATTENTION_KEY_BLOCK];
+
+  for (long keyStart = 0; keyStart < sequenceLength; keyStart += ATTENTION_KEY_BLOCK) {
+    const long keyEnd = std::min(keyStart + ATTENTION_KEY_BLOCK, sequenceLength);
+    // The key/value block stays in cache for all the queries of the block
+    for (long i = 0; i < numQueries; i++) {
+      const float* query = sequence + (queryStart + i) * rowStride + h * headSize;
+      float* acc = accumulator.data() + i * headSize;
+
+      float blockMax = -std::numeric_limits<float>::infinity();
+      for (long j = keyStart; j < keyEnd; j++) {
+        const float* key = sequence + j * rowStride + hiddenSize + h * headSize;
+        float score = dot(query, key, headSize) * scale + sequenceMask[j];
+        scores[j - keyStart] = score;
+        blockMax = std::max(blockMax, score);
+      }
+
+      // Rescale what was accumulated with the previous maximum
+      float newMax = std::max(maxScore[i], blockMax);
+      float correction = std::exp(maxScore[i] - newMax);
+      sumExp[i] *= correction;
+      kernels::scale(correction, acc, headSize);
+
+      for (long j = keyStart; j < keyEnd; j++) {
+        const float* value = sequence + j * rowStride + 2 * hiddenSize + h * headSize;
+        float p = std::exp(scores[j - keyStart] - newMax);
+        sumExp[i] += p;
+        axpy(p, value, acc, headSize);
+      }
+      maxScore[i] = newMax;
+    }
+  }
+
+  for (long i = 0; i < numQueries; i++) {
+    float* out = output + (b * sequenceLength + queryStart + i) * hiddenSize + h * headSize;
+    const float* acc = accumulator.data() + i * headSize;
+    const float inverseSum = 1.0f / sumExp[i];
+    for (long k = 0; k < headSize; k++) out[k] = acc[k] * inverseSum;
+  }
+}
+
+torch::Tensor fusedAttention(torch::Tensor qkv,
+                             torch::Tensor attentionMask,
+                             long numHeads,
+                             float scale) {
+  qkv = qkv.contiguous();
+  const long batchSize = qkv.size(0);
+  const long sequenceLength = qkv.size(1);
+  const long hiddenSize = qkv.size(2) / 3;
+  const long headSize = hiddenSize / numHeads;
+  const long numQueryBlocks =
+    (sequenceLength + ATTENTION_QUERY_BLOCK - 1) / ATTENTION_QUERY_BLOCK;
+
+  torch::Tensor mask = attentionMask.reshape({batchSize, sequenceLength})
+                                    .to(torch::kFloat).contiguous();
+  torch::Tensor output = torch::empty({batchSize, sequenceLength, hiddenSize},
+                                      qkv.options());
+
+  const float* qkvData = qkv.data_ptr<float>();
+  const float* maskData = mask.data_ptr<float>();
+  float* outputData = output.data_ptr<float>();
+
+  // One work item per (sequence, head, block of queries)
+  at::parallel_for(0, batchSize * numHeads * numQueryBlocks, 1,
+                   [&](int64_t begin, int64_t end) {
+    for (int64_t item = begin; item < end; item++) {
+      long queryBlock = item % numQueryBlocks;
+      long h = (item / numQueryBlocks) % numHeads;
+      long b = item / (numQueryBlocks * numHeads);
+      long queryStart = queryBlock * ATTENTION_QUERY_BLOCK;
+      long queryEnd = std::min(queryStart + ATTENTION_QUERY_BLOCK, sequenceLength);
+      attentionBlock(qkvData, maskData, outputData, sequenceLength, numHeads,
+                     headSize, scale, b, h, queryStart, queryEnd);
+    }
+  });
+  return output;
+}
+}
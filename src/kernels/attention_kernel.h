@@ -0,0 +1,33 @@
+#ifndef ATTENTION_KERNEL_H
+#define ATTENTION_KERNEL_H
+#include <torch/types.h>
+
+namespace kernels {
+
+// Number of queries and keys processed together by the attention kernel
+constexpr long ATTENTION_QUERY_BLOCK = 16;
+constexpr long ATTENTION_KEY_BLOCK = 64;
+
+// Fused multi-head attention for inference on the CPU.
+// qkv shape: (BATCH_SIZE, SEQUENCE_LENGTH, 3 * HIDDEN_SIZE), the concatenated
+//   query, key and value projections
+// attentionMask shape: (BATCH_SIZE, 1, 1, SEQUENCE_LENGTH), additive key mask
+// output shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+// Scores are scaled, masked and normalized with an online softmax over
+// blocks of keys, so the (SEQUENCE_LENGTH, SEQUENCE_LENGTH) score matrix and
+// the permuted query/key/value/context tensors are never materialized
+torch::Tensor fusedAttention(torch::Tensor qkv,
+                             torch::Tensor attentionMask,
+                             long numHeads,
+                             float scale);
+
+// Attend the queries [queryStart, queryEnd) of a sequence `b` and head `h`.
+// Pointers are to row-major (BATCH_SIZE, SEQUENCE_LENGTH, 3 * HIDDEN_SIZE)
+// qkv, (BATCH_SIZE, SEQUENCE_LENGTH) mask and
+// (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE) output
+void attentionBlock(const float* qkv, const float* mask, float* output,
+                    long sequenceLength, long numHeads, long headSize,
+                    float scale, long b, long h,
+                    long queryStart, long queryEnd);
+}
+#endif
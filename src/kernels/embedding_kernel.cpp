@@ -0,0 +1,87 @@
+#include "embedding_kernel.h"
+
+#include <algorithm>
+
+#include <ATen/Parallel.h>
+
+#include "layer_norm.h"
+#include "vec.h"
+
+namespace kernels {
+
+void embeddingRows(const long* inputIds, const float* wordEmbeddings,
+                   const float* positionEmbeddings,
+                   const float* tokenTypeEmbeddings,
+                   const float* gamma, const float* beta, float* output,
+                   long rowBegin, long rowEnd, long sequenceLength,
+                   long hiddenSize, long numTokenTypes, long separatorId,
+                   float eps) {
+  for (long b = rowBegin; b < rowEnd; b++) {
+    // Separators seen so far, the [SEP] itself belongs to the segment it ends
+    long numSeparators = 0;
+    for (long l = 0; l < sequenceLength; l++) {
+      long id = inputIds[b * sequenceLength + l];
+      long tokenType = std::min(numSeparators, numTokenTypes - 1);
+      if (separatorId >= 0 && id == separatorId) numSeparators++;
+
+      const float* word = wordEmbeddings + id * hiddenSize;
+      const float* position = positionEmbeddings + l * hiddenSize;
+      const float* type = tokenTypeEmbeddings + tokenType * hiddenSize;
+      float* y = output + (b * sequenceLength + l) * hiddenSize;
+
+      long i = 0;
+      for (; i + VEC_WIDTH <= hiddenSize; i += VEC_WIDTH) {
+        vstore(y + i, vadd(vadd(vload(word + i), vload(position + i)), vload(type + i)));
+      }
+      for (; i < hiddenSize; i++) y[i] = word[i] + position[i] + type[i];
+
+      float mean, rstd;
+      layerNormRow(y, gamma, beta, y, hiddenSize, eps, mean, rstd);
+    }
+  }
+}
+
+torch::Tensor fusedEmbeddings(torch::Tensor inputIds,
+                              torch::Tensor wordEmbeddings,
+                              torch::Tensor positionEmbeddings,
+                              torch::Tensor tokenTypeEmbeddings,
+                              torch::Tensor gamma,
+                              torch::Tensor beta,
+                              long separatorId,
+                              double eps) {
+  inputIds = inputIds.to(torch::kInt64).contiguous();
+  wordEmbeddings = wordEmbeddings.contiguous();
+  positionEmbeddings = positionEmbeddings.contiguous();
+  tokenTypeEmbeddings = tokenTypeEmbeddings.contiguous();
+  gamma = gamma.contiguous();
+  beta = beta.contiguous();
+  const long batchSize = inputIds.size(0);
+  const long sequenceLength = inputIds.size(1);
+  const long hiddenSize = wordEmbeddings.size(1);
+  TORCH_CHECK(sequenceLength <= positionEmbeddings.size(0),
+              "sequence length exceeds the position embeddings");
+  // The kernel indexes the word embeddings without bounds checks
+  TORCH_CHECK(inputIds.numel() == 0
+              || (inputIds.min().item<long>() >= 0
+                  && inputIds.max().item<long>() < wordEmbeddings.size(0)),
+              "token id out of the vocabulary");
+
+  torch::Tensor output = torch::empty({batchSize, sequenceLength, hiddenSize},
+                                      wordEmbeddings.options());
+  const long* ids = inputIds.data_ptr<long>();
+  const float* word = wordEmbeddings.data_ptr<float>();
+  const float* position = positionEmbeddings.data_ptr<float>();
+  const float* type = tokenTypeEmbeddings.data_ptr<float>();
+  const float* gammaData = gamma.data_ptr<float>();
+  const float* betaData = beta.data_ptr<float>();
+  float* outputData = output.data_ptr<float>();
+  const long numTokenTypes = tokenTypeEmbeddings.size(0);
+
+  at::parallel_for(0, batchSize, 1, [&](int64_t begin, int64_t end) {
+    embeddingRows(ids, word, position, type, gammaData, betaData, outputData,
+                  begin, end, sequenceLength, hiddenSize, numTokenTypes,
+                  separatorId, static_cast<float>(eps));
+  });
+  return output;
+}
+}
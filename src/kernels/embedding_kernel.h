@@ -0,0 +1,33 @@
+#ifndef EMBEDDING_KERNEL_H
+#define EMBEDDING_KERNEL_H
+#include <torch/types.h>
+
+namespace kernels {
+
+// Fused BERT embeddings for inference on the CPU (float32):
+//   layerNorm(word[inputIds] + position[l] + tokenType[t])
+// inputIds shape: (BATCH_SIZE, SEQUENCE_LENGTH)
+// output shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE), written once.
+// The token type `t` of a position is the number of `separatorId` tokens
+// before it, capped to the number of token types; a negative separatorId
+// gives type 0 everywhere
+torch::Tensor fusedEmbeddings(torch::Tensor inputIds,
+                              torch::Tensor wordEmbeddings,
+                              torch::Tensor positionEmbeddings,
+                              torch::Tensor tokenTypeEmbeddings,
+                              torch::Tensor gamma,
+                              torch::Tensor beta,
+                              long separatorId,
+                              double eps);
+
+// Embed rows [rowBegin, rowEnd) of row-major (BATCH_SIZE, SEQUENCE_LENGTH)
+// ids into (BATCH_SIZE, SEQUENCE_LENGTH, hiddenSize) output
+void embeddingRows(const long* inputIds, const float* wordEmbeddings,
+                   const float* positionEmbeddings,
+                   const float* tokenTypeEmbeddings,
+                   const float* gamma, const float* beta, float* output,
+                   long rowBegin, long rowEnd, long sequenceLength,
+                   long hiddenSize, long numTokenTypes, long separatorId,
+                   float eps);
+}
+#endif
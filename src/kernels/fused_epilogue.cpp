@@ -0,0 +1,294 @@
+#include "fused_epilogue.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <ATen/Parallel.h>
+#include <torch/autograd.h>
+
+#include "config.h"
+#include "layer_norm.h"
+#include "vec.h"
+
+using torch::autograd::AutogradContext;
+using torch::autograd::variable_list;
+
+namespace kernels {
+
+namespace {
+
+const float SQRT_1_2 = 0.70710678118654752f;
+const float INV_SQRT_2PI = 0.39894228040143268f;
+
+template <typename V>
+inline V gelu(V u) {
+  V half = vbroadcast(u, 0.5f);
+  return vmul(vmul(half, u), vadd(vbroadcast(u, 1.0f), verf(vmul(u, vbroadcast(u, SQRT_1_2)))));
+}
+
+// d gelu(u) / du = Phi(u) + u * phi(u)
+template <typename V>
+inline V geluGrad(V u) {
+  V cdf = vmul(vbroadcast(u, 0.5f),
+               vadd(vbroadcast(u, 1.0f), verf(vmul(u, vbroadcast(u, SQRT_1_2)))));
+  V pdf = vmul(vbroadcast(u, INV_SQRT_2PI),
+               vexp(vmul(vbroadcast(u, -0.5f), vmul(u, u))));
+  return vfmadd(u, pdf, cdf);
+}
+
+// Rows per parallel work item, aiming for at::internal::GRAIN_SIZE elements
+long rowGrain(long cols) {
+  return std::max(1L, static_cast<long>(at::internal::GRAIN_SIZE) / std::max(1L, cols));
+}
+
+void biasGeluForward(const float* input, const float* bias, float* output,
+                     long rows, long cols) {
+  at::parallel_for(0, rows, rowGrain(cols), [&](int64_t begin, int64_t end) {
+    for (int64_t r = begin; r < end; r++) {
+      const float* x = input + r * cols;
+      float* y = output + r * cols;
+      long i = 0;
+      for (; i + VEC_WIDTH <= cols; i += VEC_WIDTH) {
+        vstore(y + i, gelu(vadd(vload(x + i), vload(bias + i))));
+      }
+      for (; i < cols; i++) y[i] = gelu(x[i] + bias[i]);
+    }
+  });
+}
+
+void biasGeluBackward(const float* gradOutput, const float* input,
+                      const float* bias, float* gradInput,
+                      long rows, long cols) {
+  at::parallel_for(0, rows, rowGrain(cols), [&](int64_t begin, int64_t end) {
+    for (int64_t r = begin; r < end; r++) {
+      const float* dy = gradOutput + r * cols;
+      const float* x = input + r * cols;
+      float* dx = gradInput + r * cols;
+      long i = 0;
+      for (; i + VEC_WIDTH <= cols; i += VEC_WIDTH) {
+        vfloat u = vadd(vload(x + i), vload(bias + i));
+        vstore(dx + i, vmul(vload(dy + i), geluGrad(u)));
+      }
+      for (; i < cols; i++) dx[i] = dy[i] * geluGrad(x[i] + bias[i]);
+    }
+  });
+}
+
+// mask is either null or the dropout mask, already scaled by 1 / (1 - p).
+// The pre-normalization sum is written to `hidden`, which may be `output`
+// if it is not needed for the backward pass
+void layerNormForward(const float* input, const float* bias,
+                      const float* residual, const float* mask,
+                      const float* gamma, const float* beta,
+                      float* hidden, float* output, float* mean, float* rstd,
+                      long rows, long cols, float eps) {
+  at::parallel_for(0, rows, rowGrain(cols), [&](int64_t begin, int64_t end) {
+    for (int64_t r = begin; r < end; r++) {
+      const float* x = input + r * cols;
+      const float* res = residual + r * cols;
+      const float* m = mask != nullptr ? mask + r * cols : nullptr;
+      float* h = hidden + r * cols;
+      float* y = output + r * cols;
+
+      long i = 0;
+      for (; i + VEC_WIDTH <= cols; i += VEC_WIDTH) {
+        vfloat v = vadd(vload(x + i), vload(bias + i));
+        if (m != nullptr) v = vmul(v, vload(m + i));
+        vstore(h + i, vadd(v, vload(res + i)));
+      }
+      for (; i < cols; i++) {
+        float v = x[i] + bias[i];
+        if (m != nullptr) v *= m[i];
+        h[i] = v + res[i];
+      }
+      layerNormRow(h, gamma, beta, y, cols, eps, mean[r], rstd[r]);
+    }
+  });
+}
+
+// Writes the gradient of the LayerNorm input to gradHidden (which is also
+// the residual's gradient) and, through the dropout mask, to gradInput.
+// gradGamma and gradBeta hold one partial sum per chunk of rows,
+// shape: (numChunks, cols)
+void layerNormBackward(const float* gradOutput, const float* hidden,
+                       const float* mask, const float* gamma,
+                       const float* mean, const float* rstd,
+                       float* gradHidden, float* gradInput,
+                       float* gradGamma, float* gradBeta,
+                       long rows, long cols, long numChunks) {
+  long chunkSize = (rows + numChunks - 1) / numChunks;
+  // Fixed chunks, so that the parameter gradients are deterministic
+  at::parallel_for(0, numChunks, 1, [&](int64_t chunkBegin, int64_t chunkEnd) {
+    for (int64_t chunk = chunkBegin; chunk < chunkEnd; chunk++) {
+      float* dGamma = gradGamma + chunk * cols;
+      float* dBeta = gradBeta + chunk * cols;
+      std::fill(dGamma, dGamma + cols, 0.0f);
+      std::fill(dBeta, dBeta + cols, 0.0f);
+      long rowEnd = std::min(rows, (chunk + 1) * chunkSize);
+      for (long r = chunk * chunkSize; r < rowEnd; r++) {
+        const float* dy = gradOutput + r * cols;
+        const float* h = hidden + r * cols;
+        const float* m = mask != nullptr ? mask + r * cols : nullptr;
+        float* dh = gradHidden + r * cols;
+        float* dx = gradInput + r * cols;
+        vfloat vmean = vbroadcast(vfloat(), mean[r]);
+        vfloat vrstd = vbroadcast(vfloat(), rstd[r]);
+
+        // sum(dy * gamma) and sum(dy * gamma * xhat)
+        vfloat acc1 = vbroadcast(vfloat(), 0.0f), acc2 = acc1;
+        float sum1 = 0.0f, sum2 = 0.0f;
+        long i = 0;
+        for (; i + VEC_WIDTH <= cols; i += VEC_WIDTH) {
+          vfloat xhat = vmul(vsub(vload(h + i), vmean), vrstd);
+          vfloat g = vmul(vload(dy + i), vload(gamma + i));
+          acc1 = vadd(acc1, g);
+          acc2 = vfmadd(g, xhat, acc2);
+          vstore(dGamma + i, vfmadd(vload(dy + i), xhat, vload(dGamma + i)));
+          vstore(dBeta + i, vadd(vload(dy + i), vload(dBeta + i)));
+        }
+        for (; i < cols; i++) {
+          float xhat = (h[i] - mean[r]) * rstd[r];
+          float g = dy[i] * gamma[i];
+          sum1 += g;
+          sum2 += g * xhat;
+          dGamma[i] += dy[i] * xhat;
+          dBeta[i] += dy[i];
+        }
+        float meanG = (vsum(acc1) + sum1) / cols;
+        float meanGXhat = (vsum(acc2) + sum2) / cols;
+
+        vfloat vmeanG = vbroadcast(vfloat(), meanG);
+        vfloat vmeanGXhat = vbroadcast(vfloat(), meanGXhat);
+        for (i = 0; i + VEC_WIDTH <= cols; i += VEC_WIDTH) {
+          vfloat xhat = vmul(vsub(vload(h + i), vmean), vrstd);
+          vfloat g = vmul(vload(dy + i), vload(gamma + i));
+          vfloat d = vmul(vrstd, vsub(vsub(g, vmeanG), vmul(xhat, vmeanGXhat)));
+          vstore(dh + i, d);
+          if (m != nullptr) vstore(dx + i, vmul(d, vload(m + i)));
+        }
+        for (; i < cols; i++) {
+          float xhat = (h[i] - mean[r]) * rstd[r];
+          float d = rstd[r] * (dy[i] * gamma[i] - meanG - xhat * meanGXhat);
+          dh[i] = d;
+          if (m != nullptr) dx[i] = d * m[i];
+        }
+      }
+    }
+  });
+}
+
+struct BiasGeluFunction : public torch::autograd::Function<BiasGeluFunction> {
+  static torch::Tensor forward(AutogradContext* ctx,
+                               torch::Tensor input,
+                               torch::Tensor bias) {
+    input = input.contiguous();
+    bias = bias.contiguous();
+    long cols = input.size(-1);
+    torch::Tensor output = torch::empty_like(input);
+    biasGeluForward(input.data_ptr<float>(), bias.data_ptr<float>(),
+                    output.data_ptr<float>(), input.numel() / cols, cols);
+    ctx->save_for_backward({input, bias});
+    return output;
+  }
+
+  static variable_list backward(AutogradContext* ctx, variable_list gradOutputs) {
+    variable_list saved = ctx->get_saved_variables();
+    torch::Tensor input = saved[0], bias = saved[1];
+    torch::Tensor gradOutput = gradOutputs[0].contiguous();
+    long cols = input.size(-1);
+    torch::Tensor gradInput = torch::empty_like(input);
+    biasGeluBackward(gradOutput.data_ptr<float>(), input.data_ptr<float>(),
+                     bias.data_ptr<float>(), gradInput.data_ptr<float>(),
+                     input.numel() / cols, cols);
+    torch::Tensor gradBias = gradInput.view({-1, cols}).sum(0);
+    return {gradInput, gradBias};
+  }
+};
+
+struct LayerNormFunction : public torch::autograd::Function<LayerNormFunction> {
+  static torch::Tensor forward(AutogradContext* ctx,
+                               torch::Tensor input,
+                               torch::Tensor bias,
+                               torch::Tensor residual,
+                               torch::Tensor gamma,
+                               torch::Tensor beta,
+                               double dropoutProb,
+                               bool training,
+                               double eps) {
+    input = input.contiguous();
+    residual = residual.contiguous();
+    long cols = input.size(-1);
+    long rows = input.numel() / cols;
+
+    torch::Tensor mask;
+    if (training && dropoutProb > 0) {
+      mask = torch::empty_like(input).bernoulli_(1 - dropoutProb).div_(1 - dropoutProb);
+    }
+    torch::Tensor output = torch::empty_like(input);
+    // The pre-normalization sum is only kept for the backward pass
+    bool needsGrad = input.requires_grad() || bias.requires_grad()
+                     || residual.requires_grad() || gamma.requires_grad()
+                     || beta.requires_grad();
+    torch::Tensor hidden = needsGrad ? torch::empty_like(input) : output;
+    torch::Tensor mean = torch::empty({rows}, input.options());
+    torch::Tensor rstd = torch::empty({rows}, input.options());
+
+    layerNormForward(input.data_ptr<float>(), bias.contiguous().data_ptr<float>(),
+                     residual.data_ptr<float>(),
+                     mask.defined() ? mask.data_ptr<float>() : nullptr,
+                     gamma.contiguous().data_ptr<float>(),
+                     beta.contiguous().data_ptr<float>(),
+                     hidden.data_ptr<float>(), output.data_ptr<float>(),
+                     mean.data_ptr<float>(), rstd.data_ptr<float>(),
+                     rows, cols, static_cast<float>(eps));
+
+    ctx->save_for_backward({hidden, mask, gamma.contiguous(), mean, rstd});
+    return output;
+  }
+
+  static variable_list backward(AutogradContext* ctx, variable_list gradOutputs) {
+    variable_list saved = ctx->get_saved_variables();
+    torch::Tensor hidden = saved[0], mask = saved[1], gamma = saved[2],
+                  mean = saved[3], rstd = saved[4];
+    torch::Tensor gradOutput = gradOutputs[0].contiguous();
+    long cols = hidden.size(-1);
+    long rows = hidden.numel() / cols;
+    // Independent of the number of threads, so that the summation order is too
+    long numChunks = std::max(1L, std::min<long>(rows, LAYER_NORM_GRAD_CHUNKS));
+
+    torch::Tensor gradHidden = torch::empty_like(hidden);
+    torch::Tensor gradInput = mask.defined() ? torch::empty_like(hidden) : gradHidden;
+    torch::Tensor gradGamma = torch::empty({numChunks, cols}, hidden.options());
+    torch::Tensor gradBeta = torch::empty({numChunks, cols}, hidden.options());
+
+    layerNormBackward(gradOutput.data_ptr<float>(), hidden.data_ptr<float>(),
+                      mask.defined() ? mask.data_ptr<float>() : nullptr,
+                      gamma.data_ptr<float>(), mean.data_ptr<float>(),
+                      rstd.data_ptr<float>(), gradHidden.data_ptr<float>(),
+                      gradInput.data_ptr<float>(), gradGamma.data_ptr<float>(),
+                      gradBeta.data_ptr<float>(), rows, cols, numChunks);
+
+    return {gradInput, gradInput.view({-1, cols}).sum(0), gradHidden,
+            gradGamma.sum(0), gradBeta.sum(0),
+            torch::Tensor(), torch::Tensor(), torch::Tensor()};
+  }
+};
+
+}  // namespace
+
+torch::Tensor biasGelu(torch::Tensor input, torch::Tensor bias) {
+  return BiasGeluFunction::apply(input, bias);
+}
+
+torch::Tensor biasDropoutResidualLayerNorm(torch::Tensor input,
+                                           torch::Tensor bias,
+                                           torch::Tensor residual,
+                                           torch::Tensor gamma,
+                                           torch::Tensor beta,
+                                           double dropoutProb,
+                                           bool training,
+                                           double eps) {
+  return LayerNormFunction::apply(input, bias, residual, gamma, beta,
+                                  dropoutProb, training, eps);
+}
+}
@@ -0,0 +1,27 @@
+#ifndef FUSED_EPILOGUE_H
+#define FUSED_EPILOGUE_H
+#include <torch/types.h>
+
+namespace kernels {
+
+// Fused epilogues of the encoder's Linear layers on the CPU (float32).
+// Each one reads and writes the activations once, both in forward and in
+// backward, and is differentiable w.r.t. all of its tensor arguments.
+
+// gelu(input + bias), the exact (erf) form as in torch::gelu
+// input shape: (..., N), bias shape: (N)
+torch::Tensor biasGelu(torch::Tensor input, torch::Tensor bias);
+
+// layerNorm(dropout(input + bias) + residual), with LayerNorm weight `gamma`
+// and bias `beta`. Dropout is applied only if `training` is set
+// input, residual shape: (..., N), bias, gamma, beta shape: (N)
+torch::Tensor biasDropoutResidualLayerNorm(torch::Tensor input,
+                                           torch::Tensor bias,
+                                           torch::Tensor residual,
+                                           torch::Tensor gamma,
+                                           torch::Tensor beta,
+                                           double dropoutProb,
+                                           bool training,
+                                           double eps);
+}
+#endif
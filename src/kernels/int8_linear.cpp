@@ -0,0 +1,113 @@
+#include "int8_linear.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <ATen/Parallel.h>
+
+#include "vec.h"
+
+namespace kernels {
+
+std::tuple<torch::Tensor, torch::Tensor> quantizeWeight(torch::Tensor weight) {
+  weight = weight.detach().to(torch::kFloat);
+  torch::Tensor scales = std::get<0>(weight.abs().max(1)).clamp_min(1e-12) / 127.0f;
+  torch::Tensor quantized = (weight / scales.unsqueeze(1)).round()
+    .clamp(-127, 127).to(torch::kChar);
+  return std::make_tuple(quantized.contiguous(), scales.contiguous());
+}
+
+void quantizeRows(const float* input, int8_t* output, float* scales,
+                  long cols, long rowBegin, long rowEnd) {
+  for (long r = rowBegin; r < rowEnd; r++) {
+    const float* x = input + r * cols;
+    int8_t* q = output + r * cols;
+
+    long i = 0;
+    float absMax = 0.0f;
+    vfloat vAbsMax = vbroadcast(vfloat(), 0.0f);
+    for (; i + VEC_WIDTH <= cols; i += VEC_WIDTH) {
+      vAbsMax = vmax(vAbsMax, vabs(vload(x + i)));
+    }
+    float lanes[VEC_WIDTH];
+    vstore(lanes, vAbsMax);
+    for (long j = 0; j < VEC_WIDTH; j++) absMax = std::max(absMax, lanes[j]);
+    for (; i < cols; i++) absMax = std::max(absMax, std::fabs(x[i]));
+
+    // All-zero rows quantize to zeros with any scale
+    float scale = absMax > 0.0f ? absMax / 127.0f : 1.0f;
+    float inverse = 1.0f / scale;
+    for (i = 0; i < cols; i++) {
+      q[i] = static_cast<int8_t>(std::nearbyint(x[i] * inverse));
+    }
+    scales[r] = scale;
+  }
+}
+
+void int8LinearBlock(const int8_t* input, const float* inputScales,
+                     const int8_t* weight, const float* weightScales,
+                     const float* bias, float* output,
+                     long inFeatures, long outFeatures,
+                     long rowBegin, long rowEnd,
+                     long featureBegin, long featureEnd) {
+  // The weight block is reused by every row of the block
+  for (long r = rowBegin; r < rowEnd; r++) {
+    const int8_t* x = input + r * inFeatures;
+    float* y = output + r * outFeatures;
+    for (long f = featureBegin; f < featureEnd; f++) {
+      int32_t acc = dotInt8(x, weight + f * inFeatures, inFeatures);
+      y[f] = static_cast<float>(acc) * inputScales[r] * weightScales[f]
+             + (bias != nullptr ? bias[f] : 0.0f);
+    }
+  }
+}
+
+torch::Tensor int8Linear(torch::Tensor input, torch::Tensor weight,
+                         torch::Tensor scales, torch::Tensor bias) {
+  TORCH_CHECK(input.device().is_cpu() && input.scalar_type() == torch::kFloat,
+              "int8Linear expects float32 inputs on the CPU");
+  TORCH_CHECK(weight.scalar_type() == torch::kChar, "int8Linear expects int8 weights");
+  const long inFeatures = weight.size(1);
+  const long outFeatures = weight.size(0);
+  TORCH_CHECK(input.size(-1) == inFeatures, "int8Linear input size mismatch");
+
+  std::vector<int64_t> outputSizes = input.sizes().vec();
+  outputSizes.back() = outFeatures;
+  torch::Tensor x = input.reshape({-1, inFeatures}).contiguous();
+  weight = weight.contiguous();
+  scales = scales.to(torch::kFloat).contiguous();
+  if (bias.defined()) bias = bias.to(torch::kFloat).contiguous();
+  const long rows = x.size(0);
+
+  torch::Tensor quantized = torch::empty({rows, inFeatures}, x.options().dtype(torch::kChar));
+  torch::Tensor inputScales = torch::empty({rows}, x.options());
+  torch::Tensor output = torch::empty({rows, outFeatures}, x.options());
+  const float* xData = x.data_ptr<float>();
+  int8_t* quantizedData = quantized.data_ptr<int8_t>();
+  float* inputScalesData = inputScales.data_ptr<float>();
+  const int8_t* weightData = weight.data_ptr<int8_t>();
+  const float* scalesData = scales.data_ptr<float>();
+  const float* biasData = bias.defined() ? bias.data_ptr<float>() : nullptr;
+  float* outputData = output.data_ptr<float>();
+
+  at::parallel_for(0, rows, 1, [&](int64_t begin, int64_t end) {
+    quantizeRows(xData, quantizedData, inputScalesData, inFeatures, begin, end);
+  });
+
+  // One task per (row block, feature block) tile
+  const long numRowBlocks = (rows + INT8_ROW_BLOCK - 1) / INT8_ROW_BLOCK;
+  const long numFeatureBlocks = (outFeatures + INT8_FEATURE_BLOCK - 1) / INT8_FEATURE_BLOCK;
+  at::parallel_for(0, numRowBlocks * numFeatureBlocks, 1, [&](int64_t begin, int64_t end) {
+    for (int64_t tile = begin; tile < end; tile++) {
+      long rowBegin = (tile / numFeatureBlocks) * INT8_ROW_BLOCK;
+      long featureBegin = (tile % numFeatureBlocks) * INT8_FEATURE_BLOCK;
+      int8LinearBlock(quantizedData, inputScalesData, weightData, scalesData,
+                      biasData, outputData, inFeatures, outFeatures,
+                      rowBegin, std::min(rowBegin + INT8_ROW_BLOCK, rows),
+                      featureBegin, std::min(featureBegin + INT8_FEATURE_BLOCK, outFeatures));
+    }
+  });
+  return output.view(outputSizes);
+}
+}
@@ -0,0 +1,43 @@
+#ifndef INT8_LINEAR_H
+#define INT8_LINEAR_H
+#include <tuple>
+
+#include <torch/types.h>
+
+namespace kernels {
+
+// Number of input rows and output features computed together by int8Linear
+constexpr long INT8_ROW_BLOCK = 16;
+constexpr long INT8_FEATURE_BLOCK = 64;
+
+// Symmetric per-output-channel int8 quantization of a Linear weight
+// weight shape: (OUT_FEATURES, IN_FEATURES), float
+// returns the int8 weight, same shape, values in [-127, 127], and the float
+// scales, shape: (OUT_FEATURES), so that weight ~= int8 weight * scale
+std::tuple<torch::Tensor, torch::Tensor> quantizeWeight(torch::Tensor weight);
+
+// Linear layer with int8 weights for CPU inference. Each input row is
+// quantized to int8 with its own scale (dynamic quantization), products are
+// accumulated in int32 and rescaled to float before adding the bias.
+// input shape: (..., IN_FEATURES), float
+// weight shape: (OUT_FEATURES, IN_FEATURES), int8, see quantizeWeight
+// scales shape: (OUT_FEATURES)
+// bias shape: (OUT_FEATURES), or undefined
+// output shape: (..., OUT_FEATURES)
+torch::Tensor int8Linear(torch::Tensor input, torch::Tensor weight,
+                         torch::Tensor scales, torch::Tensor bias);
+
+// Quantize the rows [rowBegin, rowEnd) of a row-major (ROWS, COLS) matrix
+void quantizeRows(const float* input, int8_t* output, float* scales,
+                  long cols, long rowBegin, long rowEnd);
+
+// Compute the output rows [rowBegin, rowEnd) and features
+// [featureBegin, featureEnd) from quantized inputs and weights
+void int8LinearBlock(const int8_t* input, const float* inputScales,
+                     const int8_t* weight, const float* weightScales,
+                     const float* bias, float* output,
+                     long inFeatures, long outFeatures,
+                     long rowBegin, long rowEnd,
+                     long featureBegin, long featureEnd);
+}
+#endif
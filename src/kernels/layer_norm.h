@@ -0,0 +1,41 @@
+#ifndef KERNELS_LAYER_NORM_H
+#define KERNELS_LAYER_NORM_H
+#include <cmath>
+
+#include "vec.h"
+
+namespace kernels {
+
+// Normalize one row `h` of `cols` floats into `y` (which may be `h`), with
+// LayerNorm weight `gamma` and bias `beta`, and return its mean and
+// reciprocal standard deviation. The row is expected to be in cache, as
+// it was just written by the caller
+inline void layerNormRow(const float* h, const float* gamma, const float* beta,
+                         float* y, long cols, float eps,
+                         float& mean, float& rstd) {
+  vfloat acc = vbroadcast(vfloat(), 0.0f);
+  float sum = 0.0f;
+  long i = 0;
+  for (; i + VEC_WIDTH <= cols; i += VEC_WIDTH) acc = vadd(acc, vload(h + i));
+  for (; i < cols; i++) sum += h[i];
+  mean = (vsum(acc) + sum) / cols;
+
+  vfloat vmean = vbroadcast(vfloat(), mean);
+  acc = vbroadcast(vfloat(), 0.0f);
+  sum = 0.0f;
+  for (i = 0; i + VEC_WIDTH <= cols; i += VEC_WIDTH) {
+    vfloat d = vsub(vload(h + i), vmean);
+    acc = vfmadd(d, d, acc);
+  }
+  for (; i < cols; i++) sum += (h[i] - mean) * (h[i] - mean);
+  rstd = 1.0f / std::sqrt((vsum(acc) + sum) / cols + eps);
+
+  vfloat vrstd = vbroadcast(vfloat(), rstd);
+  for (i = 0; i + VEC_WIDTH <= cols; i += VEC_WIDTH) {
+    vfloat xhat = vmul(vsub(vload(h + i), vmean), vrstd);
+    vstore(y + i, vfmadd(xhat, vload(gamma + i), vload(beta + i)));
+  }
+  for (; i < cols; i++) y[i] = (h[i] - mean) * rstd * gamma[i] + beta[i];
+}
+}
+#endif
@@ -0,0 +1,217 @@
+#ifndef KERNELS_VEC_H
+#define KERNELS_VEC_H
+// Small vectorized helpers for the fused CPU kernels.
+// AVX-512 or AVX2+FMA is used when the compiler targets it (see
+// `-march=native` in the Makefile), with a scalar fallback otherwise
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+namespace kernels {
+
+// Dot product of two float arrays
+inline float dot(const float* a, const float* b, long n) {
+  long i = 0;
+  float out = 0.0f;
+#if defined(__AVX512F__)
+  __m512 acc = _mm512_setzero_ps();
+  for (; i + 16 <= n; i += 16) {
+    acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc);
+  }
+  out = _mm512_reduce_add_ps(acc);
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 acc = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+  }
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  sum = _mm_hadd_ps(sum, sum);
+  sum = _mm_hadd_ps(sum, sum);
+  out = _mm_cvtss_f32(sum);
+#endif
+  for (; i < n; i++) out += a[i] * b[i];
+  return out;
+}
+
+// y += alpha * x
+inline void axpy(float alpha, const float* x, float* y, long n) {
+  long i = 0;
+#if defined(__AVX512F__)
+  __m512 a = _mm512_set1_ps(alpha);
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(y + i, _mm512_fmadd_ps(a, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+  }
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 a = _mm256_set1_ps(alpha);
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+  }
+#endif
+  for (; i < n; i++) y[i] += alpha * x[i];
+}
+
+// y *= alpha
+inline void scale(float alpha, float* y, long n) {
+  long i = 0;
+#if defined(__AVX512F__)
+  __m512 a = _mm512_set1_ps(alpha);
+  for (; i + 16 <= n; i += 16) _mm512_storeu_ps(y + i, _mm512_mul_ps(a, _mm512_loadu_ps(y + i)));
+#elif defined(__AVX2__)
+  __m256 a = _mm256_set1_ps(alpha);
+  for (; i + 8 <= n; i += 8) _mm256_storeu_ps(y + i, _mm256_mul_ps(a, _mm256_loadu_ps(y + i)));
+#endif
+  for (; i < n; i++) y[i] *= alpha;
+}
+
+// Dot product of two int8 arrays with values in [-127, 127], accumulated in
+// int32. -128 is excluded so that the AVX2 pairwise int16 sums cannot
+// saturate
+inline int32_t dotInt8(const int8_t* a, const int8_t* b, long n) {
+  long i = 0;
+  int32_t out = 0;
+#if defined(__AVX2__)
+  __m256i acc = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  for (; i + 32 <= n; i += 32) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    // maddubs multiplies unsigned by signed bytes, so move the sign of a to b
+    __m256i products = _mm256_maddubs_epi16(_mm256_sign_epi8(va, va),
+                                            _mm256_sign_epi8(vb, va));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(products, ones));
+  }
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum = _mm_hadd_epi32(sum, sum);
+  sum = _mm_hadd_epi32(sum, sum);
+  out = _mm_cvtsi128_si32(sum);
+#endif
+  for (; i < n; i++) out += static_cast<int32_t>(a[i]) * b[i];
+  return out;
+}
+
+// Element-wise wrappers, so that a kernel is written once (as a template)
+// for `vfloat`, VEC_WIDTH floats at a time, and for the scalar remainder
+inline float vadd(float a, float b) { return a + b; }
+inline float vsub(float a, float b) { return a - b; }
+inline float vmul(float a, float b) { return a * b; }
+inline float vdiv(float a, float b) { return a / b; }
+inline float vfmadd(float a, float b, float c) { return a * b + c; }
+inline float vmax(float a, float b) { return a > b ? a : b; }
+inline float vmin(float a, float b) { return a < b ? a : b; }
+inline float vabs(float x) { return std::fabs(x); }
+inline float vround(float x) { return std::nearbyint(x); }
+inline float vcopysign(float magnitude, float sign) { return std::copysign(magnitude, sign); }
+inline float vbroadcast(float, float x) { return x; }
+inline float vsum(float x) { return x; }
+// 2^n for an integral n in [-127, 128]
+inline float vpow2(float n) {
+  int32_t bits = (static_cast<int32_t>(n) + 127) << 23;
+  float out;
+  std::memcpy(&out, &bits, sizeof(out));
+  return out;
+}
+
+#if defined(__AVX512F__)
+typedef __m512 vfloat;
+constexpr long VEC_WIDTH = 16;
+inline vfloat vload(const float* p) { return _mm512_loadu_ps(p); }
+inline void vstore(float* p, vfloat x) { _mm512_storeu_ps(p, x); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm512_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm512_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm512_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm512_div_ps(a, b); }
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return _mm512_fmadd_ps(a, b, c); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm512_max_ps(a, b); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm512_min_ps(a, b); }
+inline vfloat vabs(vfloat x) {
+  return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(x),
+                                              _mm512_set1_epi32(0x7fffffff)));
+}
+inline vfloat vround(vfloat x) {
+  return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+inline vfloat vcopysign(vfloat magnitude, vfloat sign) {
+  __m512i signBit = _mm512_and_si512(_mm512_castps_si512(sign),
+                                     _mm512_set1_epi32(0x80000000));
+  return _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(vabs(magnitude)), signBit));
+}
+inline vfloat vbroadcast(vfloat, float x) { return _mm512_set1_ps(x); }
+inline float vsum(vfloat x) { return _mm512_reduce_add_ps(x); }
+inline vfloat vpow2(vfloat n) {
+  __m512i bits = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+  return _mm512_castsi512_ps(_mm512_slli_epi32(bits, 23));
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+typedef __m256 vfloat;
+constexpr long VEC_WIDTH = 8;
+inline vfloat vload(const float* p) { return _mm256_loadu_ps(p); }
+inline void vstore(float* p, vfloat x) { _mm256_storeu_ps(p, x); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return _mm256_fmadd_ps(a, b, c); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+inline vfloat vabs(vfloat x) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x); }
+inline vfloat vround(vfloat x) {
+  return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+inline vfloat vcopysign(vfloat magnitude, vfloat sign) {
+  __m256 signMask = _mm256_set1_ps(-0.0f);
+  return _mm256_or_ps(_mm256_andnot_ps(signMask, magnitude), _mm256_and_ps(signMask, sign));
+}
+inline vfloat vbroadcast(vfloat, float x) { return _mm256_set1_ps(x); }
+inline float vsum(vfloat x) {
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  sum = _mm_hadd_ps(sum, sum);
+  sum = _mm_hadd_ps(sum, sum);
+  return _mm_cvtss_f32(sum);
+}
+inline vfloat vpow2(vfloat n) {
+  __m256i bits = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+}
+#else
+typedef float vfloat;
+constexpr long VEC_WIDTH = 1;
+inline vfloat vload(const float* p) { return *p; }
+inline void vstore(float* p, vfloat x) { *p = x; }
+#endif
+
+// exp(x), Cephes-style range reduction and polynomial (relative error ~1e-7)
+template <typename V>
+inline V vexp(V x) {
+  x = vmin(vmax(x, vbroadcast(x, -87.3f)), vbroadcast(x, 88.3f));
+  V n = vround(vmul(x, vbroadcast(x, 1.44269504088896341f)));
+  x = vsub(x, vmul(n, vbroadcast(x, 0.693359375f)));
+  x = vsub(x, vmul(n, vbroadcast(x, -2.12194440e-4f)));
+  V y = vbroadcast(x, 1.9875691500e-4f);
+  y = vfmadd(y, x, vbroadcast(x, 1.3981999507e-3f));
+  y = vfmadd(y, x, vbroadcast(x, 8.3334519073e-3f));
+  y = vfmadd(y, x, vbroadcast(x, 4.1665795894e-2f));
+  y = vfmadd(y, x, vbroadcast(x, 1.6666665459e-1f));
+  y = vfmadd(y, x, vbroadcast(x, 5.0000001201e-1f));
+  y = vfmadd(y, vmul(x, x), vadd(x, vbroadcast(x, 1.0f)));
+  return vmul(y, vpow2(n));
+}
+
+// erf(x), Abramowitz & Stegun 7.1.26 (absolute error < 1.5e-7)
+template <typename V>
+inline V verf(V x) {
+  V ax = vabs(x);
+  V one = vbroadcast(x, 1.0f);
+  V t = vdiv(one, vfmadd(ax, vbroadcast(x, 0.3275911f), one));
+  V y = vbroadcast(x, 1.061405429f);
+  y = vfmadd(y, t, vbroadcast(x, -1.453152027f));
+  y = vfmadd(y, t, vbroadcast(x, 1.421413741f));
+  y = vfmadd(y, t, vbroadcast(x, -0.284496736f));
+  y = vfmadd(y, t, vbroadcast(x, 0.254829592f));
+  y = vmul(y, t);
+  y = vsub(one, vmul(y, vexp(vsub(vbroadcast(x, 0.0f), vmul(ax, ax)))));
+  return vcopysign(y, x);
+}
+
+}  // namespace kernels
+#endif
@@ -0,0 +1,20 @@
+#include "vector_scores.h"
+
+#include "vec.h"
+
+namespace kernels {
+
+void vectorScores(const float* query, const float* vectors,
+                  long count, long dim, float* scores) {
+  for (long i = 0; i < count; i++) scores[i] = dot(query, vectors + i * dim, dim);
+}
+
+void vectorScoresInt8(const int8_t* query, float queryScale,
+                      const int8_t* vectors, const float* scales,
+                      long count, long dim, float* scores) {
+  for (long i = 0; i < count; i++) {
+    int32_t acc = dotInt8(query, vectors + i * dim, dim);
+    scores[i] = static_cast<float>(acc) * queryScale * scales[i];
+  }
+}
+}
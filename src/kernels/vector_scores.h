@@ -0,0 +1,19 @@
+#ifndef VECTOR_SCORES_H
+#define VECTOR_SCORES_H
+#include <cstdint>
+
+namespace kernels {
+
+// Inner products of a query with count consecutive row-major vectors of
+// dim floats, into scores
+void vectorScores(const float* query, const float* vectors,
+                  long count, long dim, float* scores);
+
+// vectorScores for int8 vectors with one scale each (see quantizeRows),
+// against an int8 query with its own scale. Products are accumulated in
+// int32 and rescaled to float
+void vectorScoresInt8(const int8_t* query, float queryScale,
+                      const int8_t* vectors, const float* scales,
+                      long count, long dim, float* scores);
+}
+#endif
@@ -25,8 +25,9 @@ float matthewsCorrelationCoefficient(torch::Tensor &labels, torch::Tensor &predi
 }
 
 float accuracy(torch::Tensor &labels, torch::Tensor &predictions) {
-  long numerator = (labels == predictions).sum().item<long>();
-  long numIgnored = (labels == CLASSIFICATION_IGNORE_INDEX).sum().item<long>();
+  torch::Tensor ignored = labels == CLASSIFICATION_IGNORE_INDEX;
+  long numerator = ((labels == predictions) & ignored.logical_not()).sum().item<long>();
+  long numIgnored = ignored.sum().item<long>();
   long denominator;
   if (labels.ndimension() > 1) {
     denominator = labels.size(0) * labels.size(1) - numIgnored;
@@ -2,4 +2,7 @@
 #define MODEL_H
 #include "model/bert_model.h"
 #include "model/classifier.h"
+#include "model/fused_heads.h"
+#include "model/packing.h"
+#include "model/pruning.h"
 #endif
@@ -9,13 +9,35 @@ BertAttentionImpl::BertAttentionImpl(Config const &config)
 }
 
 torch::Tensor BertAttentionImpl::forward(torch::Tensor inputTensor,
-                                         torch::Tensor attentionMask) {
-  // inputTensor shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
-  // attentionMask shape: (BATCH_SIZE, 1, 1, MAX_SEQUENCE_LENGTH)
-  // selfOutputs shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
-  torch::Tensor selfOutputs = self->forward(inputTensor, attentionMask);
+                                         torch::Tensor attentionMask,
+                                         const PackingInfo* packing) {
+  // inputTensor shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  // attentionMask shape: (BATCH_SIZE, 1, 1, SEQUENCE_LENGTH)
+  // selfOutputs shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  //   or (TOTAL_TOKENS, HIDDEN_SIZE) if packed, as inputTensor
+  torch::Tensor selfOutputs = self->forward(inputTensor, attentionMask, packing);
 
-  // attentionOutput shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
+  // attentionOutput shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
   torch::Tensor attentionOutput = output->forward(selfOutputs, inputTensor);
   return attentionOutput;
 }
+
+torch::Tensor BertAttentionImpl::forwardFirstToken(torch::Tensor inputTensor,
+                                                   torch::Tensor attentionMask) {
+  // selfOutputs shape: (BATCH_SIZE, 1, HIDDEN_SIZE)
+  torch::Tensor selfOutputs = self->forwardFirstToken(inputTensor, attentionMask);
+  return output->forward(selfOutputs, inputTensor.narrow(1, 0, 1));
+}
+
+void BertAttentionImpl::pruneHeads(const torch::Tensor& keepHeads) {
+  // The output dense layer reads the context features of the kept heads
+  output->pruneInputs(self->pruneHeads(keepHeads));
+}
+
+long BertAttentionImpl::getNumHeads() const {
+  return self->getNumHeads();
+}
+
+void BertAttentionImpl::setHeadMask(torch::Tensor headMask) {
+  self->headMask = headMask;
+}
@@ -6,13 +6,22 @@
 #include "config.h"
 #include "bert_self_attention.h"
 #include "bert_self_output.h"
+#include "packing.h"
 
 class BertAttentionImpl : public torch::nn::Module {
   public:
     BertAttentionImpl();
     explicit BertAttentionImpl(Config const &config);
     torch::Tensor forward(torch::Tensor inputTensor,
-                          torch::Tensor attentionMask);
+                          torch::Tensor attentionMask,
+                          const PackingInfo* packing = nullptr);
+    // Only the first position of the output, see BertLayerImpl::forwardFirstToken
+    torch::Tensor forwardFirstToken(torch::Tensor inputTensor,
+                                    torch::Tensor attentionMask);
+    // Keep only some attention heads, given by index
+    void pruneHeads(const torch::Tensor& keepHeads);
+    long getNumHeads() const;
+    void setHeadMask(torch::Tensor headMask);
 	private:
 		 BertSelfAttention self{nullptr};
 		 BertSelfOutput output{nullptr};
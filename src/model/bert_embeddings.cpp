@@ -1,5 +1,9 @@
 #include "bert_embeddings.h"
 
+#include <torch/autograd.h>
+
+#include "kernels.h"
+
 BertEmbeddingsImpl::BertEmbeddingsImpl() {};
 
 BertEmbeddingsImpl::BertEmbeddingsImpl(Config const &config)
@@ -13,22 +17,78 @@ BertEmbeddingsImpl::BertEmbeddingsImpl(Config const &config)
   register_module("tokenTypeEmbeddings", tokenTypeEmbeddings);
   register_module("layerNorm", layerNorm);
   register_module("dropout", dropout);
+  positionIds = register_buffer(
+    "positionIds", torch::arange(config.maxPositionEmbeddings, torch::kInt64).unsqueeze(0));
+  zeroTokenTypeIds = register_buffer("zeroTokenTypeIds", torch::zeros_like(positionIds));
+}
+
+void BertEmbeddingsImpl::load(torch::serialize::InputArchive& archive) {
+  // As torch::nn::Module::load, but the buffers are optional
+  for (auto& parameter : named_parameters(/*recurse=*/false)) {
+    archive.read(parameter.key(), parameter.value());
+  }
+  for (auto& buffer : named_buffers(/*recurse=*/false)) {
+    archive.try_read(buffer.key(), buffer.value(), /*is_buffer=*/true);
+  }
+  for (const auto& child : named_children()) {
+    torch::serialize::InputArchive childArchive;
+    archive.read(child.key(), childArchive);
+    child.value()->load(childArchive);
+  }
+}
+
+void BertEmbeddingsImpl::to(torch::Device device, torch::Dtype dtype, bool nonBlocking) {
+  torch::nn::Module::to(device, dtype, nonBlocking);
+  resetIndexBuffers();
+}
+
+void BertEmbeddingsImpl::to(torch::Dtype dtype, bool nonBlocking) {
+  torch::nn::Module::to(dtype, nonBlocking);
+  resetIndexBuffers();
+}
+
+void BertEmbeddingsImpl::resetIndexBuffers() {
+  // Rebuilt rather than cast back, reduced precision types cannot hold every
+  // position exactly
+  torch::NoGradGuard noGrad;
+  positionIds.set_data(torch::arange(positionIds.size(1),
+                                     positionIds.options().dtype(torch::kInt64)).unsqueeze(0));
+  zeroTokenTypeIds.set_data(torch::zeros_like(positionIds));
+}
+
+torch::Tensor BertEmbeddingsImpl::getTokenTypeIds(torch::Tensor inputIds) {
+  long sequenceLength = inputIds.size(1);
+  if (separatorId < 0) {
+    return zeroTokenTypeIds.slice(1, 0, sequenceLength).expand_as(inputIds);
+  }
+  // Count the separators before each position; a [SEP] belongs to the
+  // segment it ends
+  torch::Tensor isSeparator = (inputIds == separatorId).to(torch::kInt64);
+  torch::Tensor tokenTypeIds = isSeparator.cumsum(1) - isSeparator;
+  return tokenTypeIds.clamp_max(tokenTypeEmbeddings->weight.size(0) - 1);
 }
 
 torch::Tensor BertEmbeddingsImpl::forward(torch::Tensor inputIds) {
-  // inputIds shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH)
-  // TODO: detect presence of [SEP] and modify tokenTypeIds appropriately
-  torch::Tensor tokenTypeIds = torch::zeros_like(inputIds).cuda();
+  // inputIds shape: (BATCH_SIZE, SEQUENCE_LENGTH)
+  if (fused && !is_training() && !torch::GradMode::is_enabled()
+      && inputIds.device().is_cpu()
+      && wordEmbeddings->weight.scalar_type() == torch::kFloat) {
+    // Token types are counted inside the kernel
+    return kernels::fusedEmbeddings(
+      inputIds, wordEmbeddings->weight, positionEmbeddings->weight,
+      tokenTypeEmbeddings->weight, layerNorm->weight, layerNorm->bias,
+      separatorId, LAYER_NORM_EPS);
+  }
+
+  torch::Tensor tokenTypeIds = getTokenTypeIds(inputIds);
 
-  torch::Tensor positionIds = torch::arange(
-    MAX_SEQUENCE_LENGTH,
-    torch::TensorOptions().dtype(torch::kInt64)
-  ).cuda().unsqueeze(0).expand_as(inputIds);
+  // Batches may be trimmed to their longest row, so use the actual length
+  torch::Tensor positions = positionIds.slice(1, 0, inputIds.size(1)).expand_as(inputIds);
 
   torch::Tensor wordEmbed = wordEmbeddings->forward(inputIds);
-  torch::Tensor posEmbed = positionEmbeddings->forward(positionIds);
+  torch::Tensor posEmbed = positionEmbeddings->forward(positions);
   torch::Tensor tokEmbed = tokenTypeEmbeddings->forward(tokenTypeIds);
-  // output / *Embed shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
+  // output / *Embed shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
   torch::Tensor output = wordEmbed + posEmbed + tokEmbed;
 
   output = layerNorm->forward(output);
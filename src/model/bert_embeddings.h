@@ -4,6 +4,7 @@
 #include <torch/nn/modules/dropout.h>
 #include <torch/nn/modules/embedding.h>
 #include <torch/nn/modules/normalization.h>
+#include <torch/serialize/input-archive.h>
 #include <torch/types.h>
 
 #include "config.h"
@@ -13,12 +14,33 @@ class BertEmbeddingsImpl : public torch::nn::Module {
     BertEmbeddingsImpl();
     explicit BertEmbeddingsImpl(Config const &config);
     torch::Tensor forward(torch::Tensor inputIds);
+    // Checkpoints saved before the index buffers were registered lack them,
+    // they keep their constructed values then
+    void load(torch::serialize::InputArchive& archive) override;
+    // Keep the index buffers int64 when the parameters change dtype
+    using torch::nn::Module::to;
+    void to(torch::Device device, torch::Dtype dtype, bool nonBlocking = false) override;
+    void to(torch::Dtype dtype, bool nonBlocking = false) override;
+
+    // Id of the [SEP] token. Token type ids are derived from it: tokens up
+    // to and including the first [SEP] get type 0, the rest type 1.
+    // Negative for type 0 everywhere
+    long separatorId = -1;
+    // Use the fused gather + sum + LayerNorm kernel for CPU inference
+    // (eval mode, no gradients, float32)
+    bool fused = FUSED_EMBEDDINGS;
   private:
+    torch::Tensor getTokenTypeIds(torch::Tensor inputIds);
+    void resetIndexBuffers();
     torch::nn::Embedding wordEmbeddings{nullptr},
                          positionEmbeddings{nullptr},
                          tokenTypeEmbeddings{nullptr};
     torch::nn::LayerNorm layerNorm{nullptr};
     torch::nn::Dropout dropout{nullptr};
+    // Precomputed index tensors, registered as buffers so that to(device)
+    // moves them with the parameters
+    // shape: (1, MAX_POSITION_EMBEDDINGS)
+    torch::Tensor positionIds, zeroTokenTypeIds;
 }; TORCH_MODULE(BertEmbeddings);
 
 #endif
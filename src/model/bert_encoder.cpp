@@ -1,6 +1,9 @@
 #include "bert_encoder.h"
 
+#include <torch/autograd.h>
+
 #include "bert_layer.h"
+#include "checkpoint.h"
 
 BertEncoderImpl::BertEncoderImpl() {}
 BertEncoderImpl::BertEncoderImpl(Config const &config)
@@ -11,12 +14,51 @@ BertEncoderImpl::BertEncoderImpl(Config const &config)
   register_module("layer", layer);
 }
 
+long BertEncoderImpl::getNumLayers() const {
+  return numLayers;
+}
+
+std::shared_ptr<BertLayerImpl> BertEncoderImpl::getLayer(long i) {
+  return layer->ptr<BertLayerImpl>(i);
+}
+
 torch::Tensor BertEncoderImpl::forward(torch::Tensor hiddenStates,
-                                       torch::Tensor attentionMask) {
-  // hiddenState shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
-  // attentionMask shape: (BATCH_SIZE, 1, 1, MAX_SEQUENCE_LENGTH)
-  for (const auto &module : *layer) {
-    hiddenStates = module->as<BertLayer>()->forward(hiddenStates, attentionMask);
+                                       torch::Tensor attentionMask,
+                                       const PackingInfo* packing) {
+  return forwardLayers(hiddenStates, attentionMask, 0, numLayers, packing);
+}
+
+torch::Tensor BertEncoderImpl::forwardLayers(torch::Tensor hiddenStates,
+                                             torch::Tensor attentionMask,
+                                             long begin, long end,
+                                             const PackingInfo* packing) {
+  // hiddenState shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  // attentionMask shape: (BATCH_SIZE, 1, 1, SEQUENCE_LENGTH)
+  bool useCheckpoints = checkpointLayers > 0 && is_training()
+                        && torch::GradMode::is_enabled()
+                        && hiddenStates.requires_grad();
+  long tailBegin = clsOnlyLayers > 0 ? static_cast<long>(numLayers) - clsOnlyLayers
+                                     : static_cast<long>(numLayers);
+  for (long i = begin; i < end; i++) {
+    std::shared_ptr<BertLayerImpl> bertLayer = layer->ptr<BertLayerImpl>(i);
+    if (i >= tailBegin) {
+      TORCH_CHECK(packing == nullptr, "CLS-only layers need unpacked inputs");
+      // shape: (BATCH_SIZE, 1, HIDDEN_SIZE)
+      torch::Tensor firstToken = bertLayer->forwardFirstToken(hiddenStates, attentionMask);
+      hiddenStates = torch::cat({firstToken, hiddenStates.narrow(1, 1, hiddenStates.size(1) - 1)}, 1);
+    } else if (useCheckpoints && (i % checkpointLayers == 0)) {
+      // The packing info may not outlive this call, keep a copy for the
+      // recomputation
+      std::shared_ptr<PackingInfo> packingCopy;
+      if (packing != nullptr) packingCopy = std::make_shared<PackingInfo>(*packing);
+      hiddenStates = checkpoint(
+        [bertLayer, attentionMask, packingCopy](torch::Tensor input) {
+          return bertLayer->forward(input, attentionMask, packingCopy.get());
+        },
+        hiddenStates);
+    } else {
+      hiddenStates = bertLayer->forward(hiddenStates, attentionMask, packing);
+    }
   }
   return hiddenStates;
 }
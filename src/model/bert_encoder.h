@@ -5,13 +5,37 @@
 #include <torch/types.h>
 
 #include "config.h"
+#include "bert_layer.h"
+#include "packing.h"
 
 class BertEncoderImpl : public torch::nn::Module {
   public:
     BertEncoderImpl();
     explicit BertEncoderImpl(Config const &config);
+    // If packing is given, hiddenStates are packed (TOTAL_TOKENS, HIDDEN_SIZE)
     torch::Tensor forward(torch::Tensor hiddenStates,
-                          torch::Tensor attentionMask);
+                          torch::Tensor attentionMask,
+                          const PackingInfo* packing = nullptr);
+    // Run only the layers [begin, end)
+    torch::Tensor forwardLayers(torch::Tensor hiddenStates,
+                                torch::Tensor attentionMask,
+                                long begin, long end,
+                                const PackingInfo* packing = nullptr);
+    long getNumLayers() const;
+    std::shared_ptr<BertLayerImpl> getLayer(long i);
+
+    // If positive, every checkpointLayers-th layer (starting from the
+    // first) does not keep its activations while training; its forward
+    // pass is recomputed during backward
+    int checkpointLayers = 0;
+
+    // If positive, the last clsOnlyLayers layers compute the first ([CLS])
+    // position only; the other positions of the output are those of the
+    // input to these layers. With one layer this is exact for [CLS]; with
+    // more, the keys and values of the earlier tail layers are computed from
+    // stale states, which approximates the full model for faster inference.
+    // Tail layers need unpacked hidden states
+    int clsOnlyLayers = 0;
 	private:
 		torch::nn::ModuleList layer{nullptr};
     size_t numLayers;
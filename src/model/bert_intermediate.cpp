@@ -1,19 +1,34 @@
 #include "bert_intermediate.h"
 
+#include "kernels.h"
+
 BertIntermediateImpl::BertIntermediateImpl() {}
 BertIntermediateImpl::BertIntermediateImpl(Config const &config)
-  : dense (torch::nn::Linear(config.hiddenSize, config.intermediateSize)) {
+  : dense (QuantizableLinear(config.hiddenSize, config.intermediateSize)) {
   register_module("dense", dense);
 }
 
 torch::Tensor BertIntermediateImpl::forward(torch::Tensor hiddenStates) {
-  // hiddenStates before shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
-  hiddenStates = dense->forward(hiddenStates);
-  // hiddenStates after shape:
-  //   (BATCH_SIZE, MAX_SEQUENCE_LENGTH, INTERMEDIATE_SIZE)
-  hiddenStates = torch::gelu(hiddenStates);
+  // hiddenStates before shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  if (fused && hiddenStates.device().is_cpu()
+      && hiddenStates.scalar_type() == torch::kFloat) {
+    // The bias is added by the kernel
+    hiddenStates = kernels::biasGelu(dense->forwardWithoutBias(hiddenStates), dense->bias);
+  } else {
+    hiddenStates = dense->forward(hiddenStates);
+    // hiddenStates after shape:
+    //   (BATCH_SIZE, SEQUENCE_LENGTH, INTERMEDIATE_SIZE)
+    hiddenStates = torch::gelu(hiddenStates);
+  }
+  if (neuronMask.defined()) hiddenStates = hiddenStates * neuronMask;
   return hiddenStates;
 }
 
+void BertIntermediateImpl::pruneNeurons(const torch::Tensor& keep) {
+  dense->selectOutputFeatures(keep);
+  neuronMask = torch::Tensor();
+}
 
-
+long BertIntermediateImpl::getIntermediateSize() const {
+  return dense->options.out_features();
+}
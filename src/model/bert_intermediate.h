@@ -1,18 +1,29 @@
 #ifndef BERT_INTERMEDIATE_H
 #define BERT_INTERMEDIATE_H
 #include <torch/nn/module.h>
-#include <torch/nn/modules/linear.h>
 #include <torch/types.h>
 
 #include "config.h"
+#include "quantizable_linear.h"
 
 class BertIntermediateImpl : public torch::nn::Module {
   public:
     BertIntermediateImpl();
     explicit BertIntermediateImpl(Config const &config);
     torch::Tensor forward(torch::Tensor hiddenStates);
+
+    // Add the bias and apply GELU in one pass with the fused CPU kernel
+    // (float32 inputs on the CPU only)
+    bool fused = FUSED_EPILOGUE;
+
+    // Keep only some intermediate neurons, given by index
+    void pruneNeurons(const torch::Tensor& keep);
+    long getIntermediateSize() const;
+    // If defined, shape: (INTERMEDIATE_SIZE), scales the activation of each
+    // neuron. The gradient w.r.t. it scores the neurons for pruning
+    torch::Tensor neuronMask;
   private:
-    torch::nn::Linear dense{nullptr};
+    QuantizableLinear dense{nullptr};
 }; TORCH_MODULE(BertIntermediate);
 
 #endif
@@ -11,17 +11,51 @@ BertLayerImpl::BertLayerImpl(Config const &config)
 }
 
 torch::Tensor BertLayerImpl::forward(torch::Tensor hiddenStates,
-                                     torch::Tensor attentionMask) {
-  // inputIds shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH) (non-embedded ids)
-  // attentionMask shape: (BATCH_SIZE, 1, 1, MAX_SEQUENCE_LENGTH)
-  // attentionOutputs shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
-  torch::Tensor attentionOutputs = attention->forward(hiddenStates, attentionMask);
+                                     torch::Tensor attentionMask,
+                                     const PackingInfo* packing) {
+  // inputIds shape: (BATCH_SIZE, SEQUENCE_LENGTH) (non-embedded ids)
+  // attentionMask shape: (BATCH_SIZE, 1, 1, SEQUENCE_LENGTH)
+  // attentionOutputs shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  //   or (TOTAL_TOKENS, HIDDEN_SIZE) if packed; the remaining layers are
+  //   position-wise and run on either shape
+  torch::Tensor attentionOutputs = attention->forward(hiddenStates, attentionMask, packing);
 
   // intermediateOutput shape:
-  //   (BATCH_SIZE, MAX_SEQUENCE_LENGTH, INTERMEDIATE_SIZE)
+  //   (BATCH_SIZE, SEQUENCE_LENGTH, INTERMEDIATE_SIZE)
   torch::Tensor intermediateOutput = intermediate->forward(attentionOutputs);
 
-  // layerOutput shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
+  // layerOutput shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
   torch::Tensor layerOutput = output->forward(intermediateOutput, attentionOutputs);
   return layerOutput;
 }
+
+torch::Tensor BertLayerImpl::forwardFirstToken(torch::Tensor hiddenStates,
+                                               torch::Tensor attentionMask) {
+  // The feed-forward block runs on a single position per sequence
+  // shape: (BATCH_SIZE, 1, HIDDEN_SIZE)
+  torch::Tensor attentionOutputs = attention->forwardFirstToken(hiddenStates, attentionMask);
+  torch::Tensor intermediateOutput = intermediate->forward(attentionOutputs);
+  return output->forward(intermediateOutput, attentionOutputs);
+}
+
+void BertLayerImpl::pruneHeads(const torch::Tensor& keepHeads) {
+  attention->pruneHeads(keepHeads);
+}
+
+void BertLayerImpl::pruneNeurons(const torch::Tensor& keepNeurons) {
+  intermediate->pruneNeurons(keepNeurons);
+  output->pruneInputs(keepNeurons);
+}
+
+long BertLayerImpl::getNumHeads() const {
+  return attention->getNumHeads();
+}
+
+long BertLayerImpl::getIntermediateSize() const {
+  return intermediate->getIntermediateSize();
+}
+
+void BertLayerImpl::setImportanceMasks(torch::Tensor headMask, torch::Tensor neuronMask) {
+  attention->setHeadMask(headMask);
+  intermediate->neuronMask = neuronMask;
+}
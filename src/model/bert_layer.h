@@ -7,13 +7,33 @@
 #include "bert_intermediate.h"
 #include "bert_output.h"
 #include "config.h"
+#include "packing.h"
 
 class BertLayerImpl : public torch::nn::Module {
   public:
     BertLayerImpl();
     explicit BertLayerImpl(Config const &config);
+    // If packing is given, hiddenStates are packed (TOTAL_TOKENS, HIDDEN_SIZE)
     torch::Tensor forward(torch::Tensor hiddenStates,
-                          torch::Tensor attentionMask);
+                          torch::Tensor attentionMask,
+                          const PackingInfo* packing = nullptr);
+    // Compute the output for the first ([CLS]) position only. Its attention
+    // still reads the keys and values of every position, so the result
+    // equals forward(hiddenStates, attentionMask)[:, :1]
+    // hiddenStates shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE), unpacked
+    // output shape: (BATCH_SIZE, 1, HIDDEN_SIZE)
+    torch::Tensor forwardFirstToken(torch::Tensor hiddenStates,
+                                    torch::Tensor attentionMask);
+
+    // Structured pruning, see `bert prune`: keep only some attention heads
+    // or intermediate (feed-forward) neurons, given by index
+    void pruneHeads(const torch::Tensor& keepHeads);
+    void pruneNeurons(const torch::Tensor& keepNeurons);
+    long getNumHeads() const;
+    long getIntermediateSize() const;
+    // Scale each head's context and each intermediate neuron by these masks,
+    // shapes: (NUM_HEADS), (INTERMEDIATE_SIZE). Undefined tensors remove them
+    void setImportanceMasks(torch::Tensor headMask, torch::Tensor neuronMask);
   private:
     BertAttention attention{nullptr};
     BertIntermediate intermediate{nullptr};
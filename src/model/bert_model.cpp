@@ -1,5 +1,7 @@
 #include "bert_model.h"
 
+#include <algorithm>
+
 BertModelImpl::BertModelImpl() {}
 BertModelImpl::BertModelImpl(Config const &config)
   : embeddings (BertEmbeddings(config)),
@@ -8,9 +10,34 @@ BertModelImpl::BertModelImpl(Config const &config)
   register_module("encoder", encoder);
 }
 
-torch::Tensor BertModelImpl::forward(torch::Tensor inputIds) {
-  // inputIds shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH) (non-embedded ids)
+void BertModelImpl::setSeparatorId(long separatorId) {
+  embeddings->separatorId = separatorId;
+}
+
+void BertModelImpl::setCheckpointLayers(int checkpointLayers) {
+  encoder->checkpointLayers = checkpointLayers;
+}
+
+void BertModelImpl::setClsOnlyLayers(int clsOnlyLayers) {
+  encoder->clsOnlyLayers = std::min<long>(clsOnlyLayers, getNumLayers());
+}
+
+long BertModelImpl::getNumLayers() const {
+  return encoder->getNumLayers();
+}
 
+std::shared_ptr<BertLayerImpl> BertModelImpl::getLayer(long i) {
+  return encoder->getLayer(i);
+}
+
+torch::Tensor BertModelImpl::embed(torch::Tensor inputIds) {
+  // inputIds shape: (BATCH_SIZE, SEQUENCE_LENGTH) (non-embedded ids)
+  return embeddings(inputIds);
+}
+
+torch::Tensor BertModelImpl::forwardLayers(torch::Tensor hiddenStates,
+                                           torch::Tensor inputIds,
+                                           long begin, long end) {
   // The attention mask is going to be added to the raw scores before the
   // softmax, so we will subtract 10,000 from the embedding for  inputs that
   // are padded
@@ -18,13 +45,28 @@ torch::Tensor BertModelImpl::forward(torch::Tensor inputIds) {
     inputIds == PADDING_IDX,
     torch::full_like(inputIds, -10000.0f), // To ignore
     torch::full_like(inputIds, 0.0f) // To attend
-  ).cuda(); // shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH)
+  ); // shape: (BATCH_SIZE, SEQUENCE_LENGTH), on the device of inputIds
 
-  // Convert attentionMask to (BATCH_SIZE, 1, 1, MAX_SEQUENCE_LENGTH)
+  // Convert attentionMask to (BATCH_SIZE, 1, 1, SEQUENCE_LENGTH)
   attentionMask  = attentionMask.unsqueeze(1).unsqueeze(2);
 
-  // shapes: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE) (embedded ids)
-  torch::Tensor embeddingOutput = embeddings(inputIds);
-  torch::Tensor encoderOutputs = encoder(embeddingOutput, attentionMask);
-  return encoderOutputs;
+  // The CLS-only tail of the encoder runs unpacked
+  long tailBegin = std::max(begin, std::min(end, getNumLayers() - encoder->clsOnlyLayers));
+
+  if (packed && begin < tailBegin) {
+    // Gather the real tokens to (TOTAL_TOKENS, HIDDEN_SIZE)
+    PackingInfo packing = getPackingInfo(inputIds);
+    torch::Tensor encoderOutputs = encoder->forwardLayers(
+      pack(hiddenStates, packing), attentionMask, begin, tailBegin, &packing);
+    hiddenStates = unpack(encoderOutputs, packing);
+    begin = tailBegin;
+  }
+  return encoder->forwardLayers(hiddenStates, attentionMask, begin, end);
+}
+
+torch::Tensor BertModelImpl::forward(torch::Tensor inputIds) {
+  // inputIds shape: (BATCH_SIZE, SEQUENCE_LENGTH) (non-embedded ids)
+  // shapes: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE) (embedded ids)
+  torch::Tensor embeddingOutput = embed(inputIds);
+  return forwardLayers(embeddingOutput, inputIds, 0, getNumLayers());
 }
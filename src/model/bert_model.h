@@ -13,6 +13,37 @@ class BertModelImpl : public torch::nn::Module {
     BertModelImpl();
     explicit BertModelImpl(Config const &config);
     torch::Tensor forward(torch::Tensor inputIds);
+
+    // The forward pass in steps, e.g. to stop early:
+    //   forwardLayers(embed(inputIds), inputIds, 0, getNumLayers())
+    // is equivalent to forward(inputIds)
+    // output shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+    torch::Tensor embed(torch::Tensor inputIds);
+    // Run the encoder layers [begin, end) on the output of embed() or of a
+    // previous forwardLayers() call for the same inputIds
+    torch::Tensor forwardLayers(torch::Tensor hiddenStates,
+                                torch::Tensor inputIds,
+                                long begin, long end);
+    long getNumLayers() const;
+    // An encoder layer, e.g. to prune it
+    std::shared_ptr<BertLayerImpl> getLayer(long i);
+
+    // Run the position-wise layers of the encoder on the non-padding tokens
+    // only (padding-free "packed" execution). The output is scattered back to
+    // (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE) with zeros at the padding
+    bool packed = false;
+
+    // Derive the token type ids from the positions of this [SEP] token id,
+    // see BertEmbeddingsImpl::separatorId
+    void setSeparatorId(long separatorId);
+
+    // Recompute every N-th encoder layer during backward instead of keeping
+    // its activations, see BertEncoderImpl::checkpointLayers
+    void setCheckpointLayers(int checkpointLayers);
+
+    // Compute only the [CLS] position in the last N encoder layers, for
+    // models without token-level heads. See BertEncoderImpl::clsOnlyLayers
+    void setClsOnlyLayers(int clsOnlyLayers);
   private:
     BertEmbeddings embeddings{nullptr};
     BertEncoder encoder{nullptr};
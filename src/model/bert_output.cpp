@@ -1,8 +1,10 @@
 #include "bert_output.h"
 
+#include "kernels.h"
+
 BertOutputImpl::BertOutputImpl() {}
 BertOutputImpl::BertOutputImpl(Config const &config)
-  : dense (torch::nn::Linear(config.intermediateSize, config.hiddenSize)),
+  : dense (QuantizableLinear(config.intermediateSize, config.hiddenSize)),
     layerNorm (torch::nn::LayerNormOptions({config.hiddenSize}).eps(LAYER_NORM_EPS)),
     dropout (torch::nn::Dropout(config.hiddenDropoutProb)) {
   register_module("dense", dense);
@@ -12,10 +14,22 @@ BertOutputImpl::BertOutputImpl(Config const &config)
 
 torch::Tensor BertOutputImpl::forward(torch::Tensor hiddenStates,
                                       torch::Tensor inputTensor) {
-  // hiddenStates shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
+  // hiddenStates shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  if (fused && hiddenStates.device().is_cpu()
+      && hiddenStates.scalar_type() == torch::kFloat) {
+    // The bias is added by the kernel
+    return kernels::biasDropoutResidualLayerNorm(
+      dense->forwardWithoutBias(hiddenStates), dense->bias, inputTensor,
+      layerNorm->weight, layerNorm->bias, dropout->options.p(), is_training(),
+      LAYER_NORM_EPS);
+  }
   hiddenStates = dense->forward(hiddenStates);
   hiddenStates = dropout->forward(hiddenStates);
   hiddenStates = layerNorm->forward(hiddenStates + inputTensor);
 
   return hiddenStates;
 }
+
+void BertOutputImpl::pruneInputs(const torch::Tensor& keep) {
+  dense->selectInputFeatures(keep);
+}
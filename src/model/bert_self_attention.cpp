@@ -2,15 +2,19 @@
 
 #include <cmath>
 
+#include <torch/autograd.h>
+
+#include "kernels.h"
+
 BertSelfAttentionImpl::BertSelfAttentionImpl() {}
 
 BertSelfAttentionImpl::BertSelfAttentionImpl(Config const &config)
   : numAttentionHeads (config.numAttentionHeads),
-    hiddenSize (config.hiddenSize),
+    allHeadSize (config.hiddenSize),
     attentionHeadSize (config.hiddenSize / config.numAttentionHeads),
-    query (torch::nn::Linear(config.hiddenSize, config.hiddenSize)),
-    key (torch::nn::Linear(config.hiddenSize, config.hiddenSize)),
-    value (torch::nn::Linear(config.hiddenSize, config.hiddenSize)),
+    query (QuantizableLinear(config.hiddenSize, config.hiddenSize)),
+    key (QuantizableLinear(config.hiddenSize, config.hiddenSize)),
+    value (QuantizableLinear(config.hiddenSize, config.hiddenSize)),
     dropout(torch::nn::Dropout(config.attentionDropoutProb)) {
 
   register_module("query", query);
@@ -24,19 +28,73 @@ torch::Tensor BertSelfAttentionImpl::transposeForScores(torch::Tensor x) {
   return x.permute({0, 2, 1, 3});
 }
 
-torch::Tensor BertSelfAttentionImpl::forward(torch::Tensor hiddenStates,
-                                             torch::Tensor attentionMask) {
-  // hiddenStates shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
+void BertSelfAttentionImpl::train(bool on) {
+  torch::nn::Module::train(on);
+  qkvWeight = torch::Tensor();
+  qkvBias = torch::Tensor();
+  qkvScale = torch::Tensor();
+}
 
-  // q,k,v layers shape:
-  //   (BATCH_SIZE, NUM_LAYERS, MAX_SEQUENCE_LENGTH, NUM_ATTENTION_HEADS)
-  torch::Tensor queryLayer = transposeForScores(query->forward(hiddenStates));
-  torch::Tensor keyLayer = transposeForScores(key->forward(hiddenStates));
-  torch::Tensor valueLayer = transposeForScores(value->forward(hiddenStates));
+torch::Tensor BertSelfAttentionImpl::pruneHeads(const torch::Tensor& keepHeads) {
+  // Features h * attentionHeadSize ... (h + 1) * attentionHeadSize - 1 of
+  // every kept head h
+  torch::Tensor heads = keepHeads.to(torch::kInt64).cpu();
+  torch::Tensor features = (heads.unsqueeze(1) * attentionHeadSize
+                            + torch::arange(attentionHeadSize, torch::kInt64)).view({-1});
+  query->selectOutputFeatures(features);
+  key->selectOutputFeatures(features);
+  value->selectOutputFeatures(features);
+  numAttentionHeads = heads.size(0);
+  allHeadSize = numAttentionHeads * attentionHeadSize;
+  qkvWeight = torch::Tensor();
+  qkvBias = torch::Tensor();
+  qkvScale = torch::Tensor();
+  headMask = torch::Tensor();
+  return features;
+}
+
+long BertSelfAttentionImpl::getNumHeads() const {
+  return numAttentionHeads;
+}
+
+torch::Tensor BertSelfAttentionImpl::fusedForward(torch::Tensor hiddenStates,
+                                                  torch::Tensor attentionMask,
+                                                  const PackingInfo* packing) {
+  bool quantized = query->isQuantized();
+  if (!qkvWeight.defined() || qkvWeight.device() != query->bias.device()
+      || quantized != (qkvWeight.scalar_type() == torch::kChar)) {
+    if (quantized) {
+      // Weights are quantized per row, so the rows can be concatenated too
+      qkvWeight = torch::cat({query->weightInt8, key->weightInt8, value->weightInt8}, 0);
+      qkvScale = torch::cat({query->weightScale, key->weightScale, value->weightScale}, 0);
+    } else {
+      qkvWeight = torch::cat({query->weight, key->weight, value->weight}, 0);
+    }
+    qkvBias = torch::cat({query->bias, key->bias, value->bias}, 0);
+  }
+  // One GEMM for the three projections
+  // shape: (BATCH_SIZE, SEQUENCE_LENGTH, 3 * HIDDEN_SIZE)
+  //   or (TOTAL_TOKENS, 3 * HIDDEN_SIZE) if packed
+  torch::Tensor qkv = quantized
+    ? kernels::int8Linear(hiddenStates, qkvWeight, qkvScale, qkvBias)
+    : torch::linear(hiddenStates, qkvWeight, qkvBias);
+  if (packing != nullptr) qkv = unpack(qkv, *packing);
+
+  // shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  torch::Tensor contextLayer = kernels::fusedAttention(
+    qkv, attentionMask, numAttentionHeads, 1.0f / std::sqrt(attentionHeadSize));
+
+  if (packing != nullptr) contextLayer = pack(contextLayer, *packing);
+  return contextLayer;
+}
 
+torch::Tensor BertSelfAttentionImpl::attend(torch::Tensor queryLayer,
+                                            torch::Tensor keyLayer,
+                                            torch::Tensor valueLayer,
+                                            torch::Tensor attentionMask) {
   // Take the dot product between "query" and "key" to get the raw attention
-  // scores for each layer
-  // shape: (BATCH_SIZE, NUM_LAYERS, MAX_SEQUENCE_LENGTH, MAX_SEQUENCE_LENGTH)
+  // scores for each layer. There may be fewer queries than keys
+  // shape: (BATCH_SIZE, NUM_LAYERS, SEQUENCE_LENGTH, SEQUENCE_LENGTH)
   torch::Tensor attentionScores = torch::matmul(queryLayer, keyLayer.transpose(-1, -2));
   attentionScores /= std::sqrt(attentionHeadSize);
 
@@ -47,17 +105,68 @@ torch::Tensor BertSelfAttentionImpl::forward(torch::Tensor hiddenStates,
   attentionProbs = dropout->forward(attentionProbs);
 
   // Batch matrix multiplication for each sample and layer
-  //   (MAX_SEQUENCE_LENGTH, MAX_SEQUENCE_LENGTH) ( attentionProbs)
-  //    @ (MAX_SEQUENCE_LENGTH, //   NUM_ATTENTION_HEADS) (valueLayer)
+  //   (SEQUENCE_LENGTH, SEQUENCE_LENGTH) ( attentionProbs)
+  //    @ (SEQUENCE_LENGTH, //   NUM_ATTENTION_HEADS) (valueLayer)
   //  contextLayer shape:
-  //   (BATCH_SIZE, NUM_LAYERS, MAX_SEQUENCE_LENGTH, NUM_ATTENTION_HEADS)
+  //   (BATCH_SIZE, NUM_LAYERS, SEQUENCE_LENGTH, NUM_ATTENTION_HEADS)
   torch::Tensor contextLayer = torch::matmul(attentionProbs, valueLayer);
+  if (headMask.defined()) contextLayer = contextLayer * headMask.view({1, -1, 1, 1});
 
-  // Move MAX_SEQUENCE_LENGTH dimension after BATCH_SIZE:
-  //   (BATCH_SIZE, MAX_SEQUENCE_LENGTH, NUM_LAYERS, NUM_ATTENTION_HEADS)
+  // Move SEQUENCE_LENGTH dimension after BATCH_SIZE:
+  //   (BATCH_SIZE, SEQUENCE_LENGTH, NUM_LAYERS, NUM_ATTENTION_HEADS)
   contextLayer = contextLayer.permute({0, 2, 1, 3});
 
-  // View as (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
-  contextLayer = contextLayer.reshape({contextLayer.size(0), contextLayer.size(1), hiddenSize});
+  // View as (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  contextLayer = contextLayer.reshape({contextLayer.size(0), contextLayer.size(1), allHeadSize});
   return contextLayer;
 }
+
+torch::Tensor BertSelfAttentionImpl::forward(torch::Tensor hiddenStates,
+                                             torch::Tensor attentionMask,
+                                             const PackingInfo* packing) {
+  if (fused && !is_training() && !torch::GradMode::is_enabled() && !headMask.defined()
+      && hiddenStates.device().is_cpu()
+      && hiddenStates.scalar_type() == torch::kFloat) {
+    return fusedForward(hiddenStates, attentionMask, packing);
+  }
+
+  // hiddenStates shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  //   or (TOTAL_TOKENS, HIDDEN_SIZE) if packed
+  torch::Tensor queryStates = query->forward(hiddenStates);
+  torch::Tensor keyStates = key->forward(hiddenStates);
+  torch::Tensor valueStates = value->forward(hiddenStates);
+  if (packing != nullptr) {
+    // Projections were computed on the real tokens only, scatter them back
+    // to (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE) for the attention
+    queryStates = unpack(queryStates, *packing);
+    keyStates = unpack(keyStates, *packing);
+    valueStates = unpack(valueStates, *packing);
+  }
+
+  // q,k,v layers shape:
+  //   (BATCH_SIZE, NUM_LAYERS, SEQUENCE_LENGTH, NUM_ATTENTION_HEADS)
+  torch::Tensor queryLayer = transposeForScores(queryStates);
+  torch::Tensor keyLayer = transposeForScores(keyStates);
+  torch::Tensor valueLayer = transposeForScores(valueStates);
+
+  // shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  torch::Tensor contextLayer = attend(queryLayer, keyLayer, valueLayer, attentionMask);
+
+  // Back to (TOTAL_TOKENS, HIDDEN_SIZE) if packed
+  if (packing != nullptr) contextLayer = pack(contextLayer, *packing);
+  return contextLayer;
+}
+
+torch::Tensor BertSelfAttentionImpl::forwardFirstToken(torch::Tensor hiddenStates,
+                                                       torch::Tensor attentionMask) {
+  // Queries for the first position only, keys and values for all of them
+  // shape: (BATCH_SIZE, NUM_LAYERS, 1, NUM_ATTENTION_HEADS)
+  torch::Tensor queryLayer = transposeForScores(
+    query->forward(hiddenStates.narrow(1, 0, 1)));
+  // shape: (BATCH_SIZE, NUM_LAYERS, SEQUENCE_LENGTH, NUM_ATTENTION_HEADS)
+  torch::Tensor keyLayer = transposeForScores(key->forward(hiddenStates));
+  torch::Tensor valueLayer = transposeForScores(value->forward(hiddenStates));
+
+  // shape: (BATCH_SIZE, 1, HIDDEN_SIZE)
+  return attend(queryLayer, keyLayer, valueLayer, attentionMask);
+}
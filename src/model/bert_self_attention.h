@@ -2,22 +2,61 @@
 #define BERT_SELF_ATTENTION_H
 #include <torch/nn/module.h>
 #include <torch/nn/modules/dropout.h>
-#include <torch/nn/modules/linear.h>
 #include <torch/types.h>
 
 #include "config.h"
+#include "packing.h"
+#include "quantizable_linear.h"
 
 class BertSelfAttentionImpl : public torch::nn::Module {
   public:
     BertSelfAttentionImpl();
     explicit BertSelfAttentionImpl(Config const &config);
+    // If packing is given, hiddenStates are packed (TOTAL_TOKENS, HIDDEN_SIZE)
+    // and so is the output; the batch is unpacked only for the attention
     torch::Tensor forward(torch::Tensor hiddenStates,
-                          torch::Tensor attentionMask);
+                          torch::Tensor attentionMask,
+                          const PackingInfo* packing = nullptr);
+    // Attend from the first position only, to all positions
+    // hiddenStates shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE), unpacked
+    // output shape: (BATCH_SIZE, 1, HIDDEN_SIZE)
+    torch::Tensor forwardFirstToken(torch::Tensor hiddenStates,
+                                    torch::Tensor attentionMask);
+    // Drops the cached fused weights, parameters may change while training
+    void train(bool on = true) override;
+
+    // Keep only some attention heads, given by index. Returns the indices of
+    // the kept query/key/value features, i.e. of the context features
+    torch::Tensor pruneHeads(const torch::Tensor& keepHeads);
+    long getNumHeads() const;
+    // If defined, shape: (NUM_ATTENTION_HEADS), scales the context of each
+    // head. The gradient w.r.t. it scores the heads for pruning. Forces the
+    // unfused path
+    torch::Tensor headMask;
+
+    // Use the fused QKV projection and attention kernel for CPU inference
+    // (eval mode, no gradients, float32). Training and other devices always
+    // run the unfused path
+    bool fused = FUSED_ATTENTION;
   private:
     torch::Tensor transposeForScores(torch::Tensor x);
-    torch::nn::Linear query{nullptr}, key{nullptr}, value{nullptr};
+    torch::Tensor attend(torch::Tensor queryLayer,
+                         torch::Tensor keyLayer,
+                         torch::Tensor valueLayer,
+                         torch::Tensor attentionMask);
+    torch::Tensor fusedForward(torch::Tensor hiddenStates,
+                               torch::Tensor attentionMask,
+                               const PackingInfo* packing);
+    QuantizableLinear query{nullptr}, key{nullptr}, value{nullptr};
     torch::nn::Dropout dropout{nullptr};
-    int numAttentionHeads, hiddenSize, attentionHeadSize;
+    // allHeadSize is NUM_ATTENTION_HEADS * attentionHeadSize, HIDDEN_SIZE
+    // unless heads were pruned
+    int numAttentionHeads, allHeadSize, attentionHeadSize;
+    // Concatenated query/key/value weights, built from the parameters on
+    // first use and not registered, so checkpoints keep the three Linears
+    // shape: (3 * HIDDEN_SIZE, HIDDEN_SIZE), (3 * HIDDEN_SIZE)
+    // The weight is int8, with per-row qkvScale, if the Linears are quantized
+    torch::Tensor qkvWeight, qkvBias, qkvScale;
 }; TORCH_MODULE(BertSelfAttention);
 
 #endif
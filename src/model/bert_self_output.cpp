@@ -1,9 +1,11 @@
 #include "bert_self_output.h"
 
+#include "kernels.h"
+
 BertSelfOutputImpl::BertSelfOutputImpl() {}
 
 BertSelfOutputImpl::BertSelfOutputImpl(Config const &config)
-  : dense (torch::nn::Linear(config.hiddenSize, config.hiddenSize)),
+  : dense (QuantizableLinear(config.hiddenSize, config.hiddenSize)),
     layerNorm (torch::nn::LayerNormOptions({config.hiddenSize}).eps(LAYER_NORM_EPS)),
     dropout (torch::nn::Dropout(config.hiddenDropoutProb)) {
   register_module("dense", dense);
@@ -13,7 +15,15 @@ BertSelfOutputImpl::BertSelfOutputImpl(Config const &config)
 
 torch::Tensor BertSelfOutputImpl::forward(torch::Tensor hiddenStates,
                                           torch::Tensor inputTensor) {
-  // hiddenStates shape: (BATCH_SIZE, MAX_SEQUENCE_LENGTH, HIDDEN_SIZE)
+  // hiddenStates shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+  if (fused && hiddenStates.device().is_cpu()
+      && hiddenStates.scalar_type() == torch::kFloat) {
+    // The bias is added by the kernel
+    return kernels::biasDropoutResidualLayerNorm(
+      dense->forwardWithoutBias(hiddenStates), dense->bias, inputTensor,
+      layerNorm->weight, layerNorm->bias, dropout->options.p(), is_training(),
+      LAYER_NORM_EPS);
+  }
   hiddenStates = dense->forward(hiddenStates);
   hiddenStates = dropout->forward(hiddenStates);
 
@@ -22,3 +32,7 @@ torch::Tensor BertSelfOutputImpl::forward(torch::Tensor hiddenStates,
 
   return hiddenStates;
 }
+
+void BertSelfOutputImpl::pruneInputs(const torch::Tensor& keep) {
+  dense->selectInputFeatures(keep);
+}
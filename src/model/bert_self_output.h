@@ -2,11 +2,11 @@
 #define BERT_SELF_OUTPUT_H
 #include <torch/nn/module.h>
 #include <torch/nn/modules/dropout.h>
-#include <torch/nn/modules/linear.h>
 #include <torch/nn/modules/normalization.h>
 #include <torch/types.h>
 
 #include "config.h"
+#include "quantizable_linear.h"
 
 class BertSelfOutputImpl : public torch::nn::Module {
   public:
@@ -14,8 +14,15 @@ class BertSelfOutputImpl : public torch::nn::Module {
     explicit BertSelfOutputImpl(Config const &config);
     torch::Tensor forward(torch::Tensor hiddenStates,
                           torch::Tensor inputTensor);
+
+    // Add the bias, dropout, residual and LayerNorm in one pass with the
+    // fused CPU kernel (float32 inputs on the CPU only)
+    bool fused = FUSED_EPILOGUE;
+
+    // Keep only some input features of the dense layer, given by index
+    void pruneInputs(const torch::Tensor& keep);
 	private:
-    torch::nn::Linear dense{nullptr};
+    QuantizableLinear dense{nullptr};
     torch::nn::LayerNorm layerNorm{nullptr};
     torch::nn::Dropout dropout{nullptr};
 }; TORCH_MODULE(BertSelfOutput);
@@ -0,0 +1,75 @@
+#include "checkpoint.h"
+
+#include <mutex>
+
+#include <ATen/Context.h>
+#include <torch/autograd.h>
+#include <ATen/core/ivalue.h>
+
+using torch::autograd::AutogradContext;
+using torch::autograd::variable_list;
+
+namespace {
+
+// Holds what is needed to recompute the forward pass until backward
+struct CheckpointState : torch::CustomClassHolder {
+  std::function<torch::Tensor(torch::Tensor)> function;
+  torch::Tensor rngState;
+};
+
+at::Generator getGenerator(const torch::Device& device) {
+  return at::globalContext().defaultGenerator(device);
+}
+
+struct CheckpointFunction : public torch::autograd::Function<CheckpointFunction> {
+  static torch::Tensor forward(AutogradContext* ctx,
+                               torch::Tensor input,
+                               std::function<torch::Tensor(torch::Tensor)> function) {
+    auto state = c10::make_intrusive<CheckpointState>();
+    state->function = function;
+    {
+      at::Generator generator = getGenerator(input.device());
+      std::lock_guard<std::mutex> lock(generator.mutex());
+      state->rngState = generator.get_state();
+    }
+    ctx->saved_data["state"] = c10::IValue::make_capsule(state);
+    ctx->save_for_backward({input});
+    // Gradients are disabled here, nothing inside `function` is kept
+    return function(input);
+  }
+
+  static variable_list backward(AutogradContext* ctx, variable_list gradOutputs) {
+    auto state = c10::static_intrusive_pointer_cast<CheckpointState>(
+      ctx->saved_data["state"].toCapsule());
+    torch::Tensor input = ctx->get_saved_variables()[0].detach().requires_grad_(true);
+
+    // Replay the forward pass with the random state it started from, then
+    // give the generator back its current state
+    at::Generator generator = getGenerator(input.device());
+    torch::Tensor currentRngState;
+    {
+      std::lock_guard<std::mutex> lock(generator.mutex());
+      currentRngState = generator.get_state();
+      generator.set_state(state->rngState);
+    }
+    torch::Tensor output;
+    {
+      torch::AutoGradMode enableGrad(true);
+      output = state->function(input);
+    }
+    {
+      std::lock_guard<std::mutex> lock(generator.mutex());
+      generator.set_state(currentRngState);
+    }
+
+    torch::autograd::backward({output}, {gradOutputs[0]});
+    return {input.grad(), torch::Tensor()};
+  }
+};
+
+}  // namespace
+
+torch::Tensor checkpoint(std::function<torch::Tensor(torch::Tensor)> function,
+                         torch::Tensor input) {
+  return CheckpointFunction::apply(input, function);
+}
@@ -0,0 +1,16 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <functional>
+
+#include <torch/types.h>
+
+// Activation (gradient) checkpointing.
+// Runs `function(input)` without recording its intermediate activations;
+// they are recomputed from `input` during the backward pass, with the
+// random number generator restored so that dropout masks are identical.
+// Gradients of the parameters used by `function` are accumulated into
+// their `.grad()` by the recomputation. The output is only differentiable
+// w.r.t. `input`, which should therefore require grad
+torch::Tensor checkpoint(std::function<torch::Tensor(torch::Tensor)> function,
+                         torch::Tensor input);
+#endif
@@ -2,7 +2,7 @@
 
 BinaryClassifierImpl::BinaryClassifierImpl() {};
 BinaryClassifierImpl::BinaryClassifierImpl(const BinaryClassifierOptions& options)
-  : dense (torch::nn::Linear(options.config.hiddenSize, options.numLabels)),
+  : dense (QuantizableLinear(options.config.hiddenSize, options.numLabels)),
     dropout (torch::nn::Dropout(options.config.hiddenDropoutProb)),
     pooler (BertPooler(options.config, !options.tokenLevel)),
     options (options) {
@@ -19,9 +19,13 @@ torch::Tensor BinaryClassifierImpl::forward(torch::Tensor hidden) {
   return output;
 }
 
+torch::Tensor BinaryClassifierImpl::pool(torch::Tensor hidden) {
+  return pooler->forward(hidden);
+}
+
 MulticlassClassifierImpl::MulticlassClassifierImpl() {};
 MulticlassClassifierImpl::MulticlassClassifierImpl(const MutliclassClassifierOptions& options)
-  : dense (torch::nn::Linear(options.config.hiddenSize, options.numClasses)),
+  : dense (QuantizableLinear(options.config.hiddenSize, options.numClasses)),
     dropout(torch::nn::Dropout(options.config.hiddenDropoutProb)),
     pooler (BertPooler(options.config, !options.tokenLevel)),
     options (options) {
@@ -33,3 +37,7 @@ MulticlassClassifierImpl::MulticlassClassifierImpl(const MutliclassClassifierOpt
 torch::Tensor MulticlassClassifierImpl::forward(torch::Tensor hidden) {
   return dense->forward(dropout->forward(pooler->forward(hidden)));
 }
+
+torch::Tensor MulticlassClassifierImpl::pool(torch::Tensor hidden) {
+  return pooler->forward(hidden);
+}
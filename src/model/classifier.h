@@ -2,11 +2,11 @@
 #define BINARY_CLASSIFIER_H
 #include <torch/nn/module.h>
 #include <torch/nn/modules/dropout.h>
-#include <torch/nn/modules/linear.h>
 #include <torch/types.h>
 
 #include "config.h"
 #include "bert_pooler.h"
+#include "quantizable_linear.h"
 
 struct BinaryClassifierOptions {
   Config config;
@@ -25,9 +25,11 @@ class BinaryClassifierImpl : public torch::nn::Module {
     BinaryClassifierImpl();
     explicit BinaryClassifierImpl(const BinaryClassifierOptions& options);
     torch::Tensor forward(torch::Tensor hidden);
+    // The output of the BertPooler only, e.g. as a sentence vector
+    torch::Tensor pool(torch::Tensor hidden);
     BinaryClassifierOptions options;
   private:
-    torch::nn::Linear dense{nullptr};
+    QuantizableLinear dense{nullptr};
     torch::nn::Dropout dropout{nullptr};
     BertPooler pooler{nullptr};
 }; TORCH_MODULE(BinaryClassifier);
@@ -37,9 +39,11 @@ class MulticlassClassifierImpl : public torch::nn::Module {
     MulticlassClassifierImpl();
     explicit MulticlassClassifierImpl(const MutliclassClassifierOptions& options);
     torch::Tensor forward(torch::Tensor hidden);
+    // The output of the BertPooler only, e.g. as a sentence vector
+    torch::Tensor pool(torch::Tensor hidden);
     MutliclassClassifierOptions options;
   private:
-    torch::nn::Linear dense{nullptr};
+    QuantizableLinear dense{nullptr};
     torch::nn::Dropout dropout{nullptr};
     BertPooler pooler{nullptr};
 }; TORCH_MODULE(MulticlassClassifier);
@@ -0,0 +1,73 @@
+#include "fused_heads.h"
+
+#include <algorithm>
+
+#include <torch/autograd.h>
+#include <torch/nn/modules/dropout.h>
+
+FusedHeadsImpl::FusedHeadsImpl() {}
+FusedHeadsImpl::FusedHeadsImpl(const std::vector<torch::nn::AnyModule>& heads)
+  : heads (heads) {
+  for (const auto& head : heads) {
+    auto params = head.ptr()->named_parameters();
+    long outputs = params["dense.weight"].size(0);
+    numOutputs.push_back(outputs);
+    // BinaryClassifier squeezes single-label outputs
+    squeezeOutputs.push_back(outputs == 1 && head.ptr()->name() == "BinaryClassifierImpl");
+    maxOutputs = std::max(maxOutputs, outputs);
+  }
+}
+
+void FusedHeadsImpl::concatenateWeights() {
+  std::vector<torch::Tensor> poolerWeights, poolerBiases, outputWeights, outputBiases;
+  for (size_t i = 0; i < heads.size(); i++) {
+    auto params = heads[i].ptr()->named_parameters();
+    poolerWeights.push_back(params["pooler.dense.weight"]);
+    poolerBiases.push_back(params["pooler.dense.bias"]);
+    // Zero-pad the output layers to the largest number of outputs
+    long padding = maxOutputs - numOutputs[i];
+    outputWeights.push_back(torch::constant_pad_nd(params["dense.weight"], {0, 0, 0, padding}));
+    outputBiases.push_back(torch::constant_pad_nd(params["dense.bias"], {0, padding}));
+  }
+  poolerWeight = torch::cat(poolerWeights, 0);
+  poolerBias = torch::cat(poolerBiases, 0);
+  outputWeight = torch::stack(outputWeights, 0);
+  outputBias = torch::stack(outputBiases, 0);
+}
+
+std::vector<torch::Tensor> FusedHeadsImpl::forward(torch::Tensor hidden) {
+  torch::nn::Module& firstHead = *heads[0].ptr();
+  bool training = firstHead.is_training();
+  // Parameters only change while training
+  bool cache = !training && !torch::GradMode::is_enabled();
+  if (!cache || !poolerWeight.defined()) concatenateWeights();
+
+  long numHeads = heads.size();
+  long batchSize = hidden.size(0);
+  long hiddenSize = hidden.size(2);
+
+  // [CLS] token, shape: (BATCH_SIZE, HIDDEN_SIZE)
+  torch::Tensor cls = hidden.select(1, 0);
+  // All the poolers, shape: (NUM_HEADS, BATCH_SIZE, HIDDEN_SIZE)
+  torch::Tensor pooled = torch::tanh(torch::linear(cls, poolerWeight, poolerBias));
+  pooled = pooled.view({batchSize, numHeads, hiddenSize}).transpose(0, 1);
+  double dropoutProb = firstHead.named_children()["dropout"]
+                         ->as<torch::nn::DropoutImpl>()->options.p();
+  pooled = torch::dropout(pooled, dropoutProb, training);
+
+  // All the output layers, shape: (NUM_HEADS, BATCH_SIZE, MAX_OUTPUTS)
+  torch::Tensor logits = torch::baddbmm(outputBias.unsqueeze(1), pooled,
+                                        outputWeight.transpose(1, 2));
+
+  std::vector<torch::Tensor> out;
+  for (long i = 0; i < numHeads; i++) {
+    torch::Tensor headLogits = logits[i].slice(1, 0, numOutputs[i]);
+    if (squeezeOutputs[i]) headLogits = headLogits.squeeze(-1);
+    out.push_back(headLogits);
+  }
+  if (!cache) {
+    // Do not keep the autograd graph of the concatenation alive
+    poolerWeight = poolerBias = outputWeight = outputBias = torch::Tensor();
+  }
+  return out;
+}
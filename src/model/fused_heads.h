@@ -0,0 +1,35 @@
+#ifndef FUSED_HEADS_H
+#define FUSED_HEADS_H
+#include <vector>
+
+#include <torch/nn/module.h>
+#include <torch/nn/modules/container/any.h>
+#include <torch/types.h>
+
+#include "config.h"
+
+// Runs several sentence-level BinaryClassifier/MulticlassClassifier heads
+// over the same hidden states as one GEMM for all the poolers and one
+// batched GEMM for all the output layers.
+// The heads keep owning their parameters, so they are trained, saved and
+// loaded as before; the concatenated weights are differentiable views of
+// them, cached outside of training
+class FusedHeadsImpl : public torch::nn::Module {
+  public:
+    FusedHeadsImpl();
+    explicit FusedHeadsImpl(const std::vector<torch::nn::AnyModule>& heads);
+    // hidden shape: (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+    // Returns the logits of each head, as its own forward() would
+    std::vector<torch::Tensor> forward(torch::Tensor hidden);
+  private:
+    void concatenateWeights();
+    std::vector<torch::nn::AnyModule> heads;
+    std::vector<long> numOutputs;
+    std::vector<bool> squeezeOutputs;
+    long maxOutputs = 0;
+    // shapes: (NUM_HEADS * HIDDEN_SIZE, HIDDEN_SIZE), (NUM_HEADS * HIDDEN_SIZE),
+    //   (NUM_HEADS, MAX_OUTPUTS, HIDDEN_SIZE), (NUM_HEADS, MAX_OUTPUTS)
+    torch::Tensor poolerWeight, poolerBias, outputWeight, outputBias;
+}; TORCH_MODULE(FusedHeads);
+
+#endif
@@ -0,0 +1,29 @@
+#include "packing.h"
+
+#include <vector>
+
+#include "config.h"
+
+PackingInfo getPackingInfo(torch::Tensor inputIds) {
+  return maskToPackingInfo(inputIds != PADDING_IDX);
+}
+
+PackingInfo maskToPackingInfo(torch::Tensor mask) {
+  torch::Tensor indices = mask.reshape({-1}).nonzero().squeeze(1);
+  return {indices, mask.size(0), mask.size(1)};
+}
+
+torch::Tensor pack(torch::Tensor padded, const PackingInfo& packing) {
+  return padded.flatten(0, 1).index_select(0, packing.indices);
+}
+
+torch::Tensor unpack(torch::Tensor packed, const PackingInfo& packing,
+                     double fillValue) {
+  std::vector<int64_t> sizes = packed.sizes().vec();
+  sizes[0] = packing.batchSize * packing.sequenceLength;
+  torch::Tensor padded = torch::full(sizes, fillValue, packed.options())
+    .index_copy(0, packing.indices, packed);
+  sizes[0] = packing.sequenceLength;
+  sizes.insert(sizes.begin(), packing.batchSize);
+  return padded.view(sizes);
+}
@@ -0,0 +1,33 @@
+#ifndef PACKING_H
+#define PACKING_H
+#include <torch/types.h>
+
+// Positions of the non-padding tokens of a (BATCH_SIZE, SEQUENCE_LENGTH)
+// batch. Used to run the position-wise layers (Linear, GELU, LayerNorm,
+// residuals) on a packed (TOTAL_TOKENS, HIDDEN_SIZE) tensor that holds only
+// the real tokens
+struct PackingInfo {
+  torch::Tensor indices;  // Flat indices of the non-padding positions
+  long batchSize;
+  long sequenceLength;
+};
+
+// Find the non-padding positions of some input ids
+PackingInfo getPackingInfo(torch::Tensor inputIds);
+
+// Positions where a (BATCH_SIZE, SEQUENCE_LENGTH) boolean mask is set
+PackingInfo maskToPackingInfo(torch::Tensor mask);
+
+// Gather the real tokens:
+//   (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE) -> (TOTAL_TOKENS, HIDDEN_SIZE)
+// Any trailing dimensions are kept, e.g. for (BATCH_SIZE, SEQUENCE_LENGTH)
+// labels
+torch::Tensor pack(torch::Tensor padded, const PackingInfo& packing);
+
+// Scatter the real tokens back, padding positions are filled with zeros
+// (or fillValue):
+//   (TOTAL_TOKENS, HIDDEN_SIZE) -> (BATCH_SIZE, SEQUENCE_LENGTH, HIDDEN_SIZE)
+// As pack(), any trailing dimensions are kept
+torch::Tensor unpack(torch::Tensor packed, const PackingInfo& packing,
+                     double fillValue = 0);
+#endif
@@ -0,0 +1,29 @@
+#include "pruning.h"
+
+#include <fstream>
+#include <stdexcept>
+
+void savePrunedShapes(BertModel& model, const std::string& fname) {
+  std::ofstream file(fname);
+  if (!file.is_open()) throw std::runtime_error("Cannot write " + fname);
+  for (long i = 0; i < model->getNumLayers(); i++) {
+    auto layer = model->getLayer(i);
+    file << layer->getNumHeads() << " " << layer->getIntermediateSize() << std::endl;
+  }
+}
+
+bool loadPrunedShapes(BertModel& model, const std::string& fname) {
+  std::ifstream file(fname);
+  if (!file.is_open()) return false;
+  long numHeads, intermediateSize;
+  for (long i = 0; i < model->getNumLayers(); i++) {
+    if (!(file >> numHeads >> intermediateSize)) {
+      throw std::runtime_error(fname + ": expected a line per encoder layer");
+    }
+    // The weights are overwritten by torch::load, only the shapes matter
+    auto layer = model->getLayer(i);
+    layer->pruneHeads(torch::arange(numHeads, torch::kInt64));
+    layer->pruneNeurons(torch::arange(intermediateSize, torch::kInt64));
+  }
+  return true;
+}
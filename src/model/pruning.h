@@ -0,0 +1,20 @@
+#ifndef PRUNING_H
+#define PRUNING_H
+#include <string>
+
+#include "bert_model.h"
+
+// A pruned model (see `bert prune`) has fewer attention heads and
+// intermediate neurons in some layers than its Config says. Their numbers
+// are kept next to the checkpoint, one "NUM_HEADS INTERMEDIATE_SIZE" line
+// per encoder layer
+
+// Write the per-layer shapes of a model
+void savePrunedShapes(BertModel& model, const std::string& fname);
+
+// Shrink a model built from its Config to the shapes in fname, before
+// torch::load-ing its pruned checkpoint. Returns false, leaving the model
+// as is, if there is no such file
+bool loadPrunedShapes(BertModel& model, const std::string& fname);
+
+#endif
@@ -0,0 +1,82 @@
+#include "quantizable_linear.h"
+
+#include <tuple>
+
+#include <torch/autograd.h>
+
+#include "kernels.h"
+
+torch::Tensor QuantizableLinearImpl::forward(const torch::Tensor& input) {
+  if (isQuantized()) return kernels::int8Linear(input, weightInt8, weightScale, bias);
+  return torch::nn::LinearImpl::forward(input);
+}
+
+torch::Tensor QuantizableLinearImpl::forwardWithoutBias(const torch::Tensor& input) {
+  if (isQuantized()) {
+    return kernels::int8Linear(input, weightInt8, weightScale, torch::Tensor());
+  }
+  return torch::linear(input, weight);
+}
+
+void QuantizableLinearImpl::quantize() {
+  if (isQuantized()) return;
+  prepareQuantized();
+  torch::NoGradGuard noGrad;
+  torch::Tensor quantized, scales;
+  std::tie(quantized, scales) = kernels::quantizeWeight(weight);
+  weightInt8.set_(quantized);
+  weightScale.set_(scales.to(weight.device()));
+  weight.set_(torch::empty({0}, weight.options()));
+}
+
+void QuantizableLinearImpl::prepareQuantized() {
+  if (weightInt8.defined()) return;
+  weightInt8 = register_buffer(
+    "weightInt8", torch::empty({0}, weight.options().dtype(torch::kChar)));
+  weightScale = register_buffer("weightScale", torch::empty({0}, weight.options()));
+}
+
+bool QuantizableLinearImpl::isQuantized() const {
+  return weightInt8.defined() && weightInt8.numel() > 0;
+}
+
+void QuantizableLinearImpl::selectOutputFeatures(const torch::Tensor& indices) {
+  torch::NoGradGuard noGrad;
+  torch::Tensor index = indices.to(weight.device());
+  if (isQuantized()) {
+    weightInt8.set_(weightInt8.index_select(0, index).contiguous());
+    weightScale.set_(weightScale.index_select(0, index).contiguous());
+  } else {
+    weight.set_(weight.index_select(0, index).contiguous());
+  }
+  if (bias.defined()) bias.set_(bias.index_select(0, index).contiguous());
+  options.out_features(indices.size(0));
+}
+
+void QuantizableLinearImpl::selectInputFeatures(const torch::Tensor& indices) {
+  torch::NoGradGuard noGrad;
+  torch::Tensor index = indices.to(weight.device());
+  if (isQuantized()) {
+    // Per-output-channel scales stay valid for a subset of the inputs
+    weightInt8.set_(weightInt8.index_select(1, index).contiguous());
+  } else {
+    weight.set_(weight.index_select(1, index).contiguous());
+  }
+  options.in_features(indices.size(0));
+}
+
+void quantizeLinears(torch::nn::Module& module) {
+  for (const auto& child : module.modules()) {
+    if (auto linear = std::dynamic_pointer_cast<QuantizableLinearImpl>(child)) {
+      linear->quantize();
+    }
+  }
+}
+
+void prepareQuantizedLinears(torch::nn::Module& module) {
+  for (const auto& child : module.modules()) {
+    if (auto linear = std::dynamic_pointer_cast<QuantizableLinearImpl>(child)) {
+      linear->prepareQuantized();
+    }
+  }
+}
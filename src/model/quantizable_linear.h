@@ -0,0 +1,38 @@
+#ifndef QUANTIZABLE_LINEAR_H
+#define QUANTIZABLE_LINEAR_H
+#include <torch/nn/module.h>
+#include <torch/nn/modules/linear.h>
+#include <torch/types.h>
+
+// A torch::nn::Linear that can switch to int8 weights for CPU inference, see
+// kernels::int8Linear. Parameters keep the names of torch::nn::Linear, so
+// float checkpoints load as before
+class QuantizableLinearImpl : public torch::nn::LinearImpl {
+  public:
+    using torch::nn::LinearImpl::LinearImpl;
+    torch::Tensor forward(const torch::Tensor& input);
+    // input @ weight^T, without the bias (added by the fused epilogues)
+    torch::Tensor forwardWithoutBias(const torch::Tensor& input);
+
+    // Replace the float weight by per-output-channel int8 weights and scales,
+    // registered as the `weightInt8` and `weightScale` buffers. The float
+    // weight is emptied, so the module is inference-only afterwards
+    void quantize();
+    // Register empty quantized buffers, to torch::load a quantized checkpoint
+    void prepareQuantized();
+    bool isQuantized() const;
+
+    // Keep only some output (weight rows) or input (weight columns) features,
+    // given by their indices, for structured pruning
+    void selectOutputFeatures(const torch::Tensor& indices);
+    void selectInputFeatures(const torch::Tensor& indices);
+
+    // shape: (OUT_FEATURES, IN_FEATURES), int8, and (OUT_FEATURES)
+    torch::Tensor weightInt8, weightScale;
+}; TORCH_MODULE(QuantizableLinear);
+
+// Call quantize() or prepareQuantized() on every QuantizableLinear of a model
+void quantizeLinears(torch::nn::Module& module);
+void prepareQuantizedLinears(torch::nn::Module& module);
+
+#endif
@@ -1,4 +1,5 @@
 #ifndef OPTIM_H
 #define OPTIM_H
 #include "optim/adamw.h"
+#include "optim/mixed_precision.h"
 #endif
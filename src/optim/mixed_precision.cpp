@@ -0,0 +1,81 @@
+#include "mixed_precision.h"
+
+#include <torch/autograd.h>
+
+#include "config.h"
+
+MixedPrecision::MixedPrecision(torch::nn::Module& model, torch::Dtype dtype)
+  : model (model),
+    dtype (dtype),
+    dynamicScaling (dtype == torch::kHalf),
+    lossScale (dtype == torch::kHalf ? INITIAL_LOSS_SCALE : 1.0f) {
+  torch::NoGradGuard noGrad;
+  for (const auto& param : model.parameters()) {
+    masterIndex[param.unsafeGetTensorImpl()] = masters.size();
+    params.push_back(param);
+    masters.push_back(param.detach().to(torch::kFloat).clone().requires_grad_(true));
+  }
+  // Module::to() keeps the parameter objects, so the index stays valid
+  model.to(dtype);
+}
+
+torch::Tensor MixedPrecision::getMaster(const torch::Tensor& param) const {
+  return masters.at(masterIndex.at(param.unsafeGetTensorImpl()));
+}
+
+torch::Tensor MixedPrecision::scaleLoss(torch::Tensor loss) const {
+  return lossScale == 1.0f ? loss : loss * lossScale;
+}
+
+bool MixedPrecision::unscaleGradients(const std::vector<torch::Tensor>& optimizerParams) {
+  torch::NoGradGuard noGrad;
+  for (size_t i = 0; i < params.size(); i++) {
+    if (params[i].grad().defined()) {
+      masters[i].mutable_grad() = params[i].grad().to(torch::kFloat);
+    } else {
+      masters[i].mutable_grad() = torch::Tensor();
+    }
+  }
+
+  bool finite = true;
+  for (const auto& param : optimizerParams) {
+    torch::Tensor grad = param.grad();
+    if (!grad.defined()) continue;
+    if (lossScale != 1.0f) grad.div_(lossScale);
+    if (dynamicScaling && finite) finite = torch::isfinite(grad).all().item<bool>();
+  }
+  if (!dynamicScaling) return true;
+
+  if (!finite) {
+    lossScale /= 2.0f;
+    numGoodSteps = 0;
+    numSkippedSteps++;
+  } else if (++numGoodSteps == LOSS_SCALE_GROWTH_INTERVAL) {
+    lossScale *= 2.0f;
+    numGoodSteps = 0;
+  }
+  return finite;
+}
+
+void MixedPrecision::copyWeights() {
+  torch::NoGradGuard noGrad;
+  for (size_t i = 0; i < params.size(); i++) params[i].copy_(masters[i]);
+}
+
+void MixedPrecision::toFloat() {
+  torch::NoGradGuard noGrad;
+  model.to(torch::kFloat);
+  for (size_t i = 0; i < params.size(); i++) params[i].copy_(masters[i]);
+}
+
+void MixedPrecision::toReducedPrecision() {
+  model.to(dtype);
+}
+
+float MixedPrecision::getLossScale() const {
+  return lossScale;
+}
+
+long MixedPrecision::getNumSkippedSteps() const {
+  return numSkippedSteps;
+}
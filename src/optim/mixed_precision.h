@@ -0,0 +1,51 @@
+#ifndef MIXED_PRECISION_H
+#define MIXED_PRECISION_H
+#include <unordered_map>
+#include <vector>
+
+#include <torch/nn/module.h>
+#include <torch/types.h>
+
+// Mixed-precision training. The model runs forward and backward in a 16-bit
+// floating point type (bfloat16 or float16), while the optimizer updates
+// float32 "master" copies of its parameters:
+//   loss = scaleLoss(loss); loss.backward();
+//   if (unscaleGradients(optimizerParams)) { optimizer.step(); copyWeights(); }
+// Float16 gradients may underflow, so the loss is scaled by a dynamic factor
+// that is halved whenever the gradients overflow and doubled after
+// LOSS_SCALE_GROWTH_INTERVAL steps without overflow. Bfloat16 has the range
+// of float32 and needs no scaling
+class MixedPrecision {
+  public:
+    MixedPrecision(torch::nn::Module& model, torch::Dtype dtype);
+
+    // The float32 copy of a model parameter, for the optimizer
+    torch::Tensor getMaster(const torch::Tensor& param) const;
+
+    torch::Tensor scaleLoss(torch::Tensor loss) const;
+    // Copy the model gradients to the master parameters, and divide the
+    // gradients of these and any other optimizer parameters (e.g. float32
+    // heads) by the loss scale. Returns false, and updates the scale, if any
+    // gradient is not finite; the step should then be skipped
+    bool unscaleGradients(const std::vector<torch::Tensor>& optimizerParams);
+    // Copy the updated master parameters back to the model
+    void copyWeights();
+
+    // Switch the model to float32 with the master values, e.g. to save it,
+    // and back to the 16-bit type
+    void toFloat();
+    void toReducedPrecision();
+
+    float getLossScale() const;
+    long getNumSkippedSteps() const;
+  private:
+    torch::nn::Module& model;
+    torch::Dtype dtype;
+    std::vector<torch::Tensor> params, masters;
+    std::unordered_map<const void*, size_t> masterIndex;
+    bool dynamicScaling;
+    float lossScale;
+    long numGoodSteps = 0, numSkippedSteps = 0;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "client.h"
+
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "predict.h"
+#include "runtime.h"
+
+namespace predict {
+
+long predictRemote(const std::string& socketPath, const std::string& textsFname,
+                   const std::string& taskName) {
+  using Clock = std::chrono::steady_clock;
+  std::ifstream file;
+  if (textsFname != "-") {
+    file.open(textsFname);
+    if (!file.is_open()) throw std::runtime_error("Cannot open " + textsFname);
+  }
+  std::istream& in = (textsFname == "-") ? std::cin : file;
+  int fd = connectUnixSocket(socketPath);
+
+  // Send times of the lines without a response yet
+  std::deque<Clock::time_point> sendTimes;
+  std::mutex sendTimesMutex;
+  Clock::time_point startTime = Clock::now();
+  std::thread sender([&] {
+    std::string line;
+    while (std::getline(in, line)) {
+      {
+        std::lock_guard<std::mutex> lock(sendTimesMutex);
+        sendTimes.push_back(Clock::now());
+      }
+      std::string request = (taskName.empty() ? "" : taskName + "\t") + line + "\n";
+      if (!writeAll(fd, request)) break;
+    }
+    // Tells the server there are no more requests
+    shutdown(fd, SHUT_WR);
+  });
+
+  std::vector<double> lineLatencies;
+  long numLines = 0, numErrors = 0;
+  LineReader reader(fd);
+  std::string response;
+  while (reader.readLine(response)) {
+    Clock::time_point sendTime = Clock::now();
+    {
+      std::lock_guard<std::mutex> lock(sendTimesMutex);
+      if (!sendTimes.empty()) {
+        sendTime = sendTimes.front();
+        sendTimes.pop_front();
+      }
+    }
+    std::chrono::duration<double, std::milli> latency = Clock::now() - sendTime;
+    lineLatencies.push_back(latency.count());
+    if (response.compare(0, 6, "error:") == 0) numErrors++;
+    std::cout << response << std::endl;
+    numLines++;
+  }
+  sender.join();
+  close(fd);
+
+  std::chrono::duration<double> elapsed = Clock::now() - startTime;
+  std::cerr << "# "
+            << "socket=" << socketPath
+            << " sentences=" << numLines
+            << " errors=" << numErrors
+            << " sentences_per_sec=" << numLines / elapsed.count()
+            << " line_latency_p50_ms=" << percentile(lineLatencies, 0.5)
+            << " line_latency_p99_ms=" << percentile(lineLatencies, 0.99)
+            << std::endl;
+  return numErrors;
+}
+}
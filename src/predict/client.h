@@ -0,0 +1,13 @@
+#ifndef PREDICT_CLIENT_H
+#define PREDICT_CLIENT_H
+#include <string>
+
+namespace predict {
+// Send the lines of textsFname (`-` for the standard input) to a
+// `bert serve` socket, prefixed with the task name if given, and print the
+// responses in order. Lines are sent as they are read, without waiting for
+// the previous responses. Returns the number of error responses
+long predictRemote(const std::string& socketPath, const std::string& textsFname,
+                   const std::string& taskName);
+}
+#endif
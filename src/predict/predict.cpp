@@ -1,6 +1,19 @@
 #include "predict.h"
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <glob.h>
 
@@ -12,88 +25,700 @@
 #include "data.h"
 #include "model/bert_model.h"
 #include "model/classifier.h"
+#include "model/pruning.h"
+#include "model/quantizable_linear.h"
+#include "client.h"
+#include "prediction_cache.h"
+#include "stream.h"
+#include "runtime.h"
 #include "state.h"
 
 
 namespace predict {
 
-int main(int argc, char *argv[]) {
-  if ((argc != 3) && (argc != 4)) {
-      std::cout << "Usage: " << argv[0] << " MODEL FILE [TASK]" << std::endl;
-      return 1;
+std::string formatLogits(const torch::Tensor& logits) {
+  torch::Tensor values = logits.contiguous().to(torch::kFloat).view({-1});
+  const float* data = values.data_ptr<float>();
+  std::ostringstream line;
+  for (long i = 0; i < values.size(0); i++) {
+    if (i > 0) line << DELIMITER;
+    line << data[i];
   }
+  return line.str();
+}
 
-  std::string baseFname = argv[1];
-  std::string textsFname = argv[2];
-  std::string taskName;
-  if (argc == 4) {
-    taskName = argv[3];
-  } else {
-    taskName = "";
+void printLogits(const torch::Tensor& logits) {
+  std::cout << formatLogits(logits) << std::endl;
+}
+
+double percentile(std::vector<double> values, double q) {
+  if (values.empty()) return 0.0;
+  std::sort(values.begin(), values.end());
+  // Nearest-rank percentile
+  size_t rank = static_cast<size_t>(std::ceil(q * values.size()));
+  return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+torch::nn::AnyModule loadClassifier(const std::string& fname,
+                                    const torch::Device& device,
+                                    bool& binary, bool& tokenLevel,
+                                    bool prequantized) {
+  std::string optionsFname = fname;
+  std::string::size_type i = optionsFname.rfind('.', optionsFname.length());
+  optionsFname.replace(i+1, 6, "config");
+  binary = fname.find("binary") != std::string::npos;
+  if (binary) {
+    BinaryClassifierOptions options;
+    readStruct(options, optionsFname);
+    tokenLevel = options.tokenLevel;
+    BinaryClassifier clf(options);
+    if (prequantized) prepareQuantizedLinears(*clf);
+    torch::load(clf, fname, device);
+    return torch::nn::AnyModule(clf);
   }
-  std::string bertFname = baseFname + "-bert.pt";
-  torch::nn::AnyModule classifier;
+  MutliclassClassifierOptions options;
+  readStruct(options, optionsFname);
+  tokenLevel = options.tokenLevel;
+  MulticlassClassifier clf(options);
+  if (prequantized) prepareQuantizedLinears(*clf);
+  torch::load(clf, fname, device);
+  return torch::nn::AnyModule(clf);
+}
 
-  Config config;
-  readStruct(config, baseFname + "-bert.config");
-  BertModel bertModel(config);
-  torch::load(bertModel, bertFname);
-
-  for (const auto& fname : getGlobFiles(baseFname + "*" + taskName + "*.pt")) {
-    torch::nn::AnyModule module;
-    if (fname.find("binary") != std::string::npos) {
-      BinaryClassifierOptions options;
-      std::string optionsFname = fname;
-      std::string::size_type i = optionsFname.rfind('.', optionsFname.length());
-      optionsFname.replace(i+1, 6, "config");
-      readStruct(options, optionsFname);
-      BinaryClassifier clf(options);
-      torch::load(clf, fname);
-      classifier = torch::nn::AnyModule(clf);
-    } else if (fname.find("multiclass") != std::string::npos) {
-      MutliclassClassifierOptions options;
-      std::string optionsFname = fname;
-      std::string::size_type i = optionsFname.rfind('.', optionsFname.length());
-      optionsFname.replace(i+1, 6, "config");
-      readStruct(options, optionsFname);
-      MulticlassClassifier clf(options);
-      torch::load(clf, fname);
-      classifier = torch::nn::AnyModule(clf);
+bool isQuantizedModel(const std::string& baseFname) {
+  std::ifstream marker(baseFname + ".quantized");
+  return marker.is_open();
+}
+
+torch::Tensor getConfidence(const torch::Tensor& logits, bool binary,
+                            const std::string& criterion) {
+  torch::Tensor probs, confidence;
+  if (binary) {
+    // Every label is a two-class problem, shape: (BATCH_SIZE, NUM_LABELS)
+    probs = torch::sigmoid(logits).view({logits.size(0), -1});
+    if (criterion == "entropy") {
+      torch::Tensor entropy = -(probs * probs.clamp_min(1e-12).log()
+                                + (1 - probs) * (1 - probs).clamp_min(1e-12).log());
+      confidence = 1 - entropy / std::log(2.0);
+    } else {
+      confidence = torch::max(probs, 1 - probs);
     }
+    return std::get<0>(confidence.min(1));
+  }
+  probs = logits.softmax(-1);
+  if (criterion == "entropy") {
+    torch::Tensor entropy = -(probs * probs.clamp_min(1e-12).log()).sum(-1);
+    return 1 - entropy / std::log(static_cast<double>(logits.size(-1)));
   }
+  return std::get<0>(probs.max(-1));
+}
 
+std::string getModelVocabFname(const std::string& baseFname) {
   std::string vocabFname = baseFname + ".vocab";
   std::ifstream file(vocabFname);
   if (!file.is_open()) {
     // Sentencepiece
     vocabFname = baseFname + ".sp";
   }
-  std::string lowercaseFname = baseFname + ".lowercase";
-  torch::Tensor texts = readTextsToTensor(textsFname, vocabFname, lowercaseFname);
+  return vocabFname;
+}
+
+BertModel loadBertModel(const std::string& baseFname,
+                        const torch::Device& device,
+                        bool quantize) {
+  Config config;
+  readStruct(config, baseFname + "-bert.config");
+  bool prequantized = isQuantizedModel(baseFname);
+  BertModel bertModel(config);
+  // Heads and neurons removed by `bert prune`, if any
+  loadPrunedShapes(bertModel, baseFname + "-bert.pruned");
+  if (prequantized) prepareQuantizedLinears(*bertModel);
+  torch::load(bertModel, baseFname + "-bert.pt", device);
+  // Quantize at load time, unless done by `bert quantize` already
+  if (prequantized || quantize) quantizeLinears(*bertModel);
+  bertModel->setSeparatorId(getSeparatorId(getModelVocabFname(baseFname),
+                                           baseFname + ".lowercase"));
+  bertModel->to(device);
   bertModel->eval();
-  classifier.ptr()->eval();
+  return bertModel;
+}
+
+Predictor loadPredictor(const std::string& baseFname,
+                        const std::string& taskName,
+                        const torch::Device& device,
+                        bool quantize,
+                        float exitThreshold,
+                        const std::string& exitCriterion) {
+  Predictor predictor;
+  predictor.device = device;
+  predictor.exitThreshold = exitThreshold;
+  predictor.exitCriterion = exitCriterion;
+
+  bool prequantized = isQuantizedModel(baseFname);
+  predictor.quantized = prequantized || quantize;
+  predictor.bertModel = loadBertModel(baseFname, device, quantize);
+  predictor.fnames = {baseFname + "-bert.pt", baseFname + "-bert.pruned"};
 
-  for (int i = 0; i < texts.size(0); i++) {
-    torch::Tensor hidden = bertModel->forward(texts.index({i}).unsqueeze(0).cuda());
-    torch::Tensor logits = classifier.forward(hidden).squeeze(0);
-    std::cout << logits.item<float>() << std::endl;
+  // `<baseFname>-<task>-{binary,multiclass}.pt` and the early-exit heads
+  // `<baseFname>-<task>-exit<N>-{binary,multiclass}.pt`, as written by
+  // `train`. Exact names, so that the heads of other tasks and of sibling
+  // models (`<baseFname>-2-...`) are not picked up
+  std::string prefix = baseFname + "-";
+  std::map<std::string, std::string> heads;
+  std::map<std::string, std::map<long, std::string>> exitHeads;
+  for (const auto& fname : getGlobFiles(prefix + "*.pt")) {
+    std::string::size_type kindPos = fname.rfind('-');
+    if ((kindPos == std::string::npos) || (kindPos < prefix.size())) continue;
+    std::string kind = fname.substr(kindPos + 1);
+    if ((kind != "binary.pt") && (kind != "multiclass.pt")) continue;
+    std::string name = fname.substr(prefix.size(), kindPos - prefix.size());
+    std::string::size_type exitPos = name.rfind("-exit");
+    std::string layer = exitPos == std::string::npos ? "" : name.substr(exitPos + 5);
+    bool isExit = !layer.empty() && (layer.size() < 10)
+      && std::all_of(layer.begin(), layer.end(), [](unsigned char c) { return std::isdigit(c); });
+    if (isExit) {
+      exitHeads[name.substr(0, exitPos)][std::stol(layer)] = fname;
+    } else {
+      heads[name] = fname;
+    }
+  }
+  std::string headName = taskName;
+  if (headName.empty()) {
+    if (heads.size() != 1) {
+      throw std::runtime_error(std::to_string(heads.size()) + " task heads found for "
+                               + baseFname + ", pass the task name");
+    }
+    headName = heads.begin()->first;
+  }
+  if (heads.find(headName) == heads.end()) {
+    throw std::runtime_error("No head for task `" + headName + "` of " + baseFname);
+  }
+  predictor.classifier = loadClassifier(heads[headName], device, predictor.binary,
+                                        predictor.tokenLevel, prequantized);
+  predictor.fnames.push_back(heads[headName]);
+  // Only needed for early exits
+  if (exitThreshold > 0) {
+    for (const auto& exitHead : exitHeads[headName]) {
+      bool exitBinary, exitTokenLevel;
+      predictor.exitClassifiers[exitHead.first] = loadClassifier(
+        exitHead.second, device, exitBinary, exitTokenLevel, prequantized);
+      predictor.fnames.push_back(exitHead.second);
+    }
+  }
+  if (!predictor.exitClassifiers.empty() && predictor.tokenLevel) {
+    std::cerr << "WARNING: Early exits are not supported for token-level tasks"
+              << std::endl;
+    predictor.exitClassifiers.clear();
+  }
+  if (predictor.quantized) {
+    quantizeLinears(*predictor.classifier.ptr());
+    for (auto& exitClassifier : predictor.exitClassifiers) {
+      quantizeLinears(*exitClassifier.second.ptr());
+    }
   }
 
-  // Get the first prediction to deduct output shape
-  // torch::Tensor hidden = bertModel->forward(texts.index({0}).unsqueeze(0).cuda());
-  // torch::Tensor logits = classifier.forward(hidden).squeeze(0);
-  // std::cout << "hidden sizes: " << hidden.sizes() << std::endl;
-  // std::cout << "logits sizes: " << logits.sizes() << std::endl;
-  // std::cout << "logits: " << logits << std::endl;
+  predictor.vocabFname = getModelVocabFname(baseFname);
+  predictor.lowercaseFname = baseFname + ".lowercase";
 
-  // std::vector<long> outputShape = logits.sizes().vec();
-  // outputShape.insert(outputShape.begin(), texts.size(0));
+  predictor.classifier.ptr()->to(device);
+  predictor.classifier.ptr()->eval();
+  for (auto& exitClassifier : predictor.exitClassifiers) {
+    exitClassifier.second.ptr()->to(device);
+    exitClassifier.second.ptr()->eval();
+  }
+  return predictor;
+}
 
-  // torch::Tensor outputs = torch::empty(outputShape);
-  // std::cout << "outputs size: " << outputs.sizes() << std::endl;
+std::vector<torch::Tensor> predictBatch(Predictor& predictor, torch::Tensor batch,
+                                        long& numLayersRun) {
+  torch::NoGradGuard noGrad;
+  BertModel& bertModel = predictor.bertModel;
+  torch::Tensor lengths = (batch != PADDING_IDX).sum(1).to(torch::kCPU);
+  const long* lengthsData = lengths.data_ptr<long>();
+  std::vector<torch::Tensor> outputs(batch.size(0));
+  batch = batch.to(predictor.device);
 
-  // for (size_t i = 0; i < texts.size(0); i++) {
-  // }
+  // Store the logits of some rows of the batch, given by their index
+  auto storeLogits = [&](torch::Tensor logits, torch::Tensor rows) {
+    logits = logits.to(torch::kCPU);
+    const long* rowsData = rows.data_ptr<long>();
+    for (long k = 0; k < rows.size(0); k++) {
+      torch::Tensor rowLogits = logits[k];
+      if (predictor.tokenLevel) {
+        // Token-level, keep only the positions of the input sequence
+        rowLogits = rowLogits.slice(0, 0, lengthsData[rowsData[k]]);
+      }
+      outputs[rowsData[k]] = rowLogits;
+    }
+  };
+
+  // Rows of the batch that have not exited yet
+  torch::Tensor active = torch::arange(batch.size(0), torch::kInt64);
+  torch::Tensor hidden = bertModel->embed(batch);
+  long numLayers = bertModel->getNumLayers(), numLayersDone = 0;
+  for (auto& exitClassifier : predictor.exitClassifiers) {
+    hidden = bertModel->forwardLayers(hidden, batch, numLayersDone, exitClassifier.first);
+    numLayersDone = exitClassifier.first;
+
+    torch::Tensor exitLogits = exitClassifier.second.forward(hidden);
+    torch::Tensor exits = (getConfidence(exitLogits, predictor.binary, predictor.exitCriterion)
+                           >= predictor.exitThreshold).to(torch::kCPU);
+    torch::Tensor exitRows = exits.nonzero().view({-1});
+    if (exitRows.size(0) == 0) continue;
+    storeLogits(exitLogits.index_select(0, exitRows.to(predictor.device)),
+                active.index_select(0, exitRows));
+    numLayersRun += exitRows.size(0) * numLayersDone;
+
+    // Compact the batch to the remaining rows, trimmed to the longest one
+    torch::Tensor keepRows = exits.logical_not().nonzero().view({-1});
+    active = active.index_select(0, keepRows);
+    if (active.size(0) == 0) break;
+    keepRows = keepRows.to(predictor.device);
+    batch = batch.index_select(0, keepRows);
+    long keepLength = (batch != PADDING_IDX).sum(1).max().item<long>();
+    batch = batch.slice(1, 0, keepLength);
+    hidden = hidden.index_select(0, keepRows).slice(1, 0, keepLength);
+  }
+
+  if (active.size(0) > 0) {
+    hidden = bertModel->forwardLayers(hidden, batch, numLayersDone, numLayers);
+    if (predictor.tokenLevel) {
+      // Run the head on the non-padding positions only
+      PackingInfo tokens = getPackingInfo(batch);
+      storeLogits(unpack(predictor.classifier.forward(pack(hidden, tokens)), tokens), active);
+    } else {
+      storeLogits(predictor.classifier.forward(hidden), active);
+    }
+    numLayersRun += active.size(0) * numLayers;
+  }
+  return outputs;
+}
+
+void printHelp(const std::string &programName) {
+  std::cout << "Usage: " << programName << " [OPTIONS] MODEL FILE [TASK]" << std::endl;
+  std::cout << "       " << programName << " --connect SOCKET FILE [TASK]" << std::endl;
+  std::cout << "\
+Predict with a fine-tuned BERT model.\n\
+With FILE `-`, lines are read from the standard input as they arrive and\n\
+the outputs of each micro-batch are written as soon as it is done.\n\
+With --connect, the lines are sent to a running `bert serve` instead and\n\
+the other options are ignored.\n\n\
+Options:\n\
+  -b, --batch-size          Number of sentences per forward pass.\n\
+                              Inputs are sorted by length before batching,\n\
+                              outputs keep the original line order\n\
+                              Default: 32\n\
+  -L, --max-sequence-length Pad/truncate input sequences to that many tokens\n\
+                              Default: 100\n\
+  -d, --device              Device to run on, e.g. `cpu`, `cuda`, `cuda:1`\n\
+                              Default: `cuda` if available, else `cpu`\n\
+  -j, --num-threads         Number of intra-op threads for tensor operations\n\
+                              Default: 0 (libtorch default)\n\
+  -J, --num-interop-threads Number of inter-op threads\n\
+                              Default: 0 (libtorch default)\n\
+  -k, --tokenizer-threads   Number of threads that tokenize FILE\n\
+                              Default: 0 (single-threaded)\n\
+  -A, --cpu-affinity        Give the compute (--num-threads) and tokenizer\n\
+                              threads their own CPUs: `none`, `cores` (any\n\
+                              CPU) or `numa:N` (the CPUs of NUMA node N).\n\
+                              The utilization of each pool is reported\n\
+                              Default: none\n\
+  -P, --packed              Run the position-wise encoder layers on the\n\
+                              non-padding tokens only\n\
+  -T, --exit-threshold      Stop at the first early-exit head (see\n\
+                              `train --exit-layers`) whose confidence reaches\n\
+                              this value, in (0, 1]. Sentence-level tasks only\n\
+                              Default: 0 (run all layers)\n\
+  -X, --exit-criterion      Confidence of an exit: `max-prob` (probability of\n\
+                              the predicted class) or `entropy` (one minus the\n\
+                              normalized entropy)\n\
+                              Default: max-prob\n\
+  -C, --cls-only-layers     Compute only the [CLS] position in this many final\n\
+                              encoder layers. One layer is exact; more trade\n\
+                              accuracy for speed. Sentence-level tasks only\n\
+                              Default: 1\n\
+  -Q, --quantize            Run the Linear layers with int8 weights and\n\
+                              dynamically quantized activations: `int8`.\n\
+                              CPU only. Models written by `bert quantize`\n\
+                              are always run quantized\n\
+                              Default: none (float32)\n\
+  -w, --max-wait            Streaming (FILE `-`): run a micro-batch once\n\
+                              --batch-size lines arrived, or this many\n\
+                              milliseconds after its first line\n\
+                              Default: 10\n\
+  -c, --cache               Persistent cache of the outputs, keyed by the\n\
+                              model, task head, options and token ids. Only\n\
+                              inputs that are not in the file are encoded, and\n\
+                              their outputs are appended to it\n\
+  -W, --window-stride       Split lines longer than --max-sequence-length\n\
+                              into windows that start this many tokens apart\n\
+                              instead of truncating them, and merge the\n\
+                              outputs of the windows of each line. Not for\n\
+                              streaming\n\
+                              Default: 0 (truncate)\n\
+  -g, --window-aggregation  Merge sentence-level windows by their `mean` or\n\
+                              `max` logits. Token-level outputs take each\n\
+                              token from the window where it has the most\n\
+                              context\n\
+                              Default: mean\n\
+  -S, --connect             Predict with the model loaded by `bert serve` on\n\
+                              this Unix socket. TASK is required if it serves\n\
+                              more than one task\n\
+";
+}
+
+int main(int argc, char *argv[]) {
+  int c, opt = 0;
+  int batchSize = DEFAULT_BATCH_SIZE,
+      maxSequenceLength = DEFAULT_MAX_SEQUENCE_LENGTH,
+      numThreads = DEFAULT_NUM_THREADS,
+      numInteropThreads = DEFAULT_NUM_INTEROP_THREADS,
+      tokenizerThreads = 0;
+  std::string cpuAffinity = "none";
+  std::string deviceName = "";
+  bool packed = false;
+  float exitThreshold = 0.0f;
+  std::string exitCriterion = "max-prob";
+  int clsOnlyLayers = 1;
+  std::string quantize = "";
+  std::string cacheFname = "";
+  double maxWait = 10.0;
+  std::string socketPath = "";
+  long windowStride = 0;
+  std::string windowAggregation = "mean";
+
+	static struct option options[] = {
+			{"batch-size",            required_argument, NULL,  'b' },
+			{"max-sequence-length",   required_argument, NULL,  'L' },
+			{"device",                required_argument, NULL,  'd' },
+			{"num-threads",           required_argument, NULL,  'j' },
+			{"num-interop-threads",   required_argument, NULL,  'J' },
+			{"tokenizer-threads",     required_argument, NULL,  'k' },
+			{"cpu-affinity",          required_argument, NULL,  'A' },
+			{"packed",                no_argument,       NULL,  'P' },
+			{"exit-threshold",        required_argument, NULL,  'T' },
+			{"exit-criterion",        required_argument, NULL,  'X' },
+			{"cls-only-layers",       required_argument, NULL,  'C' },
+			{"quantize",              required_argument, NULL,  'Q' },
+			{"cache",                 required_argument, NULL,  'c' },
+			{"max-wait",              required_argument, NULL,  'w' },
+			{"window-stride",         required_argument, NULL,  'W' },
+			{"window-aggregation",    required_argument, NULL,  'g' },
+			{"connect",               required_argument, NULL,  'S' },
+			{"help",                  no_argument,       NULL,  'h' },
+			{NULL,                    0,                 NULL,   0  }
+	};
+
+	while ((c = getopt_long(argc, argv, ":b:L:d:j:J:k:A:PT:X:C:Q:c:w:W:g:S:h", options, &opt)) != -1) {
+    switch (c) {
+      case 'b':
+        batchSize = std::stoi(optarg);
+        if (batchSize <= 0) {
+          printHelp(argv[0]);
+          printf("Invalid batch size `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'L':
+        maxSequenceLength = std::stoi(optarg);
+        if (maxSequenceLength < 2) {
+          printHelp(argv[0]);
+          printf("Invalid maximum sequence length `%s`, [CLS] and [SEP] need 2\n", optarg);
+          return 1;
+        }
+        break;
+      case 'd':
+        deviceName = optarg;
+        break;
+      case 'j':
+        numThreads = std::stoi(optarg);
+        break;
+      case 'J':
+        numInteropThreads = std::stoi(optarg);
+        break;
+      case 'k':
+        tokenizerThreads = std::stoi(optarg);
+        break;
+      case 'A':
+        cpuAffinity = optarg;
+        if (!isValidAffinity(cpuAffinity)) {
+          printHelp(argv[0]);
+          printf("Invalid CPU affinity `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'P':
+        packed = true;
+        break;
+      case 'T':
+        exitThreshold = std::stof(optarg);
+        break;
+      case 'X':
+        exitCriterion = optarg;
+        if ((exitCriterion != "max-prob") && (exitCriterion != "entropy")) {
+          printHelp(argv[0]);
+          printf("Invalid exit criterion `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'C':
+        clsOnlyLayers = std::stoi(optarg);
+        break;
+      case 'Q':
+        quantize = optarg;
+        if (quantize != "int8") {
+          printHelp(argv[0]);
+          printf("Invalid quantization `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'c':
+        cacheFname = optarg;
+        break;
+      case 'w':
+        maxWait = std::stod(optarg);
+        if (maxWait < 0) {
+          printHelp(argv[0]);
+          printf("Invalid maximum wait `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'W':
+        windowStride = std::stol(optarg);
+        break;
+      case 'g':
+        windowAggregation = optarg;
+        if ((windowAggregation != "mean") && (windowAggregation != "max")) {
+          printHelp(argv[0]);
+          printf("Invalid window aggregation `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'S':
+        socketPath = optarg;
+        break;
+      case 'h':
+        printHelp(argv[0]);
+        return 1;
+      case '?':
+        printHelp(argv[0]);
+        printf("Invalid argument -%c\n", optopt);
+        return 1;
+      case ':':
+        printHelp(argv[0]);
+        printf("Missing option for %c\n", optopt);
+        return 1;
+      default:
+        printf("?? getopt returned character code 0%o ??\n", c);
+        return 1;
+    }
+  }
+
+  int numPositional = argc - optind;
+  if (!socketPath.empty()) {
+    // Positional arguments: FILE [TASK]
+    if ((numPositional != 1) && (numPositional != 2)) {
+      printHelp(argv[0]);
+      return 1;
+    }
+    long numErrors = predictRemote(socketPath, argv[optind],
+                                   numPositional == 2 ? argv[optind+1] : "");
+    return numErrors > 0 ? 1 : 0;
+  }
+
+  // Positional arguments: MODEL FILE [TASK]
+  if ((numPositional != 2) && (numPositional != 3)) {
+      printHelp(argv[0]);
+      return 1;
+  }
+
+  std::string baseFname = argv[optind];
+  std::string textsFname = argv[optind+1];
+  std::string taskName;
+  if (numPositional == 3) {
+    taskName = argv[optind+2];
+  } else {
+    taskName = "";
+  }
+
+  try {
+    configureScheduler(numThreads, numInteropThreads, tokenizerThreads, 0, cpuAffinity);
+  } catch (const std::exception& e) {
+    // e.g. the CPUs of a NUMA node that does not exist
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  torch::Device device = getDevice(deviceName);
+  printRuntimeInfo(device);
+
+  Config config;
+  readStruct(config, baseFname + "-bert.config");
+  if (maxSequenceLength > config.maxPositionEmbeddings) {
+    std::cerr << "Error: maximum sequence length exceeds the model's "
+              << config.maxPositionEmbeddings << " position embeddings"
+              << std::endl;
+    return 1;
+  }
+  bool quantized = isQuantizedModel(baseFname) || !quantize.empty();
+  if (quantized && !device.is_cpu()) {
+    std::cerr << "Error: quantized inference runs on the CPU only" << std::endl;
+    return 1;
+  }
+  Predictor predictor = loadPredictor(baseFname, taskName, device, !quantize.empty(),
+                                      exitThreshold, exitCriterion);
+  predictor.bertModel->packed = packed;
+  if (!predictor.tokenLevel) predictor.bertModel->setClsOnlyLayers(clsOnlyLayers);
+
+  torch::NoGradGuard noGrad;
+
+  std::unique_ptr<PredictionCache> cache;
+  uint64_t modelKey = 0;
+  if (!cacheFname.empty()) {
+    cache.reset(new PredictionCache(cacheFname));
+    // The options that change the outputs, and the checkpoints
+    std::string variant = "quantized=" + std::to_string(quantized)
+      + " cls_only_layers=" + std::to_string(predictor.tokenLevel ? 0 : clsOnlyLayers)
+      + " exit_threshold=" + std::to_string(exitThreshold) + " " + exitCriterion;
+    modelKey = hashBytes(variant.data(), variant.size(), 0);
+    for (const auto& fname : predictor.fnames) modelKey = hashFile(fname, modelKey);
+  }
+
+  if ((textsFname == "-") && (windowStride > 0)) {
+    std::cerr << "Error: `--window-stride` is not supported for streaming" << std::endl;
+    return 1;
+  }
+  if (textsFname == "-") {
+    // Streaming, one line at a time from stdin
+    predictStream(predictor, std::cin, batchSize, maxWait, maxSequenceLength,
+                  cache.get(), modelKey);
+    printSchedulerStats();
+    return 0;
+  }
+
+  // With windows, each window is a row below until the outputs are merged
+  TextWindows windows;
+  torch::Tensor texts;
+  if (windowStride > 0) {
+    windows = readTextsToWindows(textsFname, predictor.vocabFname, predictor.lowercaseFname,
+                                 maxSequenceLength, windowStride);
+    texts = windows.ids;
+  } else {
+    texts = readTextsToTensor(textsFname, predictor.vocabFname,
+                              predictor.lowercaseFname, maxSequenceLength);
+  }
+
+  // Outputs are collected in the original line order
+  long numTexts = texts.size(0);
+  std::vector<torch::Tensor> outputs(numTexts);
+  texts = texts.contiguous();
+  torch::Tensor lengths = (texts != PADDING_IDX).sum(1);
+  const long* lengthsData = lengths.data_ptr<long>();
+
+  // Take the outputs of cached inputs, encode the others
+  auto startTime = std::chrono::steady_clock::now();
+  std::vector<uint64_t> keys(numTexts);
+  std::vector<int64_t> missingRows;
+  // Repeated inputs take the output of their first row
+  std::unordered_map<uint64_t, long> firstRows;
+  std::vector<std::pair<long, long>> repeatedRows;
+  long numHits = 0;
+  double savedMs = 0.0;
+  const long* textsData = texts.data_ptr<long>();
+  for (long row = 0; row < numTexts; row++) {
+    if (cache) {
+      keys[row] = PredictionCache::getKey(modelKey, textsData + row * texts.size(1),
+                                          lengthsData[row]);
+      float computeMs;
+      outputs[row] = cache->lookup(keys[row], computeMs);
+      if (outputs[row].defined()) {
+        numHits++;
+        savedMs += computeMs;
+        continue;
+      }
+      auto first = firstRows.find(keys[row]);
+      if (first != firstRows.end()) {
+        numHits++;
+        repeatedRows.emplace_back(row, first->second);
+        continue;
+      }
+      firstRows[keys[row]] = row;
+    }
+    missingRows.push_back(row);
+  }
+
+  // Sort the inputs by token length (longest first) so that each batch holds
+  // sequences of similar length and can be trimmed to its longest row
+  torch::Tensor rows = torch::tensor(missingRows, torch::kInt64);
+  torch::Tensor order = rows.index_select(
+    0, lengths.index_select(0, rows).argsort(0, /*descending=*/true));
+  const long* orderData = order.data_ptr<long>();
+  long numComputed = order.size(0);
+
+  std::vector<double> batchLatencies;
+  // Per-sentence share of its batch's latency
+  std::vector<float> computeMs(numTexts, 0.0f);
+  long totalLayers = 0;
+
+  for (long i = 0; i < numComputed; i += batchSize) {
+    auto batchStartTime = std::chrono::steady_clock::now();
+    long batchEnd = std::min(i + batchSize, numComputed);
+    torch::Tensor indices = order.slice(0, i, batchEnd);
+
+    // Rows are sorted, so the first one is the longest
+    long batchLength = lengthsData[orderData[i]];
+    torch::Tensor batch = texts.index_select(0, indices).slice(1, 0, batchLength);
+    std::vector<torch::Tensor> batchOutputs = predictBatch(predictor, batch, totalLayers);
+    for (long j = i; j < batchEnd; j++) outputs[orderData[j]] = batchOutputs[j - i];
+
+    std::chrono::duration<double, std::milli> batchLatency =
+      std::chrono::steady_clock::now() - batchStartTime;
+    batchLatencies.push_back(batchLatency.count());
+    for (long j = i; j < batchEnd; j++) {
+      computeMs[orderData[j]] = batchLatency.count() / (batchEnd - i);
+    }
+  }
+  for (const auto& repeated : repeatedRows) {
+    outputs[repeated.first] = outputs[repeated.second];
+    savedMs += computeMs[repeated.second];
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - startTime;
+
+  if (cache) {
+    for (long j = 0; j < numComputed; j++) {
+      long row = orderData[j];
+      cache->insert(keys[row], outputs[row], computeMs[row]);
+    }
+    cache->flush();
+  }
+
+  if (windowStride > 0) {
+    outputs = mergeWindows(outputs, windows, predictor.tokenLevel, windowAggregation);
+  }
+  for (const auto& output : outputs) {
+    printLogits(output);
+  }
+
+  std::cerr << "# "
+            << "sentences=" << numTexts;
+  if (windowStride > 0) {
+    std::cerr << " documents=" << outputs.size()
+              << " window_stride=" << windowStride;
+  }
+  std::cerr << " batch_size=" << batchSize
+            << " sentences_per_sec=" << numTexts / elapsed.count()
+            << " batch_latency_p50_ms=" << percentile(batchLatencies, 0.5)
+            << " batch_latency_p99_ms=" << percentile(batchLatencies, 0.99)
+            << " avg_layers="
+            << (numComputed > 0 ? static_cast<double>(totalLayers) / numComputed : 0.0);
+  if (cache) {
+    std::cerr << " cache_hits=" << numHits
+              << " cache_hit_rate=" << static_cast<double>(numHits) / numTexts
+              << " cache_time_saved_sec=" << savedMs / 1000.0
+              << " cache_entries=" << cache->size();
+  }
+  std::cerr << std::endl;
+  printSchedulerStats();
 
   return 0;
 
@@ -1,6 +1,90 @@
 #ifndef PREDICT_PREDICT_H
 #define PREDICT_PREDICT_H
+#include <map>
+#include <string>
+#include <vector>
+
+#include <torch/nn/modules/container/any.h>
+#include <torch/types.h>
+
+#include "model/bert_model.h"
+
 namespace predict {
+// The flattened logits of one input as a DELIMITER-separated line, without
+// the newline
+std::string formatLogits(const torch::Tensor& logits);
+
+// Print the flattened logits of one input as a DELIMITER-separated line
+void printLogits(const torch::Tensor& logits);
+
+// Nearest-rank percentile (q in [0, 1]) of some values
+double percentile(std::vector<double> values, double q);
+
+// Load a classifier head saved by `train` (`*-binary.pt`/`*-multiclass.pt`)
+// with its options from the matching `.config` file. Heads written by
+// `bert quantize` need prequantized set
+torch::nn::AnyModule loadClassifier(const std::string& fname,
+                                    const torch::Device& device,
+                                    bool& binary, bool& tokenLevel,
+                                    bool prequantized = false);
+
+// Whether `bert quantize` wrote the model, i.e. `<baseFname>.quantized` exists
+bool isQuantizedModel(const std::string& baseFname);
+
+// Per-row confidence of sentence-level logits, in [0, 1]: the probability
+// of the predicted class(es) for the `max-prob` criterion, or one minus the
+// normalized entropy for `entropy`. For multi-label binary tasks the least
+// confident label counts
+torch::Tensor getConfidence(const torch::Tensor& logits, bool binary,
+                            const std::string& criterion);
+
+// The tokenizer vocabulary saved with a model, `<baseFname>.vocab` or
+// `<baseFname>.sp` for sentencepiece
+std::string getModelVocabFname(const std::string& baseFname);
+
+// Load `<baseFname>-bert.pt` (pruned or quantized by `bert prune` and
+// `bert quantize` if so) in eval mode on device. With quantize, the Linear
+// layers are quantized to int8 at load time
+BertModel loadBertModel(const std::string& baseFname,
+                        const torch::Device& device,
+                        bool quantize);
+
+// A fine-tuned model and task head loaded for inference, see loadPredictor
+struct Predictor {
+  BertModel bertModel{nullptr};
+  torch::nn::AnyModule classifier;
+  // Early-exit heads by encoder depth, used if exitThreshold > 0
+  std::map<long, torch::nn::AnyModule> exitClassifiers;
+  float exitThreshold = 0.0f;
+  std::string exitCriterion = "max-prob";
+  bool binary = false, tokenLevel = false, quantized = false;
+  torch::Device device = torch::kCPU;
+  // Tokenizer files, as for readTextsToTensor
+  std::string vocabFname, lowercaseFname;
+  // Files the outputs depend on, e.g. for a PredictionCache key
+  std::vector<std::string> fnames;
+};
+
+// Load `<baseFname>-bert.pt` and the head of a task (the only one if
+// taskName is empty) in eval mode on device, throws if there is no such
+// head. The early-exit heads of the task are loaded if exitThreshold > 0.
+// With quantize, the Linear layers are quantized to int8 at load time;
+// models written by `bert quantize` always are
+Predictor loadPredictor(const std::string& baseFname,
+                        const std::string& taskName,
+                        const torch::Device& device,
+                        bool quantize,
+                        float exitThreshold,
+                        const std::string& exitCriterion);
+
+// Run a batch of input ids, (BATCH_SIZE, SEQUENCE_LENGTH) trimmed to its
+// longest row. Returns the logits of each row on the CPU; token-level logits
+// cover the positions of the row only. The number of encoder layers run for
+// each row is added to numLayersRun
+std::vector<torch::Tensor> predictBatch(Predictor& predictor, torch::Tensor batch,
+                                        long& numLayersRun);
+
+void printHelp(const std::string &programName);
 int main(int argc, char *argv[]);
 }
 #endif
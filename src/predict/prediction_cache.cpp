@@ -0,0 +1,201 @@
+#include "prediction_cache.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace predict {
+
+static const char CACHE_MAGIC[8] = {'B', 'E', 'R', 'T', 'P', 'C', '0', '1'};
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+  // FNV-1a over 64-bit words, then the remaining bytes
+  const uint64_t prime = 0x100000001b3ULL;
+  const char* bytes = static_cast<const char*>(data);
+  uint64_t hash = seed ^ 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(uint64_t));
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; i++) hash = (hash ^ static_cast<unsigned char>(bytes[i])) * prime;
+  return hash;
+}
+
+uint64_t hashFile(const std::string& fname, uint64_t seed) {
+  std::ifstream file(fname, std::ios::binary);
+  if (!file.is_open()) return seed;
+  std::vector<char> buffer(1 << 20);
+  uint64_t hash = seed;
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    hash = hashBytes(buffer.data(), file.gcount(), hash);
+  }
+  return hash;
+}
+
+uint64_t PredictionCache::getKey(uint64_t modelKey, const long* ids, long length) {
+  return hashBytes(ids, length * sizeof(long), modelKey);
+}
+
+PredictionCache::PredictionCache(const std::string& fname) : fname (fname) {
+  int fd = open(fname.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) throw std::runtime_error("Cannot open the prediction cache " + fname);
+  auto fail = [&](const std::string& message) {
+    if (mapped != nullptr) munmap(const_cast<char*>(mapped), mappedSize);
+    mapped = nullptr;
+    close(fd);
+    throw std::runtime_error(message);
+  };
+  // Other runs may be appending to the same file
+  flock(fd, LOCK_EX);
+  struct stat st;
+  fstat(fd, &st);
+  if (st.st_size == 0) {
+    if (write(fd, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != sizeof(CACHE_MAGIC)) {
+      fail("Cannot write the prediction cache " + fname);
+    }
+    st.st_size = sizeof(CACHE_MAGIC);
+  }
+  mappedSize = st.st_size;
+  void* addr = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) fail("Cannot map the prediction cache " + fname);
+  mapped = static_cast<const char*>(addr);
+  if ((mappedSize < sizeof(CACHE_MAGIC))
+      || (std::memcmp(mapped, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0)) {
+    fail(fname + " is not a prediction cache");
+  }
+
+  indexedSize = sizeof(CACHE_MAGIC);
+  indexRecords();
+  // Drop a truncated last record, so that new ones follow the last complete one
+  if ((indexedSize < mappedSize) && (ftruncate(fd, indexedSize) != 0)) {
+    fail("Cannot truncate the prediction cache " + fname);
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+void PredictionCache::indexRecords() {
+  size_t offset = indexedSize;
+  const size_t headerSize = sizeof(uint64_t) + sizeof(float) + sizeof(uint32_t);
+  while (offset + headerSize <= mappedSize) {
+    uint64_t key;
+    uint32_t numDims;
+    std::memcpy(&key, mapped + offset, sizeof(key));
+    std::memcpy(&numDims, mapped + offset + sizeof(key) + sizeof(float), sizeof(numDims));
+    size_t end = offset + headerSize + numDims * sizeof(int64_t);
+    if (end > mappedSize) break;
+    int64_t numel = 1;
+    for (uint32_t d = 0; d < numDims; d++) {
+      int64_t dim;
+      std::memcpy(&dim, mapped + offset + headerSize + d * sizeof(int64_t), sizeof(dim));
+      numel *= dim;
+    }
+    end += numel * sizeof(float);
+    if (end > mappedSize) break;
+    offsets[key] = offset;
+    offset = end;
+  }
+  indexedSize = offset;
+}
+
+PredictionCache::~PredictionCache() {
+  if (mapped != nullptr) munmap(const_cast<char*>(mapped), mappedSize);
+}
+
+// The output of a record, from its COMPUTE_MS on
+static torch::Tensor decodeRecord(const char* record, float& computeMs) {
+  uint32_t numDims;
+  std::memcpy(&computeMs, record, sizeof(float));
+  record += sizeof(float);
+  std::memcpy(&numDims, record, sizeof(numDims));
+  record += sizeof(numDims);
+  std::vector<int64_t> dims(numDims);
+  std::memcpy(dims.data(), record, numDims * sizeof(int64_t));
+  record += numDims * sizeof(int64_t);
+  // Records are not aligned, copy instead of wrapping the mapped memory
+  torch::Tensor output = torch::empty(dims, torch::kFloat);
+  std::memcpy(output.data_ptr<float>(), record, output.numel() * sizeof(float));
+  return output;
+}
+
+torch::Tensor PredictionCache::lookup(uint64_t key, float& computeMs) const {
+  // Inserted but not flushed yet, e.g. a line seen twice in one run
+  auto record = pending.find(key);
+  if (record != pending.end()) {
+    return decodeRecord(record->second.data() + sizeof(uint64_t), computeMs);
+  }
+  auto it = offsets.find(key);
+  if (it == offsets.end()) return torch::Tensor();
+  return decodeRecord(mapped + it->second + sizeof(uint64_t), computeMs);
+}
+
+void PredictionCache::insert(uint64_t key, const torch::Tensor& output, float computeMs) {
+  if ((offsets.count(key) > 0) || (pending.count(key) > 0)) return;
+  torch::Tensor values = output.contiguous().to(torch::kFloat);
+  uint32_t numDims = values.dim();
+  std::string record(sizeof(uint64_t) + sizeof(float) + sizeof(uint32_t)
+                     + numDims * sizeof(int64_t) + values.numel() * sizeof(float), '\0');
+  char* data = &record[0];
+  std::memcpy(data, &key, sizeof(key));
+  data += sizeof(key);
+  std::memcpy(data, &computeMs, sizeof(computeMs));
+  data += sizeof(computeMs);
+  std::memcpy(data, &numDims, sizeof(numDims));
+  data += sizeof(numDims);
+  std::memcpy(data, values.sizes().data(), numDims * sizeof(int64_t));
+  data += numDims * sizeof(int64_t);
+  std::memcpy(data, values.data_ptr<float>(), values.numel() * sizeof(float));
+  pending[key] = std::move(record);
+}
+
+void PredictionCache::flush() {
+  if (pending.empty()) return;
+  std::string records;
+  for (const auto& record : pending) records += record.second;
+  // Readable too, for mapping it again below
+  int fd = open(fname.c_str(), O_RDWR | O_APPEND);
+  if (fd < 0) throw std::runtime_error("Cannot open the prediction cache " + fname);
+  // Other runs may append to the same file
+  flock(fd, LOCK_EX);
+  size_t written = 0;
+  while (written < records.size()) {
+    ssize_t n = write(fd, records.data() + written, records.size() - written);
+    if (n <= 0) break;
+    written += n;
+  }
+  if (written < records.size()) {
+    flock(fd, LOCK_UN);
+    close(fd);
+    throw std::runtime_error("Cannot write the prediction cache " + fname);
+  }
+  // Map the file again, with the records of this and other runs, so that
+  // lookups still find the flushed ones
+  struct stat st;
+  void* addr = fstat(fd, &st) == 0
+    ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  flock(fd, LOCK_UN);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error("Cannot map the prediction cache " + fname);
+  }
+  munmap(const_cast<char*>(mapped), mappedSize);
+  mapped = static_cast<const char*>(addr);
+  mappedSize = st.st_size;
+  indexRecords();
+  pending.clear();
+}
+
+long PredictionCache::size() const {
+  return offsets.size() + pending.size();
+}
+}
@@ -0,0 +1,60 @@
+#ifndef PREDICT_PREDICTION_CACHE_H
+#define PREDICT_PREDICTION_CACHE_H
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <torch/types.h>
+
+namespace predict {
+// 64-bit hash of some bytes, continuing from seed
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed);
+
+// Hash of the contents of a file, continuing from seed. A missing file
+// leaves the seed unchanged
+uint64_t hashFile(const std::string& fname, uint64_t seed);
+
+// A persistent, append-only cache of prediction outputs (e.g. the logits of
+// a sentence), keyed by a hash of the model, its task head and the token ids
+// of the input. Each record is
+//   KEY (uint64) COMPUTE_MS (float) NUM_DIMS (uint32) DIMS (int64...) VALUES (float...)
+// The file is memory-mapped for lookups; new records are kept in memory
+// (and found by lookups) until flush() appends them in one write and maps
+// the file again. A truncated last record, e.g. from an interrupted run, is
+// dropped when opening
+class PredictionCache {
+  public:
+    explicit PredictionCache(const std::string& fname);
+    ~PredictionCache();
+    PredictionCache(const PredictionCache&) = delete;
+    PredictionCache& operator=(const PredictionCache&) = delete;
+
+    // Key of the first `length` token ids of a row, for a model key such as
+    // a hashFile() of its checkpoints
+    static uint64_t getKey(uint64_t modelKey, const long* ids, long length);
+
+    // The output stored for a key, or an undefined tensor. computeMs is set
+    // to the time it took to compute it
+    torch::Tensor lookup(uint64_t key, float& computeMs) const;
+    // Add an output, computed in computeMs milliseconds
+    void insert(uint64_t key, const torch::Tensor& output, float computeMs);
+    // Append the inserted outputs to the file
+    void flush();
+
+    long size() const;
+  private:
+    std::string fname;
+    const char* mapped = nullptr;
+    size_t mappedSize = 0;
+    // End of the last complete record in the mapped file
+    size_t indexedSize = 0;
+    // Offsets of the records in the mapped file
+    std::unordered_map<uint64_t, size_t> offsets;
+    std::unordered_map<uint64_t, std::string> pending;
+
+    // Add the records from indexedSize to the end of the mapping to offsets
+    void indexRecords();
+};
+}
+#endif
@@ -0,0 +1,151 @@
+#include "stream.h"
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "data.h"
+#include "runtime.h"
+
+namespace predict {
+
+// A tokenized input line and when it was read
+struct StreamItem {
+  torch::Tensor ids;
+  std::chrono::steady_clock::time_point arrival;
+};
+
+// The queue and error of the reader thread, shared with it since it may
+// outlive predictStream
+struct ReaderState {
+  explicit ReaderState(size_t capacity) : queue (capacity) {}
+  BoundedQueue<StreamItem> queue;
+  std::exception_ptr error;
+};
+
+void predictStream(Predictor& predictor, std::istream& in,
+                   long batchSize, double maxWaitMs, long maxSequenceLength,
+                   PredictionCache* cache, uint64_t modelKey) {
+  using Clock = std::chrono::steady_clock;
+  if (batchSize <= 0) throw std::runtime_error("The batch size must be positive");
+  auto state = std::make_shared<ReaderState>(STREAM_QUEUE_BATCHES * batchSize);
+  BoundedQueue<StreamItem>& queue = state->queue;
+
+  // Tokenizer stage
+  std::string vocabFname = predictor.vocabFname, lowercaseFname = predictor.lowercaseFname;
+  std::thread reader([state, &in, vocabFname, lowercaseFname, maxSequenceLength] {
+    try {
+      LineEncoder encoder(vocabFname, lowercaseFname, maxSequenceLength);
+      std::string line;
+      while (std::getline(in, line)) {
+        Clock::time_point arrival = Clock::now();
+        if (!state->queue.push({encoder.encode(line), arrival})) break;
+      }
+    } catch (...) {
+      state->error = std::current_exception();
+    }
+    state->queue.close();
+  });
+
+  // Model stage. On an error, the reader is left behind rather than joined,
+  // since it may wait for a line of `in` indefinitely; it stops at its next
+  // line
+  torch::NoGradGuard noGrad;
+  std::vector<double> lineLatencies;
+  long numLines = 0, numBatches = 0, numHits = 0, numComputed = 0, totalLayers = 0;
+  Clock::time_point startTime = Clock::now();
+  try {
+    StreamItem item;
+    while (queue.pop(item)) {
+      // Wait for more lines until the batch is full or the first line is due
+      std::vector<StreamItem> items;
+      items.push_back(std::move(item));
+      Clock::time_point deadline = items[0].arrival
+        + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double, std::milli>(maxWaitMs));
+      while ((static_cast<long>(items.size()) < batchSize) && queue.popUntil(item, deadline)) {
+        items.push_back(std::move(item));
+      }
+
+      std::vector<torch::Tensor> outputs(items.size());
+      std::vector<uint64_t> keys(items.size());
+      std::vector<torch::Tensor> missingIds;
+      std::vector<size_t> missingItems;
+      for (size_t k = 0; k < items.size(); k++) {
+        if (cache != nullptr) {
+          long length = (items[k].ids != PADDING_IDX).sum().item<long>();
+          keys[k] = PredictionCache::getKey(modelKey, items[k].ids.data_ptr<long>(), length);
+          float computeMs;
+          outputs[k] = cache->lookup(keys[k], computeMs);
+          if (outputs[k].defined()) {
+            numHits++;
+            continue;
+          }
+        }
+        missingIds.push_back(items[k].ids);
+        missingItems.push_back(k);
+      }
+
+      if (!missingIds.empty()) {
+        Clock::time_point batchStartTime = Clock::now();
+        torch::Tensor batch = torch::stack(missingIds);
+        long batchLength = (batch != PADDING_IDX).sum(1).max().item<long>();
+        batch = batch.slice(1, 0, batchLength);
+        std::vector<torch::Tensor> batchOutputs = predictBatch(predictor, batch, totalLayers);
+        std::chrono::duration<double, std::milli> batchLatency = Clock::now() - batchStartTime;
+        for (size_t j = 0; j < missingItems.size(); j++) {
+          outputs[missingItems[j]] = batchOutputs[j];
+          if (cache != nullptr) {
+            cache->insert(keys[missingItems[j]], batchOutputs[j],
+                          batchLatency.count() / missingItems.size());
+          }
+        }
+        if (cache != nullptr) cache->flush();
+        numComputed += missingItems.size();
+        numBatches++;
+      }
+
+      for (const auto& output : outputs) printLogits(output);
+      std::cout.flush();
+      Clock::time_point doneTime = Clock::now();
+      for (const auto& done : items) {
+        std::chrono::duration<double, std::milli> latency = doneTime - done.arrival;
+        lineLatencies.push_back(latency.count());
+      }
+      numLines += items.size();
+    }
+  } catch (...) {
+    queue.close();
+    reader.detach();
+    throw;
+  }
+  reader.join();
+  if (state->error) std::rethrow_exception(state->error);
+
+  std::chrono::duration<double> elapsed = Clock::now() - startTime;
+  std::cerr << "# "
+            << "sentences=" << numLines
+            << " batch_size=" << batchSize
+            << " max_wait_ms=" << maxWaitMs
+            << " avg_batch_size="
+            << (numBatches > 0 ? static_cast<double>(numComputed) / numBatches : 0.0)
+            << " sentences_per_sec=" << numLines / elapsed.count()
+            << " line_latency_p50_ms=" << percentile(lineLatencies, 0.5)
+            << " line_latency_p99_ms=" << percentile(lineLatencies, 0.99)
+            << " avg_layers="
+            << (numComputed > 0 ? static_cast<double>(totalLayers) / numComputed : 0.0);
+  if (cache != nullptr) {
+    std::cerr << " cache_hits=" << numHits
+              << " cache_hit_rate="
+              << (numLines > 0 ? static_cast<double>(numHits) / numLines : 0.0)
+              << " cache_entries=" << cache->size();
+  }
+  std::cerr << std::endl;
+}
+}
@@ -0,0 +1,22 @@
+#ifndef PREDICT_STREAM_H
+#define PREDICT_STREAM_H
+#include <cstdint>
+#include <istream>
+
+#include "predict.h"
+#include "prediction_cache.h"
+
+namespace predict {
+// Predict the lines of `in` as they arrive and print the outputs in the
+// input order. A reader thread tokenizes lines into a queue of at most
+// STREAM_QUEUE_BATCHES * batchSize lines; the model runs a micro-batch once
+// batchSize lines are queued or maxWaitMs after the first line of the batch
+// arrived, and flushes its outputs. If given, cached outputs are reused and
+// new ones added, see PredictionCache. If the model fails, the error is
+// rethrown without waiting for the reader, so `in` must outlive it (e.g.
+// std::cin)
+void predictStream(Predictor& predictor, std::istream& in,
+                   long batchSize, double maxWaitMs, long maxSequenceLength,
+                   PredictionCache* cache = nullptr, uint64_t modelKey = 0);
+}
+#endif
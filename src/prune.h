@@ -0,0 +1,4 @@
+#ifndef PRUNE_H
+#define PRUNE_H
+#include "prune/prune.h"
+#endif
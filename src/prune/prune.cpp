@@ -0,0 +1,286 @@
+#include "prune.h"
+
+#include <algorithm>
+#include <cmath>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <torch/serialize.h>
+
+#include "config.h"
+#include "data.h"
+#include "model.h"
+#include "predict.h"
+#include "runtime.h"
+#include "state.h"
+#include "train/task.h"
+#include "train/train_loop.h"
+#include "train/train_utils.h"
+
+namespace prune {
+
+std::vector<torch::Tensor> selectGlobalTopK(const std::vector<torch::Tensor>& scores,
+                                            double keepFraction) {
+  std::vector<torch::Tensor> normalized;
+  for (const auto& layerScores : scores) {
+    normalized.push_back(layerScores / layerScores.norm().clamp_min(1e-12));
+  }
+  torch::Tensor all = torch::cat(normalized);
+  long numKeep = std::max(1L, static_cast<long>(std::ceil(keepFraction * all.size(0))));
+  numKeep = std::min(numKeep, all.size(0));
+  // The lowest score that is kept
+  float threshold = std::get<0>(all.topk(numKeep)).min().item<float>();
+
+  std::vector<torch::Tensor> keep;
+  for (const auto& layerScores : normalized) {
+    torch::Tensor indices = (layerScores >= threshold).nonzero().view({-1});
+    if (indices.size(0) == 0) indices = layerScores.argmax().view({1});
+    keep.push_back(indices);
+  }
+  return keep;
+}
+
+static long countParameters(torch::nn::Module& module) {
+  long count = 0;
+  for (const auto& param : module.parameters()) count += param.numel();
+  return count;
+}
+
+void printHelp(const std::string &programName) {
+  std::cout << "Usage: " << programName << " [OPTIONS] MODEL OUTPUT" << std::endl;
+  std::cout << "\
+Remove the least important attention heads and intermediate (feed-forward)\n\
+neurons of a fine-tuned BERT model and write the smaller model to OUTPUT.\n\
+Importance is the magnitude of the gradient of the task losses w.r.t. a\n\
+mask on each head and neuron, accumulated over the training data, with the\n\
+scores of each layer normalized. `predict OUTPUT ...` loads the result.\n\n\
+Data:\n\
+  -M, --model-dir           Extracted model directory the model was\n\
+                              fine-tuned from, for its vocabulary\n\
+  -D, --data-dir            Base data directory, as used by `train`\n\
+  -t  --task                Task name, as used by `train`. Repeat for\n\
+                              several tasks\n\n\
+Pruning:\n\
+  -H, --keep-heads          Fraction of the attention heads to keep\n\
+                              Default: 0.5\n\
+  -N, --keep-neurons        Fraction of the intermediate neurons to keep\n\
+                              Default: 0.5\n\n\
+Options:\n\
+  -b, --batch-size          Number of sentences per forward/backward pass\n\
+                              Default: 32\n\
+  -L, --max-sequence-length Pad/truncate input sequences to that many tokens\n\
+                              Default: 100\n\
+  -d, --device              Device to score on, e.g. `cpu`, `cuda`, `cuda:1`\n\
+                              Default: `cuda` if available, else `cpu`\n\
+  -j, --num-threads         Number of intra-op threads for tensor operations\n\
+                              Default: 0 (libtorch default)\n\
+";
+}
+
+int main(int argc, char *argv[]) {
+  int c, opt = 0;
+  int batchSize = DEFAULT_BATCH_SIZE,
+      maxSequenceLength = DEFAULT_MAX_SEQUENCE_LENGTH,
+      numThreads = DEFAULT_NUM_THREADS;
+  double keepHeads = 0.5, keepNeurons = 0.5;
+  std::string modelDir = "", dataDir = "", deviceName = "";
+  std::vector<Task> tasks;
+
+	static struct option options[] = {
+			{"model-dir",             required_argument, NULL,  'M' },
+			{"data-dir",              required_argument, NULL,  'D' },
+			{"task",                  required_argument, NULL,  't' },
+			{"keep-heads",            required_argument, NULL,  'H' },
+			{"keep-neurons",          required_argument, NULL,  'N' },
+			{"batch-size",            required_argument, NULL,  'b' },
+			{"max-sequence-length",   required_argument, NULL,  'L' },
+			{"device",                required_argument, NULL,  'd' },
+			{"num-threads",           required_argument, NULL,  'j' },
+			{"help",                  no_argument,       NULL,  'h' },
+			{NULL,                    0,                 NULL,   0  }
+	};
+
+	while ((c = getopt_long(argc, argv, ":M:D:t:H:N:b:L:d:j:h", options, &opt)) != -1) {
+    switch (c) {
+      case 'M':
+        modelDir = optarg;
+        break;
+      case 'D':
+        dataDir = optarg;
+        break;
+      case 't':
+        tasks.push_back(Task());
+        tasks.back().name = optarg;
+        break;
+      case 'H':
+        keepHeads = std::stod(optarg);
+        break;
+      case 'N':
+        keepNeurons = std::stod(optarg);
+        break;
+      case 'b':
+        batchSize = std::stoi(optarg);
+        break;
+      case 'L':
+        maxSequenceLength = std::stoi(optarg);
+        if (maxSequenceLength < 2) {
+          printHelp(argv[0]);
+          printf("Invalid maximum sequence length `%s`, [CLS] and [SEP] need 2\n", optarg);
+          return 1;
+        }
+        break;
+      case 'd':
+        deviceName = optarg;
+        break;
+      case 'j':
+        numThreads = std::stoi(optarg);
+        break;
+      case 'h':
+        printHelp(argv[0]);
+        return 1;
+      case '?':
+        printHelp(argv[0]);
+        printf("Invalid argument -%c\n", optopt);
+        return 1;
+      case ':':
+        printHelp(argv[0]);
+        printf("Missing option for %c\n", optopt);
+        return 1;
+      default:
+        printf("?? getopt returned character code 0%o ??\n", c);
+        return 1;
+    }
+  }
+
+  if ((argc - optind != 2) || modelDir.empty() || dataDir.empty() || tasks.empty()) {
+    printHelp(argv[0]);
+    return 1;
+  }
+  if ((keepHeads <= 0.0) || (keepHeads > 1.0) || (keepNeurons <= 0.0) || (keepNeurons > 1.0)) {
+    std::cout << "Error: the fractions to keep should be in (0, 1]" << std::endl;
+    return 1;
+  }
+  std::string baseFname = argv[optind];
+  std::string outputFname = argv[optind+1];
+  if (predict::isQuantizedModel(baseFname)) {
+    std::cerr << "Error: prune the float model, then quantize it" << std::endl;
+    return 1;
+  }
+
+  setNumThreads(numThreads, DEFAULT_NUM_INTEROP_THREADS);
+  torch::Device device = getDevice(deviceName);
+  printRuntimeInfo(device);
+
+  Config config;
+  readStruct(config, baseFname + "-bert.config");
+  BertModel model(config);
+  // A pruned model can be pruned further
+  loadPrunedShapes(model, baseFname + "-bert.pruned");
+  torch::load(model, baseFname + "-bert.pt", device);
+  model->setSeparatorId(getSeparatorId(modelDir));
+  long numParametersBefore = countParameters(*model);
+
+  for (auto& task : tasks) {
+    task.baseDir = dataDir;
+    detectTaskType(task);
+  }
+  TextDatasetType dataset = getDataset(modelDir, tasks, "train", maxSequenceLength);
+  TextDataLoaderType loader = torch::data::make_data_loader(
+    dataset,
+    LengthBucketSampler(dataset.dataset().getLengths(), batchSize, BUCKET_SIZE, false),
+    torch::data::DataLoaderOptions().batch_size(batchSize));
+
+  // Criteria and heads as in `train`, with the fine-tuned head weights
+  tasks = initTasks(tasks, dataset, config, "", device);
+  for (auto& task : tasks) {
+    std::string moduleId = task.classifier.ptr()->name() == "BinaryClassifierImpl"
+      ? "binary" : "multiclass";
+    std::shared_ptr<torch::nn::Module> head = task.classifier.ptr();
+    torch::load(head, baseFname + "-" + task.name + "-" + moduleId + ".pt", device);
+    head->eval();
+    for (auto& param : head->parameters()) param.requires_grad_(false);
+  }
+  bool anyTokenLevel = std::any_of(tasks.begin(), tasks.end(), [](const Task& task) {
+    return (TokenLevel & task.taskType) == TokenLevel;
+  });
+  if (!anyTokenLevel) model->setClsOnlyLayers(1);
+
+  // Only the masks need gradients; dropout is off
+  model->eval();
+  for (auto& param : model->parameters()) param.requires_grad_(false);
+  long numLayers = model->getNumLayers();
+  std::vector<torch::Tensor> headMasks, neuronMasks, headScores, neuronScores;
+  for (long i = 0; i < numLayers; i++) {
+    auto layer = model->getLayer(i);
+    auto options = torch::TensorOptions().device(device);
+    headMasks.push_back(torch::ones({layer->getNumHeads()}, options).requires_grad_());
+    neuronMasks.push_back(torch::ones({layer->getIntermediateSize()}, options).requires_grad_());
+    headScores.push_back(torch::zeros({layer->getNumHeads()}, options));
+    neuronScores.push_back(torch::zeros({layer->getIntermediateSize()}, options));
+    layer->setImportanceMasks(headMasks.back(), neuronMasks.back());
+  }
+
+  // Accumulate |dLoss/dMask| for every batch
+  auto callback = [&] (torch::Tensor loss) {
+    loss.backward();
+    torch::NoGradGuard noGrad;
+    for (long i = 0; i < numLayers; i++) {
+      headScores[i] += headMasks[i].grad().abs();
+      neuronScores[i] += neuronMasks[i].grad().abs();
+      headMasks[i].grad().zero_();
+      neuronMasks[i].grad().zero_();
+    }
+  };
+  std::vector<torch::IntArrayRef> labelSizes = dataset.dataset().getLabelSizes();
+  std::vector<std::vector<float>> losses(tasks.size());
+  std::vector<torch::Tensor> labels, predictions;
+  for (const auto& size : labelSizes) {
+    labels.push_back(torch::full(size, CLASSIFICATION_IGNORE_INDEX, torch::kFloat));
+    predictions.push_back(torch::zeros(size));
+  }
+  float paddingRatio;
+  innerLoop(model, tasks, loader, losses, labels, predictions, paddingRatio, device, callback);
+
+  // Remove the masks and the lowest-scoring heads and neurons
+  std::vector<torch::Tensor> keptHeads = selectGlobalTopK(headScores, keepHeads);
+  std::vector<torch::Tensor> keptNeurons = selectGlobalTopK(neuronScores, keepNeurons);
+  for (long i = 0; i < numLayers; i++) {
+    auto layer = model->getLayer(i);
+    layer->setImportanceMasks(torch::Tensor(), torch::Tensor());
+    std::cerr << "# "
+              << "layer=" << i
+              << " heads=" << layer->getNumHeads() << "->" << keptHeads[i].size(0)
+              << " neurons=" << layer->getIntermediateSize() << "->" << keptNeurons[i].size(0)
+              << std::endl;
+    layer->pruneHeads(keptHeads[i]);
+    layer->pruneNeurons(keptNeurons[i]);
+  }
+  for (auto& param : model->parameters()) param.requires_grad_(true);
+  long numParametersAfter = countParameters(*model);
+  std::cerr << "# "
+            << "parameters=" << numParametersBefore << "->" << numParametersAfter
+            << " ratio=" << static_cast<float>(numParametersAfter) / numParametersBefore
+            << std::endl;
+
+  // Write the pruned model and its shapes, with copies of the heads and of
+  // the vocabulary
+  torch::save(model, outputFname + "-bert.pt");
+  saveStruct(config, outputFname + "-bert.config");
+  savePrunedShapes(model, outputFname + "-bert.pruned");
+  for (const auto& fname : getGlobFiles(baseFname + "-*.pt")) {
+    std::string suffix = fname.substr(baseFname.size());
+    if (suffix == "-bert.pt") continue;
+    copyFile(fname, outputFname + suffix);
+    std::string configSuffix = suffix.substr(0, suffix.rfind('.')) + ".config";
+    copyFile(baseFname + configSuffix, outputFname + configSuffix);
+  }
+  copyFile(baseFname + ".vocab", outputFname + ".vocab");
+  copyFile(baseFname + ".sp", outputFname + ".sp");
+  copyFile(baseFname + ".lowercase", outputFname + ".lowercase");
+  return 0;
+}
+}
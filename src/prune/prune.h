@@ -0,0 +1,18 @@
+#ifndef PRUNE_PRUNE_H
+#define PRUNE_PRUNE_H
+#include <string>
+#include <vector>
+
+#include <torch/types.h>
+
+namespace prune {
+// Indices of the entries to keep of some per-layer importance scores: the
+// globally highest keepFraction of them, after normalizing the scores of
+// every layer to unit L2 norm. Every layer keeps at least one entry
+std::vector<torch::Tensor> selectGlobalTopK(const std::vector<torch::Tensor>& scores,
+                                            double keepFraction);
+
+void printHelp(const std::string &programName);
+int main(int argc, char *argv[]);
+}
+#endif
@@ -0,0 +1,4 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+#include "quantize/quantize.h"
+#endif
@@ -0,0 +1,250 @@
+#include "quantize.h"
+
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <torch/serialize.h>
+
+#include "config.h"
+#include "data.h"
+#include "metrics.h"
+#include "model/classifier.h"
+#include "model/packing.h"
+#include "model/pruning.h"
+#include "model/quantizable_linear.h"
+#include "predict.h"
+#include "runtime.h"
+#include "state.h"
+
+namespace quantize {
+
+torch::Tensor computeLogits(BertModel& bertModel,
+                            torch::nn::AnyModule& classifier,
+                            const torch::Tensor& texts,
+                            long batchSize, bool tokenLevel) {
+  if (batchSize <= 0) throw std::runtime_error("The batch size must be positive");
+  torch::NoGradGuard noGrad;
+  std::vector<torch::Tensor> outputs;
+  for (long i = 0; i < texts.size(0); i += batchSize) {
+    torch::Tensor batch = texts.slice(0, i, i + batchSize);
+    // Trim the batch to its longest row
+    long batchLength = (batch != PADDING_IDX).sum(1).max().item<long>();
+    batch = batch.slice(1, 0, batchLength);
+    torch::Tensor hidden = bertModel->forward(batch);
+    torch::Tensor logits;
+    if (tokenLevel) {
+      PackingInfo tokens = getPackingInfo(batch);
+      logits = unpack(classifier.forward(pack(hidden, tokens)), tokens);
+      // Pad back to the full sequence length
+      std::vector<int64_t> padding(2 * (logits.dim() - 2), 0);
+      padding.push_back(0);
+      padding.push_back(texts.size(1) - batchLength);
+      logits = torch::constant_pad_nd(logits, padding);
+    } else {
+      logits = classifier.forward(hidden);
+    }
+    outputs.push_back(logits);
+  }
+  return torch::cat(outputs, 0);
+}
+
+void printHelp(const std::string &programName) {
+  std::cout << "Usage: " << programName << " [OPTIONS] MODEL OUTPUT" << std::endl;
+  std::cout << "\
+Write an int8 copy of a fine-tuned BERT model (see `predict --quantize`).\n\
+The Linear layers of the encoder and the heads get per-channel int8 weights;\n\
+`predict OUTPUT ...` then runs quantized without re-quantizing at startup.\n\n\
+Options:\n\
+  -D, --data-dir            Report the accuracy of the float and the int8\n\
+                              model on the `val-texts` and `val-$task` files\n\
+                              of this directory, as used by `train`\n\
+  -b, --batch-size          Number of sentences per forward pass\n\
+                              Default: 32\n\
+  -L, --max-sequence-length Pad/truncate input sequences to that many tokens\n\
+                              Default: 100\n\
+  -j, --num-threads         Number of intra-op threads for tensor operations\n\
+                              Default: 0 (libtorch default)\n\
+";
+}
+
+int main(int argc, char *argv[]) {
+  int c, opt = 0;
+  int batchSize = DEFAULT_BATCH_SIZE,
+      maxSequenceLength = DEFAULT_MAX_SEQUENCE_LENGTH,
+      numThreads = DEFAULT_NUM_THREADS;
+  std::string dataDir = "";
+
+	static struct option options[] = {
+			{"data-dir",              required_argument, NULL,  'D' },
+			{"batch-size",            required_argument, NULL,  'b' },
+			{"max-sequence-length",   required_argument, NULL,  'L' },
+			{"num-threads",           required_argument, NULL,  'j' },
+			{"help",                  no_argument,       NULL,  'h' },
+			{NULL,                    0,                 NULL,   0  }
+	};
+
+	while ((c = getopt_long(argc, argv, ":D:b:L:j:h", options, &opt)) != -1) {
+    switch (c) {
+      case 'D':
+        dataDir = optarg;
+        break;
+      case 'b':
+        batchSize = std::stoi(optarg);
+        if (batchSize <= 0) {
+          printHelp(argv[0]);
+          printf("Invalid batch size `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'L':
+        maxSequenceLength = std::stoi(optarg);
+        if (maxSequenceLength < 2) {
+          printHelp(argv[0]);
+          printf("Invalid maximum sequence length `%s`, [CLS] and [SEP] need 2\n", optarg);
+          return 1;
+        }
+        break;
+      case 'j':
+        numThreads = std::stoi(optarg);
+        break;
+      case 'h':
+        printHelp(argv[0]);
+        return 1;
+      case '?':
+        printHelp(argv[0]);
+        printf("Invalid argument -%c\n", optopt);
+        return 1;
+      case ':':
+        printHelp(argv[0]);
+        printf("Missing option for %c\n", optopt);
+        return 1;
+      default:
+        printf("?? getopt returned character code 0%o ??\n", c);
+        return 1;
+    }
+  }
+
+  if (argc - optind != 2) {
+    printHelp(argv[0]);
+    return 1;
+  }
+  std::string baseFname = argv[optind];
+  std::string outputFname = argv[optind+1];
+  if (predict::isQuantizedModel(baseFname)) {
+    std::cerr << "Error: " << baseFname << " is quantized already" << std::endl;
+    return 1;
+  }
+
+  setNumThreads(numThreads, DEFAULT_NUM_INTEROP_THREADS);
+  // The int8 kernels run on the CPU only
+  torch::Device device(torch::kCPU);
+  printRuntimeInfo(device);
+
+  Config config;
+  readStruct(config, baseFname + "-bert.config");
+  BertModel bertModel(config);
+  loadPrunedShapes(bertModel, baseFname + "-bert.pruned");
+  torch::load(bertModel, baseFname + "-bert.pt", device);
+  bertModel->eval();
+
+  // Input files for the accuracy report
+  std::string vocabFname = baseFname + ".vocab";
+  if (!std::ifstream(vocabFname).is_open()) {
+    // Sentencepiece
+    vocabFname = baseFname + ".sp";
+  }
+  std::string lowercaseFname = baseFname + ".lowercase";
+  torch::Tensor texts;
+  if (!dataDir.empty()) {
+    bertModel->setSeparatorId(getSeparatorId(vocabFname, lowercaseFname));
+    texts = readTextsToTensor(dataDir + "/val-texts", vocabFname, lowercaseFname,
+                              maxSequenceLength);
+  }
+
+  // Heads, with the logits of the float model for the report
+  std::vector<std::string> headFnames;
+  std::vector<torch::nn::AnyModule> heads;
+  std::vector<bool> headBinary, headTokenLevel;
+  std::vector<torch::Tensor> floatLogits;
+  for (const auto& fname : getGlobFiles(baseFname + "-*.pt")) {
+    if ((fname.find("binary") == std::string::npos)
+        && (fname.find("multiclass") == std::string::npos)) {
+      continue;
+    }
+    bool binary, tokenLevel;
+    headFnames.push_back(fname);
+    heads.push_back(predict::loadClassifier(fname, device, binary, tokenLevel));
+    heads.back().ptr()->eval();
+    headBinary.push_back(binary);
+    headTokenLevel.push_back(tokenLevel);
+    bool exitHead = fname.find("-exit") != std::string::npos;
+    floatLogits.push_back(texts.defined() && !exitHead
+      ? computeLogits(bertModel, heads.back(), texts, batchSize, tokenLevel)
+      : torch::Tensor());
+  }
+
+  quantizeLinears(*bertModel);
+  for (auto& head : heads) quantizeLinears(*head.ptr());
+
+  // Write the quantized model next to copies of its configuration and
+  // vocabulary, and the marker that `predict` looks for
+  torch::save(bertModel, outputFname + "-bert.pt");
+  saveStruct(config, outputFname + "-bert.config");
+  copyFile(baseFname + "-bert.pruned", outputFname + "-bert.pruned");
+  for (size_t i = 0; i < heads.size(); i++) {
+    std::string suffix = headFnames[i].substr(baseFname.size());
+    torch::save(heads[i].ptr(), outputFname + suffix);
+    std::string configSuffix = suffix.substr(0, suffix.rfind('.')) + ".config";
+    copyFile(baseFname + configSuffix, outputFname + configSuffix);
+  }
+  copyFile(baseFname + ".vocab", outputFname + ".vocab");
+  copyFile(baseFname + ".sp", outputFname + ".sp");
+  copyFile(baseFname + ".lowercase", outputFname + ".lowercase");
+  std::ofstream(outputFname + ".quantized") << "int8" << std::endl;
+
+  // Accuracy of the float and the int8 model on the validation set
+  for (size_t i = 0; i < heads.size(); i++) {
+    if (!floatLogits[i].defined()) continue;
+    // `<baseFname>-<task>-{binary,multiclass}.pt`
+    std::string suffix = headFnames[i].substr(baseFname.size() + 1);
+    std::string taskName = suffix.substr(0, suffix.rfind('-'));
+
+    torch::Tensor int8Logits = computeLogits(bertModel, heads[i], texts, batchSize,
+                                             headTokenLevel[i]);
+    int taskType = (headBinary[i] ? Binary : 0) | (headTokenLevel[i] ? TokenLevel : 0);
+    if (headBinary[i] && !headTokenLevel[i] && floatLogits[i].dim() == 2) {
+      taskType |= MultiLabel;
+    }
+    torch::Tensor labels = readLabelsToTensor(dataDir + "/val-" + taskName, taskType,
+                                              maxSequenceLength);
+    auto toPredictions = [&](const torch::Tensor& logits) -> torch::Tensor {
+      torch::Tensor predictions = headBinary[i] ? (logits >= 0.0f).to(torch::kInt64)
+                                                : logits.argmax(-1);
+      // Positions without a label do not count
+      return predictions.masked_fill(labels == CLASSIFICATION_IGNORE_INDEX,
+                                     CLASSIFICATION_IGNORE_INDEX);
+    };
+    torch::Tensor floatPredictions = toPredictions(floatLogits[i]);
+    torch::Tensor int8Predictions = toPredictions(int8Logits);
+    float floatAccuracy = accuracy(labels, floatPredictions);
+    float int8Accuracy = accuracy(labels, int8Predictions);
+    float agreement = accuracy(floatPredictions, int8Predictions);
+
+    std::cerr << "# "
+              << "task=" << taskName
+              << " val_examples=" << texts.size(0)
+              << " float_accuracy=" << floatAccuracy
+              << " int8_accuracy=" << int8Accuracy
+              << " accuracy_delta=" << int8Accuracy - floatAccuracy
+              << " prediction_agreement=" << agreement
+              << " max_abs_logit_diff="
+              << (floatLogits[i] - int8Logits).abs().max().item<float>()
+              << std::endl;
+  }
+  return 0;
+}
+}
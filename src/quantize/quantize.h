@@ -0,0 +1,22 @@
+#ifndef QUANTIZE_QUANTIZE_H
+#define QUANTIZE_QUANTIZE_H
+#include <string>
+
+#include <torch/nn/modules/container/any.h>
+#include <torch/types.h>
+
+#include "model/bert_model.h"
+
+namespace quantize {
+// Logits of a model for every row of some texts, computed in batches of
+// batchSize. Token-level logits are computed for the non-padding positions
+// only and have zeros at the padding
+torch::Tensor computeLogits(BertModel& bertModel,
+                            torch::nn::AnyModule& classifier,
+                            const torch::Tensor& texts,
+                            long batchSize, bool tokenLevel);
+
+void printHelp(const std::string &programName);
+int main(int argc, char *argv[]);
+}
+#endif
@@ -0,0 +1,7 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+#include "runtime/bounded_queue.h"
+#include "runtime/runtime_utils.h"
+#include "runtime/scheduler.h"
+#include "runtime/unix_socket.h"
+#endif
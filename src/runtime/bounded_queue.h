@@ -0,0 +1,64 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// A FIFO queue of at most `capacity` items shared between threads. push()
+// blocks while it is full, so a fast producer is held back by a slow
+// consumer instead of buffering without bounds. After close(), pops drain
+// the remaining items and then fail
+template <typename T>
+class BoundedQueue {
+  public:
+    explicit BoundedQueue(size_t capacity) : capacity (capacity) {}
+
+    // Returns false if the queue was closed
+    bool push(T item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+      if (closed) return false;
+      items.push_back(std::move(item));
+      notEmpty.notify_one();
+      return true;
+    }
+
+    // Wait for an item. Returns false if the queue is closed and empty
+    bool pop(T& item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+      return take(item);
+    }
+
+    // As pop(), but gives up at deadline
+    bool popUntil(T& item, std::chrono::steady_clock::time_point deadline) {
+      std::unique_lock<std::mutex> lock(mutex);
+      notEmpty.wait_until(lock, deadline, [this] { return closed || !items.empty(); });
+      return take(item);
+    }
+
+    void close() {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      notEmpty.notify_all();
+      notFull.notify_all();
+    }
+
+  private:
+    bool take(T& item) {
+      if (items.empty()) return false;
+      item = std::move(items.front());
+      items.pop_front();
+      notFull.notify_one();
+      return true;
+    }
+
+    size_t capacity;
+    bool closed = false;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty, notFull;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "runtime_utils.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <sys/resource.h>
+
+#include <ATen/Parallel.h>
+#include <torch/cuda.h>
+#ifdef WITH_CUDA
+#include <c10/cuda/CUDACachingAllocator.h>
+#include <c10/cuda/CUDAFunctions.h>
+#endif
+
+torch::Device getDevice(const std::string& description) {
+  if (description.empty()) {
+    return torch::cuda::is_available() ? torch::Device(torch::kCUDA)
+                                       : torch::Device(torch::kCPU);
+  }
+  torch::Device device(description);
+  if (device.is_cuda() && !torch::cuda::is_available()) {
+    throw std::runtime_error("Device `" + description + "` requested but CUDA is not available");
+  }
+  return device;
+}
+
+void setNumThreads(int intraOpThreads, int interOpThreads) {
+  // The inter-op pool can only be sized before its first use
+  if (interOpThreads > 0) at::set_num_interop_threads(interOpThreads);
+  if (intraOpThreads > 0) at::set_num_threads(intraOpThreads);
+}
+
+void printRuntimeInfo(const torch::Device& device) {
+  std::cerr << "# "
+            << "device=" << device
+            << " intra_op_threads=" << at::get_num_threads()
+            << " inter_op_threads=" << at::get_num_interop_threads()
+            << std::endl;
+}
+
+bool hasNativeBFloat16() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 5, "flags") != 0) continue;
+    return (line.find(" avx512_bf16") != std::string::npos)
+           || (line.find(" amx_bf16") != std::string::npos);
+  }
+  return false;
+}
+
+long getPeakMemory(const torch::Device& device) {
+#ifdef WITH_CUDA
+  if (device.is_cuda()) {
+    int index = device.has_index() ? device.index() : c10::cuda::current_device();
+    auto stats = c10::cuda::CUDACachingAllocator::getDeviceStats(index);
+    return stats.allocated_bytes[static_cast<size_t>(
+      c10::cuda::CUDACachingAllocator::StatType::AGGREGATE)].peak;
+  }
+#endif
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // ru_maxrss is in kilobytes
+  return usage.ru_maxrss * 1024L;
+}
+
+void resetPeakMemory(const torch::Device& device) {
+#ifdef WITH_CUDA
+  if (device.is_cuda()) {
+    int index = device.has_index() ? device.index() : c10::cuda::current_device();
+    c10::cuda::CUDACachingAllocator::resetPeakStats(index);
+  }
+#endif
+}
@@ -0,0 +1,29 @@
+#ifndef RUNTIME_UTILS_H
+#define RUNTIME_UTILS_H
+#include <string>
+
+#include <torch/types.h>
+
+// Parse a device description ("cpu", "cuda", "cuda:1").
+// An empty description selects CUDA if available, else the CPU
+torch::Device getDevice(const std::string& description);
+
+// Set the number of libtorch intra-op (OpenMP/MKL) and inter-op threads.
+// Non-positive values keep the libtorch defaults.
+// Should be called before any tensor operation
+void setNumThreads(int intraOpThreads, int interOpThreads);
+
+// Print the selected device and thread settings as a `#` comment line
+void printRuntimeInfo(const torch::Device& device);
+
+// Whether the CPU has bfloat16 instructions (AVX512-BF16 or AMX-BF16), from
+// the flags in /proc/cpuinfo. Without them bfloat16 math is emulated
+bool hasNativeBFloat16();
+
+// Peak memory in bytes: allocated by the caching allocator since the last
+// resetPeakMemory() for CUDA devices (needs a WITH_CUDA build), the
+// process' peak resident set size otherwise
+long getPeakMemory(const torch::Device& device);
+// Start a new peak measurement. The resident set size cannot be reset
+void resetPeakMemory(const torch::Device& device);
+#endif
@@ -0,0 +1,288 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+#include <ATen/Parallel.h>
+
+#include "runtime_utils.h"
+
+std::vector<int> parseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty() || range == "\n") continue;
+    std::string::size_type dash = range.find('-');
+    int first = std::stoi(range.substr(0, dash));
+    int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+void pinCurrentThread(const std::vector<int>& cpus) {
+  if (cpus.empty()) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+ThreadPool::ThreadPool(int numThreads, const std::vector<int>& cpus) {
+  for (int worker = 0; worker < numThreads; worker++) {
+    threads.emplace_back([this, worker, cpus] {
+      // One CPU per worker, wrapping around if there are fewer
+      if (!cpus.empty()) pinCurrentThread({cpus[worker % cpus.size()]});
+      run(worker);
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workReady.notify_all();
+  for (auto& thread : threads) thread.join();
+}
+
+void ThreadPool::run(int worker) {
+  long seenGeneration = 0;
+  while (true) {
+    const std::function<void (int, long, long)>* fn;
+    long n;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      workReady.wait(lock, [&] { return stopping || generation != seenGeneration; });
+      if (stopping) return;
+      seenGeneration = generation;
+      fn = work;
+      n = workSize;
+    }
+    long chunk = (n + size() - 1) / size();
+    long begin = std::min(n, worker * chunk), end = std::min(n, begin + chunk);
+    auto start = std::chrono::steady_clock::now();
+    std::exception_ptr workerError;
+    if (begin < end) {
+      try {
+        (*fn)(worker, begin, end);
+      } catch (...) {
+        workerError = std::current_exception();
+      }
+    }
+    busyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (workerError && !error) error = workerError;
+    if (--numPending == 0) workDone.notify_all();
+  }
+}
+
+void ThreadPool::parallelFor(long n, const std::function<void (int, long, long)>& fn) {
+  std::lock_guard<std::mutex> callLock(callMutex);
+  std::unique_lock<std::mutex> lock(mutex);
+  work = &fn;
+  workSize = n;
+  numPending = size();
+  error = nullptr;
+  generation++;
+  workReady.notify_all();
+  workDone.wait(lock, [this] { return numPending == 0; });
+  work = nullptr;
+  if (error) std::rethrow_exception(error);
+}
+
+double ThreadPool::getBusySeconds() const {
+  return busyNs / 1e9;
+}
+
+namespace {
+// The process-wide pools, see configureScheduler
+struct Scheduler {
+  bool configured = false;
+  std::string affinity = "none";
+  std::vector<int> computeCpus, tokenizerCpus, loaderCpus;
+  int computeThreads = 0, loaderThreads = 0;
+  std::unique_ptr<ThreadPool> tokenizerPool;
+  std::atomic<long> loaderBusyNs{0};
+  std::thread::id mainThread;
+  std::chrono::steady_clock::time_point startTime;
+};
+
+Scheduler scheduler;
+
+// The CPUs the process may run on
+std::vector<int> getAllowedCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+std::vector<int> getNumaNodeCpus(int node) {
+  std::string fname = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+  std::ifstream file(fname);
+  std::string list;
+  if (!file.is_open() || !std::getline(file, list)) {
+    throw std::runtime_error("Cannot read the CPUs of NUMA node " + std::to_string(node));
+  }
+  // Keep only those the process may run on
+  std::vector<int> allowed = getAllowedCpus(), cpus;
+  for (int cpu : parseCpuList(list)) {
+    if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+// The next count CPUs from position `next`, wrapping around
+std::vector<int> takeCpus(const std::vector<int>& cpus, size_t& next, int count) {
+  std::vector<int> taken;
+  for (int i = 0; i < count; i++) taken.push_back(cpus[next++ % cpus.size()]);
+  return taken;
+}
+
+std::string formatCpuList(const std::vector<int>& cpus) {
+  if (cpus.empty()) return "any";
+  std::string list;
+  for (size_t i = 0; i < cpus.size(); i++) {
+    size_t j = i;
+    while ((j + 1 < cpus.size()) && (cpus[j + 1] == cpus[j] + 1)) j++;
+    if (!list.empty()) list += ",";
+    list += std::to_string(cpus[i]);
+    if (j > i) list += "-" + std::to_string(cpus[j]);
+    i = j;
+  }
+  return list;
+}
+
+void printPoolStats(const std::string& name, int numThreads, const std::vector<int>& cpus,
+                    double busySeconds, double wallSeconds) {
+  double capacity = numThreads * wallSeconds;
+  std::cerr << "# "
+            << "pool=" << name
+            << " threads=" << numThreads
+            << " cpus=" << formatCpuList(cpus)
+            << " busy_sec=" << busySeconds
+            << " utilization=" << (capacity > 0 ? std::min(1.0, busySeconds / capacity) : 0.0)
+            << std::endl;
+}
+}
+
+bool isValidAffinity(const std::string& affinity) {
+  if ((affinity == "none") || (affinity == "cores")) return true;
+  if (affinity.compare(0, 5, "numa:") != 0) return false;
+  std::string node = affinity.substr(5);
+  return !node.empty() && (node.size() < 10)
+    && std::all_of(node.begin(), node.end(), [](unsigned char c) { return std::isdigit(c); });
+}
+
+void configureScheduler(int computeThreads, int interOpThreads,
+                        int tokenizerThreads, int loaderThreads,
+                        const std::string& affinity) {
+  scheduler.affinity = affinity;
+  scheduler.loaderThreads = loaderThreads;
+  scheduler.mainThread = std::this_thread::get_id();
+  scheduler.startTime = std::chrono::steady_clock::now();
+
+  if (affinity != "none") {
+    std::vector<int> cpus;
+    if (affinity == "cores") {
+      cpus = getAllowedCpus();
+    } else if (isValidAffinity(affinity)) {
+      cpus = getNumaNodeCpus(std::stoi(affinity.substr(5)));
+    } else {
+      throw std::runtime_error("Invalid CPU affinity `" + affinity + "`");
+    }
+    if (cpus.empty()) throw std::runtime_error("No CPUs for affinity `" + affinity + "`");
+
+    int others = std::max(0, tokenizerThreads) + std::max(0, loaderThreads);
+    if (computeThreads <= 0) {
+      computeThreads = std::max(1, static_cast<int>(cpus.size()) - others);
+    }
+    if (computeThreads + others > static_cast<int>(cpus.size())) {
+      std::cerr << "WARNING: " << computeThreads + others << " threads for "
+                << cpus.size() << " CPUs, some pools share CPUs" << std::endl;
+    }
+    size_t next = 0;
+    scheduler.computeCpus = takeCpus(cpus, next, computeThreads);
+    scheduler.tokenizerCpus = takeCpus(cpus, next, tokenizerThreads);
+    scheduler.loaderCpus = takeCpus(cpus, next, loaderThreads);
+  }
+
+  setNumThreads(computeThreads, interOpThreads);
+  scheduler.computeThreads = at::get_num_threads();
+  if (!scheduler.computeCpus.empty()) {
+    // One chunk per intra-op thread, so that each pins itself. The calling
+    // thread is intra-op thread 0 (the OpenMP master) and gets its own
+    // affinity back, so it is left unpinned: threads started later
+    // (readers, connections) inherit its mask and should not share the CPU
+    // of one compute thread
+    cpu_set_t mainCpus;
+    bool restore = pthread_getaffinity_np(pthread_self(), sizeof(mainCpus), &mainCpus) == 0;
+    std::vector<int> cpus = scheduler.computeCpus;
+    at::parallel_for(0, scheduler.computeThreads, 1, [&cpus](int64_t begin, int64_t end) {
+      pinCurrentThread({cpus[at::get_thread_num() % cpus.size()]});
+    });
+    if (restore) pthread_setaffinity_np(pthread_self(), sizeof(mainCpus), &mainCpus);
+  }
+  if (tokenizerThreads > 1) {
+    scheduler.tokenizerPool.reset(new ThreadPool(tokenizerThreads, scheduler.tokenizerCpus));
+  }
+  scheduler.configured = true;
+}
+
+ThreadPool* getTokenizerPool() {
+  return scheduler.tokenizerPool.get();
+}
+
+LoaderScope::LoaderScope() : start (std::chrono::steady_clock::now()) {
+  thread_local bool pinned = false;
+  if (!pinned && !scheduler.loaderCpus.empty()
+      && (std::this_thread::get_id() != scheduler.mainThread)) {
+    pinCurrentThread(scheduler.loaderCpus);
+  }
+  pinned = true;
+}
+
+LoaderScope::~LoaderScope() {
+  scheduler.loaderBusyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+void printSchedulerStats() {
+  if (!scheduler.configured) return;
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - scheduler.startTime;
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  double cpuSeconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+                      + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+  double tokenizerBusy = 0.0;
+  if (scheduler.tokenizerPool) {
+    tokenizerBusy = scheduler.tokenizerPool->getBusySeconds();
+    printPoolStats("tokenizer", scheduler.tokenizerPool->size(), scheduler.tokenizerCpus,
+                   tokenizerBusy, wall.count());
+  }
+  double loaderBusy = scheduler.loaderBusyNs / 1e9;
+  if (scheduler.loaderThreads > 0) {
+    printPoolStats("loader", scheduler.loaderThreads, scheduler.loaderCpus,
+                   loaderBusy, wall.count());
+  }
+  printPoolStats("compute", scheduler.computeThreads, scheduler.computeCpus,
+                 std::max(0.0, cpuSeconds - tokenizerBusy - loaderBusy), wall.count());
+}
@@ -0,0 +1,86 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Parse a Linux CPU list, e.g. "0-3,8,10-11" as in /sys/devices/system/node
+std::vector<int> parseCpuList(const std::string& list);
+
+// Pin the calling thread to some CPUs. An empty list leaves it as it is
+void pinCurrentThread(const std::vector<int>& cpus);
+
+// A fixed set of worker threads, each pinned to the given CPUs (if any),
+// that keeps track of how long its workers were busy
+class ThreadPool {
+  public:
+    ThreadPool(int numThreads, const std::vector<int>& cpus);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Split [0, n) in one contiguous range per worker and run
+    // fn(worker, begin, end) on the workers. Waits for all of them and
+    // rethrows the first exception
+    void parallelFor(long n, const std::function<void (int, long, long)>& fn);
+
+    int size() const { return static_cast<int>(threads.size()); }
+    double getBusySeconds() const;
+
+  private:
+    void run(int worker);
+
+    std::vector<std::thread> threads;
+    // Serializes parallelFor calls, mutex guards the state below
+    std::mutex callMutex, mutex;
+    std::condition_variable workReady, workDone;
+    const std::function<void (int, long, long)>* work = nullptr;
+    long workSize = 0, generation = 0;
+    int numPending = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::atomic<long> busyNs{0};
+};
+
+// Cores are shared by three pools: the tokenizer (readTextsToTensor), the
+// data loader workers and the libtorch intra-op (compute) threads.
+// configureScheduler sizes them and, with an affinity other than `none`,
+// gives each pool its own CPUs:
+//   `cores`   all CPUs the process may run on
+//   `numa:N`  the CPUs of NUMA node N only
+// The compute pool gets the first CPUs, then the tokenizer and the loader
+// pools. Without computeThreads it gets the CPUs the others left over.
+// Replaces setNumThreads; should be called before any tensor operation.
+// Throws if the CPUs of the affinity cannot be read
+void configureScheduler(int computeThreads, int interOpThreads,
+                        int tokenizerThreads, int loaderThreads,
+                        const std::string& affinity);
+
+// Whether an affinity is `none`, `cores` or `numa:N` with N a node number
+bool isValidAffinity(const std::string& affinity);
+
+// The tokenizer pool, or nullptr to tokenize on the calling thread
+ThreadPool* getTokenizerPool();
+
+// Marks work of a data loader worker: pins the worker thread to the loader
+// CPUs the first time, and counts the time until destruction as busy.
+// Not pinned on the thread that configured the scheduler (`--num-workers 0`)
+class LoaderScope {
+  public:
+    LoaderScope();
+    ~LoaderScope();
+  private:
+    std::chrono::steady_clock::time_point start;
+};
+
+// Print the CPUs, busy time and utilization of each pool as `#` comment
+// lines. The compute utilization is estimated from the process' CPU time
+// minus the busy time of the other pools
+void printSchedulerStats();
+#endif
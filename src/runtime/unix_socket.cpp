@@ -0,0 +1,85 @@
+#include "unix_socket.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static sockaddr_un getAddress(const std::string& path) {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("Socket path too long: " + path);
+  }
+  std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return address;
+}
+
+int listenUnixSocket(const std::string& path, int backlog) {
+  sockaddr_un address = getAddress(path);
+  struct stat st;
+  if ((stat(path.c_str(), &st) == 0) && S_ISSOCK(st.st_mode)) unlink(path.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) throw std::runtime_error("Cannot create a socket");
+  if ((bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+      || (listen(fd, backlog) != 0)) {
+    close(fd);
+    throw std::runtime_error("Cannot listen on " + path + ": " + std::strerror(errno));
+  }
+  return fd;
+}
+
+int connectUnixSocket(const std::string& path) {
+  sockaddr_un address = getAddress(path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) throw std::runtime_error("Cannot create a socket");
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+    close(fd);
+    throw std::runtime_error("Cannot connect to " + path + ": " + std::strerror(errno));
+  }
+  return fd;
+}
+
+bool writeAll(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    written += n;
+  }
+  return true;
+}
+
+bool LineReader::readLine(std::string& line) {
+  while (true) {
+    size_t end = buffer.find('\n', start);
+    if (end != std::string::npos) {
+      line = buffer.substr(start, end - start);
+      start = end + 1;
+      return true;
+    }
+    if (done) {
+      if (start >= buffer.size()) return false;
+      line = buffer.substr(start);
+      start = buffer.size();
+      return true;
+    }
+    // Keep only the unread part, then read more
+    buffer.erase(0, start);
+    start = 0;
+    char chunk[1 << 16];
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      done = true;
+    } else {
+      buffer.append(chunk, n);
+    }
+  }
+}
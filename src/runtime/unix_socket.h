@@ -0,0 +1,30 @@
+#ifndef UNIX_SOCKET_H
+#define UNIX_SOCKET_H
+#include <string>
+
+// Listen on a Unix domain socket at path, replacing a stale socket file.
+// Returns the listening file descriptor
+int listenUnixSocket(const std::string& path, int backlog = 64);
+
+// Connect to a Unix domain socket. Returns the file descriptor
+int connectUnixSocket(const std::string& path);
+
+// Write all of data to a file descriptor. Returns false if the other end
+// went away
+bool writeAll(int fd, const std::string& data);
+
+// Reads newline-terminated lines from a file descriptor
+class LineReader {
+  public:
+    explicit LineReader(int fd) : fd (fd) {}
+    // The next line, without its newline. Returns false at the end of the
+    // input; a last line without a newline is still returned
+    bool readLine(std::string& line);
+  private:
+    int fd;
+    std::string buffer;
+    size_t start = 0;
+    bool done = false;
+};
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef SERVE_H
+#define SERVE_H
+#include "serve/serve.h"
+#endif
@@ -0,0 +1,481 @@
+#include "serve.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <exception>
+#include <future>
+#include <getopt.h>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <torch/types.h>
+
+#include "config.h"
+#include "data.h"
+#include "model/bert_model.h"
+#include "model/quantizable_linear.h"
+#include "predict.h"
+#include "runtime.h"
+#include "state.h"
+
+namespace serve {
+
+using Clock = std::chrono::steady_clock;
+
+// A tokenized request line waiting for the batcher
+struct Request {
+  predict::Predictor* predictor;
+  torch::Tensor ids;
+  Clock::time_point arrival;
+  std::promise<std::string> response;
+};
+
+// A client and the thread that reads its requests. The fd is closed once
+// the thread is joined
+struct Connection {
+  int fd;
+  std::thread thread;
+  std::atomic<bool> done {false};
+};
+
+// Line encoders shared by the connections: the vocabulary is loaded once,
+// plus once for each additional connection tokenizing at the same time
+class EncoderPool {
+  public:
+    EncoderPool(const std::string& vocabFname, const std::string& lowercaseFname,
+                long maxLength)
+      : vocabFname (vocabFname), lowercaseFname (lowercaseFname),
+        maxLength (maxLength) {
+      encoders.emplace_back(new LineEncoder(vocabFname, lowercaseFname, maxLength));
+    }
+
+    torch::Tensor encode(const std::string& line) {
+      std::unique_ptr<LineEncoder> encoder;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!encoders.empty()) {
+          encoder = std::move(encoders.back());
+          encoders.pop_back();
+        }
+      }
+      if (!encoder) encoder.reset(new LineEncoder(vocabFname, lowercaseFname, maxLength));
+      torch::Tensor ids = encoder->encode(line);
+      std::lock_guard<std::mutex> lock(mutex);
+      encoders.push_back(std::move(encoder));
+      return ids;
+    }
+  private:
+    std::string vocabFname, lowercaseFname;
+    long maxLength;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<LineEncoder>> encoders;
+};
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void handleStop(int) {
+  stopRequested = 1;
+}
+
+// The task heads next to `<baseFname>-bert.pt` by task name, i.e.
+// `<baseFname>-<task>-{binary,multiclass}.pt` without the early exits
+static std::map<std::string, std::string> getTaskHeads(const std::string& baseFname) {
+  std::map<std::string, std::string> taskHeads;
+  std::string prefix = baseFname + "-";
+  for (const auto& fname : getGlobFiles(prefix + "*.pt")) {
+    std::string::size_type kindPos = fname.rfind('-');
+    if ((kindPos == std::string::npos) || (kindPos < prefix.size())) continue;
+    std::string kind = fname.substr(kindPos + 1);
+    if ((kind != "binary.pt") && (kind != "multiclass.pt")) continue;
+    std::string taskName = fname.substr(prefix.size(), kindPos - prefix.size());
+    if (taskName.find("-exit") != std::string::npos) continue;
+    taskHeads[taskName] = fname;
+  }
+  return taskHeads;
+}
+
+// Load the encoder once and the head of every task. The predictors share
+// the encoder
+static std::map<std::string, predict::Predictor> loadTasks(const std::string& baseFname,
+                                                           const torch::Device& device,
+                                                           bool quantize) {
+  std::map<std::string, predict::Predictor> predictors;
+  std::map<std::string, std::string> taskHeads = getTaskHeads(baseFname);
+  if (taskHeads.empty()) {
+    throw std::runtime_error("No task heads found for " + baseFname);
+  }
+  predict::Predictor base = predict::loadPredictor(baseFname, taskHeads.begin()->first, device,
+                                                   quantize, 0.0f, "max-prob");
+  bool prequantized = predict::isQuantizedModel(baseFname);
+  for (const auto& taskHead : taskHeads) {
+    predict::Predictor predictor = base;
+    predictor.classifier = predict::loadClassifier(taskHead.second, device, predictor.binary,
+                                                   predictor.tokenLevel, prequantized);
+    if (base.quantized) quantizeLinears(*predictor.classifier.ptr());
+    predictor.classifier.ptr()->to(device);
+    predictor.classifier.ptr()->eval();
+    predictor.fnames = {baseFname + "-bert.pt", taskHead.second};
+    predictors[taskHead.first] = predictor;
+  }
+  return predictors;
+}
+
+// Read the requests of a client and write the responses in the same order.
+// A request line is `TASK<TAB>TEXT`, or only TEXT if a single task is served.
+// Sets connection.done when the client is served, without closing its fd
+static void handleConnection(Connection& connection,
+                             std::map<std::string, predict::Predictor>& predictors,
+                             BoundedQueue<std::shared_ptr<Request>>& queue,
+                             EncoderPool& encoders) {
+  int fd = connection.fd;
+  // Responses that are not written yet, in request order
+  BoundedQueue<std::future<std::string>> pending(STREAM_QUEUE_BATCHES * 64);
+  std::thread writer([&] {
+    std::future<std::string> response;
+    bool connected = true;
+    while (pending.pop(response)) {
+      std::string line = response.get() + "\n";
+      // Keep draining after a disconnect, the batcher still fulfills them
+      if (connected) connected = writeAll(fd, line);
+    }
+  });
+
+  try {
+    LineReader reader(fd);
+    std::string line;
+    while (reader.readLine(line)) {
+      auto request = std::make_shared<Request>();
+      request->arrival = Clock::now();
+      std::string text = line;
+      std::string::size_type tab = line.find('\t');
+      auto task = (tab != std::string::npos) ? predictors.find(line.substr(0, tab))
+                                             : predictors.end();
+      if (task != predictors.end()) {
+        text = line.substr(tab + 1);
+      } else if (predictors.size() == 1) {
+        task = predictors.begin();
+      }
+      if (task == predictors.end()) {
+        request->response.set_value("error: unknown task, expected `TASK<TAB>TEXT`");
+        pending.push(request->response.get_future());
+        continue;
+      }
+      request->predictor = &task->second;
+      request->ids = encoders.encode(text);
+      pending.push(request->response.get_future());
+      if (!queue.push(request)) {
+        request->response.set_value("error: server is shutting down");
+        break;
+      }
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "WARNING: connection failed: " << e.what() << std::endl;
+  }
+  pending.close();
+  writer.join();
+  connection.done = true;
+}
+
+// Run the queued requests in batches of at most batchSize, waiting at most
+// maxWaitMs after the first request of a batch arrived
+static void runBatches(BoundedQueue<std::shared_ptr<Request>>& queue,
+                       long batchSize, double maxWaitMs) {
+  torch::NoGradGuard noGrad;
+  long numRequests = 0, numBatches = 0, totalRequests = 0, totalLayers = 0;
+  std::vector<double> latencies;
+  Clock::time_point statsTime = Clock::now();
+  std::shared_ptr<Request> request;
+  while (queue.pop(request)) {
+    std::vector<std::shared_ptr<Request>> requests = {request};
+    Clock::time_point deadline = request->arrival
+      + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double, std::milli>(maxWaitMs));
+    while ((static_cast<long>(requests.size()) < batchSize)
+           && queue.popUntil(request, deadline)) {
+      requests.push_back(request);
+    }
+
+    // One forward pass per task
+    std::map<predict::Predictor*, std::vector<std::shared_ptr<Request>>> byTask;
+    for (auto& taskRequest : requests) byTask[taskRequest->predictor].push_back(taskRequest);
+    for (auto& task : byTask) {
+      try {
+        std::vector<torch::Tensor> ids;
+        for (const auto& taskRequest : task.second) ids.push_back(taskRequest->ids);
+        torch::Tensor batch = torch::stack(ids);
+        long batchLength = (batch != PADDING_IDX).sum(1).max().item<long>();
+        batch = batch.slice(1, 0, batchLength);
+        std::vector<torch::Tensor> outputs = predict::predictBatch(*task.first, batch,
+                                                                   totalLayers);
+        for (size_t k = 0; k < outputs.size(); k++) {
+          task.second[k]->response.set_value(predict::formatLogits(outputs[k]));
+        }
+      } catch (const std::exception& e) {
+        for (auto& taskRequest : task.second) {
+          taskRequest->response.set_value(std::string("error: ") + e.what());
+        }
+      }
+      numBatches++;
+    }
+
+    Clock::time_point doneTime = Clock::now();
+    for (const auto& done : requests) {
+      std::chrono::duration<double, std::milli> latency = doneTime - done->arrival;
+      latencies.push_back(latency.count());
+    }
+    numRequests += requests.size();
+    totalRequests += requests.size();
+
+    std::chrono::duration<double> sinceStats = doneTime - statsTime;
+    if (sinceStats.count() >= SERVE_STATS_INTERVAL_SEC) {
+      std::cerr << "# "
+                << "requests=" << numRequests
+                << " total_requests=" << totalRequests
+                << " requests_per_sec=" << numRequests / sinceStats.count()
+                << " avg_batch_size=" << static_cast<double>(numRequests) / numBatches
+                << " latency_p50_ms=" << predict::percentile(latencies, 0.5)
+                << " latency_p99_ms=" << predict::percentile(latencies, 0.99)
+                << std::endl;
+      numRequests = numBatches = 0;
+      latencies.clear();
+      statsTime = doneTime;
+    }
+  }
+}
+
+void printHelp(const std::string &programName) {
+  std::cout << "Usage: " << programName << " [OPTIONS] MODEL SOCKET" << std::endl;
+  std::cout << "\
+Serve a fine-tuned BERT model on a Unix socket.\n\
+The encoder and every task head of MODEL are loaded once. Clients send one\n\
+request per line, `TASK<TAB>TEXT`, or only TEXT if MODEL has a single task,\n\
+and receive the logits of each line in order, or an `error: ...` line.\n\
+Requests of all clients are batched together. See `predict --connect`.\n\n\
+Options:\n\
+  -b, --batch-size          Maximum number of requests per forward pass\n\
+                              Default: 32\n\
+  -w, --max-wait            Run a batch at most this many milliseconds after\n\
+                              its first request arrived\n\
+                              Default: 10\n\
+  -L, --max-sequence-length Pad/truncate input sequences to that many tokens\n\
+                              Default: 100\n\
+  -d, --device              Device to run on, e.g. `cpu`, `cuda`, `cuda:1`\n\
+                              Default: `cuda` if available, else `cpu`\n\
+  -j, --num-threads         Number of intra-op threads for tensor operations\n\
+                              Default: 0 (libtorch default)\n\
+  -J, --num-interop-threads Number of inter-op threads\n\
+                              Default: 0 (libtorch default)\n\
+  -P, --packed              Run the position-wise encoder layers on the\n\
+                              non-padding tokens only\n\
+  -C, --cls-only-layers     Compute only the [CLS] position in this many final\n\
+                              encoder layers, if no task is token-level\n\
+                              Default: 1\n\
+  -Q, --quantize            Run the Linear layers with int8 weights: `int8`.\n\
+                              CPU only\n\
+                              Default: none (float32)\n\
+";
+}
+
+int main(int argc, char *argv[]) {
+  int c, opt = 0;
+  int batchSize = DEFAULT_BATCH_SIZE,
+      maxSequenceLength = DEFAULT_MAX_SEQUENCE_LENGTH,
+      numThreads = DEFAULT_NUM_THREADS,
+      numInteropThreads = DEFAULT_NUM_INTEROP_THREADS;
+  std::string deviceName = "";
+  bool packed = false;
+  int clsOnlyLayers = 1;
+  std::string quantize = "";
+  double maxWait = 10.0;
+
+	static struct option options[] = {
+			{"batch-size",            required_argument, NULL,  'b' },
+			{"max-wait",              required_argument, NULL,  'w' },
+			{"max-sequence-length",   required_argument, NULL,  'L' },
+			{"device",                required_argument, NULL,  'd' },
+			{"num-threads",           required_argument, NULL,  'j' },
+			{"num-interop-threads",   required_argument, NULL,  'J' },
+			{"packed",                no_argument,       NULL,  'P' },
+			{"cls-only-layers",       required_argument, NULL,  'C' },
+			{"quantize",              required_argument, NULL,  'Q' },
+			{"help",                  no_argument,       NULL,  'h' },
+			{NULL,                    0,                 NULL,   0  }
+	};
+
+	while ((c = getopt_long(argc, argv, ":b:w:L:d:j:J:PC:Q:h", options, &opt)) != -1) {
+    switch (c) {
+      case 'b':
+        batchSize = std::stoi(optarg);
+        if (batchSize <= 0) {
+          printHelp(argv[0]);
+          printf("Invalid batch size `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'w':
+        maxWait = std::stod(optarg);
+        if (maxWait < 0) {
+          printHelp(argv[0]);
+          printf("Invalid maximum wait `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'L':
+        maxSequenceLength = std::stoi(optarg);
+        if (maxSequenceLength < 2) {
+          printHelp(argv[0]);
+          printf("Invalid maximum sequence length `%s`, [CLS] and [SEP] need 2\n", optarg);
+          return 1;
+        }
+        break;
+      case 'd':
+        deviceName = optarg;
+        break;
+      case 'j':
+        numThreads = std::stoi(optarg);
+        break;
+      case 'J':
+        numInteropThreads = std::stoi(optarg);
+        break;
+      case 'P':
+        packed = true;
+        break;
+      case 'C':
+        clsOnlyLayers = std::stoi(optarg);
+        break;
+      case 'Q':
+        quantize = optarg;
+        if (quantize != "int8") {
+          printHelp(argv[0]);
+          printf("Invalid quantization `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'h':
+        printHelp(argv[0]);
+        return 1;
+      case '?':
+        printHelp(argv[0]);
+        printf("Invalid argument -%c\n", optopt);
+        return 1;
+      case ':':
+        printHelp(argv[0]);
+        printf("Missing option for %c\n", optopt);
+        return 1;
+      default:
+        printf("?? getopt returned character code 0%o ??\n", c);
+        return 1;
+    }
+  }
+
+  if (argc - optind != 2) {
+    printHelp(argv[0]);
+    return 1;
+  }
+  std::string baseFname = argv[optind];
+  std::string socketPath = argv[optind+1];
+
+  setNumThreads(numThreads, numInteropThreads);
+  torch::Device device = getDevice(deviceName);
+  printRuntimeInfo(device);
+
+  Config config;
+  readStruct(config, baseFname + "-bert.config");
+  if (maxSequenceLength > config.maxPositionEmbeddings) {
+    std::cerr << "Error: maximum sequence length exceeds the model's "
+              << config.maxPositionEmbeddings << " position embeddings"
+              << std::endl;
+    return 1;
+  }
+  if ((predict::isQuantizedModel(baseFname) || !quantize.empty()) && !device.is_cpu()) {
+    std::cerr << "Error: quantized inference runs on the CPU only" << std::endl;
+    return 1;
+  }
+
+  std::map<std::string, predict::Predictor> predictors =
+    loadTasks(baseFname, device, !quantize.empty());
+  bool anyTokenLevel = false;
+  for (const auto& task : predictors) anyTokenLevel |= task.second.tokenLevel;
+  BertModel bertModel = predictors.begin()->second.bertModel;
+  bertModel->packed = packed;
+  if (!anyTokenLevel) bertModel->setClsOnlyLayers(clsOnlyLayers);
+  for (const auto& task : predictors) {
+    std::cerr << "# "
+              << "task=" << task.first
+              << " binary?=" << task.second.binary
+              << " token_level?=" << task.second.tokenLevel
+              << " quantized?=" << task.second.quantized
+              << std::endl;
+  }
+
+  int listenFd = listenUnixSocket(socketPath);
+  // Stop on SIGINT/SIGTERM: interrupt accept() rather than restarting it
+  struct sigaction stop;
+  stop.sa_handler = handleStop;
+  sigemptyset(&stop.sa_mask);
+  stop.sa_flags = 0;
+  sigaction(SIGINT, &stop, nullptr);
+  sigaction(SIGTERM, &stop, nullptr);
+  std::signal(SIGPIPE, SIG_IGN);
+  std::cerr << "# "
+            << "socket=" << socketPath
+            << " batch_size=" << batchSize
+            << " max_wait_ms=" << maxWait
+            << std::endl;
+
+  const predict::Predictor& first = predictors.begin()->second;
+  EncoderPool encoders(first.vocabFname, first.lowercaseFname, maxSequenceLength);
+  BoundedQueue<std::shared_ptr<Request>> queue(STREAM_QUEUE_BATCHES * batchSize);
+  std::thread batcher(runBatches, std::ref(queue), batchSize, maxWait);
+
+  long numConnections = 0;
+  std::list<Connection> connections;
+  auto finish = [](Connection& connection) {
+    connection.thread.join();
+    close(connection.fd);
+  };
+  while (!stopRequested) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    // Clean up after the clients that are done
+    for (auto it = connections.begin(); it != connections.end();) {
+      if (it->done) {
+        finish(*it);
+        it = connections.erase(it);
+      } else {
+        it++;
+      }
+    }
+    if (fd < 0) continue;
+    numConnections++;
+    connections.emplace_back();
+    Connection& connection = connections.back();
+    connection.fd = fd;
+    connection.thread = std::thread(handleConnection, std::ref(connection),
+                                    std::ref(predictors), std::ref(queue),
+                                    std::ref(encoders));
+  }
+
+  // Stop reading new requests. Pending requests are still answered, and
+  // the batcher keeps running until every connection has written them
+  for (auto& connection : connections) shutdown(connection.fd, SHUT_RD);
+  queue.close();
+  for (auto& connection : connections) finish(connection);
+  batcher.join();
+  close(listenFd);
+  unlink(socketPath.c_str());
+  std::cerr << "# connections=" << numConnections << std::endl;
+  return 0;
+}
+}
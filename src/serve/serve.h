@@ -0,0 +1,9 @@
+#ifndef SERVE_SERVE_H
+#define SERVE_SERVE_H
+#include <string>
+
+namespace serve {
+void printHelp(const std::string &programName);
+int main(int argc, char *argv[]);
+}
+#endif
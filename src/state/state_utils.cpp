@@ -25,6 +25,13 @@ std::vector<std::string> getGlobFiles (const std::string& pattern) {
     return out;
 }
 
+void copyFile(const std::string& from, const std::string& to) {
+  std::ifstream in(from, std::ios::binary);
+  if (!in.is_open()) return;
+  std::ofstream out(to, std::ios::binary);
+  out << in.rdbuf();
+}
+
 std::string getParameterName(std::string fname) {
   size_t from = fname.find_last_of("\\/") + 1;
   size_t to = fname.find_last_of("-");
@@ -22,6 +22,9 @@ std::vector<float> getParameterValues(std::string fname, int expectedSize);
 // Load state from a pytorch-transformer exported model to a BertModel
 void loadState(const std::string &path, torch::nn::Module& model);
 
+// Copy a file, if it exists
+void copyFile(const std::string& from, const std::string& to);
+
 // Save a struct to disk (used for saving Config(s))
 template <typename T>
 void saveStruct(const T& obj, const std::string& fname);
@@ -5,6 +5,7 @@
 
 class Tokenizer {
   public:
+    virtual ~Tokenizer() {}
     virtual std::vector<std::string> tokenize(const std::string &s) {};
     virtual std::vector<long> tokenizeToIds (const std::string &s) {};
     virtual long tokenToId(const std::string &s) const {};
@@ -13,7 +13,8 @@ Task::Task(Task& t,  M1 classifier_, M2 criterion_,
   : name (t.name), baseDir(t.baseDir), metrics (t.metrics),
     lossMultiplier (t.lossMultiplier), taskType (t.taskType),
     criterion(criterion_), classifier(classifier_),
-    logitsToPredictions (logitsToPredictions_) {};
+    logitsToPredictions (logitsToPredictions_),
+    exitLayers (t.exitLayers), exitDistillation (t.exitDistillation) {};
 
 void Task::addMetric(std::string metric) {
   if (metric == "accuracy") {
@@ -47,5 +47,13 @@ class Task {
     torch::nn::AnyModule criterion;
     torch::nn::AnyModule classifier;
     LogitsToPredictionsFunc logitsToPredictions;
+
+    // Early-exit heads, of the same type as `classifier`, applied to the
+    // output of the first exitLayers[i] encoder layers (sentence-level only)
+    std::vector<long> exitLayers;
+    std::vector<torch::nn::AnyModule> exitClassifiers;
+    // Train the exit heads to match the final head's (detached) outputs
+    // instead of the labels, without updating the encoder through them
+    bool exitDistillation = false;
 };
 #endif
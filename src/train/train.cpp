@@ -2,8 +2,11 @@
 
 #include <getopt.h>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
 
 #include "data.h"
+#include "runtime.h"
 #include "task.h"
 #include "train_utils.h"
 
@@ -51,6 +54,56 @@ Training parameters:\n\
 Training options:\n\
   -n, --num-workers         Number of workers for the data loader.\n\
                               Default: 0 (single-threaded)\n\
+  -L, --max-sequence-length Pad/truncate input sequences to that many tokens.\n\
+                              Batches are further trimmed to their longest row\n\
+                              Default: 100\n\
+  -d, --device              Device to train on, e.g. `cpu`, `cuda`, `cuda:1`\n\
+                              Default: `cuda` if available, else `cpu`\n\
+  -j, --num-threads         Number of intra-op threads for tensor operations\n\
+                              Default: 0 (libtorch default)\n\
+  -J, --num-interop-threads Number of inter-op threads\n\
+                              Default: 0 (libtorch default)\n\
+  -k, --tokenizer-threads   Number of threads that tokenize the data files\n\
+                              Default: 0 (single-threaded)\n\
+  -A, --cpu-affinity        Give the compute (--num-threads), tokenizer and\n\
+                              data loader (--num-workers) threads their own\n\
+                              CPUs: `none`, `cores` (any CPU) or `numa:N`\n\
+                              (the CPUs of NUMA node N). Without --num-threads\n\
+                              the compute threads get the remaining CPUs.\n\
+                              The utilization of each pool is reported\n\
+                              Default: none\n\
+  -P, --packed              Run the position-wise encoder layers on the\n\
+                              non-padding tokens only\n\
+  -C, --checkpoint-layers   Recompute the forward pass of every N-th encoder\n\
+                              layer during backward instead of keeping its\n\
+                              activations. Trades compute for memory; the peak\n\
+                              memory and throughput are reported per epoch\n\
+                              Default: 0 (disabled)\n\
+  -E, --exit-layers         Comma-separated encoder depths, e.g. `4,8`, after\n\
+                              which to train early-exit heads for the\n\
+                              sentence-level tasks (see `predict --exit-threshold`)\n\
+  -X, --exit-distillation   Train the exit heads on the final head's outputs\n\
+                              (self-distillation) instead of jointly on the labels\n\
+  -p, --precision           Encoder precision: `fp32`, `bf16` (CPUs with\n\
+                              AVX512-BF16/AMX, or CUDA) or `fp16` (CUDA, with\n\
+                              dynamic loss scaling). Master weights, optimizer\n\
+                              state, heads and checkpoints stay in float32\n\
+                              Default: fp32\n\
+  -W, --window-stride       Split texts longer than --max-sequence-length\n\
+                              into windows that start this many tokens apart\n\
+                              instead of truncating them. Windows are trained\n\
+                              on as separate examples; validation merges the\n\
+                              outputs of each text's windows\n\
+                              Default: 0 (truncate)\n\
+  -g, --window-aggregation  Merge the windows of a sentence-level task by\n\
+                              their `mean` or `max` logits. Token-level tasks\n\
+                              take each token from the window where it has\n\
+                              the most context\n\
+                              Default: mean\n\
+  -r, --streaming           Read the training split from disk in shuffled\n\
+                              chunks while training instead of loading it,\n\
+                              for splits larger than memory. Training metrics\n\
+                              are not computed (only the losses)\n\
 ";
 }
 
@@ -58,10 +111,26 @@ int main(int argc, char *argv[]) {
   int c, opt = 0;
   int batchSize = DEFAULT_BATCH_SIZE,
       numEpochs = DEFAULT_NUM_EPOCHS,
-      numWorkers = 0, seed = 42;
+      numWorkers = 0, seed = 42,
+      maxSequenceLength = DEFAULT_MAX_SEQUENCE_LENGTH,
+      numThreads = DEFAULT_NUM_THREADS,
+      numInteropThreads = DEFAULT_NUM_INTEROP_THREADS,
+      tokenizerThreads = 0;
+  std::string cpuAffinity = "none";
+  long windowStride = 0;
+  std::string windowAggregation = "mean";
+  bool streaming = false;
   float lr = DEFAULT_LR;
+  bool packed = false;
+  int checkpointLayers = 0;
+  std::vector<long> exitLayers;
+  bool exitDistillation = false;
+  std::string precision = "fp32";
+  std::stringstream exitLayersStream;
+  std::string exitLayer;
 
-  std::string modelDir, dataDir, saveModel; modelDir = dataDir = saveModel = "";
+  std::string modelDir, dataDir, saveModel, deviceName;
+  modelDir = dataDir = saveModel = deviceName = "";
   std::vector<Task> tasks;
   Task lastTask;
 
@@ -77,11 +146,25 @@ int main(int argc, char *argv[]) {
 			{"metric",                required_argument, NULL,  'm' },
 			{"loss-multiplier",       required_argument, NULL,  'l' },
 			{"seed",                  required_argument, NULL,  's' },
+			{"max-sequence-length",   required_argument, NULL,  'L' },
+			{"device",                required_argument, NULL,  'd' },
+			{"num-threads",           required_argument, NULL,  'j' },
+			{"num-interop-threads",   required_argument, NULL,  'J' },
+			{"tokenizer-threads",     required_argument, NULL,  'k' },
+			{"cpu-affinity",          required_argument, NULL,  'A' },
+			{"packed",                no_argument,       NULL,  'P' },
+			{"checkpoint-layers",     required_argument, NULL,  'C' },
+			{"exit-layers",           required_argument, NULL,  'E' },
+			{"exit-distillation",     no_argument,       NULL,  'X' },
+			{"precision",             required_argument, NULL,  'p' },
+			{"window-stride",         required_argument, NULL,  'W' },
+			{"window-aggregation",    required_argument, NULL,  'g' },
+			{"streaming",             no_argument,       NULL,  'r' },
 			{"help",                  no_argument,       NULL,  'h' },
 			{NULL,                    0,                 NULL,   0  }
 	};
 
-	while ((c = getopt_long(argc, argv, "-:b:e:a:w:M:S:D:t:m:l:s:h", options, &opt)) != -1) {
+	while ((c = getopt_long(argc, argv, "-:b:e:a:w:M:S:D:t:m:l:s:L:d:j:J:k:A:PC:E:Xp:W:g:rh", options, &opt)) != -1) {
     switch (c) {
       case 1:
         printHelp(argv[0]);
@@ -89,6 +172,11 @@ int main(int argc, char *argv[]) {
         return 1;
      case 'b':
         batchSize = std::stoi(optarg);
+        if (batchSize <= 0) {
+          printHelp(argv[0]);
+          printf("Invalid batch size `%s`\n", optarg);
+          return 1;
+        }
         break;
       case 'e':
         numEpochs = std::stoi(optarg);
@@ -138,6 +226,72 @@ int main(int argc, char *argv[]) {
       case 's':
         seed = std::stoi(optarg);
         break;
+      case 'L':
+        maxSequenceLength = std::stoi(optarg);
+        if (maxSequenceLength < 2) {
+          printHelp(argv[0]);
+          printf("Invalid maximum sequence length `%s`, [CLS] and [SEP] need 2\n", optarg);
+          return 1;
+        }
+        break;
+      case 'd':
+        deviceName = optarg;
+        break;
+      case 'j':
+        numThreads = std::stoi(optarg);
+        break;
+      case 'J':
+        numInteropThreads = std::stoi(optarg);
+        break;
+      case 'k':
+        tokenizerThreads = std::stoi(optarg);
+        break;
+      case 'A':
+        cpuAffinity = optarg;
+        if (!isValidAffinity(cpuAffinity)) {
+          printHelp(argv[0]);
+          printf("Invalid CPU affinity `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'P':
+        packed = true;
+        break;
+      case 'C':
+        checkpointLayers = std::stoi(optarg);
+        break;
+      case 'E':
+        exitLayersStream.clear();
+        exitLayersStream.str(optarg);
+        while (std::getline(exitLayersStream, exitLayer, ',')) {
+          exitLayers.push_back(std::stol(exitLayer));
+        }
+        break;
+      case 'X':
+        exitDistillation = true;
+        break;
+      case 'p':
+        precision = optarg;
+        if ((precision != "fp32") && (precision != "bf16") && (precision != "fp16")) {
+          printHelp(argv[0]);
+          printf("Invalid precision `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'W':
+        windowStride = std::stol(optarg);
+        break;
+      case 'g':
+        windowAggregation = optarg;
+        if ((windowAggregation != "mean") && (windowAggregation != "max")) {
+          printHelp(argv[0]);
+          printf("Invalid window aggregation `%s`\n", optarg);
+          return 1;
+        }
+        break;
+      case 'r':
+        streaming = true;
+        break;
       case '?':
         printHelp(argv[0]);
         printf("Invalid argument -%c\n", optopt);
@@ -160,11 +314,41 @@ int main(int argc, char *argv[]) {
     tasks[0].lossMultiplier = 1.0f;
   }
 
+  for (auto& task : tasks) {
+    task.exitLayers = exitLayers;
+    task.exitDistillation = exitDistillation;
+  }
+
 
   CHECK_STR_ARG("--model-dir", modelDir);
   CHECK_STR_ARG("--data-dir", dataDir);
   CHECK_VECTOR_ARG("--task", tasks);
 
+  if (streaming && (windowStride > 0)) {
+    std::cout << "Error: `--streaming` cannot be combined with `--window-stride`"
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    configureScheduler(numThreads, numInteropThreads, tokenizerThreads, numWorkers,
+                       cpuAffinity);
+  } catch (const std::exception& e) {
+    // e.g. the CPUs of a NUMA node that does not exist
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  torch::Device device = getDevice(deviceName);
+  printRuntimeInfo(device);
+  if ((precision == "fp16") && !device.is_cuda()) {
+    std::cout << "Error: `--precision fp16` needs a CUDA device" << std::endl;
+    return 1;
+  }
+  if ((precision == "bf16") && device.is_cpu() && !hasNativeBFloat16()) {
+    std::cerr << "WARNING: this CPU has no bfloat16 instructions, `--precision bf16` "
+              << "will be slower than fp32" << std::endl;
+  }
+
   for (auto& task : tasks) {
     detectTaskType(task);
     std::cerr << "# "
@@ -183,7 +367,9 @@ int main(int argc, char *argv[]) {
   }
 
   runTraining(modelDir, dataDir, tasks, batchSize, numEpochs, lr, numWorkers,
-              saveModel, seed);
+              saveModel, seed, maxSequenceLength, packed, checkpointLayers,
+              precision, windowStride, windowAggregation, streaming, device);
+  printSchedulerStats();
 
  return 0;
 }
@@ -1,84 +1,190 @@
 #include "train_loop.h"
 
+#include <algorithm>
+#include <map>
+#include <set>
 #include <tuple>
 #include <vector>
 #include <stdexcept>
 
 #include <torch/nn/utils.h>
 
+torch::Tensor distillationLoss(torch::Tensor studentLogits,
+                               torch::Tensor teacherLogits,
+                               bool binary) {
+  if (binary) {
+    return torch::binary_cross_entropy_with_logits(studentLogits,
+                                                   torch::sigmoid(teacherLogits));
+  }
+  return -(teacherLogits.softmax(-1) * studentLogits.log_softmax(-1)).sum(-1).mean();
+}
+
+template <typename DataLoader>
 void innerLoop(BertModel &model,
                std::vector<Task> &tasks,
-               TextDataLoaderType &loader,
+               DataLoader &loader,
                std::vector<std::vector<float>> &losses,
                std::vector<torch::Tensor> &labels,
                std::vector<torch::Tensor> &predictions,
+               float &paddingRatio,
+               const torch::Device &device,
                std::function<void (torch::Tensor)> callback) {
+  using torch::indexing::Slice;
+
+  // Encoder depths where any task has an exit head
+  std::set<long> exitLayers;
+  for (const auto& task : tasks) {
+    exitLayers.insert(task.exitLayers.begin(), task.exitLayers.end());
+  }
+
+  // Sentence-level heads of several tasks run together, see FusedHeads
+  std::vector<size_t> fusedTasks;
+  std::vector<torch::nn::AnyModule> fusedClassifiers;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (FUSED_HEADS && (TokenLevel & tasks[i].taskType) != TokenLevel) {
+      fusedTasks.push_back(i);
+      fusedClassifiers.push_back(tasks[i].classifier);
+    }
+  }
+  FusedHeads fusedHeads{nullptr};
+  if (fusedTasks.size() > 1) fusedHeads = FusedHeads(fusedClassifiers);
 
-  int batchSize = loader->options().batch_size;
   int startIdx = 0;
+  long numPositions = 0, numPaddingPositions = 0;
   for (auto& batch : *loader) {
-      auto data = batch.data.cuda();
+      numPositions += batch.data.numel();
+      numPaddingPositions += (batch.data == PADDING_IDX).sum().item<long>();
+      auto data = batch.data.to(device);
       auto batchLabels = batch.target;
 
-      // Move the labels to CUDA
+      // Move the labels to the device
 			std::for_each(batchLabels.begin(), batchLabels.end(), 
-				[](torch::Tensor &t) {
-					t = t.cuda();
+				[&device](torch::Tensor &t) {
+					t = t.to(device);
 			});
 
-      torch::Tensor output = model->forward(data);
+      // Keep the hidden states after the exit layers, if any
+      torch::Tensor output;
+      std::map<long, torch::Tensor> exitOutputs;
+      if (exitLayers.empty()) {
+        output = model->forward(data);
+      } else {
+        output = model->embed(data);
+        long numLayersDone = 0;
+        for (long layer : exitLayers) {
+          output = model->forwardLayers(output, data, numLayersDone, layer);
+          exitOutputs[layer] = output;
+          numLayersDone = layer;
+        }
+        output = model->forwardLayers(output, data, numLayersDone, model->getNumLayers());
+      }
+      // The heads run in float32, also for a reduced-precision encoder
+      output = output.to(torch::kFloat);
+      for (auto& exitOutput : exitOutputs) exitOutput.second = exitOutput.second.to(torch::kFloat);
 
       // Total loss placeholder
-      torch::Tensor loss = torch::zeros(1, torch::requires_grad()).cuda();
+      torch::Tensor loss = torch::zeros(1, torch::TensorOptions().device(device));
+
+      std::vector<torch::Tensor> allTaskLogits(tasks.size());
+      if (!fusedHeads.is_empty()) {
+        std::vector<torch::Tensor> fusedLogits = fusedHeads->forward(output);
+        for (size_t k = 0; k < fusedTasks.size(); k++) {
+          allTaskLogits[fusedTasks[k]] = fusedLogits[k];
+        }
+      }
 
       torch::Tensor taskLogits, taskLoss, taskPredictions;
       for (size_t i = 0; i < tasks.size(); i++) {
-        taskLogits = tasks[i].classifier.forward(output);
-        if (taskLogits.ndimension() == 3) {
-          // Token-level, flatten logits and targets
-          taskLoss = tasks[i].criterion.forward(
-            taskLogits.view({-1, taskLogits.size(2)}),
-            batchLabels[i].view({-1})
-          );
+        PackingInfo validTokens;
+        if ((TokenLevel & tasks[i].taskType) == TokenLevel) {
+          // Token-level, run the head on the non-padding positions that have
+          // a label only
+          validTokens = maskToPackingInfo(
+            (data != PADDING_IDX) & (batchLabels[i] != CLASSIFICATION_IGNORE_INDEX));
+          // shape: (NUM_VALID, NUM_CLASSES), or (NUM_VALID) if binary
+          taskLogits = tasks[i].classifier.forward(pack(output, validTokens));
+          taskLoss = tasks[i].criterion.forward(taskLogits, pack(batchLabels[i], validTokens));
         } else {
+          taskLogits = allTaskLogits[i].defined() ? allTaskLogits[i]
+                                                  : tasks[i].classifier.forward(output);
           taskLoss = tasks[i].criterion.forward(taskLogits, batchLabels[i]);
         }
         loss += taskLoss * tasks[i].lossMultiplier;
         losses[i].push_back(taskLoss.item<float>());
-        
-        // Insert the true labels for the batch to `labels`
-        labels[i].index_put_({torch::indexing::Slice(startIdx, startIdx+batchLabels[i].size(0))}, batchLabels[i]);
 
+        // Exit heads, either trained jointly on the labels or distilled from
+        // the final head
+        for (size_t j = 0; j < tasks[i].exitLayers.size(); j++) {
+          torch::Tensor exitOutput = exitOutputs[tasks[i].exitLayers[j]];
+          torch::Tensor exitLoss;
+          if (tasks[i].exitDistillation) {
+            torch::Tensor exitLogits = tasks[i].exitClassifiers[j].forward(exitOutput.detach());
+            exitLoss = distillationLoss(exitLogits, taskLogits.detach(),
+                                        (Binary & tasks[i].taskType) == Binary);
+          } else {
+            torch::Tensor exitLogits = tasks[i].exitClassifiers[j].forward(exitOutput);
+            exitLoss = tasks[i].criterion.forward(exitLogits, batchLabels[i]);
+          }
+          loss += exitLoss * tasks[i].lossMultiplier;
+        }
+        
         // Convert the task logits to predicted classes
         taskPredictions = tasks[i].logitsToPredictions(taskLogits);
+        if (validTokens.indices.defined()) {
+          // Scatter back to (BATCH_SIZE, SEQUENCE_LENGTH), positions without
+          // a prediction are ignored like their labels
+          taskPredictions = unpack(taskPredictions, validTokens, CLASSIFICATION_IGNORE_INDEX);
+        }
 
-        // Insert the predicted labels for the batch to `predictions`
-        predictions[i].index_put_({torch::indexing::Slice(startIdx, startIdx+taskPredictions.size(0))}, taskPredictions);
+        // Insert the true and predicted labels for the batch to `labels` and
+        // `predictions`. Token-level batches may be trimmed to fewer columns
+        // than the full tensors. Streamed splits are not held in memory, so
+        // the caller leaves their tensors undefined and nothing is recorded
+        if (!labels[i].defined()) {
+          continue;
+        } else if (batchLabels[i].ndimension() > 1) {
+          labels[i].index_put_({Slice(startIdx, startIdx+batchLabels[i].size(0)),
+                                Slice(0, batchLabels[i].size(1))}, batchLabels[i]);
+          predictions[i].index_put_({Slice(startIdx, startIdx+taskPredictions.size(0)),
+                                     Slice(0, taskPredictions.size(1))}, taskPredictions);
+        } else {
+          labels[i].index_put_({Slice(startIdx, startIdx+batchLabels[i].size(0))}, batchLabels[i]);
+          predictions[i].index_put_({Slice(startIdx, startIdx+taskPredictions.size(0))}, taskPredictions);
+        }
 			}
 
-      startIdx += batchSize;
+      // Batches from the length bucket sampler may have different sizes
+      startIdx += data.size(0);
 
       #ifdef DEBUG
-      std::cout << "step=" << (int)(startIdx/batchSize) << ", loss=" << losses.back() << std::endl;
+      std::cout << "step=" << losses[0].size() << ", loss=" << loss.item<float>() << std::endl;
       #endif
 
       callback(loss);
   }
+  paddingRatio = numPositions > 0
+    ? static_cast<float>(numPaddingPositions) / static_cast<float>(numPositions)
+    : 0.0f;
 }
 
 // Training
+template <typename DataLoader>
 void trainLoop(BertModel &model,
                std::vector<Task> &tasks,
-               TextDataLoaderType &loader,
+               DataLoader &loader,
                std::vector<std::vector<float>> &losses,
                std::vector<torch::Tensor> &labels,
                std::vector<torch::Tensor> &predictions,
-               torch::optim::Optimizer &optimizer) {
+               float &paddingRatio,
+               const torch::Device &device,
+               torch::optim::Optimizer &optimizer,
+               MixedPrecision* mixedPrecision) {
   model->train();
 
   // Set all classifier heads to train mode
   for (auto& task : tasks) {
     task.classifier.ptr()->train();
+    for (auto& exitClassifier : task.exitClassifiers) exitClassifier.ptr()->train();
   }
   
   // Training callback - perform an optimization step
@@ -86,8 +192,19 @@ void trainLoop(BertModel &model,
       model->zero_grad();
       for (auto& task : tasks) {
         task.classifier.ptr()->zero_grad();
+        for (auto& exitClassifier : task.exitClassifiers) exitClassifier.ptr()->zero_grad();
+      }
+      if (mixedPrecision != nullptr) {
+        mixedPrecision->scaleLoss(loss).backward();
+        std::vector<torch::Tensor> params;
+        for (auto& param_group : optimizer.param_groups()) {
+          params.insert(params.end(), param_group.params().begin(), param_group.params().end());
+        }
+        // Skip the step if the float16 gradients overflowed
+        if (!mixedPrecision->unscaleGradients(params)) return;
+      } else {
+        loss.backward();
       }
-      loss.backward();
       // Gradient clipping
       for (auto& param_group : optimizer.param_groups()) {
         for (auto& param : param_group.params()) {
@@ -95,27 +212,128 @@ void trainLoop(BertModel &model,
         }
       }
       optimizer.step();
+      if (mixedPrecision != nullptr) mixedPrecision->copyWeights();
   };
 
   // Train for an epoch
-  innerLoop(model, tasks, loader, losses, labels, predictions, callback);
+  innerLoop(model, tasks, loader, losses, labels, predictions, paddingRatio, device, callback);
 }
 
 // Validation
+template <typename DataLoader>
 void trainLoop(BertModel &model,
                std::vector<Task> &tasks,
-               TextDataLoaderType &loader,
+               DataLoader &loader,
                std::vector<std::vector<float>> &losses,
                std::vector<torch::Tensor> &labels,
-               std::vector<torch::Tensor> &predictions) {
+               std::vector<torch::Tensor> &predictions,
+               float &paddingRatio,
+               const torch::Device &device) {
   torch::NoGradGuard no_grad;
   model->eval();
   // Set all classifier heads to eval mode
   for (auto& task : tasks) {
     task.classifier.ptr()->eval();
+    for (auto& exitClassifier : task.exitClassifiers) exitClassifier.ptr()->eval();
   }
   auto callback = [] (torch::Tensor loss) {}; // Dummy callback, does nothing
 
   // Forward for an epoch
-  innerLoop(model, tasks, loader, losses, labels, predictions, callback);
+  innerLoop(model, tasks, loader, losses, labels, predictions, paddingRatio, device, callback);
+}
+
+#define INSTANTIATE_TRAIN_LOOPS(DataLoader) \
+template void innerLoop(BertModel&, std::vector<Task>&, DataLoader&, \
+                        std::vector<std::vector<float>>&, std::vector<torch::Tensor>&, \
+                        std::vector<torch::Tensor>&, float&, const torch::Device&, \
+                        std::function<void (torch::Tensor)>); \
+template void trainLoop(BertModel&, std::vector<Task>&, DataLoader&, \
+                        std::vector<std::vector<float>>&, std::vector<torch::Tensor>&, \
+                        std::vector<torch::Tensor>&, float&, const torch::Device&, \
+                        torch::optim::Optimizer&, MixedPrecision*); \
+template void trainLoop(BertModel&, std::vector<Task>&, DataLoader&, \
+                        std::vector<std::vector<float>>&, std::vector<torch::Tensor>&, \
+                        std::vector<torch::Tensor>&, float&, const torch::Device&);
+
+INSTANTIATE_TRAIN_LOOPS(TextDataLoaderType)
+INSTANTIATE_TRAIN_LOOPS(StreamingDataLoaderType)
+
+// Validation over windows
+void windowedValidationLoop(BertModel &model,
+                            std::vector<Task> &tasks,
+                            const TextDataset &dataset,
+                            long batchSize,
+                            const std::string &aggregation,
+                            std::vector<std::vector<float>> &losses,
+                            std::vector<torch::Tensor> &labels,
+                            std::vector<torch::Tensor> &predictions,
+                            const torch::Device &device) {
+  torch::NoGradGuard no_grad;
+  model->eval();
+  for (auto& task : tasks) task.classifier.ptr()->eval();
+
+  const TextWindows& windows = dataset.getWindows();
+  const std::vector<torch::Tensor>& windowLabels = dataset.getLabels();
+  long numWindows = windows.ids.size(0);
+
+  // Outputs of each task and window, on the CPU. Token-level outputs cover
+  // the positions of the window only
+  std::vector<std::vector<torch::Tensor>> outputs(
+    tasks.size(), std::vector<torch::Tensor>(numWindows));
+  for (long start = 0; start < numWindows; start += batchSize) {
+    long end = std::min(start + batchSize, numWindows);
+    torch::Tensor lengths = (windows.ids.slice(0, start, end) != PADDING_IDX).sum(1);
+    long length = lengths.max().item<long>();
+    torch::Tensor data = windows.ids.slice(0, start, end).slice(1, 0, length).to(device);
+    torch::Tensor output = model->forward(data).to(torch::kFloat);
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+      bool tokenLevel = (TokenLevel & tasks[i].taskType) == TokenLevel;
+      torch::Tensor batchLabels = windowLabels[i].slice(0, start, end);
+      if (tokenLevel) batchLabels = batchLabels.slice(1, 0, length);
+      batchLabels = batchLabels.to(device);
+
+      torch::Tensor logits, loss;
+      if (tokenLevel) {
+        // shape: (BATCH_SIZE, SEQUENCE_LENGTH, NUM_CLASSES), the loss is over
+        // the positions with a label
+        PackingInfo tokens = getPackingInfo(data);
+        logits = unpack(tasks[i].classifier.forward(pack(output, tokens)), tokens);
+        PackingInfo validTokens = maskToPackingInfo(
+          (data != PADDING_IDX) & (batchLabels != CLASSIFICATION_IGNORE_INDEX));
+        loss = tasks[i].criterion.forward(pack(logits, validTokens),
+                                          pack(batchLabels, validTokens));
+      } else {
+        logits = tasks[i].classifier.forward(output);
+        loss = tasks[i].criterion.forward(logits, batchLabels);
+      }
+      losses[i].push_back(loss.item<float>());
+
+      logits = logits.to(torch::kCPU);
+      const long* lengthsData = lengths.data_ptr<long>();
+      for (long k = 0; k < end - start; k++) {
+        outputs[i][start + k] = tokenLevel ? logits[k].slice(0, 0, lengthsData[k]) : logits[k];
+      }
+    }
+  }
+
+  // Predictions of the whole texts
+  for (size_t i = 0; i < tasks.size(); i++) {
+    bool tokenLevel = (TokenLevel & tasks[i].taskType) == TokenLevel;
+    std::vector<torch::Tensor> merged = mergeWindows(outputs[i], windows, tokenLevel,
+                                                     aggregation);
+    labels[i] = dataset.getDocumentLabels()[i].to(torch::kFloat);
+    if (!tokenLevel) {
+      torch::Tensor documentLogits = torch::stack(merged);
+      predictions[i] = tasks[i].logitsToPredictions(documentLogits).to(torch::kFloat);
+      continue;
+    }
+    // Positions past the end of a text are ignored like their labels
+    predictions[i] = torch::full(labels[i].sizes(), CLASSIFICATION_IGNORE_INDEX, torch::kFloat);
+    for (size_t d = 0; d < merged.size(); d++) {
+      torch::Tensor documentPredictions = tasks[i].logitsToPredictions(merged[d]);
+      predictions[i][d].slice(0, 0, documentPredictions.size(0))
+        .copy_(documentPredictions.to(torch::kFloat));
+    }
+  }
 }
@@ -7,33 +7,70 @@
 
 #include "data.h"
 #include "model.h"
+#include "optim.h"
 #include "train/task.h"
 
-// Run training for an epoch. Helper function used by `trainLoop`
-inline void innerLoop(BertModel &model,
-                      std::vector<Task> &tasks,
-                      TextDataLoaderType &loader,
-                      std::vector<std::vector<float>> &losses,
-                      std::vector<torch::Tensor> &labels,
-                      std::vector<torch::Tensor> &predictions,
-                      std::function<void (torch::Tensor)> callback);
+// Soft-target loss of a student's logits w.r.t. a teacher's logits:
+// binary cross-entropy against the teacher's sigmoid for binary tasks,
+// cross-entropy against the teacher's softmax otherwise
+torch::Tensor distillationLoss(torch::Tensor studentLogits,
+                               torch::Tensor teacherLogits,
+                               bool binary);
+
+// Run training for an epoch. Helper function used by `trainLoop`.
+// DataLoader is a TextDataLoaderType or a StreamingDataLoaderType; tasks
+// whose labels tensor is undefined get no labels and predictions recorded,
+// e.g. for a streamed split
+template <typename DataLoader>
+void innerLoop(BertModel &model,
+               std::vector<Task> &tasks,
+               DataLoader &loader,
+               std::vector<std::vector<float>> &losses,
+               std::vector<torch::Tensor> &labels,
+               std::vector<torch::Tensor> &predictions,
+               float &paddingRatio,
+               const torch::Device &device,
+               std::function<void (torch::Tensor)> callback);
 
 // Run training for an epoch.
-// Writes results to the referenced losses, labels, and predictions
+// Writes results to the referenced losses, labels, and predictions, and the
+// fraction of padding positions in the collated batches to paddingRatio.
+// With mixedPrecision, the optimizer holds its master parameters
+template <typename DataLoader>
 void trainLoop(BertModel &model,
                std::vector<Task> &tasks,
-               TextDataLoaderType &loader,
+               DataLoader &loader,
                std::vector<std::vector<float>> &losses,
                std::vector<torch::Tensor> &labels,
                std::vector<torch::Tensor> &predictions,
-               torch::optim::Optimizer &optimizer);
+               float &paddingRatio,
+               const torch::Device &device,
+               torch::optim::Optimizer &optimizer,
+               MixedPrecision* mixedPrecision = nullptr);
 
 // Run vaildation for an epoch (overloaded - no optimizer argument)
+template <typename DataLoader>
 void trainLoop(BertModel &model,
                std::vector<Task> &tasks,
-               TextDataLoaderType &loader,
+               DataLoader &loader,
                std::vector<std::vector<float>> &losses,
                std::vector<torch::Tensor> &labels,
-               std::vector<torch::Tensor> &predictions);
+               std::vector<torch::Tensor> &predictions,
+               float &paddingRatio,
+               const torch::Device &device);
+
+// Run validation over the windows of a dataset split with a windowStride.
+// Losses are per window; the outputs of the windows of each text are merged
+// (see mergeWindows) before the predictions, so `labels` and `predictions`
+// are set to those of the whole texts
+void windowedValidationLoop(BertModel &model,
+                            std::vector<Task> &tasks,
+                            const TextDataset &dataset,
+                            long batchSize,
+                            const std::string &aggregation,
+                            std::vector<std::vector<float>> &losses,
+                            std::vector<torch::Tensor> &labels,
+                            std::vector<torch::Tensor> &predictions,
+                            const torch::Device &device);
 
 #endif
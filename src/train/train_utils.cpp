@@ -1,5 +1,7 @@
 #include "train_utils.h"
 
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -7,24 +9,40 @@
 #include <iostream>
 #include <stdexcept>
 #include <limits>
+#include <memory>
 #include <fstream>
 
 #include "model.h"
 #include "optim.h"
 #include "state.h"
 #include "metrics.h"
+#include "runtime.h"
 #include "train_loop.h"
 
 
 std::vector<Task> initTasks(std::vector<Task>& tasks,
                             TextDatasetType& dataset,
                             const Config& config,
-                            const std::string& saveFname) {
+                            const std::string& saveFname,
+                            const torch::Device& device) {
+  return initTasks(tasks, dataset.dataset().getClassWeights(tasks, device), config,
+                   saveFname, device);
+}
+
+std::vector<Task> initTasks(std::vector<Task>& tasks,
+                            const std::vector<torch::Tensor>& weights,
+                            const Config& config,
+                            const std::string& saveFname,
+                            const torch::Device& device) {
   std::vector<Task> out;
-  std::vector<torch::Tensor> weights = dataset.dataset().getClassWeights(tasks);
 
   for (size_t i = 0; i< tasks.size(); i++) {
     bool tokenLevel = (TokenLevel & tasks[i].taskType) == TokenLevel;
+    if (tokenLevel && !tasks[i].exitLayers.empty()) {
+      std::cerr << "WARNING: Early exits are not supported for token-level task "
+                << tasks[i].name << std::endl;
+      tasks[i].exitLayers.clear();
+    }
     if ((Regression & tasks[i].taskType) == Regression) {
       throw std::runtime_error("Regression not implemented");
     } else if ((Binary & tasks[i].taskType) == Binary) {
@@ -51,7 +69,16 @@ std::vector<Task> initTasks(std::vector<Task>& tasks,
           }
         )
       );
-      out.back().classifier.ptr()->to(torch::kCUDA);
+      out.back().classifier.ptr()->to(device);
+
+      // Exit heads share the configuration of the final head
+      for (long layer : out.back().exitLayers) {
+        if (!saveFname.empty())
+          saveStruct(options, saveFname + "-" + tasks[i].name + "-exit"
+                              + std::to_string(layer) + "-binary.config");
+        out.back().exitClassifiers.push_back(torch::nn::AnyModule(BinaryClassifier(options)));
+        out.back().exitClassifiers.back().ptr()->to(device);
+      }
     } else {
       torch::Tensor weight = weights[i];
       MutliclassClassifierOptions options{
@@ -75,12 +102,34 @@ std::vector<Task> initTasks(std::vector<Task>& tasks,
           }
         )
       );
-      out.back().classifier.ptr()->to(torch::kCUDA);
+      out.back().classifier.ptr()->to(device);
+
+      for (long layer : out.back().exitLayers) {
+        if (!saveFname.empty())
+          saveStruct(options, saveFname + "-" + tasks[i].name + "-exit"
+                              + std::to_string(layer) + "-multiclass.config");
+        out.back().exitClassifiers.push_back(torch::nn::AnyModule(MulticlassClassifier(options)));
+        out.back().exitClassifiers.back().ptr()->to(device);
+      }
     }
   }
   return out;
 }
 
+void splitWeightDecayParams(const torch::nn::Module& module,
+                            std::vector<torch::Tensor>& decayParams,
+                            std::vector<torch::Tensor>& noDecayParams) {
+  for (const auto& param : module.named_parameters()) {
+    const auto& name = param.key();
+    if ((name.find("bias") != std::string::npos)
+        || (name.find("layerNorm.weight") != std::string::npos)) {
+      noDecayParams.push_back(param.value());
+    } else {
+      decayParams.push_back(param.value());
+    }
+  }
+}
+
 void saveModel(BertModel &model,
                std::vector<Task> &tasks,
                const std::string& baseFname,
@@ -104,6 +153,13 @@ void saveModel(BertModel &model,
         task.classifier.ptr(),
         baseFname + "-" + task.name + "-" + moduleId + ".pt"
       );
+      for (size_t i = 0; i < task.exitLayers.size(); i++) {
+        torch::save(
+          task.exitClassifiers[i].ptr(),
+          baseFname + "-" + task.name + "-exit" + std::to_string(task.exitLayers[i])
+          + "-" + moduleId + ".pt"
+        );
+      }
     }
   }
 }
@@ -116,65 +172,130 @@ void runTraining(const std::string& modelDir,
                  float lr,
                  int numWorkers,
                  const std::string& saveFname,
-                 int randomSeed) {
+                 int randomSeed,
+                 long maxSequenceLength,
+                 bool packed,
+                 int checkpointLayers,
+                 const std::string& precision,
+                 long windowStride,
+                 const std::string& windowAggregation,
+                 bool streaming,
+                 const torch::Device& device) {
   torch::manual_seed(randomSeed);
 
   // Read config
   Config config;
   readStruct(config, modelDir + "/config");
+  if (maxSequenceLength > config.maxPositionEmbeddings) {
+    throw std::runtime_error(
+      "Maximum sequence length " + std::to_string(maxSequenceLength)
+      + " exceeds the model's " + std::to_string(config.maxPositionEmbeddings)
+      + " position embeddings");
+  }
 
   // Save Config if saveFname
   if (!saveFname.empty()) {
     saveStruct(config, saveFname + "-bert.config");
   }
 
+  for (const auto& task : tasks) {
+    long previous = 0;
+    for (long layer : task.exitLayers) {
+      if (layer <= previous || layer >= config.numHiddenLayers) {
+        throw std::runtime_error(
+          "Exit layers should be increasing and between 1 and "
+          + std::to_string(config.numHiddenLayers - 1));
+      }
+      previous = layer;
+    }
+  }
+
   // Initialize models
   BertModel model(config);
   loadState(modelDir, *model);
-  model->to(torch::kCUDA);
+  model->to(device);
+  model->packed = packed;
+  model->setSeparatorId(getSeparatorId(modelDir));
+  model->setCheckpointLayers(checkpointLayers);
 
-  //Initialize dataset
-  TextDatasetType trainDataset = getDataset(modelDir, tasks, "train");
-  TextDatasetType valDataset = getDataset(modelDir, tasks, "val");
+  // Sentence-level heads read the [CLS] position only, so the last layer
+  // does not need the others
+  bool anyTokenLevel = std::any_of(tasks.begin(), tasks.end(), [](const Task& task) {
+    return (TokenLevel & task.taskType) == TokenLevel;
+  });
+  if (!anyTokenLevel) model->setClsOnlyLayers(1);
+
+  // Reduced-precision encoder with float32 master weights, see MixedPrecision
+  std::unique_ptr<MixedPrecision> mixedPrecision;
+  if (precision != "fp32") {
+    mixedPrecision = std::make_unique<MixedPrecision>(
+      *model, precision == "bf16" ? torch::kBFloat16 : torch::kHalf);
+  }
+
+  //Initialize dataset. With a windowStride, long texts are split into
+  // windows that are trained on as separate examples
+  TextDatasetType valDataset = getDataset(modelDir, tasks, "val", maxSequenceLength,
+                                          windowStride);
 
   // Get label tensor sizes
-  std::vector<torch::IntArrayRef> trainLabelSizes = trainDataset.dataset().getLabelSizes();
   std::vector<torch::IntArrayRef> valLabelSizes = valDataset.dataset().getLabelSizes();
 
-  // Initialize data loaders
-  TextDataLoaderType trainLoader = torch::data::make_data_loader(
-    trainDataset,
-    torch::data::DataLoaderOptions().batch_size(batchSize).workers(numWorkers));
+  // Initialize data loaders. Batches are formed from examples of similar
+  // length; training batches are shuffled within and across length buckets.
+  // Streamed training data is read from disk in shuffled chunks instead, and
+  // its labels and predictions are not kept
+  TextDataLoaderType trainLoader;
+  StreamingDataLoaderType streamingTrainLoader;
+  std::vector<std::vector<int64_t>> trainLabelSizes;
+  std::vector<torch::Tensor> classWeights;
+  long numTrainExamples;
+  if (streaming) {
+    TextChunkReader trainReader(modelDir, tasks, "train", maxSequenceLength);
+    numTrainExamples = trainReader.getNumExamples();
+    classWeights = trainReader.getClassWeights(tasks, device);
+    streamingTrainLoader = torch::data::make_data_loader(
+      getStreamingDataset(trainReader, tasks, batchSize),
+      torch::data::DataLoaderOptions().batch_size(batchSize).workers(numWorkers));
+  } else {
+    TextDatasetType trainDataset = getDataset(modelDir, tasks, "train", maxSequenceLength,
+                                              windowStride);
+    for (const auto& size : trainDataset.dataset().getLabelSizes()) {
+      trainLabelSizes.push_back(size.vec());
+    }
+    numTrainExamples = trainDataset.dataset().size().value();
+    classWeights = trainDataset.dataset().getClassWeights(tasks, device);
+    trainLoader = torch::data::make_data_loader(
+      trainDataset,
+      LengthBucketSampler(trainDataset.dataset().getLengths(), batchSize, BUCKET_SIZE, true),
+      torch::data::DataLoaderOptions().batch_size(batchSize).workers(numWorkers));
+  }
   TextDataLoaderType valLoader = torch::data::make_data_loader(
       valDataset,
+      LengthBucketSampler(valDataset.dataset().getLengths(), batchSize, BUCKET_SIZE, false),
       torch::data::DataLoaderOptions().batch_size(batchSize).workers(numWorkers));
 
   // Initialize criteria
-  tasks = initTasks(tasks, trainDataset, config, saveFname);
+  tasks = initTasks(tasks, classWeights, config, saveFname, device);
 
   // Initialize optimizer
   std::vector<torch::Tensor> dParams;  // Params to apply weight decay
   std::vector<torch::Tensor> ndParams;  // Params to not apply weight decay
   for (const auto& param : model->named_parameters()) {
     const auto& name = param.key();
+    torch::Tensor value = mixedPrecision ? mixedPrecision->getMaster(param.value())
+                                         : param.value();
     if ((name.find("bias") != std::string::npos)
         || (name.find("layerNorm.weight") != std::string::npos)) {
-      ndParams.push_back(param.value());
+      ndParams.push_back(value);
     } else {
-      dParams.push_back(param.value());
+      dParams.push_back(value);
     }
   }
 
   for (auto& task : tasks) {
-    for (const auto& param : task.classifier.ptr()->named_parameters()) {
-      const auto& name = param.key();
-      if ((name.find("bias") != std::string::npos)
-          || (name.find("layerNorm.weight") != std::string::npos)) {
-        ndParams.push_back(param.value());
-      } else {
-        dParams.push_back(param.value());
-      }
-    };
+    std::vector<torch::nn::AnyModule> heads = task.exitClassifiers;
+    heads.push_back(task.classifier);
+    for (auto& head : heads) splitWeightDecayParams(*head.ptr(), dParams, ndParams);
   }
 
   std::vector<torch::optim::OptimizerParamGroup> param_groups {
@@ -219,23 +340,41 @@ void runTraining(const std::string& modelDir,
   for (int epoch=1; epoch <= numEpochs; epoch++) {
     std::vector<std::vector<float>> trainLosses(tasks.size()), valLosses(tasks.size());
     std::vector<torch::Tensor> trainLabels, trainPredictions, valLabels, valPredictions;
+    float trainPaddingRatio, valPaddingRatio;
 
-    // Initialize labels and predictions with zeros shaped as the originals
+    // Initialize labels and predictions shaped as the originals. Labels start
+    // as ignored, since trimmed token-level batches leave trailing columns
+    // untouched. Streamed ones stay undefined
+    if (streaming) {
+      trainLabels.resize(tasks.size());
+      trainPredictions.resize(tasks.size());
+    }
     for (auto it = trainLabelSizes.begin();
               it != trainLabelSizes.end();
               it++) {
-      trainLabels.push_back(torch::zeros(*it));
+      trainLabels.push_back(torch::full(*it, CLASSIFICATION_IGNORE_INDEX, torch::kFloat));
       trainPredictions.push_back(torch::zeros(*it));
     }
     for (auto it = valLabelSizes.begin();
               it != valLabelSizes.end();
               it++) {
-      valLabels.push_back(torch::zeros(*it));
+      valLabels.push_back(torch::full(*it, CLASSIFICATION_IGNORE_INDEX, torch::kFloat));
       valPredictions.push_back(torch::zeros(*it));
     }
 
     // Train epoch
-    trainLoop(model, tasks, trainLoader, trainLosses, trainLabels, trainPredictions, optimizer);
+    resetPeakMemory(device);
+    auto trainStartTime = std::chrono::steady_clock::now();
+    if (streaming) {
+      trainLoop(model, tasks, streamingTrainLoader, trainLosses, trainLabels, trainPredictions,
+                trainPaddingRatio, device, optimizer, mixedPrecision.get());
+    } else {
+      trainLoop(model, tasks, trainLoader, trainLosses, trainLabels, trainPredictions,
+                trainPaddingRatio, device, optimizer, mixedPrecision.get());
+    }
+    std::chrono::duration<double> trainElapsed =
+      std::chrono::steady_clock::now() - trainStartTime;
+    long trainPeakMemory = getPeakMemory(device);
   
     // Print train stats separated by comma (csv-like)
     std::cout << epoch;
@@ -245,13 +384,21 @@ void runTraining(const std::string& modelDir,
       float avg = sum / trainLosses[i].size();
       std::cout << "," << avg;
       for (const auto& metric : tasks[i].metrics) {
-        float val = metric.second(trainLabels[i], trainPredictions[i]);
+        float val = streaming ? std::numeric_limits<float>::quiet_NaN()
+                              : metric.second(trainLabels[i], trainPredictions[i]);
         std::cout << "," << val;
       }
     }
 
-    // Val epoch
-    trainLoop(model, tasks, valLoader, valLosses, valLabels, valPredictions);
+    // Val epoch, on the whole texts if split into windows
+    if (windowStride > 0) {
+      valPaddingRatio = 0.0f;
+      windowedValidationLoop(model, tasks, valDataset.dataset(), batchSize, windowAggregation,
+                             valLosses, valLabels, valPredictions, device);
+    } else {
+      trainLoop(model, tasks, valLoader, valLosses, valLabels, valPredictions,
+                valPaddingRatio, device);
+    }
 
     // Print val stats separated by comma (csv-like)
     for (size_t i = 0; i < tasks.size(); i++){
@@ -265,10 +412,27 @@ void runTraining(const std::string& modelDir,
       }
     }
     std::cout << std::endl;
+    std::cerr << "# "
+              << "epoch=" << epoch
+              << " train_padding_ratio=" << trainPaddingRatio
+              << " val_padding_ratio=" << valPaddingRatio
+              << " train_examples_per_sec="
+              << numTrainExamples / trainElapsed.count()
+              << " train_peak_memory_mb=" << trainPeakMemory / (1024 * 1024)
+              << " checkpoint_layers=" << checkpointLayers
+              << " precision=" << precision;
+    if (mixedPrecision) {
+      std::cerr << " loss_scale=" << mixedPrecision->getLossScale()
+                << " skipped_steps=" << mixedPrecision->getNumSkippedSteps();
+    }
+    std::cerr << std::endl;
     // Save model if applicable
     if (!saveFname.empty()) {
       currentMetric = tasks[0].metrics[0].second(valLabels[0], valPredictions[0]);
+      // Checkpoints are float32
+      if (mixedPrecision) mixedPrecision->toFloat();
       saveModel(model, tasks, saveFname, currentMetric, bestMetric);
+      if (mixedPrecision) mixedPrecision->toReducedPrecision();
     }
   }
 }
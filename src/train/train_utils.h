@@ -5,9 +5,12 @@
 
 #include "config.h"
 #include "data.h"
+#include "model.h"
 #include "task.h"
 
-// Initialize required objects (models, tasks, optimizer) and run training
+// Initialize required objects (models, tasks, optimizer) and run training.
+// With streaming, the training split is read from disk in chunks (see
+// TextChunkReader) and training metrics are not computed
 void runTraining(const std::string& modelDir,
                  const std::string& dataDir,
                  std::vector<Task>& tasks,
@@ -16,13 +19,46 @@ void runTraining(const std::string& modelDir,
                  float lr,
                  int numWorkers,
                  const std::string& saveModel,
-                 int randomSeed);
+                 int randomSeed,
+                 long maxSequenceLength,
+                 bool packed,
+                 int checkpointLayers,
+                 const std::string& precision,
+                 long windowStride,
+                 const std::string& windowAggregation,
+                 bool streaming,
+                 const torch::Device& device);
 
 // Initialize "second-stage" tasks from some "first-stage" tasks.
 // Adds appropriate classifier, criterion and logitsToPredictions for each task.
-// If saveFname is given, saves the configurations of each classifier head
+// If saveFname is given, saves the configurations of each classifier head.
+// The classifier heads and class weights are placed on `device`
 std::vector<Task> initTasks(std::vector<Task>& tasks,
                             TextDatasetType& dataset,
                             const Config& config,
-                            const std::string& saveFname);
+                            const std::string& saveFname,
+                            const torch::Device& device);
+
+// As above, with the class weights of each task (see
+// TextDataset::getClassWeights) instead of the dataset they come from
+std::vector<Task> initTasks(std::vector<Task>& tasks,
+                            const std::vector<torch::Tensor>& weights,
+                            const Config& config,
+                            const std::string& saveFname,
+                            const torch::Device& device);
+
+// Split the parameters of a module into those with weight decay and those
+// without (biases and LayerNorm weights)
+void splitWeightDecayParams(const torch::nn::Module& module,
+                            std::vector<torch::Tensor>& decayParams,
+                            std::vector<torch::Tensor>& noDecayParams);
+
+// Save the model and its task heads as `<baseFname>-bert.pt` and
+// `<baseFname>-<task>-{binary,multiclass}.pt`, if currentMetric improved
+// on bestMetric
+void saveModel(BertModel &model,
+               std::vector<Task> &tasks,
+               const std::string& baseFname,
+               float& currentMetric,
+               float& bestMetric);
 #endif